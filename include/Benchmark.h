@@ -0,0 +1,71 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Settings of a headless benchmark run: the scene is rendered offscreen at width x height for
+// warmupFrames + frames fixed 60 Hz steps, and only the last frames are measured.
+struct BenchmarkOptions {
+    std::string scene = "Scene1";
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    uint32_t frames = 600;
+    uint32_t warmupFrames = 60;
+    std::string cameraPath;   // Keyframe file; empty turns the scene's own camera in place
+    std::string outputPath;   // Also write the JSON report here
+    std::string baselinePath; // Earlier report to compare against
+    double tolerance = 0.10;  // Fraction a percentile may grow over the baseline before it fails
+    bool textureMipmaps = true;
+};
+
+// Pose of the camera's rig (the active camera's root entity) over time, linearly interpolated
+// between keyframes and held past either end. Each non-empty line of a path file that doesn't
+// start with '#' is one keyframe: time in seconds, position x y z, rotation x y z in degrees.
+class CameraPath {
+public:
+    struct Keyframe {
+        float time = 0.0f;
+        glm::vec3 position{0.0f};
+        glm::vec3 rotation{0.0f};
+    };
+
+    bool load(const std::string& path);
+    void addKeyframe(const Keyframe& keyframe);
+    bool empty() const { return keyframes.empty(); }
+    float duration() const { return keyframes.empty() ? 0.0f : keyframes.back().time; }
+    Keyframe sample(float time) const;
+
+private:
+    std::vector<Keyframe> keyframes;
+};
+
+struct FrameTimeSummary {
+    uint32_t samples = 0;
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+// Collects per-frame CPU and GPU times and reports them as JSON.
+class BenchmarkReport {
+public:
+    // GPU times arrive frames in flight later than CPU times, so they are added separately.
+    void addCpuFrame(double ms) { cpuMs.push_back(ms); }
+    void addGpuFrame(double ms) { gpuMs.push_back(ms); }
+    // GPU time of one top-level profiler scope (a frame graph pass) in one frame.
+    void addPassFrame(const std::string& pass, double ms) { passMs[pass].push_back(ms); }
+    static FrameTimeSummary summarize(std::vector<double> samples);
+
+    // Builds the report; with a baseline, lists every percentile more than tolerance slower than
+    // it under "regressions" and returns false through passed.
+    std::string toJSON(const BenchmarkOptions& options, const std::string& deviceName, bool& passed) const;
+
+private:
+    std::vector<double> cpuMs;
+    std::vector<double> gpuMs;
+    std::map<std::string, std::vector<double>> passMs;
+};
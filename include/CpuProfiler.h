@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped CPU profiling zones. Every thread records its completed zones into a ring buffer of its
+// own that no other thread writes, so recording takes no lock; while profiling is disabled a zone
+// costs one relaxed atomic load. writeChromeTrace() snapshots each thread's ring and writes them as
+// Chrome trace-event JSON, which chrome://tracing and Perfetto open directly.
+class CpuProfiler {
+public:
+    static constexpr uint32_t kEventsPerThread = 1u << 15; // Oldest zones are overwritten first
+
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool on) { enabled.store(on, std::memory_order_relaxed); }
+    // Names the calling thread in exported traces.
+    static void setThreadName(const std::string& name);
+    // Nanoseconds on the steady clock since the profiler was loaded.
+    static uint64_t now();
+    // Name must outlive the trace; zones pass string literals.
+    static void record(const char* name, uint64_t startNs, uint64_t endNs);
+    static bool writeChromeTrace(const std::string& path);
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+class CpuProfileZone {
+public:
+    explicit CpuProfileZone(const char* zoneName)
+        : name(CpuProfiler::isEnabled() ? zoneName : nullptr), start(name ? CpuProfiler::now() : 0) {}
+    ~CpuProfileZone() {
+        if (name) {
+            CpuProfiler::record(name, start, CpuProfiler::now());
+        }
+    }
+    CpuProfileZone(const CpuProfileZone&) = delete;
+    CpuProfileZone& operator=(const CpuProfileZone&) = delete;
+
+private:
+    const char* name;
+    uint64_t start;
+};
+
+#define CPU_PROFILE_CONCAT_INNER(a, b) a##b
+#define CPU_PROFILE_CONCAT(a, b) CPU_PROFILE_CONCAT_INNER(a, b)
+// Profiles from here to the end of the enclosing scope under a string literal name.
+#define CPU_PROFILE_ZONE(name) CpuProfileZone CPU_PROFILE_CONCAT(cpuProfileZone, __LINE__)(name)
@@ -0,0 +1,96 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+// A range of device memory handed out by DeviceAllocator. Host-visible memory stays mapped for as
+// long as its block lives, so mapped points at this range whenever the memory type allows it.
+struct DeviceAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;     // Requested size
+    VkDeviceSize nodeSize = 0; // Buddy node the range occupies; 0 for dedicated allocations
+    void* mapped = nullptr;
+    uint32_t memoryType = 0;
+    uint32_t block = UINT32_MAX;
+    bool linear = true;
+    bool isDedicated() const { return memory != VK_NULL_HANDLE && nodeSize == 0; }
+    explicit operator bool() const { return memory != VK_NULL_HANDLE; }
+};
+
+// Sub-allocates device memory from large blocks so resources don't each cost a vkAllocateMemory
+// (maxMemoryAllocationCount is often only 4096). Blocks are split with a buddy allocator, which
+// keeps every range aligned to its own power-of-two size. Linear resources (buffers) and optimally
+// tiled images get separate pools per memory type, so bufferImageGranularity never applies inside
+// a block. Ranges over half a block, and images the driver prefers dedicated memory for, get their
+// own allocation.
+class DeviceAllocator {
+public:
+    static constexpr VkDeviceSize kDefaultBlockSize = 64ull * 1024 * 1024;
+    static constexpr VkDeviceSize kMinNodeSize = 256;
+
+    struct Stats {
+        VkDeviceSize used = 0;      // Bytes requested by live allocations
+        VkDeviceSize allocated = 0; // Bytes of the buddy nodes and dedicated memory backing them
+        VkDeviceSize reserved = 0;  // Bytes obtained from vkAllocateMemory
+        VkDeviceSize largestFreeRange = 0;
+        uint32_t allocations = 0;
+        uint32_t blocks = 0;
+        uint32_t dedicatedAllocations = 0;
+        // Share of the free space in blocks that lies outside the largest free range.
+        double fragmentation = 0.0;
+    };
+
+    void init(VkDevice device, VkPhysicalDevice physicalDevice);
+    void destroy();
+
+    // Throws when the memory can't be allocated, like the rest of the renderer's resource creation.
+    DeviceAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, bool dedicated = false,
+                              VkImage dedicatedImage = VK_NULL_HANDLE, VkBuffer dedicatedBuffer = VK_NULL_HANDLE);
+    void free(DeviceAllocation& allocation);
+
+    // Returns empty blocks to the driver; one empty block per pool is otherwise kept for reuse.
+    void trim();
+
+    Stats getStats() const;
+    static std::string format(const Stats& stats);
+
+private:
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        VkDeviceSize allocated = 0;
+        void* mapped = nullptr;
+        // Free node offsets per level, level 0 being the whole block.
+        std::vector<std::set<VkDeviceSize>> freeNodes;
+    };
+    struct Pool {
+        uint32_t memoryType = 0;
+        bool linear = true;
+        VkDeviceSize blockSize = kDefaultBlockSize;
+        std::vector<std::unique_ptr<Block>> blocks; // Null entries are reusable slots
+    };
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+    Pool& getPool(uint32_t memoryType, bool linear);
+    Block* createBlock(Pool& pool, uint32_t& index);
+    void destroyBlock(Block& block);
+    bool allocateNode(Block& block, VkDeviceSize nodeSize, VkDeviceSize& offset);
+    void freeNode(Block& block, VkDeviceSize offset, VkDeviceSize nodeSize);
+    uint32_t levelOf(const Block& block, VkDeviceSize nodeSize) const;
+    DeviceAllocation allocateDedicated(const VkMemoryRequirements& requirements, uint32_t memoryType, VkImage image, VkBuffer buffer);
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    std::map<std::pair<uint32_t, bool>, Pool> pools;
+    VkDeviceSize dedicatedBytes = 0;
+    VkDeviceSize usedBytes = 0;
+    uint32_t dedicatedCount = 0;
+    uint32_t allocationCount = 0;
+    mutable std::mutex mutex;
+};
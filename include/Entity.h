@@ -21,7 +21,6 @@ public:
         updateWorldTransform();
     }
     ~Entity() {
-        destroyUniformBuffers();
         for (auto& child : children) {
             delete child;
         }
@@ -42,7 +41,7 @@ public:
     std::string getName() const { return name; }
     std::string getShader() const { return shader; }
     bool isActive() const { return active; }
-    void setActive(bool state) { active = state; }
+    void setActive(bool state);
     Model* getModel() const { return model; }
     void setModel(Model* m) { model = m; }
     std::vector<Entity*>& getChildren() { return children; }
@@ -50,6 +49,9 @@ public:
     Entity* getParent() const { return parent; }
     bool isMovable() const { return movable; }
     void setMovable(bool state) { movable = state; }
+    // Occluders are rasterized into the software occlusion buffer before other entities are tested.
+    bool isOccluder() const { return occluder; }
+    void setOccluder(bool state) { occluder = state; }
 
     glm::vec3 getWorldPosition();
     glm::vec3 getWorldRotation();
@@ -60,7 +62,10 @@ public:
 
     void loadTextures();
     const std::vector<VkDescriptorSet>& getDescriptorSets() const { return descriptorSets; }
-    void updateUniformBuffer(uint32_t frameIndex, const UniformBufferObject& ubo);
+    const std::vector<Image*>& getBoundTextures() const { return boundTextures; }
+    uint32_t updateUniformBuffer(const UniformBufferObject& ubo);
+    // Points frame's uniform bindings at a regrown ring buffer; frame must not be in flight.
+    void bindUniformRingBuffer(uint32_t frame, VkBuffer buffer);
 
     AABB getWorldBounds(const glm::mat4& worldTransform) const;
 
@@ -69,9 +74,8 @@ private:
     std::string shader = "gbuffer";
     std::vector<std::string> textures;
     std::vector<VkDescriptorSet> descriptorSets;
-    std::vector<VkBuffer> uniformBuffers;
-    std::vector<VkDeviceMemory> uniformBuffersMemory;
-    size_t uniformBufferStride = 0;
+    std::vector<Image*> boundTextures;
+    int uniformBindingCount = 0;
     glm::vec3 position = glm::vec3(0.0f);
     glm::vec3 rotation = glm::vec3(0.0f);
     glm::vec3 scale = glm::vec3(1.0f);
@@ -84,8 +88,5 @@ private:
     Model* model = nullptr;
     bool active = true;
     bool movable = false;
-
-    void ensureUniformBuffers(Renderer* renderer, int vertexBindings);
-
-    void destroyUniformBuffers();
+    bool occluder = false;
 };
\ No newline at end of file
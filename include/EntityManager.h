@@ -52,10 +52,18 @@ public:
         dirtyLights.push_back(light);
     }
 
+    // The scene version moves with every change to the entity set; the static geometry version only
+    // when the change adds, removes, shows or hides static G-buffer geometry.
+    uint64_t getSceneVersion() const { return sceneVersion; }
+    uint64_t getStaticGeometryVersion() const { return staticGeometryVersion; }
+    void markSceneChanged(Entity* entity);
+
 private:
     std::map<std::string, Entity*> entities;
     std::vector<Entity*> rootEntities;
     std::vector<Entity*> movableEntities;
     std::vector<Light*> dirtyLights;
     std::vector<Light*> allLights;
+    uint64_t sceneVersion = 0;
+    uint64_t staticGeometryVersion = 0;
 };
\ No newline at end of file
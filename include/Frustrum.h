@@ -1,6 +1,7 @@
 #pragma once
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <cstdint>
 
 // Axis Aligned Bounding Box
 struct AABB {
@@ -8,6 +9,12 @@ struct AABB {
     glm::vec3 max;
 };
 
+inline bool intersectsSphere(const AABB& box, const glm::vec3& center, float radius) {
+    glm::vec3 closest = glm::clamp(center, box.min, box.max);
+    glm::vec3 delta = closest - center;
+    return glm::dot(delta, delta) <= radius * radius;
+}
+
 class Frustum {
     public:
         enum PlaneID {
@@ -39,3 +46,14 @@ class Frustum {
 
 
 
+
+// Bit i is set when the box overlaps cube face i of a point light (+X -X +Y -Y +Z -Z).
+inline uint32_t cubeFaceMask(const AABB& box, const Frustum faceFrustums[6]) {
+    uint32_t mask = 0;
+    for (uint32_t face = 0; face < 6; ++face) {
+        if (faceFrustums[face].intersectsAABB(box.min, box.max)) {
+            mask |= 1u << face;
+        }
+    }
+    return mask;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Per-pass GPU profiler over one range of queries per frame in flight. Scopes opened with begin()
+// and closed with end() while a frame is recorded get a timestamp pair; outermost scopes also get a
+// pipeline statistics query when the device supports them and they are enabled (queries of one type
+// can't nest). collect() reads a frame slot back once its fence has signalled, without waiting, so
+// results trail the frame being recorded by the number of frames in flight.
+class GpuProfiler {
+public:
+    static constexpr uint32_t kMaxScopes = 64;
+    static constexpr uint32_t kStatisticCount = 4;
+
+    struct ScopeResult {
+        std::string name;
+        uint32_t depth = 0;
+        double gpuMs = 0.0;         // Latest completed frame
+        double averageGpuMs = 0.0;  // Moving average across frames
+        bool hasStatistics = false;
+        std::array<uint64_t, kStatisticCount> statistics{};
+    };
+
+    // Names of the counters in ScopeResult::statistics, in order.
+    static const char* statisticName(uint32_t index);
+
+    void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t framesInFlight, bool pipelineStatisticsSupported);
+    void destroy();
+
+    // Resets the frame slot's queries; record it before any scope of that frame.
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+    void begin(VkCommandBuffer commandBuffer, const std::string& name);
+    void end(VkCommandBuffer commandBuffer);
+    // Reads back what frameIndex recorded last time; call once that frame's fence has signalled.
+    void collect(uint32_t frameIndex);
+
+    bool isAvailable() const { return timestampPool != VK_NULL_HANDLE; }
+    bool hasPipelineStatistics() const { return statisticsPool != VK_NULL_HANDLE; }
+    bool isPipelineStatisticsEnabled() const { return statisticsEnabled; }
+    // Takes effect from the next beginFrame().
+    void setPipelineStatisticsEnabled(bool enabled) { statisticsEnabled = enabled; }
+
+    const std::vector<ScopeResult>& getResults() const { return results; }
+    // Counts the collect() calls that replaced the results, to tell a fresh frame from a stale one.
+    uint64_t getCollectedFrames() const { return collectedFrames; }
+    // One line per scope for overlays and logs: indented name, latest and average time, statistics.
+    static std::string format(const ScopeResult& result);
+    bool writeCSV(const std::string& path) const;
+    bool writeJSON(const std::string& path) const;
+
+private:
+    struct Scope {
+        std::string name;
+        uint32_t depth = 0;
+        uint32_t statisticsQuery = UINT32_MAX;
+    };
+    struct Frame {
+        std::vector<Scope> scopes;
+        std::vector<uint32_t> openScopes;
+        uint32_t statisticsCount = 0;
+        bool statistics = false;
+        bool recorded = false;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueryPool timestampPool = VK_NULL_HANDLE;
+    VkQueryPool statisticsPool = VK_NULL_HANDLE;
+    double timestampPeriod = 0.0;
+    uint64_t timestampMask = ~0ull;
+    bool statisticsEnabled = false;
+    std::vector<Frame> frames;
+    uint32_t currentFrame = 0;
+    std::vector<ScopeResult> results;
+    uint64_t collectedFrames = 0;
+    std::map<std::string, double> averages;
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <vulkan/vulkan.h>
+#include <DeviceAllocator.h>
 #include <string>
 
 class Image {
@@ -10,7 +11,7 @@ public:
     std::string path;
     VkImage image = VK_NULL_HANDLE;
     VkImageView imageView = VK_NULL_HANDLE;
-    VkDeviceMemory imageMemory = VK_NULL_HANDLE;
+    DeviceAllocation imageMemory{};
     VkSampler imageSampler = VK_NULL_HANDLE;
     VkFormat format = VK_FORMAT_UNDEFINED;
     int width = 0;
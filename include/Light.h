@@ -20,10 +20,10 @@ public:
           const glm::vec3& position = {0.0f, 0.0f, 0.0f}, const glm::vec3& rotation = {0.0f, 0.0f, 0.0f}, bool movable = false)
         : Entity(name, "", position, rotation), radius(radius), color(color), intensity(intensity), 
           shadowTextureName(this->getName() + "_shadow_cubemap"),
-          dynamicShadowTextureName(this->getName() + "_shadow_cubemap_dynamic") {
+          dynamicShadowTextureName(this->getName() + "_shadow_cubemap_dynamic"),
+          shadowMomentTextureName(this->getName() + "_shadow_moments") {
         this->setMovable(movable);
         shadowFarPlane = std::max(radius, shadowFarPlane);
-        initializeShadowResources();
     }
     virtual ~Light() {
         destroyShadowResources();
@@ -48,11 +48,60 @@ public:
     float getShadowFarPlane() const { return shadowFarPlane; }
     void setShadowFarPlane(float farPlane) { shadowFarPlane = farPlane; }
 
+    // Cube face resolution currently allocated for this light; 0 while the
+    // renderer's shadow budget has not granted (or has evicted) its maps.
+    uint32_t getShadowMapSize() const { return shadowMapSize; }
+    void setShadowMapSize(uint32_t size) {
+        if (size == shadowMapSize) {
+            return;
+        }
+        releaseShadowMaps();
+        shadowMapSize = size;
+        if (shadowMapSize > 0) {
+            initializeShadowResources();
+        }
+        dynamicShadowStaleFaces = 0x3F;
+        shadowMomentsDirty = true;
+    }
+    // Faces of the dynamic cubemap that no longer match the static one and must be re-copied.
+    uint32_t getDynamicShadowStaleFaces() const { return dynamicShadowStaleFaces; }
+    void setDynamicShadowStaleFaces(uint32_t faces) { dynamicShadowStaleFaces = faces; }
+    // Scales the screen-size based priority used when assigning shadow tiers.
+    float getShadowImportance() const { return shadowImportance; }
+    void setShadowImportance(float importance) { shadowImportance = importance; }
+    uint64_t getShadowLastUsedFrame() const { return shadowLastUsedFrame; }
+    void setShadowLastUsedFrame(uint64_t frame) { shadowLastUsedFrame = frame; }
+
+    ShadowFilterMode getShadowFilterMode() const { return shadowFilterMode; }
+    void setShadowFilterMode(ShadowFilterMode mode) {
+        shadowFilterMode = mode;
+        shadowMomentsDirty = true;
+    }
+    // Set whenever the dynamic cubemap changes; the moment map is rebuilt from it before lighting.
+    bool getShadowMomentsDirty() const { return shadowMomentsDirty; }
+    void setShadowMomentsDirty(bool dirty) { shadowMomentsDirty = dirty; }
+
+    void releaseShadowMaps() {
+        destroyShadowResources();
+        TextureManager* textureManager = TextureManager::getInstance();
+        if (textureManager) {
+            textureManager->unregisterTexture(shadowTextureName);
+            textureManager->unregisterTexture(dynamicShadowTextureName);
+            textureManager->unregisterTexture(shadowMomentTextureName);
+        }
+        shadowImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        dynamicShadowImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        shadowMapSize = 0;
+    }
+
     Image* getShadowMap() {
         TextureManager* textureManager = TextureManager::getInstance();
         if (!textureManager) {
             return nullptr;
         }
+        if (shadowMapSize == 0) {
+            return nullptr;
+        }
         Image* existing = textureManager->getTexture(shadowTextureName);
         if (existing && existing->image != VK_NULL_HANDLE && existing->imageView != VK_NULL_HANDLE) {
             return existing;
@@ -69,8 +118,8 @@ public:
         const VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
 
         Image shadowImage;
-        shadowImage.width = static_cast<int>(kShadowMapSize);
-        shadowImage.height = static_cast<int>(kShadowMapSize);
+        shadowImage.width = static_cast<int>(shadowMapSize);
+        shadowImage.height = static_cast<int>(shadowMapSize);
         shadowImage.format = depthFormat;
 
         std::array<VkImageView, 6> tempFaceViews{};
@@ -95,15 +144,12 @@ public:
                 vkDestroyImage(deviceHandle, shadowImage.image, nullptr);
                 shadowImage.image = VK_NULL_HANDLE;
             }
-            if (shadowImage.imageMemory != VK_NULL_HANDLE) {
-                vkFreeMemory(deviceHandle, shadowImage.imageMemory, nullptr);
-                shadowImage.imageMemory = VK_NULL_HANDLE;
-            }
+            rendererInstance->freeDeviceMemory(shadowImage.imageMemory);
         };
 
         rendererInstance->createImage(
-            kShadowMapSize,
-            kShadowMapSize,
+            shadowMapSize,
+            shadowMapSize,
             1,
             VK_SAMPLE_COUNT_1_BIT,
             depthFormat,
@@ -208,8 +254,8 @@ public:
             .renderPass = Renderer::getInstance()->getShadowMapRenderPass(),
             .attachmentCount = 1,
             .pAttachments = &shadowImageViews[index],
-            .width = static_cast<uint32_t>(kShadowMapSize),
-            .height = static_cast<uint32_t>(kShadowMapSize),
+            .width = static_cast<uint32_t>(shadowMapSize),
+            .height = static_cast<uint32_t>(shadowMapSize),
             .layers = 1,
         };
         if (vkCreateFramebuffer(Renderer::getInstance()->getDevice(), &framebufferInfo, nullptr, &shadowFrameBuffers[index]) != VK_SUCCESS) {
@@ -223,6 +269,9 @@ public:
         if (!textureManager) {
             return nullptr;
         }
+        if (shadowMapSize == 0) {
+            return nullptr;
+        }
         Image* existing = textureManager->getTexture(dynamicShadowTextureName);
         if (existing && existing->image != VK_NULL_HANDLE && existing->imageView != VK_NULL_HANDLE) {
             return existing;
@@ -239,8 +288,8 @@ public:
         const VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
 
         Image dynamicShadowImage;
-        dynamicShadowImage.width = static_cast<int>(kShadowMapSize);
-        dynamicShadowImage.height = static_cast<int>(kShadowMapSize);
+        dynamicShadowImage.width = static_cast<int>(shadowMapSize);
+        dynamicShadowImage.height = static_cast<int>(shadowMapSize);
         dynamicShadowImage.format = depthFormat;
 
         std::array<VkImageView, 6> tempFaceViews{};
@@ -265,15 +314,12 @@ public:
                 vkDestroyImage(deviceHandle, dynamicShadowImage.image, nullptr);
                 dynamicShadowImage.image = VK_NULL_HANDLE;
             }
-            if (dynamicShadowImage.imageMemory != VK_NULL_HANDLE) {
-                vkFreeMemory(deviceHandle, dynamicShadowImage.imageMemory, nullptr);
-                dynamicShadowImage.imageMemory = VK_NULL_HANDLE;
-            }
+            rendererInstance->freeDeviceMemory(dynamicShadowImage.imageMemory);
         };
 
         rendererInstance->createImage(
-            kShadowMapSize,
-            kShadowMapSize,
+            shadowMapSize,
+            shadowMapSize,
             1,
             VK_SAMPLE_COUNT_1_BIT,
             depthFormat,
@@ -376,8 +422,8 @@ public:
             .renderPass = Renderer::getInstance()->getShadowMapRenderPassLoad(),
             .attachmentCount = 1,
             .pAttachments = &dynamicShadowImageViews[index],
-            .width = static_cast<uint32_t>(kShadowMapSize),
-            .height = static_cast<uint32_t>(kShadowMapSize),
+            .width = static_cast<uint32_t>(shadowMapSize),
+            .height = static_cast<uint32_t>(shadowMapSize),
             .layers = 1,
         };
         if (vkCreateFramebuffer(Renderer::getInstance()->getDevice(), &framebufferInfo, nullptr, &dynamicShadowFrameBuffers[index]) != VK_SUCCESS) {
@@ -386,6 +432,142 @@ public:
         return dynamicShadowFrameBuffers[index];
     }
 
+    // Half-resolution EVSM cubemap (positive and negative warped moments), created on first use
+    // and kept in VK_IMAGE_LAYOUT_GENERAL so the prefilter can write it and lighting can sample it.
+    Image* getShadowMomentMap() {
+        TextureManager* textureManager = TextureManager::getInstance();
+        if (!textureManager || shadowMapSize == 0) {
+            return nullptr;
+        }
+        Image* existing = textureManager->getTexture(shadowMomentTextureName);
+        if (existing && existing->image != VK_NULL_HANDLE && existing->imageView != VK_NULL_HANDLE) {
+            return existing;
+        }
+
+        Renderer* rendererInstance = Renderer::getInstance();
+        if (!rendererInstance) {
+            throw std::runtime_error("Renderer instance is not available for shadow moment map creation.");
+        }
+        VkDevice deviceHandle = rendererInstance->getDevice();
+        const VkFormat momentFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+        const uint32_t momentSize = std::max(shadowMapSize / 2, 1u);
+
+        Image momentImage;
+        momentImage.width = static_cast<int>(momentSize);
+        momentImage.height = static_cast<int>(momentSize);
+        momentImage.format = momentFormat;
+        rendererInstance->createImage(
+            momentSize,
+            momentSize,
+            1,
+            VK_SAMPLE_COUNT_1_BIT,
+            momentFormat,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            momentImage.image,
+            momentImage.imageMemory,
+            6,
+            VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT
+        );
+        rendererInstance->transitionImageLayout(momentImage.image, momentFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1, 6);
+        momentImage.imageView = rendererInstance->createImageView(momentImage.image, momentFormat, 1, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_CUBE, 6);
+        momentStorageView = rendererInstance->createImageView(momentImage.image, momentFormat, 1, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 6);
+
+        VkSamplerCreateInfo samplerInfo = {
+            .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            .magFilter = VK_FILTER_LINEAR,
+            .minFilter = VK_FILTER_LINEAR,
+            .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+            .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .mipLodBias = 0.0f,
+            .anisotropyEnable = VK_FALSE,
+            .maxAnisotropy = 1.0f,
+            .compareEnable = VK_FALSE,
+            .compareOp = VK_COMPARE_OP_ALWAYS,
+            .minLod = 0.0f,
+            .maxLod = 0.0f,
+            .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+            .unnormalizedCoordinates = VK_FALSE,
+        };
+        if (vkCreateSampler(deviceHandle, &samplerInfo, nullptr, &momentImage.imageSampler) != VK_SUCCESS) {
+            vkDestroyImageView(deviceHandle, momentStorageView, nullptr);
+            momentStorageView = VK_NULL_HANDLE;
+            vkDestroyImageView(deviceHandle, momentImage.imageView, nullptr);
+            vkDestroyImage(deviceHandle, momentImage.image, nullptr);
+            rendererInstance->freeDeviceMemory(momentImage.imageMemory);
+            throw std::runtime_error("Failed to create shadow moment map sampler.");
+        }
+
+        shadowMomentsDirty = true;
+        textureManager->registerTexture(shadowMomentTextureName, momentImage);
+        return textureManager->getTexture(shadowMomentTextureName);
+    }
+
+    VkImageView getShadowMomentStorageView() {
+        return getShadowMomentMap() ? momentStorageView : VK_NULL_HANDLE;
+    }
+
+    // All six faces of a cubemap as a 2D array, for multiview rendering and compute reads.
+    VkImageView getLayeredShadowView(bool dynamicImage) {
+        Image* shadowImage = dynamicImage ? getDynamicShadowMap() : getShadowMap();
+        if (!shadowImage) {
+            return VK_NULL_HANDLE;
+        }
+        VkImageView& layeredView = dynamicImage ? dynamicLayeredShadowImageView : layeredShadowImageView;
+        if (layeredView == VK_NULL_HANDLE) {
+            layeredView = Renderer::getInstance()->createImageView(shadowImage->image, shadowImage->format, 1, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 6);
+        }
+        return layeredView;
+    }
+
+    VkFramebuffer getLayeredShadowFrameBuffer(bool dynamicImage) {
+        VkFramebuffer& framebuffer = dynamicImage ? dynamicLayeredShadowFrameBuffer : layeredShadowFrameBuffer;
+        if (framebuffer != VK_NULL_HANDLE) {
+            return framebuffer;
+        }
+        Renderer* rendererInstance = Renderer::getInstance();
+        VkRenderPass renderPass = dynamicImage ? rendererInstance->getShadowMapRenderPassMultiviewLoad() : rendererInstance->getShadowMapRenderPassMultiview();
+        if (renderPass == VK_NULL_HANDLE) {
+            return VK_NULL_HANDLE;
+        }
+        VkImageView layeredView = getLayeredShadowView(dynamicImage);
+        if (layeredView == VK_NULL_HANDLE) {
+            return VK_NULL_HANDLE;
+        }
+        VkFramebufferCreateInfo framebufferInfo = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = renderPass,
+            .attachmentCount = 1,
+            .pAttachments = &layeredView,
+            .width = static_cast<uint32_t>(shadowMapSize),
+            .height = static_cast<uint32_t>(shadowMapSize),
+            .layers = 1,
+        };
+        if (vkCreateFramebuffer(rendererInstance->getDevice(), &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create layered shadow framebuffer.");
+        }
+        return framebuffer;
+    }
+
+    VkRenderPassBeginInfo getLayeredShadowRenderPassBeginInfo(VkFramebuffer framebuffer, VkExtent2D extent, bool dynamicImage) const {
+        Renderer* rendererInstance = Renderer::getInstance();
+        VkRenderPassBeginInfo renderPassInfo = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = dynamicImage ? rendererInstance->getShadowMapRenderPassMultiviewLoad() : rendererInstance->getShadowMapRenderPassMultiview(),
+            .framebuffer = framebuffer,
+            .renderArea = {
+                .offset = {0, 0},
+                .extent = extent
+            },
+            .clearValueCount = dynamicImage ? 0u : 1u,
+            .pClearValues = dynamicImage ? nullptr : &clearValue,
+        };
+        return renderPassInfo;
+    }
+
     VkRenderPassBeginInfo getShadowRenderPassBeginInfo(VkFramebuffer framebuffer, VkExtent2D extent, int faceIndex) const {
         VkRenderPassBeginInfo renderPassInfo = {
             .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
@@ -422,6 +604,9 @@ public:
     uint32_t getShadowMapIndex() const { return shadowMapIndex; }
     void setShadowMapIndex(uint32_t index) { shadowMapIndex = index; }
 
+    const std::array<uint32_t, 6>& getShadowCasterCounts() const { return shadowCasterCounts; }
+    void setShadowCasterCounts(const std::array<uint32_t, 6>& counts) { shadowCasterCounts = counts; }
+
     const glm::mat4* getShadowViewProjections() const { return shadowViewProjections; }
     void setShadowViewProjections(const glm::mat4 vps[6]) { 
         for (int i = 0; i < 6; ++i) {
@@ -526,7 +711,7 @@ public:
                 shadowViewProjections[5]
             },
             .shadowParams = glm::vec4(shadowBias, shadowNearPlane, shadowFarPlane, shadowStrength),
-            .shadowData = glm::uvec4(shadowMapIndex, castsShadows ? 1u : 0u, 0u, 0u)
+            .shadowData = glm::uvec4(shadowMapIndex, castsShadows ? 1u : 0u, static_cast<uint32_t>(shadowFilterMode), 0u)
         };
         return pl;
     }
@@ -551,8 +736,8 @@ public:
             },
             .dstOffset = {0, 0, 0},
             .extent = {
-                static_cast<uint32_t>(kShadowMapSize),
-                static_cast<uint32_t>(kShadowMapSize),
+                static_cast<uint32_t>(shadowMapSize),
+                static_cast<uint32_t>(shadowMapSize),
                 1
             },
         };
@@ -569,15 +754,28 @@ private:
     float shadowFarPlane = 300.0f;
     std::string shadowTextureName = "";
     std::string dynamicShadowTextureName = "";
+    std::string shadowMomentTextureName = "";
     float shadowStrength = 1.0f;
     uint32_t shadowMapIndex = 0;
     glm::mat4 shadowViewProjections[6];
+    std::array<uint32_t, 6> shadowCasterCounts{};
+    uint32_t shadowMapSize = 0;
+    float shadowImportance = 1.0f;
+    uint64_t shadowLastUsedFrame = 0;
+    uint32_t dynamicShadowStaleFaces = 0x3F;
+    ShadowFilterMode shadowFilterMode = ShadowFilterMode::PCF;
+    bool shadowMomentsDirty = true;
+    VkImageView momentStorageView = VK_NULL_HANDLE;
     VkFramebuffer shadowFrameBuffers[6] = { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE };
     VkImageView shadowImageViews[6] = { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE };
     VkImageLayout shadowImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     VkFramebuffer dynamicShadowFrameBuffers[6] = { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE };
     VkImageView dynamicShadowImageViews[6] = { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE };
     VkImageLayout dynamicShadowImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImageView layeredShadowImageView = VK_NULL_HANDLE;
+    VkFramebuffer layeredShadowFrameBuffer = VK_NULL_HANDLE;
+    VkImageView dynamicLayeredShadowImageView = VK_NULL_HANDLE;
+    VkFramebuffer dynamicLayeredShadowFrameBuffer = VK_NULL_HANDLE;
 
     VkClearValue clearValue = {
         .depthStencil = {1.0f, 0},
@@ -616,8 +814,8 @@ private:
                     .renderPass = Renderer::getInstance()->getShadowMapRenderPass(),
                     .attachmentCount = 1,
                     .pAttachments = &shadowImageViews[i],
-                    .width = static_cast<uint32_t>(kShadowMapSize),
-                    .height = static_cast<uint32_t>(kShadowMapSize),
+                    .width = static_cast<uint32_t>(shadowMapSize),
+                    .height = static_cast<uint32_t>(shadowMapSize),
                     .layers = 1,
                 };
                 if (vkCreateFramebuffer(Renderer::getInstance()->getDevice(), &framebufferInfo, nullptr, &shadowFrameBuffers[i]) != VK_SUCCESS) {
@@ -655,8 +853,8 @@ private:
                     .renderPass = Renderer::getInstance()->getShadowMapRenderPassLoad(),
                     .attachmentCount = 1,
                     .pAttachments = &dynamicShadowImageViews[i],
-                    .width = static_cast<uint32_t>(kShadowMapSize),
-                    .height = static_cast<uint32_t>(kShadowMapSize),
+                    .width = static_cast<uint32_t>(shadowMapSize),
+                    .height = static_cast<uint32_t>(shadowMapSize),
                     .layers = 1,
                 };
                 if (vkCreateFramebuffer(Renderer::getInstance()->getDevice(), &framebufferInfo, nullptr, &dynamicShadowFrameBuffers[i]) != VK_SUCCESS) {
@@ -674,8 +872,25 @@ private:
             std::fill(std::begin(shadowImageViews), std::end(shadowImageViews), VK_NULL_HANDLE);
             std::fill(std::begin(dynamicShadowFrameBuffers), std::end(dynamicShadowFrameBuffers), VK_NULL_HANDLE);
             std::fill(std::begin(dynamicShadowImageViews), std::end(dynamicShadowImageViews), VK_NULL_HANDLE);
+            layeredShadowImageView = VK_NULL_HANDLE;
+            layeredShadowFrameBuffer = VK_NULL_HANDLE;
+            dynamicLayeredShadowImageView = VK_NULL_HANDLE;
+            dynamicLayeredShadowFrameBuffer = VK_NULL_HANDLE;
+            momentStorageView = VK_NULL_HANDLE;
             return;
         }
+        for (VkFramebuffer* framebuffer : {&layeredShadowFrameBuffer, &dynamicLayeredShadowFrameBuffer}) {
+            if (*framebuffer != VK_NULL_HANDLE) {
+                vkDestroyFramebuffer(deviceHandle, *framebuffer, nullptr);
+                *framebuffer = VK_NULL_HANDLE;
+            }
+        }
+        for (VkImageView* imageView : {&layeredShadowImageView, &dynamicLayeredShadowImageView, &momentStorageView}) {
+            if (*imageView != VK_NULL_HANDLE) {
+                vkDestroyImageView(deviceHandle, *imageView, nullptr);
+                *imageView = VK_NULL_HANDLE;
+            }
+        }
         for (auto& framebuffer : shadowFrameBuffers) {
             if (framebuffer != VK_NULL_HANDLE) {
                 vkDestroyFramebuffer(deviceHandle, framebuffer, nullptr);
@@ -2,6 +2,7 @@
 #include <string>
 #include <vector>
 #include <vulkan/vulkan.h>
+#include <DeviceAllocator.h>
 #include <glm/glm.hpp>
 #include <cstdint>
 
@@ -12,7 +13,8 @@ public:
     Model(std::string name)
         : name(std::move(name)) {};
     ~Model() = default;
-    void loadFromFile(const std::string& path);
+    // uploadToGPU = false keeps only the CPU copy (tools and benchmarks without a Vulkan device).
+    void loadFromFile(const std::string& path, bool uploadToGPU = true);
     const std::string& getName() const { return name; }
     VkBuffer getVertexBuffer() const { return vertexBuffer; }
     VkBuffer getIndexBuffer() const { return indexBuffer; }
@@ -27,9 +29,9 @@ private:
     std::vector<float> vertices;
     std::vector<uint32_t> indices;
     VkBuffer vertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
+    DeviceAllocation vertexBufferMemory{};
     VkBuffer indexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
+    DeviceAllocation indexBufferMemory{};
     glm::vec3 boundsMin;
     glm::vec3 boundsMax;
 };
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+
+// Picks a quality level from measured frame times so the frame rate holds at a target: level 0 is
+// full quality and every higher level is cheaper. It steps down one level once the GPU has stayed
+// over the target for a short window and steps back up only after a much longer window with clear
+// headroom. Each raise that has to be undone soon after doubles that window, so a level that
+// barely fits isn't retried every few seconds. Knows nothing about what the levels change.
+class QualityGovernor {
+public:
+    struct Config {
+        float targetMs = 1000.0f / 60.0f;
+        float downThreshold = 1.05f;   // Smoothed GPU time above target * this counts as over budget
+        float upThreshold = 0.75f;     // ... below target * this counts as headroom
+        uint32_t downFrames = 20;      // Consecutive over-budget frames before stepping down
+        uint32_t upFrames = 180;       // Consecutive headroom frames before stepping up
+        uint32_t maxUpFrames = 1440;
+        uint32_t settleFrames = 30;    // Frames ignored after a change while the new level settles
+    };
+    enum class Bottleneck : uint32_t {
+        None,
+        GPU,
+        CPU,
+    };
+
+    QualityGovernor() = default;
+    QualityGovernor(uint32_t levelCount, const Config& config);
+
+    // Feeds one frame's CPU and GPU time; returns true when the level changed.
+    bool update(double cpuMs, double gpuMs);
+    uint32_t getLevel() const { return level; }
+    const Config& getConfig() const { return config; }
+    double getCpuMs() const { return smoothedCpuMs; }
+    double getGpuMs() const { return smoothedGpuMs; }
+    // What limits the frame when it misses the target; the GPU-side knobs can't help a CPU-bound frame.
+    Bottleneck getBottleneck() const { return bottleneck; }
+
+private:
+    Config config{};
+    uint32_t levelCount = 1;
+    uint32_t level = 0;
+    double smoothedCpuMs = 0.0;
+    double smoothedGpuMs = 0.0;
+    bool hasSamples = false;
+    uint32_t overFrames = 0;
+    uint32_t headroomFrames = 0;
+    uint32_t framesSinceChange = 0;
+    uint32_t upWindow = 0;
+    bool lastChangeRaised = false;
+    Bottleneck bottleneck = Bottleneck::None;
+};
@@ -0,0 +1,140 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class GpuProfiler;
+
+// How a pass touches an image. layout is what the pass expects on entry; finalLayout is where
+// it leaves the image when that differs (a render pass's finalLayout). discard marks writes that
+// overwrite every texel, so the previous contents don't need to survive the transition.
+struct RenderGraphAccess {
+    VkPipelineStageFlags stages = 0;
+    VkAccessFlags access = 0;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    bool discard = false;
+
+    // Render pass attachment; an UNDEFINED initialLayout means the pass clears or overwrites it.
+    static RenderGraphAccess colorAttachment(VkImageLayout initialLayout, VkImageLayout finalLayout);
+    static RenderGraphAccess depthAttachment(VkImageLayout initialLayout, VkImageLayout finalLayout);
+    static RenderGraphAccess sampled(VkPipelineStageFlags stages, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    static RenderGraphAccess storage(VkPipelineStageFlags stages, bool read, bool write, bool discard = false);
+};
+
+// Frame graph over the swapchain-sized images. Passes declare what they read and write; compile()
+// culls passes nothing consumes, derives the lifetime of every transient image and packs images
+// whose lifetimes don't overlap into the same device memory. execute() records the passes in
+// order with the barriers their declared accesses need, batched into one vkCmdPipelineBarrier
+// per pass. Buffers aren't tracked; passes that only produce buffers are marked as side effects
+// and synchronize them themselves. Images created with TRANSIENT_ATTACHMENT usage are placed in
+// lazily allocated memory where the device has it.
+class RenderGraph {
+public:
+    using Resource = uint32_t;
+    static constexpr Resource kInvalidResource = UINT32_MAX;
+
+    struct ImageDesc {
+        VkExtent2D extent{};
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkImageUsageFlags usage = 0;
+        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+        uint32_t mipLevels = 1;
+    };
+
+    class PassBuilder {
+    public:
+        void read(Resource resource, const RenderGraphAccess& access);
+        void write(Resource resource, const RenderGraphAccess& access);
+        // Never culled: the pass writes something outside the graph (buffers, the swapchain).
+        void setSideEffect() { sideEffect = true; }
+        // Evaluated when the pass is reached in execute(); a false result skips it for that frame.
+        void setCondition(std::function<bool()> predicate) { condition = std::move(predicate); }
+
+    private:
+        friend class RenderGraph;
+        struct Access {
+            Resource resource;
+            RenderGraphAccess access;
+            bool read;
+            bool write;
+        };
+        void add(Resource resource, const RenderGraphAccess& access, bool read, bool write);
+        std::vector<Access> accesses;
+        std::function<bool()> condition;
+        bool sideEffect = false;
+    };
+
+    void init(VkDevice device, VkPhysicalDevice physicalDevice);
+    // Graph-owned image; its memory is bound by compile(), so create views only after that.
+    Resource createImage(const std::string& name, const ImageDesc& desc);
+    // Image owned elsewhere and kept across frames, currently in `layout`.
+    Resource importImage(const std::string& name, VkImage image, VkImageAspectFlags aspect, uint32_t mipLevels, VkImageLayout layout);
+    VkImage getImage(Resource resource) const;
+
+    void addPass(const std::string& name, const std::function<void(PassBuilder&)>& setup, std::function<void(VkCommandBuffer)> execute);
+    // Every executed pass is recorded inside a profiler scope named after it; survives reset().
+    void setProfiler(GpuProfiler* gpuProfiler) { profiler = gpuProfiler; }
+    void compile();
+    void execute(VkCommandBuffer commandBuffer);
+    // Destroys the graph-owned images and memory and forgets every pass and resource.
+    void reset();
+
+    VkDeviceSize getTransientMemorySize() const { return transientMemorySize; }
+    VkDeviceSize getUnaliasedMemorySize() const { return unaliasedMemorySize; }
+
+private:
+    struct ImageState {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags writeStages = 0;
+        VkAccessFlags writeAccess = 0;
+        VkPipelineStageFlags readStages = 0;
+        VkPipelineStageFlags visibleStages = 0; // Readers already synchronized with the last write
+    };
+    struct ImageResource {
+        std::string name;
+        VkImage image = VK_NULL_HANDLE;
+        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+        uint32_t mipLevels = 1;
+        bool imported = false;
+        bool lazilyAllocated = false;
+        // Transient images only
+        VkMemoryRequirements requirements{};
+        uint32_t memoryBlock = UINT32_MAX;
+        VkDeviceSize memoryOffset = 0;
+        int firstPass = -1;
+        int lastPass = -1;
+        bool aliasable = false;
+        bool firstUse = true;
+        std::vector<Resource> aliases;
+        ImageState state;
+    };
+    struct Pass {
+        std::string name;
+        PassBuilder builder;
+        std::function<void(VkCommandBuffer)> execute;
+        bool culled = false;
+    };
+    struct MemoryBlock {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        uint32_t memoryTypeIndex = 0;
+        VkDeviceSize size = 0;
+    };
+
+    uint32_t findMemoryType(uint32_t typeBits, bool lazilyAllocated) const;
+    void allocateTransientMemory();
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    GpuProfiler* profiler = nullptr;
+    std::vector<ImageResource> images;
+    std::vector<Pass> passes;
+    std::vector<MemoryBlock> memoryBlocks;
+    std::vector<VkImageMemoryBarrier> pendingBarriers;
+    VkDeviceSize transientMemorySize = 0;
+    VkDeviceSize unaliasedMemorySize = 0;
+    VkDeviceSize lazyMemorySize = 0;
+    bool compiled = false;
+};
@@ -5,7 +5,17 @@
 #include <array>
 #include <optional>
 #include <functional>
+#include <map>
+#include <chrono>
 #include <cstdint>
+#include <glm/glm.hpp>
+#include <SoftwareOcclusion.h>
+#include <RenderGraph.h>
+#include <QualityGovernor.h>
+#include <GpuProfiler.h>
+#include <DeviceAllocator.h>
+#include <UploadManager.h>
+#include <Benchmark.h>
 
 struct GLFWwindow;
 class UIManager;
@@ -20,14 +30,97 @@ class ButtonObject;
 class Camera;
 class Image;
 class Light;
+class Entity;
+class Model;
+class Frustum;
+enum class ShadowFilterMode : uint32_t;
+struct CullPushConstants;
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    // A transfer-only family (a copy engine), when the device exposes one.
+    std::optional<uint32_t> transferFamily;
     bool isComplete() {
         return graphicsFamily.has_value() && presentFamily.has_value();
     }
 };
 
+struct IndirectDrawBatch {
+    Model* model = nullptr;
+    std::vector<Image*> textures;
+    uint32_t firstCommand = 0;
+    uint32_t commandCount = 0;
+    std::vector<VkDescriptorSet> descriptorSets;
+};
+
+// Indirect draw resources replaced by a rebuild. They are destroyed once every frame slot that was in
+// flight at the time has signalled its fence.
+struct RetiredIndirectDrawResources {
+    std::vector<std::pair<VkBuffer, DeviceAllocation>> buffers;
+    std::vector<VkDescriptorPool> descriptorPools;
+    uint32_t pendingFrameMask = 0;
+};
+
+struct ShadowTimingSample {
+    std::string label;
+    uint32_t firstQuery = 0;
+    double cpuMs = 0.0;
+    std::chrono::steady_clock::time_point cpuStart{};
+};
+
+struct ShadowTimingStats {
+    double cpuMs = 0.0;
+    double gpuMs = 0.0;
+    uint32_t samples = 0;
+};
+
+struct DynamicShadowStats {
+    uint32_t lightsUpdated = 0;
+    uint32_t lightsSkipped = 0;
+    uint32_t facesCopied = 0;
+    uint32_t facesRedrawn = 0;
+    VkDeviceSize bytesSaved = 0;
+    bool operator==(const DynamicShadowStats&) const = default;
+};
+
+// Reference is the original full-resolution linear march; the others trace the Hi-Z pyramid at
+// half resolution and accumulate over frames.
+enum class SSRPreset : uint32_t {
+    Reference,
+    Low,
+    Medium,
+    High,
+};
+
+struct SSRPresetSettings {
+    const char* name;
+    bool hierarchical;
+    uint32_t maxIterations;
+    float roughnessCutoff; // pixels rougher than this skip the trace
+    float metallicCutoff;  // pixels less metallic than this skip the trace
+    float thickness;       // view-space depth a hit may sit behind the surface
+    float maxDistance;
+    float historyWeight;
+};
+
+inline SSRPresetSettings ssrPresetSettings(SSRPreset preset) {
+    switch (preset) {
+        case SSRPreset::Reference: return {"reference", false, 128, 1.0f, 0.0f, 0.5f, 50.0f, 0.0f};
+        case SSRPreset::Low: return {"low", true, 24, 0.3f, 0.5f, 0.5f, 25.0f, 0.9f};
+        case SSRPreset::Medium: return {"medium", true, 48, 0.5f, 0.25f, 0.5f, 50.0f, 0.9f};
+        case SSRPreset::High: return {"high", true, 96, 0.7f, 0.0f, 0.3f, 50.0f, 0.85f};
+    }
+    return {"unknown", false, 0, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+}
+
+// Culling counters written by cull.comp, read back once the frame's fence has signalled.
+struct GeometryCullStats {
+    uint32_t frustumCulled = 0;
+    uint32_t occlusionCulled = 0;
+    uint32_t firstPhaseDraws = 0;
+    uint32_t secondPhaseDraws = 0;
+};
+
 struct SwapChainSupportDetails {
     VkSurfaceCapabilitiesKHR capabilities;
     std::vector<VkSurfaceFormatKHR> formats;
@@ -38,6 +131,19 @@ class Renderer {
 public:
     static constexpr uint32_t kMaxFramesInFlight = 2;
     static constexpr uint32_t kMaxShadowCubeSlots = 64;
+    static constexpr uint32_t kMaxIndirectBatches = 256;
+    // Starting size of each frame slot's uniform ring; a slot grows when a frame needs more.
+    static constexpr VkDeviceSize kUniformRingFrameSize = 4 * 1024 * 1024;
+    static constexpr uint32_t kUniformAllocationFailed = UINT32_MAX;
+    static constexpr uint32_t kShadowTimestampsPerFrame = kMaxShadowCubeSlots * 4;
+    // The last two timestamps of each frame's range bracket the whole frame for the quality governor.
+    static constexpr uint32_t kFrameTimestampQuery = kShadowTimestampsPerFrame - 2;
+    static constexpr VkDeviceSize kDefaultShadowMemoryBudget = 256ull * 1024 * 1024;
+    static constexpr uint32_t kShadowBudgetInterval = 30;
+    static constexpr uint32_t kMaxHiZMips = 16;
+    // Linear albedo with coverage alpha (sRGB-encoded by the hardware) and metallic/roughness.
+    static constexpr VkFormat kGBufferAlbedoFormat = VK_FORMAT_R8G8B8A8_SRGB;
+    static constexpr VkFormat kGBufferMaterialFormat = VK_FORMAT_R8G8_UNORM;
     VkDevice device;
 
     Renderer();
@@ -45,22 +151,32 @@ public:
     static Renderer* getInstance();
 
     void run();
+    // Renders options.scene without a window: offscreen images stand in for the swapchain and the
+    // camera rig follows options.cameraPath in fixed 60 Hz steps. Prints CPU, GPU and per-pass GPU
+    // frame-time percentiles as JSON and returns the exit code: 0, 1 on errors, 2 on a baseline regression.
+    int runBenchmark(const BenchmarkOptions& options);
+    bool isHeadless() const { return headless; }
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount = 1, VkDeviceSize layerSize = 0);
     void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1, uint32_t layerCount = 1);
-    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t arrayLayers = 1, VkImageCreateFlags flags = 0);
-    void createTextureImage(int width, int height, unsigned char* imageBuffer, VkImage& textureImage, VkDeviceMemory& textureImageMemory, VkFormat format);
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, DeviceAllocation& imageMemory, uint32_t arrayLayers = 1, VkImageCreateFlags flags = 0);
+    void createTextureImage(int width, int height, unsigned char* imageBuffer, VkImage& textureImage, DeviceAllocation& textureImageMemory, VkFormat format);
     VkShaderModule createShaderModule(const std::vector<char>& code);
-    void createTextureImageView(VkFormat textureFormat, VkImage textureImage, VkImageView &textureImageView);
+    void createTextureImageView(VkFormat textureFormat, VkImage textureImage, VkImageView &textureImageView, uint32_t mipLevels = 1);
     VkImageView createImageView(VkImage image, VkFormat format, uint32_t mipLevels, VkImageAspectFlags aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT, VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D, uint32_t layerCount = 1);
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-    void createDescriptorSetLayout(int vertexBitBindings, int fragmentBitBindings, VkDescriptorSetLayout& descriptorSetLayout, VkShaderStageFlags shaderStage = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, const std::vector<uint32_t>* fragmentDescriptorCounts = nullptr);
-    void createDescriptorPool(int vertexBitBindings, int fragmentBitBindings, VkDescriptorPool &descriptorPool, int multiplier = 1, bool isCompute = false, const std::vector<uint32_t>* fragmentDescriptorCounts = nullptr);
-    std::vector<VkDescriptorSet> createDescriptorSets(VkDescriptorPool pool, VkDescriptorSetLayout& descriptorSetLayout, int vertexBindingCount, int fragmentBindingCount, std::vector<Image*>& textures, std::vector<VkBuffer>& uniformBuffers);
-    void createGraphicsPipeline(const std::string& vertexShaderPath, const std::string& fragmentShaderPath, VkPipeline& pipeline, VkPipelineLayout& pipelineLayout, VkDescriptorSetLayout& descriptorSetLayout, VkPushConstantRange* pushConstantRange = nullptr, bool enableDepth = true, bool useTextVertex = false, VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT, VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE, bool depthWrite = true, VkCompareOp depthCompare = VK_COMPARE_OP_LESS, VkRenderPass renderPassOverride = VK_NULL_HANDLE, uint32_t colorAttachmentCount = 1, VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT, bool noVertexInput = false);
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& bufferMemory);
+    // Returns memory from createBuffer() or createImage(); destroy the resource bound to it first.
+    void freeDeviceMemory(DeviceAllocation& allocation) { memoryAllocator.free(allocation); }
+    DeviceAllocator& getMemoryAllocator() { return memoryAllocator; }
+    UploadManager& getUploadManager() { return uploadManager; }
+    void createDescriptorSetLayout(int vertexBitBindings, int fragmentBitBindings, VkDescriptorSetLayout& descriptorSetLayout, VkShaderStageFlags shaderStage = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, const std::vector<uint32_t>* fragmentDescriptorCounts = nullptr, VkDescriptorType vertexDescriptorType = VK_DESCRIPTOR_TYPE_MAX_ENUM, const std::vector<VkDescriptorType>* fragmentDescriptorTypes = nullptr);
+    void createDescriptorPool(int vertexBitBindings, int fragmentBitBindings, VkDescriptorPool &descriptorPool, int multiplier = 1, bool isCompute = false, const std::vector<uint32_t>* fragmentDescriptorCounts = nullptr, VkDescriptorType vertexDescriptorType = VK_DESCRIPTOR_TYPE_MAX_ENUM, const std::vector<VkDescriptorType>* fragmentDescriptorTypes = nullptr);
+    std::vector<VkDescriptorSet> createDescriptorSets(VkDescriptorPool pool, VkDescriptorSetLayout& descriptorSetLayout, int vertexBindingCount, int fragmentBindingCount, std::vector<Image*>& textures, std::vector<VkBuffer>& uniformBuffers, VkDescriptorType bufferDescriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VkDeviceSize bufferRange = VK_WHOLE_SIZE);
+    void createGraphicsPipeline(const std::string& vertexShaderPath, const std::string& fragmentShaderPath, VkPipeline& pipeline, VkPipelineLayout& pipelineLayout, VkDescriptorSetLayout& descriptorSetLayout, VkPushConstantRange* pushConstantRange = nullptr, bool enableDepth = true, bool useTextVertex = false, VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT, VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE, bool depthWrite = true, VkCompareOp depthCompare = VK_COMPARE_OP_LESS, VkRenderPass renderPassOverride = VK_NULL_HANDLE, uint32_t colorAttachmentCount = 1, VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT, bool noVertexInput = false, uint32_t subpass = 0);
     void createComputePipeline(const std::string& computeShaderPath, VkPipeline& pipeline, VkPipelineLayout& pipelineLayout, VkDescriptorSetLayout& descriptorSetLayout, VkPushConstantRange* pushConstantRange = nullptr);
+    // Returns the dynamic offset of the copy, or kUniformAllocationFailed when this frame's ring is full.
+    uint32_t allocateUniformData(const void* data, VkDeviceSize size);
+    VkBuffer getUniformRingBuffer(uint32_t frame) const { return uniformRingBuffers[frame]; }
     void createCommandBuffers();
     void createSyncObjects();
     void setUIMode(bool enabled);
@@ -70,12 +186,56 @@ public:
     void createTextureSampler(VkSampler &sampler, uint32_t mipLevels = 1);
 
     VkDevice getDevice() const { return device; }
-    VkRenderPass getGBufferRenderPass() const { return gBufferRenderPass; }
-    VkRenderPass getLightingRenderPass() const { return lightingRenderPass; }
+    // In the single render pass path geometry and lighting are subpasses 0 and 1 of deferredRenderPass.
+    VkRenderPass getGBufferRenderPass() const { return singlePassDeferred ? deferredRenderPass : gBufferRenderPass; }
+    VkRenderPass getLightingRenderPass() const { return singlePassDeferred ? deferredRenderPass : lightingRenderPass; }
+    uint32_t getLightingSubpass() const { return singlePassDeferred ? 1u : 0u; }
     VkRenderPass getCompositeRenderPass() const { return compositeRenderPass; }
     VkRenderPass getShadowMapRenderPass() const { return shadowRenderPass; }
     VkRenderPass getShadowMapRenderPassLoad() const { return shadowRenderPassLoad; }
+    VkRenderPass getShadowMapRenderPassMultiview() const { return shadowRenderPassMultiview; }
+    VkRenderPass getShadowMapRenderPassMultiviewLoad() const { return shadowRenderPassMultiviewLoad; }
+    bool supportsLayeredShadows() const { return supportsMultiview; }
     uint32_t getFramesInFlight() const { return kMaxFramesInFlight; }
+    VkDeviceSize getShadowMemoryBudget() const { return shadowMemoryBudget; }
+    VkDeviceSize getShadowMemoryUsed() const { return shadowMemoryUsed; }
+    void setShadowMemoryBudget(VkDeviceSize budget) { shadowMemoryBudget = budget; shadowBudgetDirty = true; }
+    // Min/max depth pyramid of the current frame's G-buffer depth, rebuilt after the geometry pass.
+    // Kept in VK_IMAGE_LAYOUT_GENERAL; sample it with getHiZSampler() to reach every mip.
+    VkImageView getHiZView() const { return hiZView; }
+    VkSampler getHiZSampler() const { return hiZSampler; }
+    uint32_t getHiZMipCount() const { return hiZMipCount; }
+    // Two-phase occlusion culling of the GPU-driven static geometry against the Hi-Z pyramid.
+    bool isOcclusionCullingEnabled() const { return occlusionCulling; }
+    void setOcclusionCullingEnabled(bool enabled) { occlusionCulling = enabled; }
+    const GeometryCullStats& getGeometryCullStats() const { return geometryCullStats; }
+    // CPU occlusion culling of the entities recorded one by one, against designated occluders.
+    // On by default when the device can't compact indirect draws with vkCmdDrawIndexedIndirectCount.
+    bool isSoftwareOcclusionEnabled() const { return softwareOcclusionEnabled; }
+    void setSoftwareOcclusionEnabled(bool enabled) { softwareOcclusionEnabled = enabled; }
+    // Geometry and lighting in one render pass, the G-buffer read as input attachments. Must be
+    // chosen before run(); it replaces the second occlusion culling phase, which needs the Hi-Z
+    // pyramid between the two.
+    bool isSinglePassDeferred() const { return singlePassDeferred; }
+    void setSinglePassDeferred(bool enabled) { singlePassDeferred = enabled; }
+    // Material textures get mip chains generated at load time; must be chosen before run().
+    bool areTextureMipmapsEnabled() const { return textureMipmaps; }
+    // BC1-BC7 sampling (textureCompressionBC), which cooked textures use when it is there.
+    bool supportsBlockCompressedTextures() const { return supportsBlockCompression; }
+    void setTextureMipmapsEnabled(bool enabled) { textureMipmaps = enabled; }
+    SSRPreset getSSRPreset() const { return ssrPreset; }
+    void setSSRPreset(SSRPreset preset) { ssrPreset = preset; ssrHistoryValid = false; }
+    // Trades SSR quality, shadow filtering, shadow memory and then internal render resolution for
+    // frame time to hold targetMs. The settings in effect when it is enabled are its full-quality
+    // level, and disabling it restores them.
+    bool isQualityGovernorEnabled() const { return qualityGovernorEnabled; }
+    void setQualityGovernorEnabled(bool enabled, float targetMs = 1000.0f / 60.0f);
+    // Fraction of the swapchain extent the G-buffer, lighting and SSR are rendered at.
+    float getRenderScale() const { return renderScale; }
+    // Per-pass GPU timings, plus pipeline statistics when enabled, trailing by the frames in flight.
+    GpuProfiler& getGpuProfiler() { return gpuProfiler; }
+    // Writes the profiler's latest results to basePath.csv and basePath.json.
+    void dumpGpuProfile(const std::string& basePath);
     bool isCursorLocked() const { return cursorLocked; }
     bool isUIMode() const { return uiMode; }
 
@@ -94,33 +254,69 @@ private:
     void createSwapChain();
     void recreateSwapChain();
     void cleanupSwapChain();
+    void updateRenderExtent();
+    void cleanupRenderTargets();
+    void recreateRenderTargets();
+    void updateQualityGovernor();
+    void updateGpuProfilerOverlay();
+    // Whether diagnostic stats go to stdout: only while the CPU profiler or the GPU profiler overlay is on.
+    bool isProfilingOutputEnabled() const;
+    void applyQualityLevel(uint32_t level);
     void createImageViews();
     void createGBufferResources();
     void createGBufferRenderPass();
     void createGBufferFramebuffers();
     void createGBufferSampler();
+    void createShadowCompareSampler();
     void createLightingResources();
     void createLightingRenderPass();
     void createLightingFramebuffers();
+    void createDeferredRenderPass();
     void createShadowRenderPass();
     void createShadowRenderPassLoad();
+    void createShadowRenderPassMultiview();
+    void createShadowTimestampPool();
+    void collectShadowTimings();
     void createSSRResources();
+    void dispatchSSR(VkCommandBuffer commandBuffer);
+    void createHiZResources();
+    void buildHiZPyramid(VkCommandBuffer commandBuffer);
+    void createFrameGraph();
     void createCompositeRenderPass();
     void createCompositeFramebuffers();
     void createDeferredDescriptorSets();
     void recreateDeferredDescriptorSets();
-    void updateLightsUniformBuffer();
+    void updateLightsBuffer();
+    void dispatchLightCulling(VkCommandBuffer commandBuffer);
     VkFormat findDepthFormat();
+    void chooseRenderTargetFormats();
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
     void createCommandPool();
+    void createUniformRingBuffer(uint32_t frame, VkDeviceSize size);
+    void growUniformRingBuffer();
     void createQuadBuffers();
     void setupUI();
     void renderUI(VkCommandBuffer commandBuffer);
     void updateEntities();
     void renderEntitiesGeometry(VkCommandBuffer commandBuffer);
+    void prepareSoftwareOcclusion(const glm::mat4& viewProjection);
+    void updateIndirectDrawBatches();
+    void retireIndirectDrawResources();
+    void releaseRetiredIndirectDrawResources(bool all);
+    CullPushConstants makeCullPushConstants(uint32_t phase) const;
+    void dispatchGeometryCulling(VkCommandBuffer commandBuffer);
+    void writeCullHiZDescriptors();
+    void renderOcclusionCulledGeometry(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void renderIndirectDrawBatches(VkCommandBuffer commandBuffer, const glm::mat4& view, const glm::mat4& proj, const glm::vec3& cameraPos, bool secondPhase = false);
     void renderEntitiesShadowDepth(VkCommandBuffer commandBuffer, const std::vector<Light*>& lights);
+    void updateShadowBudget();
+    void computeShadowFaces(Light* light, Frustum faceFrustums[6]);
+    void drawShadowCasters(VkCommandBuffer commandBuffer, Light* light, const std::vector<Entity*>& roots, bool staticCasters, bool dynamicImage, uint32_t faceMask, std::array<uint32_t, 6>& casterCounts);
+    size_t beginShadowTiming(VkCommandBuffer commandBuffer, const std::string& label);
+    void endShadowTiming(VkCommandBuffer commandBuffer, size_t sampleIndex);
     void renderEntitiesMovableShadowDepth(VkCommandBuffer commandBuffer);
-    void transitionGBufferForReading(VkCommandBuffer commandBuffer);
+    ShadowFilterMode getEffectiveShadowFilter(const Light* light) const;
+    void prefilterShadowMoments(VkCommandBuffer commandBuffer);
     void renderDeferredLighting(VkCommandBuffer commandBuffer);
     void renderComposite(VkCommandBuffer commandBuffer);
     void recordDeferredCommandBuffer(VkCommandBuffer cmd, uint32_t imageIndex);
@@ -130,7 +326,6 @@ private:
     VkSampleCountFlagBits getMaxUsableSampleCount();
     bool checkValidationLayerSupport();
     std::vector<const char*> getRequiredExtensions();
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
     void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo);
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
     bool hasStencilComponent(VkFormat format);
@@ -146,70 +341,174 @@ private:
     static void mouseMoveCallback(GLFWwindow* window, double xpos, double ypos);
 
     GLFWwindow* window = nullptr;
+    // Set by runBenchmark(); there is no surface, swapchain or present, and swapChainImages are
+    // plain images of headlessExtent backed by swapChainImageMemory.
+    bool headless = false;
+    VkExtent2D headlessExtent{};
     VkInstance instance{};
     VkDebugUtilsMessengerEXT debugMessenger{};
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     VkQueue graphicsQueue{};
+    VkQueue transferQueue{};
     VkQueue presentQueue{};
     VkSurfaceKHR surface{};
     VkSwapchainKHR swapChain{};
     std::vector<VkImage> swapChainImages{};
     std::vector<VkImageView> swapChainImageViews{};
-    std::vector<VkDeviceMemory> swapChainImageMemory{};
+    std::vector<DeviceAllocation> swapChainImageMemory{};
+    // The swapchain-sized targets are created by frameGraph, which owns and aliases their memory.
+    RenderGraph frameGraph;
+    uint32_t frameGraphImageIndex = 0;
+    // Octahedral normals and HDR lighting; chosen per device by chooseRenderTargetFormats().
+    VkFormat gBufferNormalFormat = VK_FORMAT_R16G16_SFLOAT;
+    VkFormat lightingFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
     VkImage gBufferAlbedoImage{};
-    VkDeviceMemory gBufferAlbedoMemory{};
+    RenderGraph::Resource gBufferAlbedoResource = RenderGraph::kInvalidResource;
     VkImageView gBufferAlbedoView{};
     VkImage gBufferNormalImage{};
-    VkDeviceMemory gBufferNormalMemory{};
+    RenderGraph::Resource gBufferNormalResource = RenderGraph::kInvalidResource;
     VkImageView gBufferNormalView{};
     VkImage gBufferMaterialImage{};
-    VkDeviceMemory gBufferMaterialMemory{};
+    RenderGraph::Resource gBufferMaterialResource = RenderGraph::kInvalidResource;
     VkImageView gBufferMaterialView{};
     VkImage gBufferDepthImage{};
-    VkDeviceMemory gBufferDepthMemory{};
+    RenderGraph::Resource gBufferDepthResource = RenderGraph::kInvalidResource;
     VkImageView gBufferDepthView{};
     VkImage lightingImage{};
-    VkDeviceMemory lightingMemory{};
+    RenderGraph::Resource lightingResource = RenderGraph::kInvalidResource;
     VkImageView lightingView{};
     VkImage ssrImage{};
-    VkDeviceMemory ssrMemory{};
+    RenderGraph::Resource ssrResource = RenderGraph::kInvalidResource;
     VkImageView ssrView{};
+    VkImage hiZImage{};
+    DeviceAllocation hiZMemory{};
+    VkImageView hiZView{};
+    std::vector<VkImageView> hiZMipViews{};
+    uint32_t hiZMipCount = 0;
+    std::vector<VkDescriptorSet> hiZDescriptorSets{};
+    bool supportsHiZ = false;
+    int hiZDebugMip = -1;
     std::vector<VkDescriptorSet> ssrDescriptorSets{};
+    VkImage ssrTraceImage{};
+    RenderGraph::Resource ssrTraceResource = RenderGraph::kInvalidResource;
+    VkImageView ssrTraceView{};
+    std::array<VkImage, 2> ssrHistoryImages{};
+    std::array<DeviceAllocation, 2> ssrHistoryMemory{};
+    std::array<VkImageView, 2> ssrHistoryViews{};
+    VkExtent2D ssrTraceExtent{};
+    std::vector<VkDescriptorSet> ssrTraceDescriptorSets{};
+    std::vector<VkDescriptorSet> ssrResolveDescriptorSets{};  // indexed by the history image written
+    std::vector<VkDescriptorSet> ssrUpsampleDescriptorSets{}; // indexed by the history image read
+    SSRPreset ssrPreset = SSRPreset::Medium;
+    uint32_t ssrHistoryIndex = 0;
+    uint32_t ssrFrameIndex = 0;
+    bool ssrHistoryValid = false;
+    glm::mat4 ssrPrevViewProj{1.0f};
     std::vector<VkDescriptorSet> lightingDescriptorSets{};
     std::vector<VkDescriptorSet> compositeDescriptorSets{};
     std::array<VkDescriptorImageInfo, kMaxShadowCubeSlots> shadowCubeDescriptorInfos{};
+    std::array<VkDescriptorImageInfo, kMaxShadowCubeSlots> shadowCompareDescriptorInfos{};
+    std::array<VkDescriptorImageInfo, kMaxShadowCubeSlots> shadowMomentDescriptorInfos{};
     uint32_t shadowCubeDescriptorCount = 0;
-    std::vector<VkBuffer> lightsUniformBuffers{};
-    std::vector<VkDeviceMemory> lightsUniformBuffersMemory{};
+    std::vector<VkDescriptorSet> shadowMomentDescriptorSets{};
+    std::vector<VkBuffer> lightsBuffers{};
+    std::vector<DeviceAllocation> lightsBuffersMemory{};
+    std::vector<void*> lightsBuffersMapped{};
+    std::vector<VkBuffer> clusterBuffers{};
+    std::vector<DeviceAllocation> clusterBuffersMemory{};
+    std::vector<VkBuffer> clusterLightIndexBuffers{};
+    std::vector<DeviceAllocation> clusterLightIndexBuffersMemory{};
+    std::vector<VkDescriptorSet> lightCullDescriptorSets{};
+    std::vector<VkBuffer> lightCullStatsBuffers{};
+    std::vector<DeviceAllocation> lightCullStatsBuffersMemory{};
+    std::array<bool, kMaxFramesInFlight> lightCullStatsPending{};
+    uint32_t lightCullWarningCooldown = 0;
+    uint32_t activeLightCount = 0;
+    std::array<VkBuffer, kMaxFramesInFlight> uniformRingBuffers{};
+    std::array<DeviceAllocation, kMaxFramesInFlight> uniformRingMemory{};
+    std::array<VkDeviceSize, kMaxFramesInFlight> uniformRingSizes{};
+    VkDeviceSize uniformRingOffset = 0;
+    VkDeviceSize uniformRingDemand = 0;
+    VkDeviceSize uniformRingPeakDemand = 0;
+    VkDeviceSize uniformRingAlignment = 256;
+    std::vector<IndirectDrawBatch> indirectDrawBatches;
+    std::vector<Entity*> cpuGeometryEntities;
+    std::vector<VkDescriptorSet> cullDescriptorSets{};
+    VkDescriptorPool cullDescriptorPool{};
+    VkDescriptorPool indirectDescriptorPool{};
+    std::vector<RetiredIndirectDrawResources> retiredIndirectDrawResources;
+    bool cullVisibilityCleared = false;
+    VkBuffer cullObjectBuffer{};
+    DeviceAllocation cullObjectBufferMemory{};
+    std::vector<VkBuffer> cullCommandBuffers{};
+    std::vector<DeviceAllocation> cullCommandBuffersMemory{};
+    std::vector<VkBuffer> cullCountBuffers{};
+    std::vector<DeviceAllocation> cullCountBuffersMemory{};
+    uint32_t indirectObjectCount = 0;
+    VkBuffer cullVisibilityBuffer{};
+    DeviceAllocation cullVisibilityBufferMemory{};
+    std::vector<VkBuffer> cullStatsBuffers{};
+    std::vector<DeviceAllocation> cullStatsBuffersMemory{};
+    std::vector<void*> cullStatsBuffersMapped{};
+    std::array<bool, kMaxFramesInFlight> cullStatsPending{};
+    GeometryCullStats geometryCullStats{};
+    uint64_t occludedObjectsTotal = 0;
+    uint32_t occlusionStatsFrames = 0;
+    bool occlusionCulling = true;
+    bool occlusionPhaseActive = false;
+    SoftwareOcclusionBuffer softwareOcclusion;
+    bool softwareOcclusionEnabled = false;
+    uint64_t softwareOccludedTotal = 0;
+    double softwareOcclusionMs = 0.0;
+    uint32_t softwareOcclusionFrames = 0;
+    uint64_t indirectSceneVersion = UINT64_MAX;
+    uint64_t indirectStaticGeometryVersion = UINT64_MAX;
+    bool gpuDrivenGeometry = false;
+    bool supportsMultiDrawIndirect = false;
+    bool supportsPipelineStatistics = false;
+    bool supportsBlockCompression = false;
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
     std::vector<VkFramebuffer> gBufferFramebuffers;
     std::vector<VkFramebuffer> lightingFramebuffers;
+    bool singlePassDeferred = false;
+    bool textureMipmaps = true;
     std::vector<VkFramebuffer> compositeFramebuffers;
     std::vector<VkFramebuffer> swapChainFramebuffers;
     VkRenderPass gBufferRenderPass{};
+    VkRenderPass gBufferRenderPassLoad{};
     VkRenderPass lightingRenderPass{};
+    VkRenderPass deferredRenderPass{};
     VkRenderPass compositeRenderPass{};
     VkRenderPass shadowRenderPass{};
     VkRenderPass shadowRenderPassLoad{};
+    VkRenderPass shadowRenderPassMultiview{};
+    VkRenderPass shadowRenderPassMultiviewLoad{};
     VkFormat swapChainImageFormat{};
     VkExtent2D swapChainExtent{};
+    VkExtent2D renderExtent{}; // swapChainExtent scaled by renderScale
+    float renderScale = 1.0f;
     VkPipelineLayout pipelineLayout{};
     VkCommandPool commandPool{};
     VkSampler textureSampler{};
     VkSampler gBufferSampler{};
+    VkSampler upscaleSampler{};
+    VkSampler shadowCompareSampler{};
+    VkSampler hiZSampler{};
+    VkSampler ssrHistorySampler{};
     std::vector<VkCommandBuffer> commandBuffers;
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
     VkImage colorImage{};
-    VkDeviceMemory colorImageMemory{};
+    DeviceAllocation colorImageMemory{};
     VkImageView colorImageView{};
     VkImage depthImage{};
-    VkDeviceMemory depthImageMemory{};
+    DeviceAllocation depthImageMemory{};
     VkImageView depthImageView{};
     VkBuffer quadVertexBuffer{};
-    VkDeviceMemory quadVertexBufferMemory{};
+    DeviceAllocation quadVertexBufferMemory{};
     VkBuffer quadIndexBuffer{};
-    VkDeviceMemory quadIndexBufferMemory{};
+    DeviceAllocation quadIndexBufferMemory{};
     UIManager* uiManager = nullptr;
     FontManager* fontManager = nullptr;
     VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
@@ -230,4 +529,32 @@ private:
     float deltaTime = 0.0f;
     float currentTime = 0.0f;
     Camera* activeCamera = nullptr;
+    bool supportsMultiview = false;
+    bool layeredShadows = false;
+    VkQueryPool shadowTimestampPool{};
+    float timestampPeriod = 0.0f;
+    std::vector<ShadowTimingSample> shadowTimingSamples[kMaxFramesInFlight];
+    std::map<std::string, ShadowTimingStats> shadowTimingStats;
+    uint32_t shadowTimingFrames = 0;
+    VkDeviceSize shadowMemoryBudget = kDefaultShadowMemoryBudget;
+    VkDeviceSize shadowMemoryUsed = 0;
+    uint64_t shadowBudgetFrame = 0;
+    uint64_t lastShadowBudgetChange = 0;
+    bool shadowBudgetDirty = true;
+    DynamicShadowStats dynamicShadowStats{};
+    std::optional<ShadowFilterMode> shadowFilterOverride;
+    QualityGovernor qualityGovernor;
+    bool qualityGovernorEnabled = false;
+    SSRPreset qualityBaseSSRPreset = SSRPreset::Medium;
+    std::optional<ShadowFilterMode> qualityBaseShadowFilter;
+    VkDeviceSize qualityBaseShadowBudget = kDefaultShadowMemoryBudget;
+    std::array<bool, kMaxFramesInFlight> frameTimingPending{};
+    double frameCpuMs = 0.0;
+    // GPU time of the last frame read back from this frame slot, or negative when it had none.
+    double lastGpuFrameMs = -1.0;
+    GpuProfiler gpuProfiler;
+    uint32_t gpuProfilerOverlayMode = 0; // 0 off, 1 timings, 2 timings and pipeline statistics
+    // Backs createBuffer() and createImage(); the render graph places its transients itself.
+    DeviceAllocator memoryAllocator;
+    UploadManager uploadManager;
 };
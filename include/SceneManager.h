@@ -9,9 +9,12 @@ public:
     ~SceneManager();
     void addScene(int id, std::function<void()> func);
     void switchScene(int id);
+    // Id of the scene registered under name, which may also be the id itself; -1 if there is none.
+    int findScene(const std::string& name) const;
     static SceneManager* getInstance();
     void shutdown();
 private:
     int currentScene = 0;
     std::map<int, std::function<void()>> scenes;
+    std::map<std::string, int> sceneIds;
 };
\ No newline at end of file
@@ -7,7 +7,14 @@
 #include <glm/glm.hpp>
 #include <variant>
 
-inline constexpr uint32_t kMaxPointLights = 64;
+inline constexpr uint32_t kMaxPointLights = 4096;
+// Froxel grid used by the light culling pass; must match light_cull.comp and lighting.frag.
+inline constexpr uint32_t kClusterGridX = 16;
+inline constexpr uint32_t kClusterGridY = 9;
+inline constexpr uint32_t kClusterGridZ = 24;
+inline constexpr uint32_t kClusterCount = kClusterGridX * kClusterGridY * kClusterGridZ;
+inline constexpr uint32_t kMaxClusterLightIndices = kClusterCount * 64;
+inline constexpr uint32_t kMaxLightsPerCluster = 128;
 
 class Renderer;
 
@@ -29,8 +36,10 @@ struct Shader {
     bool depthWrite = true;
     VkCompareOp depthCompare = VK_COMPARE_OP_LESS;
     VkRenderPass renderPassToUse = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
     uint32_t colorAttachmentCount = 1;
     bool noVertexInput = false;
+    VkDescriptorType vertexDescriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 };
 
 struct ComputeShader {
@@ -44,6 +53,7 @@ struct ComputeShader {
     int poolMultiplier = 1;
     int computeBitBindings = 1;
     int storageImageCount = 1;
+    VkDescriptorType storageDescriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
 };
 
 struct alignas(16) UIPushConstants {
@@ -61,17 +71,49 @@ struct alignas(16) UniformBufferObject {
     float padding;
 };
 
+// Per-light shadow filter, stored in PointLight::shadowData.z and matched by lighting.frag.
+enum class ShadowFilterMode : uint32_t {
+    Hard = 0,      // one hardware depth-compare fetch
+    PCF = 1,       // 8-tap Poisson disk of hardware depth-compare fetches
+    Moments = 2,   // one fetch of the prefiltered EVSM cubemap
+    Reference = 3, // 20-tap manual depth comparison
+};
+inline const char* shadowFilterModeName(ShadowFilterMode mode) {
+    switch (mode) {
+        case ShadowFilterMode::Hard: return "hard";
+        case ShadowFilterMode::PCF: return "pcf";
+        case ShadowFilterMode::Moments: return "moments";
+        case ShadowFilterMode::Reference: return "reference";
+    }
+    return "unknown";
+}
+
 struct alignas(16) PointLight {
     glm::vec4 positionRadius; // xyz = position, w = radius
     glm::vec4 colorIntensity; // rgb = color, w = intensity
     glm::mat4 lightViewProj[6]; // Shadow cubemap view-projection matrix
     glm::vec4 shadowParams; // x = bias, y = near, z = far, w = strength
-    glm::uvec4 shadowData; // x = shadow map index, y = castsShadow flag, others reserved
+    glm::uvec4 shadowData; // x = shadow map index, y = castsShadow flag, z = ShadowFilterMode, w reserved
 };
 
+// Storage buffer layout; only the first counts.x lights are uploaded each frame.
 struct alignas(16) LightsBuffer {
-    PointLight lights[kMaxPointLights];
     glm::uvec4 counts; // x = numLights, other components reserved
+    PointLight lights[kMaxPointLights];
+};
+
+struct alignas(16) LightCullPushConstants {
+    glm::mat4 view;
+    glm::vec4 projParams; // x = tan(fovX / 2), y = tan(fovY / 2), z = near, w = far
+    glm::uvec4 counts;    // x = numLights, y = light index capacity
+};
+
+// Lights light_cull.comp had to leave out of a frame's clusters.
+struct LightCullStats {
+    uint32_t overflowedClusters = 0; // Clusters that hit kMaxLightsPerCluster
+    uint32_t maxClusterLights = 0;   // Lights touching the fullest of them
+    uint32_t droppedIndices = 0;     // Lights cut because the index buffer ran out
+    uint32_t padding = 0;
 };
 
 struct alignas(16) LightingPushConstants {
@@ -87,12 +129,70 @@ struct alignas(16) SSRPushConstants {
     glm::mat4 invProj;
 };
 
+struct alignas(16) SSRTracePushConstants {
+    glm::mat4 view;
+    glm::mat4 proj;
+    glm::mat4 invProj;
+    glm::uvec4 params;     // x = max iterations, y = Hi-Z mip count, z = frame index
+    glm::vec4 thresholds;  // x = roughness cutoff, y = metallic cutoff, z = thickness, w = max distance
+};
+
+struct alignas(16) SSRResolvePushConstants {
+    glm::mat4 reprojection; // current clip space -> previous frame clip space
+    glm::vec4 params;       // x = history weight, y = 1 when the history is valid
+};
+
+struct alignas(16) HiZBuildPushConstants {
+    glm::uvec4 sizes; // xy = source size, zw = destination size
+    glm::uvec4 mode;  // x = 1 when the source is the depth buffer
+};
+
+struct alignas(16) CompositePushConstants {
+    glm::uvec4 debug; // x = 1 to show the Hi-Z pyramid, y = mip level
+};
+
+struct alignas(16) GPUObjectData {
+    glm::mat4 model;
+    glm::vec4 boundsMin; // xyz = local AABB min
+    glm::vec4 boundsMax; // xyz = local AABB max
+    glm::uvec4 drawInfo; // x = batch index, y = batch first command, z = index count, w = first index
+};
+
+struct alignas(16) CullPushConstants {
+    glm::vec4 frustumPlanes[6]; // xyz = normal, w = distance
+    glm::mat4 viewProj;
+    glm::vec4 hiZSize; // xy = level 0 size, z = mip count
+    glm::uvec4 counts; // x = object count, y = compact output flag, z = culling phase, w = batch count
+};
+
+struct alignas(16) IndirectGeometryPushConstants {
+    glm::mat4 view;
+    glm::mat4 proj;
+    glm::vec4 cameraPos;
+};
+
 struct alignas(16) ShadowMapPushConstants {
     glm::mat4 model;
     glm::mat4 lightViewProj;
     glm::vec4 lightPosFar; // xyz = light position, w = far plane
 };
 
+// EVSM warp exponents; must match lighting.frag.
+constexpr float kShadowMomentPositiveExponent = 40.0f;
+constexpr float kShadowMomentNegativeExponent = 5.0f;
+
+struct alignas(16) ShadowMomentsPushConstants {
+    glm::uvec4 size;      // x = moment face size, y = depth face size
+    glm::vec4 exponents;  // x = positive warp exponent, y = negative warp exponent
+};
+
+struct alignas(16) ShadowMultiviewPushConstants {
+    glm::mat4 model;
+    glm::vec4 lightPosFar; // xyz = light position, w = far plane
+    glm::vec4 clipParams;  // x = near plane, y = far plane
+    glm::uvec4 faceMask;   // x = bit per cube face the caster overlaps
+};
+
 class ShaderManager {
 private:
     std::unordered_map<std::string, std::variant<Shader, ComputeShader>> shaders;
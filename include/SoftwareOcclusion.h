@@ -0,0 +1,53 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <Frustrum.h>
+
+class Model;
+
+// Low-resolution CPU depth buffer for occlusion culling. A handful of large occluder meshes
+// (walls, proxies) are rasterized into it each frame, then candidate bounds are tested against
+// it before any draw is recorded. Needs no GPU, so it also runs in the headless benchmark.
+class SoftwareOcclusionBuffer {
+public:
+    static constexpr uint32_t kWidth = 256;
+    static constexpr uint32_t kHeight = 128;
+    static constexpr uint32_t kBandHeight = 8; // Rows per worker task
+
+    SoftwareOcclusionBuffer();
+
+    // Starts a new frame: drops last frame's occluders and clears the depth to the far plane.
+    void beginFrame(const glm::mat4& viewProjection);
+    // Transforms and sets up the triangles of an occluder; call between beginFrame and rasterize.
+    void addOccluder(const Model& model, const glm::mat4& worldTransform);
+    // Rasterizes every added triangle, one horizontal band of the buffer per worker thread.
+    void rasterize();
+    // Conservative test: false only when the whole box lies behind the rasterized occluders.
+    bool isVisible(const AABB& worldBounds) const;
+
+    uint32_t getTriangleCount() const { return static_cast<uint32_t>(triangles.size()); }
+    const std::vector<float>& getDepth() const { return depth; }
+
+    // Rasterizes the shipped walls mesh from several viewpoints, tests a grid of crate-sized
+    // boxes against it and prints the timings. Loads the models without a Vulkan device.
+    static int runBenchmark();
+
+private:
+    struct Triangle {
+        // Edge functions a*x + b*y + c, positive inside, evaluated at pixel centres.
+        float edgeA[3];
+        float edgeB[3];
+        float edgeC[3];
+        // Depth plane z = zA*x + zB*y + zC, clamped to the farthest vertex depth.
+        float zA, zB, zC, zMax;
+        int minX, maxX, minY, maxY;
+    };
+
+    void rasterizeBand(uint32_t band);
+
+    glm::mat4 viewProjection{1.0f};
+    std::vector<Triangle> triangles;
+    std::vector<glm::vec4> clipVertices;
+    std::vector<float> depth;
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <MappedFile.h>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// A texture in the form the GPU samples it: every mip level in its final format, back to back,
+// ready to be copied into staging memory as is.
+struct CookedTexture {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<VkDeviceSize> levelSizes;
+    const uint8_t* data = nullptr;
+    bool fromCache = false;
+
+    // Whichever of the two backs data: the mapped cache file, or the output of a cook that
+    // couldn't be read back from disk.
+    MappedFile file;
+    std::vector<uint8_t> storage;
+
+    VkDeviceSize size(uint32_t levelCount) const;
+};
+
+// Turns PNG and HDR sources into cooked textures and caches them on disk, so stb_image, mip
+// generation and block compression run once per source instead of at every launch. Cache files
+// are KTX2-style: a header with the Vulkan format, extent and a content hash of the source, a
+// level index, then the levels. A file whose hash doesn't match the source (or this cooker's
+// settings) is cooked again.
+//
+// LDR textures are classified by file name. Normal maps become BC5 (the shader rebuilds z),
+// roughness and metallic maps BC4, or BC3 when their alpha carries a mask, all UNORM; everything
+// else is colour and becomes sRGB BC1 when opaque and BC3 otherwise. Without block compression
+// support they stay RGBA8, sRGB or UNORM to match. HDR textures are stored as RGBA16F with their
+// mip chain.
+class TextureCooker {
+public:
+    static constexpr uint32_t kVersion = 2;
+
+    TextureCooker(std::filesystem::path cacheDirectory, bool blockCompression);
+
+    // Loads name's cooked texture, cooking sourcePath first when the cache has no current copy.
+    // Safe to call from several threads for different names. False when the source can't be decoded.
+    bool load(const std::string& name, const std::string& sourcePath, CookedTexture& texture) const;
+
+private:
+    enum class Usage : uint32_t { Color, Normal, Scalar };
+
+    static Usage usageOf(const std::string& sourcePath);
+    VkFormat targetFormat(Usage usage, bool opaque) const;
+    bool loadCached(const std::filesystem::path& path, uint64_t sourceHash, CookedTexture& texture) const;
+    bool cook(const std::string& sourcePath, Usage usage, CookedTexture& texture) const;
+    bool write(const std::filesystem::path& path, uint64_t sourceHash, const CookedTexture& texture) const;
+
+    std::filesystem::path cacheDirectory;
+    bool blockCompression;
+    // Set by the first failed write, so an unwritable cache is reported once rather than per texture.
+    mutable std::atomic<bool> reportedWriteFailure = false;
+};
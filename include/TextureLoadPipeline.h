@@ -0,0 +1,60 @@
+#pragma once
+#include <TextureCooker.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Loads textures through a TextureCooker on worker threads and hands them to a single consumer as
+// they finish, so cache reads, decoding and compression overlap with what the consumer does with
+// the results (creating images, staging them). Textures that are finished but not yet taken are
+// capped at memoryBudget bytes: a worker waits for room before it starts on the next texture, so
+// the cap is overshot by at most one texture per worker.
+class TextureLoadPipeline {
+public:
+    static constexpr VkDeviceSize kDefaultMemoryBudget = 256ull * 1024 * 1024;
+
+    struct Job {
+        std::string name;
+        std::string path;
+    };
+    struct Result {
+        std::string name;
+        CookedTexture texture;
+        bool loaded = false;
+        double loadMs = 0.0;  // Cache read or cook, on the worker
+        double readyMs = 0.0; // Since the pipeline started
+    };
+
+    // Starts the workers right away: workerCount of them, or one fewer than the hardware threads for 0.
+    TextureLoadPipeline(const TextureCooker& cooker, std::vector<Job> jobs, VkDeviceSize memoryBudget = kDefaultMemoryBudget, uint32_t workerCount = 0);
+    ~TextureLoadPipeline();
+    TextureLoadPipeline(const TextureLoadPipeline&) = delete;
+    TextureLoadPipeline& operator=(const TextureLoadPipeline&) = delete;
+
+    // Appends every texture finished since the last call to results, waiting for one if there are
+    // none yet. False once every job has been handed out.
+    bool takeFinished(std::vector<Result>& results);
+    uint32_t getWorkerCount() const { return static_cast<uint32_t>(workers.size()); }
+
+private:
+    void work();
+
+    const TextureCooker& cooker;
+    std::vector<Job> jobs;
+    VkDeviceSize memoryBudget;
+    std::chrono::steady_clock::time_point start;
+
+    std::mutex mutex;
+    std::condition_variable resultReady;
+    std::condition_variable roomAvailable;
+    std::vector<Result> finished;
+    VkDeviceSize finishedBytes = 0;
+    size_t nextJob = 0;
+    size_t takenCount = 0;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
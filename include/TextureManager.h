@@ -21,9 +21,13 @@ public:
 
     struct ImageData { unsigned char* pixels; int width; int height; };
     void prepareTextureAtlas();
+    // Brings the texture cache up to date without a window or device, for cooking offline.
+    // Returns the exit code: 1 when a source couldn't be decoded.
+    static int cookTextures();
 
     Image* getTexture(const std::string& name);
     void registerTexture(const std::string& name, const Image& texture);
+    void unregisterTexture(const std::string& name);
     void shutdown();
     static TextureManager* getInstance();
 };
@@ -0,0 +1,118 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <DeviceAllocator.h>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Streams buffer and image contents to the GPU without waiting for it. Data is copied into a
+// persistent staging ring right away, and the copies are batched into one submission per flush():
+// on the transfer-only queue when the device has one (with a queue family ownership transfer to
+// the graphics queue), on the graphics queue otherwise. Everything recorded before a flush() is
+// ordered before any later graphics submission, so the renderer only has to flush before it submits
+// a frame; code that needs the data on the CPU side of the GPU (freeing the source, reporting load
+// times) waits on or registers a callback for the ticket each call returns. Targets are expected to
+// be freshly created: nothing transfers them back from the graphics queue before the copy. Calls
+// are serialized, but they may submit to the graphics queue, so they belong on the render thread.
+class UploadManager {
+public:
+    using Ticket = uint64_t;
+    static constexpr VkDeviceSize kStagingRingSize = 32ull * 1024 * 1024;
+    static constexpr uint32_t kBatchCount = 8;
+
+    void init(VkDevice device, VkPhysicalDevice physicalDevice, DeviceAllocator& allocator,
+              uint32_t graphicsFamily, VkQueue graphicsQueue, uint32_t transferFamily, VkQueue transferQueue);
+    void destroy();
+
+    // The buffer must have been created with TRANSFER_DST usage. It is ready for vertex, index,
+    // uniform and shader reads once the batch executes.
+    Ticket uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize offset = 0);
+    struct ImageUpload {
+        VkImage image = VK_NULL_HANDLE;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        const void* data = nullptr;
+        VkDeviceSize size = 0;
+        uint32_t layerCount = 1;
+        // Sizes of the mip levels stored back to back in data (cooked textures), one per level of
+        // the image. Empty when data holds level 0 only.
+        std::vector<VkDeviceSize> levelSizes;
+    };
+    // Fills mip 0 of every layer from tightly packed layers of size / layerCount bytes each and
+    // leaves the image in SHADER_READ_ONLY_OPTIMAL. The image starts out UNDEFINED.
+    Ticket uploadImage(VkImage image, uint32_t width, uint32_t height, const void* data, VkDeviceSize size, uint32_t layerCount = 1);
+    // uploadImage for a whole load batch: one staging range holds every image, and each side of the
+    // copies gets a single barrier call covering all of them instead of one per image.
+    Ticket uploadImages(const std::vector<ImageUpload>& uploads);
+    // Records work that needs the graphics queue (layout transitions, clears) into the open batch,
+    // after the batch's copies.
+    Ticket recordGraphics(const std::function<void(VkCommandBuffer)>& record);
+
+    // Submits the open batch, if any; returns the last submitted ticket.
+    Ticket flush();
+    // Retires finished batches and runs their callbacks. Called once per frame.
+    void poll();
+    bool isComplete(Ticket ticket) const;
+    void wait(Ticket ticket);
+    // Runs callback from poll() or wait() once ticket's batch has finished, or right away if it has.
+    void onComplete(Ticket ticket, std::function<void()> callback);
+
+    bool hasTransferQueue() const { return transferCommandPool != VK_NULL_HANDLE; }
+
+private:
+    struct Batch {
+        VkCommandBuffer transferCommands = VK_NULL_HANDLE; // Only with a separate transfer queue
+        VkCommandBuffer graphicsCommands = VK_NULL_HANDLE;
+        VkSemaphore copiesDone = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        Ticket ticket = 0;
+        VkDeviceSize ringBytes = 0;
+        uint32_t copyCount = 0;
+        std::vector<std::pair<VkBuffer, DeviceAllocation>> overflowBuffers;
+        std::vector<std::function<void()>> callbacks;
+        bool open = false;
+        bool submitted = false;
+    };
+    struct Staging {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        void* mapped = nullptr;
+        VkDeviceSize ringBytes = 0;
+        DeviceAllocation overflow{};
+    };
+
+    Batch& openBatch();
+    Staging reserveStaging(VkDeviceSize size);
+    void attachStaging(Batch& batch, Staging& staging);
+    void submitLocked();
+    void retireLocked(Batch& batch);
+    void waitLocked(Ticket ticket);
+    void runCallbacks();
+    VkCommandBuffer copyCommands(Batch& batch) const { return batch.transferCommands ? batch.transferCommands : batch.graphicsCommands; }
+
+    VkDevice device = VK_NULL_HANDLE;
+    DeviceAllocator* allocator = nullptr;
+    uint32_t graphicsFamily = 0;
+    uint32_t transferFamily = 0;
+    VkQueue graphicsQueue = VK_NULL_HANDLE;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+    VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+    std::array<Batch, kBatchCount> batches{};
+    Ticket submittedTicket = 0;
+    Ticket completedTicket = 0;
+
+    // Ring space is handed out in submission order and returned as batches retire, so the used
+    // range always runs from head - used to head, wrapping around the end.
+    VkBuffer ringBuffer = VK_NULL_HANDLE;
+    DeviceAllocation ringMemory{};
+    VkDeviceSize ringHead = 0;
+    VkDeviceSize ringUsed = 0;
+    VkDeviceSize copyAlignment = 16;
+
+    std::vector<std::function<void()>> readyCallbacks;
+    mutable std::mutex mutex;
+};
@@ -4,10 +4,33 @@ layout(location = 0) in vec2 texCoord;
 
 layout(binding = 0) uniform sampler2D lightingTex;
 layout(binding = 1) uniform sampler2D ssrTex;
+layout(binding = 2) uniform sampler2D hiZTex;
+
+layout(push_constant) uniform PushConstants {
+    uvec4 debug; // x = 1 to show the Hi-Z pyramid, y = mip level
+} pc;
+
+const float NEAR_PLANE = 0.1;
+const float FAR_PLANE = 200.0;
+
+// Log-scaled view distance in [0, 1] for a [0, 1] depth buffer value.
+float depthToGray(float depth) {
+    float viewDepth = NEAR_PLANE * FAR_PLANE / (FAR_PLANE - depth * (FAR_PLANE - NEAR_PLANE));
+    return clamp(log(viewDepth / NEAR_PLANE) / log(FAR_PLANE / NEAR_PLANE), 0.0, 1.0);
+}
 
 layout(location = 0) out vec4 FragColor;
 
 void main() {
+    if (pc.debug.x == 1u) {
+        vec2 minMax = textureLod(hiZTex, texCoord, float(pc.debug.y)).rg;
+        float nearest = depthToGray(minMax.x);
+        float farthest = depthToGray(minMax.y);
+        // Grey shows the nearest depth; red marks texels whose depth range is wide.
+        vec3 color = mix(vec3(nearest), vec3(1.0, 0.0, 0.0), clamp((farthest - nearest) * 4.0, 0.0, 1.0) * 0.5);
+        FragColor = vec4(color, 1.0);
+        return;
+    }
     vec4 lighting = texture(lightingTex, texCoord);
     vec4 ssr = texture(ssrTex, texCoord);
     
@@ -1,4 +1,5 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
 
 layout(location = 0) in vec3 FragPos;
 layout(location = 1) in vec3 normalVec;
@@ -14,8 +15,12 @@ layout(location = 0) out vec4 outAlbedo;
 layout(location = 1) out vec4 outNormal;
 layout(location = 2) out vec4 outMaterial;
 
+#include "octahedral.glsl"
+
 vec3 getNormalFromMap() {
-    vec3 tangentNormal = texture(normalMap, texCoord).xyz * 2.0 - 1.0;
+    // Normal maps are cooked to two channels (BC5); z is rebuilt from the unit length.
+    vec2 tangentXY = texture(normalMap, texCoord).xy * 2.0 - 1.0;
+    vec3 tangentNormal = vec3(tangentXY, sqrt(max(1.0 - dot(tangentXY, tangentXY), 0.0)));
     return normalize(TBN * tangentNormal);
 }
 
@@ -33,6 +38,7 @@ void main() {
     vec3 normal = getNormalFromMap();
     
     outAlbedo = vec4(albedo, alpha);
-    outNormal = vec4(normal * 0.5 + 0.5, 1.0);
+    // The targets keep only the channels they have; alpha still feeds the blend state.
+    outNormal = vec4(encodeOctahedral(normal), 0.0, 1.0);
     outMaterial = vec4(metallic, roughness, 0.0, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,45 @@
+#version 450
+
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in vec3 aTangent;
+
+struct ObjectData {
+    mat4 model;
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uvec4 drawInfo;
+};
+
+layout(std430, binding = 0) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+};
+
+layout(push_constant) uniform PushConstants {
+    mat4 view;
+    mat4 proj;
+    vec4 cameraPos;
+} pc;
+
+layout(location = 0) out vec3 FragPos;
+layout(location = 1) out vec3 normalVec;
+layout(location = 2) out vec2 texCoord;
+layout(location = 3) out mat3 TBN;
+
+void main() {
+    mat4 model = objects[gl_InstanceIndex].model;
+    vec4 worldPos = model * vec4(aPos, 1.0);
+    FragPos = worldPos.xyz;
+    
+    vec3 T = normalize(mat3(model) * aTangent);
+    vec3 N = normalize(mat3(model) * aNormal);
+    T = normalize(T - dot(T, N) * N);
+    vec3 B = cross(N, T);
+    TBN = mat3(T, B, N);
+    
+    normalVec = N;
+    texCoord = aTexCoord;
+    
+    gl_Position = pc.proj * pc.view * worldPos;
+}
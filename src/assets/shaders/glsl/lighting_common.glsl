@@ -0,0 +1,291 @@
+// Clustered deferred lighting shared by lighting.frag (G-buffer sampled after its own render pass)
+// and lighting_subpass.frag (G-buffer read as input attachments). The including shader declares
+// bindings 3-6 and loadAlbedo/loadNormal/loadMaterial/loadDepth for the current pixel.
+struct PointLight {
+    vec4 positionRadius;
+    vec4 colorIntensity;
+    mat4 lightViewProj[6];
+    vec4 shadowParams;
+    uvec4 shadowData;
+};
+
+layout(std430, binding = 0) readonly buffer LightsBuffer {
+    uvec4 lightCounts;
+    PointLight lights[];
+} lightsSSBO;
+
+// Written by light_cull.comp: x = offset into lightIndices, y = light count
+layout(std430, binding = 1) readonly buffer ClusterBuffer {
+    uvec2 clusters[];
+};
+
+layout(std430, binding = 2) readonly buffer LightIndexBuffer {
+    uint lightIndexCount;
+    uint lightIndices[];
+};
+
+layout(binding = 7) uniform samplerCube shadowMaps[64];
+// Same depth cubemaps as shadowMaps, bound with a compareEnable sampler.
+layout(binding = 8) uniform samplerCubeShadow shadowCompareMaps[64];
+// Prefiltered EVSM cubemaps written by shadow_moments.comp; only valid for SHADOW_FILTER_MOMENTS lights.
+layout(binding = 9) uniform samplerCube shadowMomentMaps[64];
+
+const uint CLUSTER_GRID_X = 16u;
+const uint CLUSTER_GRID_Y = 9u;
+const uint CLUSTER_GRID_Z = 24u;
+const float CLUSTER_NEAR = 0.1;
+const float CLUSTER_FAR = 200.0;
+
+const float PI = 3.14159265358979323846;
+
+layout(push_constant) uniform PushConstants {
+    mat4 invView;
+    mat4 invProj;
+    vec3 cameraPos;
+} pc;
+
+layout(location = 0) out vec4 FragColor;
+
+vec3 reconstructViewPosition(vec2 uv, float depth) {
+    vec4 clipSpace = vec4(uv * 2.0 - 1.0, depth, 1.0);
+    vec4 viewSpace = pc.invProj * clipSpace;
+    return viewSpace.xyz / viewSpace.w;
+}
+uint clusterIndex(vec2 uv, float viewDepth) {
+    uint x = min(uint(uv.x * float(CLUSTER_GRID_X)), CLUSTER_GRID_X - 1u);
+    uint y = min(uint(uv.y * float(CLUSTER_GRID_Y)), CLUSTER_GRID_Y - 1u);
+    float slice = log(max(viewDepth, CLUSTER_NEAR) / CLUSTER_NEAR) / log(CLUSTER_FAR / CLUSTER_NEAR) * float(CLUSTER_GRID_Z);
+    uint z = min(uint(max(slice, 0.0)), CLUSTER_GRID_Z - 1u);
+    return x + y * CLUSTER_GRID_X + z * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+}
+vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness) {
+    cosTheta = clamp(cosTheta, 0.0, 1.0);
+    return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
+}
+float DistributionGGX(vec3 N, vec3 H, float roughness){
+    float a = roughness * roughness;
+    float a2 = a * a;
+    float NdotH = max(dot(N, H), 0.0);
+    float NdotH2 = NdotH * NdotH;
+    float denom = NdotH2 * (a2 - 1.0) + 1.0;
+    denom = PI * denom * denom;
+    return a2 / max(denom, 0.0001);
+}
+float GeometrySchlickGGX(float NdotV, float roughness){
+    float r = roughness + 1.0;
+    float k = (r * r) / 8.0;
+    float denom = NdotV * (1.0 - k) + k;
+    return NdotV / max(denom, 0.0001);
+}
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness){
+    float NdotL = max(dot(N, L), 0.0);
+    float NdotV = max(dot(N, V), 0.0);
+    float ggx1 = GeometrySchlickGGX(NdotL, roughness);
+    float ggx2 = GeometrySchlickGGX(NdotV, roughness);
+    return ggx1 * ggx2;
+}
+#include "octahedral.glsl"
+
+float specularAntiAliasing(vec3 normal, float roughness){
+    vec3 dndu = dFdx(normal);
+    vec3 dndv = dFdy(normal);
+    float variance = dot(dndu, dndu) + dot(dndv, dndv);
+    float kernelRoughness = min(2.0 * variance, 1.0);
+    return clamp(roughness + kernelRoughness, 0.0, 1.0);
+}
+
+const uint INVALID_SHADOW_INDEX = 0xffffffffu;
+
+const uint SHADOW_FILTER_HARD = 0u;
+const uint SHADOW_FILTER_PCF = 1u;
+const uint SHADOW_FILTER_MOMENTS = 2u;
+const uint SHADOW_FILTER_REFERENCE = 3u;
+
+const float MOMENT_POSITIVE_EXPONENT = 40.0;
+const float MOMENT_NEGATIVE_EXPONENT = 5.0;
+const float MOMENT_LIGHT_BLEEDING = 0.2;
+
+const vec3 sampleOffsetDirections[20] = vec3[](
+    vec3( 1,  1,  1), vec3( 1, -1,  1), vec3(-1, -1,  1), vec3(-1,  1,  1),
+    vec3( 1,  1, -1), vec3( 1, -1, -1), vec3(-1, -1, -1), vec3(-1,  1, -1),
+    vec3( 1,  1,  0), vec3( 1, -1,  0), vec3(-1, -1,  0), vec3(-1,  1,  0),
+    vec3( 1,  0,  1), vec3(-1,  0,  1), vec3( 1,  0, -1), vec3(-1,  0, -1),
+    vec3( 0,  1,  1), vec3( 0, -1,  1), vec3( 0, -1, -1), vec3( 0,  1, -1)
+);
+
+const vec2 poissonDisk[8] = vec2[](
+    vec2(-0.613392,  0.617481), vec2( 0.170019, -0.040254),
+    vec2(-0.299417,  0.791925), vec2( 0.645680,  0.493210),
+    vec2(-0.651784,  0.717887), vec2( 0.421003,  0.027070),
+    vec2(-0.817194, -0.271096), vec2( 0.977050, -0.108615)
+);
+
+float chebyshevUpperBound(vec2 moments, float mean, float minVariance) {
+    if (mean <= moments.x) {
+        return 1.0;
+    }
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = mean - moments.x;
+    float pMax = variance / (variance + d * d);
+    return clamp((pMax - MOMENT_LIGHT_BLEEDING) / (1.0 - MOMENT_LIGHT_BLEEDING), 0.0, 1.0);
+}
+
+float momentShadow(uint shadowIndex, vec3 sampleDir, float receiverDepth) {
+    vec4 moments = texture(shadowMomentMaps[shadowIndex], sampleDir);
+    float depth = receiverDepth * 2.0 - 1.0;
+    float positive = exp(MOMENT_POSITIVE_EXPONENT * depth);
+    float negative = -exp(-MOMENT_NEGATIVE_EXPONENT * depth);
+    float positiveMinVariance = 0.0001 * MOMENT_POSITIVE_EXPONENT * positive;
+    float negativeMinVariance = 0.0001 * MOMENT_NEGATIVE_EXPONENT * negative;
+    float positiveLit = chebyshevUpperBound(moments.xy, positive, positiveMinVariance * positiveMinVariance);
+    float negativeLit = chebyshevUpperBound(moments.zw, negative, negativeMinVariance * negativeMinVariance);
+    return min(positiveLit, negativeLit);
+}
+
+float pcfShadow(uint shadowIndex, vec3 sampleDir, float receiverDepth, float diskRadius) {
+    vec3 up = abs(sampleDir.y) < 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, sampleDir));
+    vec3 bitangent = cross(sampleDir, tangent);
+    float lit = 0.0;
+    for (uint i = 0u; i < 8u; i++) {
+        vec3 sampleVec = sampleDir + (tangent * poissonDisk[i].x + bitangent * poissonDisk[i].y) * diskRadius;
+        lit += texture(shadowCompareMaps[shadowIndex], vec4(normalize(sampleVec), receiverDepth));
+    }
+    return lit / 8.0;
+}
+
+float referenceShadow(uint shadowIndex, vec3 sampleDir, float currentDistance, float bias, float diskRadius, float farPlane) {
+    if (texture(shadowMaps[shadowIndex], sampleDir).r >= 0.9999) {
+        return 1.0;
+    }
+    float shadow = 0.0;
+    for (uint i = 0u; i < 20u; i++) {
+        vec3 sampleVec = normalize(sampleDir + sampleOffsetDirections[i] * diskRadius);
+        float closestDistance = texture(shadowMaps[shadowIndex], sampleVec).r * farPlane;
+        if (currentDistance > closestDistance + bias) {
+            shadow += 1.0;
+        }
+    }
+    return 1.0 - shadow / 20.0;
+}
+
+float computePointShadow(PointLight light, vec3 fragPos, vec3 geomNormal, vec3 lightDir) {
+    if (light.shadowData.y == 0u) {
+        return 1.0;
+    }
+    uint shadowIndex = light.shadowData.x;
+    if (shadowIndex == INVALID_SHADOW_INDEX || shadowIndex >= 64u) {
+        return 1.0;
+    }
+
+    vec3 lightPos = light.positionRadius.xyz;
+    vec3 toFrag = fragPos - lightPos;
+    float currentDistance = length(toFrag);
+    if (currentDistance <= 0.0001) {
+        return 1.0;
+    }
+
+    float farPlane = light.shadowParams.z;
+    if (currentDistance >= farPlane) {
+        return 1.0;
+    }
+
+    vec3 sampleDir = normalize(toFrag);
+    float NoLGeom = max(dot(geomNormal, lightDir), 0.0);
+    float baseBias = light.shadowParams.x;
+    float bias = baseBias + baseBias * 5.0 * (1.0 - NoLGeom);
+    float receiverDepth = clamp((currentDistance - bias) / farPlane, 0.0, 1.0);
+    float viewDistance = length(pc.cameraPos - fragPos);
+    float diskRadius = (1.0 + (viewDistance / farPlane)) / 25.0;
+
+    float lit;
+    uint filterMode = light.shadowData.z;
+    if (filterMode == SHADOW_FILTER_HARD) {
+        lit = texture(shadowCompareMaps[shadowIndex], vec4(sampleDir, receiverDepth));
+    } else if (filterMode == SHADOW_FILTER_PCF) {
+        lit = pcfShadow(shadowIndex, sampleDir, receiverDepth, diskRadius);
+    } else if (filterMode == SHADOW_FILTER_MOMENTS) {
+        lit = momentShadow(shadowIndex, sampleDir, receiverDepth);
+    } else {
+        lit = referenceShadow(shadowIndex, sampleDir, currentDistance, bias, diskRadius, farPlane);
+    }
+    float strength = clamp(light.shadowParams.w, 0.0, 1.0);
+    return 1.0 - (1.0 - lit) * strength;
+}
+
+void main() {
+    vec4 albedoSample = loadAlbedo();
+    vec3 albedo = albedoSample.rgb;
+    float alpha = albedoSample.a;
+    vec3 N = decodeOctahedral(loadNormal());
+    vec2 material = loadMaterial();
+    float metallic = material.r;
+    float baseRoughness = material.g;
+
+    float depth = loadDepth();
+    if (depth >= 0.9999) {
+        FragColor = vec4(albedo, 1.0);
+        return;
+    }
+    
+    vec3 viewPos = reconstructViewPosition(texCoord, depth);
+    vec3 fragPos = (pc.invView * vec4(viewPos, 1.0)).xyz;
+    vec3 V = normalize(pc.cameraPos - fragPos);
+    vec3 geomNormal = cross(dFdx(fragPos), dFdy(fragPos));
+    if (dot(geomNormal, geomNormal) > 1e-10) {
+        geomNormal = normalize(geomNormal);
+    } else {
+        geomNormal = N;
+    }
+    if (dot(geomNormal, N) < 0.0) {
+        geomNormal = -geomNormal;
+    }
+    
+    float roughness = specularAntiAliasing(N, baseRoughness);
+    roughness = clamp(roughness, 0.05, 1.0);
+    float dNdX = length(dFdx(N)),  dNdY = length(dFdy(N));
+    float dVdX = length(dFdx(V)),  dVdY = length(dFdy(V));
+    float sigma = max(max(dNdX, dNdY), max(dVdX, dVdY));
+    roughness = max(roughness, sigma);
+
+    uvec2 cluster = clusters[clusterIndex(texCoord, -viewPos.z)];
+
+    vec3 totalLo = vec3(0.0);
+    for (uint i = 0u; i < cluster.y; i++) {
+        PointLight light = lightsSSBO.lights[lightIndices[cluster.x + i]];
+        vec3 lightPos = light.positionRadius.xyz;
+        float radius = light.positionRadius.w;
+        vec3 lightColor = light.colorIntensity.rgb;
+        float intensity = light.colorIntensity.w;
+
+        vec3 L = normalize(lightPos - fragPos);
+        vec3 H = normalize(V + L);
+        float distance = length(lightPos - fragPos);
+        float attenuation = clamp(1.0 - (distance * distance) / (radius * radius), 0.0, 1.0);
+        vec3 radiance = lightColor * intensity * attenuation;
+
+        float NdotL = max(dot(N, L), 0.0);
+        float NdotV = max(dot(N, V), 0.0);
+
+        vec3 F0 = mix(vec3(0.04), albedo, metallic);
+        vec3 F = fresnelSchlickRoughness(max(dot(V, H), 0.0), F0, roughness);
+        float D = DistributionGGX(N, H, roughness);
+        float G = GeometrySmith(N, V, L, roughness);
+
+        vec3 numerator = F * D * G;
+        float denominator = 4.0 * max(NdotL * NdotV, 0.001);
+        vec3 specular = numerator / denominator;
+
+        vec3 kS = F;
+        vec3 kD = (1.0 - kS) * (1.0 - metallic);
+        vec4 diffuse = vec4(kD * albedo, alpha);
+
+        float shadowVisibility = computePointShadow(light, fragPos, geomNormal, L);
+
+        vec3 lightingContribution = (diffuse.rgb + specular) * radiance * NdotL;
+        totalLo += lightingContribution * shadowVisibility;
+    }
+    float alphaOut = max(max(totalLo.r, totalLo.g), max(totalLo.b, alpha));
+
+    FragColor = vec4(totalLo, alphaOut);
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Lighting subpass of the single render pass deferred path: the G-buffer written by the geometry
+// subpass is read at this pixel straight from the attachments.
+layout(location = 0) in vec2 texCoord;
+
+layout(input_attachment_index = 0, binding = 3) uniform subpassInput gBufferAlbedo;
+layout(input_attachment_index = 1, binding = 4) uniform subpassInput gBufferNormal;
+layout(input_attachment_index = 2, binding = 5) uniform subpassInput gBufferMaterial;
+layout(input_attachment_index = 3, binding = 6) uniform subpassInput gBufferDepth;
+
+vec4 loadAlbedo() { return subpassLoad(gBufferAlbedo); }
+vec2 loadNormal() { return subpassLoad(gBufferNormal).rg; }
+vec2 loadMaterial() { return subpassLoad(gBufferMaterial).rg; }
+float loadDepth() { return subpassLoad(gBufferDepth).r; }
+
+#include "lighting_common.glsl"
@@ -0,0 +1,8 @@
+#version 450
+
+layout(location = 0) in vec3 vLightVector;
+layout(location = 1) in float vLinearDepth;
+
+void main() {
+    gl_FragDepth = vLinearDepth;
+}
@@ -0,0 +1,64 @@
+#version 450
+#extension GL_EXT_multiview : require
+
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in vec3 aTangent;
+
+layout(push_constant) uniform ShadowMultiviewPushConstants {
+    mat4 model;
+    vec4 lightPosFar;
+    vec4 clipParams;
+    uvec4 faceMask;
+} pc;
+
+layout(location = 0) out vec3 vLightVector;
+layout(location = 1) out float vLinearDepth;
+
+// Cube face orientations, matching the per-face lookAt matrices built on the CPU.
+const vec3 kFaceForward[6] = vec3[](
+    vec3( 1.0,  0.0,  0.0),
+    vec3(-1.0,  0.0,  0.0),
+    vec3( 0.0,  1.0,  0.0),
+    vec3( 0.0, -1.0,  0.0),
+    vec3( 0.0,  0.0,  1.0),
+    vec3( 0.0,  0.0, -1.0)
+);
+const vec3 kFaceUp[6] = vec3[](
+    vec3(0.0, -1.0,  0.0),
+    vec3(0.0, -1.0,  0.0),
+    vec3(0.0,  0.0,  1.0),
+    vec3(0.0,  0.0, -1.0),
+    vec3(0.0, -1.0,  0.0),
+    vec3(0.0, -1.0,  0.0)
+);
+
+void main() {
+    vec4 worldPos = pc.model * vec4(aPos, 1.0);
+    vLightVector = worldPos.xyz - pc.lightPosFar.xyz;
+
+    float distance = length(vLightVector);
+    vLinearDepth = clamp(distance / pc.lightPosFar.w, 0.0, 1.0);
+
+    uint face = gl_ViewIndex;
+    if (((pc.faceMask.x >> face) & 1u) == 0u) {
+        // Caster does not touch this face: push the vertex outside the clip volume.
+        gl_Position = vec4(0.0, 0.0, -1.0, 1.0);
+        return;
+    }
+
+    vec3 f = kFaceForward[face];
+    vec3 s = normalize(cross(f, kFaceUp[face]));
+    vec3 u = cross(s, f);
+    vec3 viewPos = vec3(dot(s, vLightVector), dot(u, vLightVector), -dot(f, vLightVector));
+
+    float nearPlane = pc.clipParams.x;
+    float farPlane = pc.clipParams.y;
+    gl_Position = vec4(
+        viewPos.x,
+        viewPos.y,
+        viewPos.z * farPlane / (nearPlane - farPlane) - (farPlane * nearPlane) / (farPlane - nearPlane),
+        -viewPos.z
+    );
+}
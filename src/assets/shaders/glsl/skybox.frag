@@ -1,4 +1,5 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
 
 layout(location = 0) in vec3 vDir;
 layout(binding = 1) uniform samplerCube skyboxTex;
@@ -12,6 +13,8 @@ const float kContrast = 5.0;
 const float kGamma = 2.2;
 const vec3 kLuminanceWeights = vec3(0.2126, 0.7152, 0.0722);
 
+#include "octahedral.glsl"
+
 vec3 toneMapReinhard(vec3 hdrColor) {
     float luminance = dot(hdrColor, kLuminanceWeights);
     if (luminance <= 1e-6) {
@@ -31,7 +34,7 @@ void main() {
     
     outAlbedo = vec4(mapped, 1.0);
     vec3 skyNormal = normalize(dir);
-    outNormal = vec4(skyNormal * 0.5 + 0.5, 1.0);
+    outNormal = vec4(encodeOctahedral(skyNormal), 0.0, 1.0);
     outMaterial = vec4(0.0, 0.1, 0.0, 1.0);
 }
 
@@ -0,0 +1,192 @@
+#include <Benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace {
+    // Nearest-rank percentile of sorted samples.
+    double percentile(const std::vector<double>& sorted, double fraction) {
+        if (sorted.empty()) {
+            return 0.0;
+        }
+        const size_t rank = static_cast<size_t>(std::ceil(fraction * static_cast<double>(sorted.size())));
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+
+    // Reads "key": <number> from the object named section in one of our own reports. Not a general
+    // JSON parser; it only has to understand what toJSON() writes.
+    bool findNumber(const std::string& json, const std::string& section, const std::string& key, double& value) {
+        const size_t sectionStart = json.find("\"" + section + "\"");
+        if (sectionStart == std::string::npos) {
+            return false;
+        }
+        const size_t sectionEnd = json.find('}', sectionStart);
+        const size_t keyStart = json.find("\"" + key + "\"", sectionStart);
+        if (keyStart == std::string::npos || keyStart > sectionEnd) {
+            return false;
+        }
+        const size_t colon = json.find(':', keyStart);
+        if (colon == std::string::npos) {
+            return false;
+        }
+        const char* begin = json.c_str() + colon + 1;
+        char* end = nullptr;
+        value = std::strtod(begin, &end);
+        return end != begin;
+    }
+
+    std::string escapeJSON(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    std::string formatSummary(const FrameTimeSummary& summary) {
+        char buffer[192];
+        std::snprintf(buffer, sizeof(buffer), "{\"samples\": %u, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+            summary.samples, summary.mean, summary.p50, summary.p95, summary.p99, summary.max);
+        return buffer;
+    }
+}
+
+bool CameraPath::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    keyframes.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        const size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        std::istringstream stream(line);
+        Keyframe keyframe;
+        if (!(stream >> keyframe.time >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z
+                     >> keyframe.rotation.x >> keyframe.rotation.y >> keyframe.rotation.z)) {
+            keyframes.clear();
+            return false;
+        }
+        addKeyframe(keyframe);
+    }
+    return !keyframes.empty();
+}
+
+void CameraPath::addKeyframe(const Keyframe& keyframe) {
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), keyframe.time, [](float time, const Keyframe& other) { return time < other.time; });
+    keyframes.insert(it, keyframe);
+}
+
+CameraPath::Keyframe CameraPath::sample(float time) const {
+    if (keyframes.empty()) {
+        return {};
+    }
+    if (time <= keyframes.front().time) {
+        return keyframes.front();
+    }
+    if (time >= keyframes.back().time) {
+        return keyframes.back();
+    }
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time, [](float t, const Keyframe& other) { return t < other.time; });
+    const Keyframe& a = *(next - 1);
+    const Keyframe& b = *next;
+    const float t = (time - a.time) / std::max(b.time - a.time, 1e-6f);
+    return {
+        .time = time,
+        .position = glm::mix(a.position, b.position, t),
+        .rotation = glm::mix(a.rotation, b.rotation, t),
+    };
+}
+
+FrameTimeSummary BenchmarkReport::summarize(std::vector<double> samples) {
+    FrameTimeSummary summary;
+    if (samples.empty()) {
+        return summary;
+    }
+    std::sort(samples.begin(), samples.end());
+    double total = 0.0;
+    for (double sample : samples) {
+        total += sample;
+    }
+    summary.samples = static_cast<uint32_t>(samples.size());
+    summary.mean = total / static_cast<double>(samples.size());
+    summary.p50 = percentile(samples, 0.50);
+    summary.p95 = percentile(samples, 0.95);
+    summary.p99 = percentile(samples, 0.99);
+    summary.max = samples.back();
+    return summary;
+}
+
+std::string BenchmarkReport::toJSON(const BenchmarkOptions& options, const std::string& deviceName, bool& passed) const {
+    const FrameTimeSummary cpu = summarize(cpuMs);
+    const FrameTimeSummary gpu = summarize(gpuMs);
+    std::ostringstream json;
+    json << "{\n";
+    json << "  \"scene\": \"" << escapeJSON(options.scene) << "\",\n";
+    json << "  \"device\": \"" << escapeJSON(deviceName) << "\",\n";
+    json << "  \"width\": " << options.width << ",\n";
+    json << "  \"height\": " << options.height << ",\n";
+    json << "  \"frames\": " << options.frames << ",\n";
+    json << "  \"camera_path\": \"" << escapeJSON(options.cameraPath) << "\",\n";
+    json << "  \"texture_mipmaps\": " << (options.textureMipmaps ? "true" : "false") << ",\n";
+    json << "  \"cpu_ms\": " << formatSummary(cpu) << ",\n";
+    json << "  \"gpu_ms\": " << formatSummary(gpu);
+    if (!passMs.empty()) {
+        json << ",\n  \"pass_gpu_ms\": {";
+        bool firstPass = true;
+        for (const auto& [pass, samples] : passMs) {
+            json << (firstPass ? "\n" : ",\n") << "    \"" << escapeJSON(pass) << "\": " << formatSummary(summarize(samples));
+            firstPass = false;
+        }
+        json << "\n  }";
+    }
+
+    passed = true;
+    if (!options.baselinePath.empty()) {
+        std::ifstream file(options.baselinePath);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        const std::string baseline = contents.str();
+        json << ",\n  \"baseline\": {\"path\": \"" << escapeJSON(options.baselinePath) << "\", \"tolerance\": " << options.tolerance;
+        if (baseline.empty()) {
+            json << ", \"error\": \"unreadable\"}";
+            passed = false;
+        } else {
+            std::string regressions;
+            const std::pair<const char*, const FrameTimeSummary*> sections[] = {{"cpu_ms", &cpu}, {"gpu_ms", &gpu}};
+            for (const auto& [section, summary] : sections) {
+                const std::pair<const char*, double> values[] = {{"p50", summary->p50}, {"p95", summary->p95}, {"p99", summary->p99}};
+                json << ", \"" << section << "_ratio\": {";
+                bool firstValue = true;
+                for (const auto& [key, current] : values) {
+                    double reference = 0.0;
+                    if (!findNumber(baseline, section, key, reference) || reference <= 0.0 || summary->samples == 0) {
+                        continue;
+                    }
+                    const double ratio = current / reference;
+                    char buffer[64];
+                    std::snprintf(buffer, sizeof(buffer), "%s\"%s\": %.4f", firstValue ? "" : ", ", key, ratio);
+                    json << buffer;
+                    firstValue = false;
+                    if (ratio > 1.0 + options.tolerance) {
+                        regressions += std::string(regressions.empty() ? "" : ", ") + "\"" + section + "." + key + "\"";
+                        passed = false;
+                    }
+                }
+                json << "}";
+            }
+            json << ", \"regressions\": [" << regressions << "]}";
+        }
+    }
+    json << "\n}\n";
+    return json.str();
+}
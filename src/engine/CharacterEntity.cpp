@@ -3,9 +3,11 @@
 #include <cmath>
 #include <Entity.h>
 #include <Collider.h>
+#include <CpuProfiler.h>
 #include <glm/gtc/matrix_transform.hpp>
 
 void CharacterEntity::update(float deltaTime) {
+    CPU_PROFILE_ZONE("CharacterEntity::update");
     // Clamp deltaTime to avoid giant steps (e.g., when resizing window)
     const float MAX_DELTA_TIME = 0.05f; // 50 ms
     deltaTime = std::min(deltaTime, MAX_DELTA_TIME);
@@ -189,6 +191,7 @@ void CharacterEntity::rotate(const glm::vec3& delta) {
 }
 
 collision CharacterEntity::willCollide(const glm::vec3& deltaPos, const glm::vec3& deltaRot) {
+    CPU_PROFILE_ZONE("CharacterEntity::willCollide");
     OBBCollider* myBox = nullptr;
     for (auto& child : this->getChildren()) {
         myBox = dynamic_cast<OBBCollider*>(child);
@@ -0,0 +1,106 @@
+#include <CpuProfiler.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> CpuProfiler::enabled{false};
+
+namespace {
+    struct Event {
+        std::atomic<const char*> name{nullptr};
+        std::atomic<uint64_t> start{0};
+        std::atomic<uint64_t> end{0};
+    };
+    // Kept after its thread exits so the trace still shows what it did.
+    struct ThreadBuffer {
+        uint32_t id = 0;
+        std::string name; // Guarded by registryMutex
+        std::unique_ptr<Event[]> events{new Event[CpuProfiler::kEventsPerThread]};
+        std::atomic<uint64_t> head{0}; // Events ever written; only the owning thread stores it
+    };
+
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> registry;
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    ThreadBuffer& threadBuffer() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            registry.push_back(std::make_unique<ThreadBuffer>());
+            buffer = registry.back().get();
+            buffer->id = static_cast<uint32_t>(registry.size());
+            buffer->name = "thread " + std::to_string(buffer->id);
+        }
+        return *buffer;
+    }
+}
+
+void CpuProfiler::setThreadName(const std::string& name) {
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    buffer.name = name;
+}
+
+uint64_t CpuProfiler::now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+}
+
+void CpuProfiler::record(const char* name, uint64_t startNs, uint64_t endNs) {
+    ThreadBuffer& buffer = threadBuffer();
+    const uint64_t index = buffer.head.load(std::memory_order_relaxed);
+    Event& event = buffer.events[index % kEventsPerThread];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(startNs, std::memory_order_relaxed);
+    event.end.store(endNs, std::memory_order_relaxed);
+    buffer.head.store(index + 1, std::memory_order_release);
+}
+
+bool CpuProfiler::writeChromeTrace(const std::string& path) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(registryMutex);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    char line[256];
+    for (const std::unique_ptr<ThreadBuffer>& buffer : registry) {
+        std::snprintf(line, sizeof(line), "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+            first ? "" : ",\n", buffer->id, buffer->name.c_str());
+        file << line;
+        first = false;
+
+        // The owner keeps recording while we read; anything it may have overwritten meanwhile is dropped.
+        const uint64_t head = buffer->head.load(std::memory_order_acquire);
+        const uint64_t begin = head > kEventsPerThread ? head - kEventsPerThread : 0;
+        struct Snapshot {
+            const char* name;
+            uint64_t start;
+            uint64_t end;
+        };
+        std::vector<Snapshot> snapshot;
+        snapshot.reserve(static_cast<size_t>(head - begin));
+        for (uint64_t i = begin; i < head; i++) {
+            const Event& event = buffer->events[i % kEventsPerThread];
+            snapshot.push_back({event.name.load(std::memory_order_relaxed), event.start.load(std::memory_order_relaxed), event.end.load(std::memory_order_relaxed)});
+        }
+        const uint64_t after = buffer->head.load(std::memory_order_acquire);
+        const uint64_t firstIntact = after + 1 > kEventsPerThread ? after + 1 - kEventsPerThread : 0;
+        for (uint64_t i = std::max(begin, firstIntact); i < head; i++) {
+            const Snapshot& event = snapshot[static_cast<size_t>(i - begin)];
+            if (!event.name) {
+                continue;
+            }
+            std::snprintf(line, sizeof(line), ",\n{\"name\": \"%s\", \"cat\": \"cpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                event.name, buffer->id, static_cast<double>(event.start) / 1000.0, static_cast<double>(event.end - event.start) / 1000.0);
+            file << line;
+        }
+    }
+    file << "\n]}\n";
+    return file.good();
+}
@@ -0,0 +1,282 @@
+#include <DeviceAllocator.h>
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <stdexcept>
+
+namespace {
+    constexpr VkDeviceSize kMinBlockSize = 1ull * 1024 * 1024;
+}
+
+void DeviceAllocator::init(VkDevice device, VkPhysicalDevice physicalDevice) {
+    this->device = device;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+}
+
+void DeviceAllocator::destroy() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& [key, pool] : pools) {
+        for (std::unique_ptr<Block>& block : pool.blocks) {
+            if (block) {
+                destroyBlock(*block);
+            }
+        }
+    }
+    pools.clear();
+    usedBytes = 0;
+    allocationCount = 0;
+}
+
+uint32_t DeviceAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    throw std::runtime_error("Failed to find suitable memory type!");
+}
+
+DeviceAllocator::Pool& DeviceAllocator::getPool(uint32_t memoryType, bool linear) {
+    auto [it, inserted] = pools.try_emplace({memoryType, linear});
+    Pool& pool = it->second;
+    if (inserted) {
+        pool.memoryType = memoryType;
+        pool.linear = linear;
+        // Small heaps (BAR windows, integrated carve-outs) get blocks that don't hog them.
+        const VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+        pool.blockSize = std::max(std::min(kDefaultBlockSize, std::bit_floor(heapSize / 8)), kMinBlockSize);
+    }
+    return pool;
+}
+
+DeviceAllocator::Block* DeviceAllocator::createBlock(Pool& pool, uint32_t& index) {
+    VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = pool.blockSize,
+        .memoryTypeIndex = pool.memoryType,
+    };
+    auto block = std::make_unique<Block>();
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &block->memory) != VK_SUCCESS) {
+        return nullptr;
+    }
+    block->size = pool.blockSize;
+    if (memoryProperties.memoryTypes[pool.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped) != VK_SUCCESS) {
+            vkFreeMemory(device, block->memory, nullptr);
+            return nullptr;
+        }
+    }
+    block->freeNodes.resize(std::countr_zero(pool.blockSize / kMinNodeSize) + 1);
+    block->freeNodes[0].insert(0);
+
+    auto slot = std::find(pool.blocks.begin(), pool.blocks.end(), nullptr);
+    if (slot == pool.blocks.end()) {
+        slot = pool.blocks.insert(pool.blocks.end(), nullptr);
+    }
+    *slot = std::move(block);
+    index = static_cast<uint32_t>(slot - pool.blocks.begin());
+    return slot->get();
+}
+
+void DeviceAllocator::destroyBlock(Block& block) {
+    // Freeing memory unmaps it.
+    vkFreeMemory(device, block.memory, nullptr);
+    block.memory = VK_NULL_HANDLE;
+    block.mapped = nullptr;
+}
+
+uint32_t DeviceAllocator::levelOf(const Block& block, VkDeviceSize nodeSize) const {
+    return static_cast<uint32_t>(std::countr_zero(block.size / nodeSize));
+}
+
+bool DeviceAllocator::allocateNode(Block& block, VkDeviceSize nodeSize, VkDeviceSize& offset) {
+    const uint32_t target = levelOf(block, nodeSize);
+    int level = static_cast<int>(target);
+    while (level >= 0 && block.freeNodes[level].empty()) {
+        --level;
+    }
+    if (level < 0) {
+        return false;
+    }
+    // Lowest offsets first keeps the tail of the block free for large requests.
+    offset = *block.freeNodes[level].begin();
+    block.freeNodes[level].erase(block.freeNodes[level].begin());
+    for (uint32_t split = static_cast<uint32_t>(level) + 1; split <= target; split++) {
+        block.freeNodes[split].insert(offset + (block.size >> split));
+    }
+    block.allocated += nodeSize;
+    return true;
+}
+
+void DeviceAllocator::freeNode(Block& block, VkDeviceSize offset, VkDeviceSize nodeSize) {
+    block.allocated -= nodeSize;
+    uint32_t level = levelOf(block, nodeSize);
+    while (level > 0) {
+        const VkDeviceSize buddy = offset ^ (block.size >> level);
+        if (block.freeNodes[level].erase(buddy) == 0) {
+            break;
+        }
+        offset = std::min(offset, buddy);
+        --level;
+    }
+    block.freeNodes[level].insert(offset);
+}
+
+DeviceAllocation DeviceAllocator::allocateDedicated(const VkMemoryRequirements& requirements, uint32_t memoryType, VkImage image, VkBuffer buffer) {
+    VkMemoryDedicatedAllocateInfo dedicatedInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .image = image,
+        .buffer = buffer,
+    };
+    VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = (image != VK_NULL_HANDLE || buffer != VK_NULL_HANDLE) ? &dedicatedInfo : nullptr,
+        .allocationSize = requirements.size,
+        .memoryTypeIndex = memoryType,
+    };
+    DeviceAllocation allocation;
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &allocation.memory) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate dedicated device memory!");
+    }
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vkMapMemory(device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mapped);
+    }
+    allocation.size = requirements.size;
+    allocation.memoryType = memoryType;
+    dedicatedBytes += requirements.size;
+    dedicatedCount++;
+    return allocation;
+}
+
+DeviceAllocation DeviceAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, bool dedicated,
+                                           VkImage dedicatedImage, VkBuffer dedicatedBuffer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+    Pool& pool = getPool(memoryType, linear);
+    DeviceAllocation allocation;
+    if (dedicated || requirements.size > pool.blockSize / 2) {
+        allocation = allocateDedicated(requirements, memoryType, dedicatedImage, dedicatedBuffer);
+    } else {
+        // Buddy nodes are aligned to their own size within a block, and blocks to far more than any resource needs.
+        const VkDeviceSize nodeSize = std::max(std::bit_ceil(std::max(requirements.size, requirements.alignment)), kMinNodeSize);
+        Block* block = nullptr;
+        uint32_t blockIndex = 0;
+        VkDeviceSize offset = 0;
+        for (uint32_t i = 0; i < pool.blocks.size() && !block; i++) {
+            if (pool.blocks[i] && allocateNode(*pool.blocks[i], nodeSize, offset)) {
+                block = pool.blocks[i].get();
+                blockIndex = i;
+            }
+        }
+        if (!block) {
+            block = createBlock(pool, blockIndex);
+            if (!block || !allocateNode(*block, nodeSize, offset)) {
+                throw std::runtime_error("Failed to allocate device memory block!");
+            }
+        }
+        allocation.memory = block->memory;
+        allocation.offset = offset;
+        allocation.size = requirements.size;
+        allocation.nodeSize = nodeSize;
+        allocation.mapped = block->mapped ? static_cast<char*>(block->mapped) + offset : nullptr;
+        allocation.memoryType = memoryType;
+        allocation.block = blockIndex;
+    }
+    allocation.linear = linear;
+    usedBytes += requirements.size;
+    allocationCount++;
+    return allocation;
+}
+
+void DeviceAllocator::free(DeviceAllocation& allocation) {
+    if (!allocation) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (allocation.isDedicated()) {
+        vkFreeMemory(device, allocation.memory, nullptr);
+        usedBytes -= allocation.size;
+        allocationCount--;
+        dedicatedBytes -= allocation.size;
+        dedicatedCount--;
+        allocation = {};
+        return;
+    }
+    auto found = pools.find({allocation.memoryType, allocation.linear});
+    if (found == pools.end()) {
+        // Outlived destroy(); the block went with it.
+        allocation = {};
+        return;
+    }
+    usedBytes -= allocation.size;
+    allocationCount--;
+    Pool& pool = found->second;
+    std::unique_ptr<Block>& block = pool.blocks[allocation.block];
+    freeNode(*block, allocation.offset, allocation.nodeSize);
+    allocation = {};
+    if (block->allocated > 0) {
+        return;
+    }
+    // Keep a single empty block around so a pool that empties and refills doesn't churn the driver.
+    const bool otherEmpty = std::any_of(pool.blocks.begin(), pool.blocks.end(), [&](const std::unique_ptr<Block>& other) {
+        return other && other != block && other->allocated == 0;
+    });
+    if (otherEmpty) {
+        destroyBlock(*block);
+        block.reset();
+    }
+}
+
+void DeviceAllocator::trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& [key, pool] : pools) {
+        for (std::unique_ptr<Block>& block : pool.blocks) {
+            if (block && block->allocated == 0) {
+                destroyBlock(*block);
+                block.reset();
+            }
+        }
+    }
+}
+
+DeviceAllocator::Stats DeviceAllocator::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats stats;
+    stats.used = usedBytes;
+    stats.allocated = dedicatedBytes;
+    stats.reserved = dedicatedBytes;
+    stats.allocations = allocationCount;
+    stats.dedicatedAllocations = dedicatedCount;
+    VkDeviceSize freeBytes = 0;
+    VkDeviceSize largestFreeBytes = 0;
+    for (const auto& [key, pool] : pools) {
+        for (const std::unique_ptr<Block>& block : pool.blocks) {
+            if (!block) {
+                continue;
+            }
+            stats.blocks++;
+            stats.reserved += block->size;
+            stats.allocated += block->allocated;
+            freeBytes += block->size - block->allocated;
+            for (size_t level = 0; level < block->freeNodes.size(); level++) {
+                if (!block->freeNodes[level].empty()) {
+                    largestFreeBytes += block->size >> level;
+                    stats.largestFreeRange = std::max(stats.largestFreeRange, block->size >> level);
+                    break;
+                }
+            }
+        }
+    }
+    // Measured per block: free space split across blocks is still usable for anything up to a block's size.
+    stats.fragmentation = freeBytes > 0 ? 1.0 - static_cast<double>(largestFreeBytes) / static_cast<double>(freeBytes) : 0.0;
+    return stats;
+}
+
+std::string DeviceAllocator::format(const Stats& stats) {
+    constexpr double kMiB = 1024.0 * 1024.0;
+    char buffer[256];
+    std::snprintf(buffer, sizeof(buffer), "%.1f MB used, %.1f MB allocated, %.1f MB reserved in %u blocks + %u dedicated, %u allocations, fragmentation %.1f%%",
+        static_cast<double>(stats.used) / kMiB, static_cast<double>(stats.allocated) / kMiB, static_cast<double>(stats.reserved) / kMiB,
+        stats.blocks, stats.dedicatedAllocations, stats.allocations, stats.fragmentation * 100.0);
+    return buffer;
+}
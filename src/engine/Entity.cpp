@@ -58,6 +58,12 @@ void Entity::moveToParent(Entity* newParent) {
     }
 }
 
+void Entity::setActive(bool state) {
+    if (active == state) return;
+    active = state;
+    EntityManager::getInstance()->markSceneChanged(this);
+}
+
 Entity* Entity::getChild(const std::string& name) {
     for (auto* child : children) {
         if (child->getName() == name) {
@@ -169,7 +175,12 @@ void Entity::loadTextures() {
         return;
     }
 
-    ensureUniformBuffers(renderer, shaderUsed->vertexBitBindings);
+    boundTextures = textureResources;
+    uniformBindingCount = std::max(shaderUsed->vertexBitBindings, 0);
+    std::vector<VkBuffer> uniformBuffers;
+    for (uint32_t frame = 0; frame < renderer->getFramesInFlight(); ++frame) {
+        uniformBuffers.insert(uniformBuffers.end(), static_cast<size_t>(uniformBindingCount), renderer->getUniformRingBuffer(frame));
+    }
 
     descriptorSets = renderer->createDescriptorSets(
         shaderUsed->descriptorPool,
@@ -177,88 +188,41 @@ void Entity::loadTextures() {
         shaderUsed->vertexBitBindings,
         shaderUsed->fragmentBitBindings,
         textureResources,
-        uniformBuffers
+        uniformBuffers,
+        shaderUsed->vertexDescriptorType,
+        sizeof(UniformBufferObject)
     );
 }
 
-void Entity::updateUniformBuffer(uint32_t frameIndex, const UniformBufferObject& ubo) {
-    if (uniformBufferStride == 0) return;
-    const size_t bufferIndex = static_cast<size_t>(frameIndex) * uniformBufferStride;
-    if (bufferIndex >= uniformBuffers.size()) return;
-    Renderer* renderer = Renderer::getInstance();
-    if (!renderer) return;
-    VkDevice device = renderer->getDevice();
-    if (device == VK_NULL_HANDLE) return;
-    VkDeviceMemory memory = uniformBuffersMemory[bufferIndex];
-    VkBuffer buffer = uniformBuffers[bufferIndex];
-    if (memory == VK_NULL_HANDLE || buffer == VK_NULL_HANDLE) return;
-    void* mapped = nullptr;
-    if (vkMapMemory(device, memory, 0, sizeof(UniformBufferObject), 0, &mapped) != VK_SUCCESS || !mapped) {
-        return;
-    }
-    std::memcpy(mapped, &ubo, sizeof(UniformBufferObject));
-    vkUnmapMemory(device, memory);
-}
-
-void Entity::ensureUniformBuffers(Renderer* renderer, int vertexBindings) {
-    if (!renderer) return;
-    if (vertexBindings <= 0) {
-        destroyUniformBuffers();
-        return;
-    }
-    const size_t frames = static_cast<size_t>(renderer->getFramesInFlight());
-    const size_t requiredStride = static_cast<size_t>(vertexBindings);
-    if (requiredStride == 0 || frames == 0) {
-        destroyUniformBuffers();
+void Entity::bindUniformRingBuffer(uint32_t frame, VkBuffer buffer) {
+    if (uniformBindingCount == 0 || frame >= descriptorSets.size() || descriptorSets[frame] == VK_NULL_HANDLE) {
         return;
     }
-    if (uniformBufferStride == requiredStride && uniformBuffers.size() == frames * requiredStride) {
+    Shader* shaderUsed = ShaderManager::getInstance()->getShader(shader);
+    if (!shaderUsed) {
         return;
     }
-    destroyUniformBuffers();
-    uniformBufferStride = requiredStride;
-    uniformBuffers.resize(frames * requiredStride, VK_NULL_HANDLE);
-    uniformBuffersMemory.resize(frames * requiredStride, VK_NULL_HANDLE);
-    for (size_t frame = 0; frame < frames; ++frame) {
-        for (size_t binding = 0; binding < requiredStride; ++binding) {
-            const size_t index = frame * requiredStride + binding;
-            renderer->createBuffer(
-                sizeof(UniformBufferObject),
-                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                uniformBuffers[index],
-                uniformBuffersMemory[index]
-            );
-        }
-    }
+    const VkDescriptorBufferInfo bufferInfo = {
+        .buffer = buffer,
+        .offset = 0,
+        .range = sizeof(UniformBufferObject),
+    };
+    std::vector<VkWriteDescriptorSet> writes;
+    for (int binding = 0; binding < uniformBindingCount; ++binding) {
+        writes.push_back({
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSets[frame],
+            .dstBinding = static_cast<uint32_t>(binding),
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = shaderUsed->vertexDescriptorType,
+            .pBufferInfo = &bufferInfo,
+        });
+    }
+    vkUpdateDescriptorSets(Renderer::getInstance()->device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
-void Entity::destroyUniformBuffers() {
-    Renderer* renderer = Renderer::getInstance();
-    if (!renderer) {
-        uniformBuffers.clear();
-        uniformBuffersMemory.clear();
-        uniformBufferStride = 0;
-        return;
-    }
-    VkDevice device = renderer->getDevice();
-    if (device == VK_NULL_HANDLE) {
-        uniformBuffers.clear();
-        uniformBuffersMemory.clear();
-        uniformBufferStride = 0;
-        return;
-    }
-    for (size_t i = 0; i < uniformBuffers.size(); ++i) {
-        if (uniformBuffers[i] != VK_NULL_HANDLE) {
-            vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-            uniformBuffers[i] = VK_NULL_HANDLE;
-        }
-        if (i < uniformBuffersMemory.size() && uniformBuffersMemory[i] != VK_NULL_HANDLE) {
-            vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
-            uniformBuffersMemory[i] = VK_NULL_HANDLE;
-        }
-    }
-    uniformBuffers.clear();
-    uniformBuffersMemory.clear();
-    uniformBufferStride = 0;
-}
\ No newline at end of file
+uint32_t Entity::updateUniformBuffer(const UniformBufferObject& ubo) {
+    if (uniformBindingCount == 0) return 0;
+    return Renderer::getInstance()->allocateUniformData(&ubo, sizeof(UniformBufferObject));
+}
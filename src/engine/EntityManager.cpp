@@ -6,6 +6,7 @@
 
 void EntityManager::addEntity(const std::string& name, Entity* entity) {
     entities[name] = entity;
+    markSceneChanged(entity);
     if (!entity->getParent()) {
         rootEntities.push_back(entity);
     }
@@ -28,6 +29,7 @@ void EntityManager::addEntity(const std::string& name, Entity* entity) {
 void EntityManager::removeEntity(const std::string& name) {
     if (entities.find(name) == entities.end()) return;
     Entity* entity = entities[name];
+    markSceneChanged(entity);
 
     std::vector<Entity*> hierarchy;
     hierarchy.reserve(8);
@@ -86,6 +88,35 @@ void EntityManager::shutdown() {
     movableEntities.clear();
     dirtyLights.clear();
     allLights.clear();
+    ++sceneVersion;
+    ++staticGeometryVersion;
+}
+
+void EntityManager::markSceneChanged(Entity* entity) {
+    ++sceneVersion;
+    // Anything under a movable entity moves with it, so it is never part of the static geometry.
+    for (Entity* current = entity; current != nullptr; current = current->getParent()) {
+        if (current->isMovable()) {
+            return;
+        }
+    }
+    std::function<bool(Entity*)> hasStaticGeometry = [&](Entity* current) -> bool {
+        if (current->isMovable()) {
+            return false;
+        }
+        if (current->getShader() == "gbuffer" && current->getModel()) {
+            return true;
+        }
+        for (Entity* child : current->getChildren()) {
+            if (hasStaticGeometry(child)) {
+                return true;
+            }
+        }
+        return false;
+    };
+    if (hasStaticGeometry(entity)) {
+        ++staticGeometryVersion;
+    }
 }
 
 std::vector<Light*> EntityManager::getDirtyLights() {
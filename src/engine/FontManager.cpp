@@ -1,6 +1,7 @@
 #include <FontManager.h>
 #include <Renderer.h>
 #include <ShaderManager.h>
+#include <CpuProfiler.h>
 #include <freetype/include/ft2build.h>
 #include FT_FREETYPE_H
 #include <iostream>
@@ -18,6 +19,7 @@ FontManager::~FontManager() {
 }
 
 void FontManager::loadFont(const std::string& fontPath, const std::string& fontName, int fontSize) {
+    CPU_PROFILE_ZONE("FontManager::loadFont");
     FT_Library ft;
     if(FT_Init_FreeType(&ft)) {
         throw std::runtime_error("could not init FreeType library");
@@ -111,10 +113,7 @@ void FontManager::shutdown() {
                 vkDestroyImage(renderer->device, img.image, nullptr);
                 img.image = VK_NULL_HANDLE;
             }
-            if (img.imageMemory) {
-                vkFreeMemory(renderer->device, img.imageMemory, nullptr);
-                img.imageMemory = VK_NULL_HANDLE;
-            }
+            renderer->freeDeviceMemory(img.imageMemory);
             character.descriptorSets.clear();
         }
         font.characters.clear();
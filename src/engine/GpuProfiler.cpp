@@ -0,0 +1,252 @@
+#include <GpuProfiler.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+    constexpr double kSmoothing = 0.05; // Weight of the newest frame in the averages
+    // Written in increasing bit order, which is the order vkGetQueryPoolResults returns them in.
+    constexpr VkQueryPipelineStatisticFlags kStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT
+        | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+        | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+        | VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+    std::string formatCount(uint64_t count) {
+        char buffer[32];
+        if (count >= 1000000) {
+            std::snprintf(buffer, sizeof(buffer), "%.1fM", static_cast<double>(count) / 1.0e6);
+        } else if (count >= 1000) {
+            std::snprintf(buffer, sizeof(buffer), "%.1fK", static_cast<double>(count) / 1.0e3);
+        } else {
+            std::snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(count));
+        }
+        return buffer;
+    }
+
+    std::string escapeJSON(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+}
+
+const char* GpuProfiler::statisticName(uint32_t index) {
+    static constexpr const char* kNames[kStatisticCount] = {
+        "input_assembly_primitives",
+        "vertex_invocations",
+        "fragment_invocations",
+        "compute_invocations",
+    };
+    return index < kStatisticCount ? kNames[index] : "unknown";
+}
+
+void GpuProfiler::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t framesInFlight, bool pipelineStatisticsSupported) {
+    this->device = device;
+    frames.assign(framesInFlight, Frame{});
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    const uint32_t validBits = queueFamilyIndex < queueFamilyCount ? queueFamilies[queueFamilyIndex].timestampValidBits : 0;
+    if (validBits == 0 || properties.limits.timestampPeriod <= 0.0f) {
+        return;
+    }
+    timestampPeriod = properties.limits.timestampPeriod;
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    VkQueryPoolCreateInfo timestampPoolInfo = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = kMaxScopes * 2 * framesInFlight,
+    };
+    if (vkCreateQueryPool(device, &timestampPoolInfo, nullptr, &timestampPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create GPU profiler timestamp query pool!");
+    }
+    if (pipelineStatisticsSupported) {
+        VkQueryPoolCreateInfo statisticsPoolInfo = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+            .queryCount = kMaxScopes * framesInFlight,
+            .pipelineStatistics = kStatistics,
+        };
+        if (vkCreateQueryPool(device, &statisticsPoolInfo, nullptr, &statisticsPool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create GPU profiler pipeline statistics query pool!");
+        }
+    }
+}
+
+void GpuProfiler::destroy() {
+    if (timestampPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, timestampPool, nullptr);
+        timestampPool = VK_NULL_HANDLE;
+    }
+    if (statisticsPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, statisticsPool, nullptr);
+        statisticsPool = VK_NULL_HANDLE;
+    }
+    frames.clear();
+    results.clear();
+    averages.clear();
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+    currentFrame = frameIndex;
+    if (!isAvailable() || frameIndex >= frames.size()) {
+        return;
+    }
+    Frame& frame = frames[frameIndex];
+    frame.scopes.clear();
+    frame.openScopes.clear();
+    frame.statisticsCount = 0;
+    frame.statistics = statisticsEnabled && hasPipelineStatistics();
+    frame.recorded = true;
+    vkCmdResetQueryPool(commandBuffer, timestampPool, frameIndex * kMaxScopes * 2, kMaxScopes * 2);
+    if (frame.statistics) {
+        vkCmdResetQueryPool(commandBuffer, statisticsPool, frameIndex * kMaxScopes, kMaxScopes);
+    }
+}
+
+void GpuProfiler::begin(VkCommandBuffer commandBuffer, const std::string& name) {
+    if (!isAvailable() || currentFrame >= frames.size() || !frames[currentFrame].recorded) {
+        return;
+    }
+    Frame& frame = frames[currentFrame];
+    const uint32_t index = static_cast<uint32_t>(frame.scopes.size());
+    if (index >= kMaxScopes) {
+        frame.openScopes.push_back(UINT32_MAX);
+        return;
+    }
+    Scope scope{
+        .name = name,
+        .depth = static_cast<uint32_t>(frame.openScopes.size()),
+    };
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, (currentFrame * kMaxScopes + index) * 2);
+    if (frame.statistics && scope.depth == 0) {
+        scope.statisticsQuery = frame.statisticsCount++;
+        vkCmdBeginQuery(commandBuffer, statisticsPool, currentFrame * kMaxScopes + scope.statisticsQuery, 0);
+    }
+    frame.scopes.push_back(scope);
+    frame.openScopes.push_back(index);
+}
+
+void GpuProfiler::end(VkCommandBuffer commandBuffer) {
+    if (!isAvailable() || currentFrame >= frames.size() || frames[currentFrame].openScopes.empty()) {
+        return;
+    }
+    Frame& frame = frames[currentFrame];
+    const uint32_t index = frame.openScopes.back();
+    frame.openScopes.pop_back();
+    if (index == UINT32_MAX) {
+        return;
+    }
+    const Scope& scope = frame.scopes[index];
+    if (scope.statisticsQuery != UINT32_MAX) {
+        vkCmdEndQuery(commandBuffer, statisticsPool, currentFrame * kMaxScopes + scope.statisticsQuery);
+    }
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, (currentFrame * kMaxScopes + index) * 2 + 1);
+}
+
+void GpuProfiler::collect(uint32_t frameIndex) {
+    if (!isAvailable() || frameIndex >= frames.size() || !frames[frameIndex].recorded) {
+        return;
+    }
+    Frame& frame = frames[frameIndex];
+    frame.recorded = false;
+    // Scopes left open when the frame ended never wrote their second timestamp.
+    if (frame.scopes.empty() || !frame.openScopes.empty()) {
+        return;
+    }
+    std::vector<uint64_t> timestamps(frame.scopes.size() * 2);
+    if (vkGetQueryPoolResults(device, timestampPool, frameIndex * kMaxScopes * 2, static_cast<uint32_t>(timestamps.size()),
+            timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+    std::vector<uint64_t> statistics(frame.statisticsCount * kStatisticCount);
+    const bool statisticsValid = frame.statisticsCount > 0
+        && vkGetQueryPoolResults(device, statisticsPool, frameIndex * kMaxScopes, frame.statisticsCount,
+            statistics.size() * sizeof(uint64_t), statistics.data(), kStatisticCount * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS;
+
+    results.clear();
+    for (size_t i = 0; i < frame.scopes.size(); i++) {
+        const Scope& scope = frame.scopes[i];
+        ScopeResult result{
+            .name = scope.name,
+            .depth = scope.depth,
+            .gpuMs = static_cast<double>((timestamps[i * 2 + 1] - timestamps[i * 2]) & timestampMask) * timestampPeriod / 1.0e6,
+        };
+        auto [average, inserted] = averages.try_emplace(scope.name, result.gpuMs);
+        if (!inserted) {
+            average->second += (result.gpuMs - average->second) * kSmoothing;
+        }
+        result.averageGpuMs = average->second;
+        if (statisticsValid && scope.statisticsQuery != UINT32_MAX) {
+            result.hasStatistics = true;
+            std::copy_n(statistics.begin() + scope.statisticsQuery * kStatisticCount, kStatisticCount, result.statistics.begin());
+        }
+        results.push_back(result);
+    }
+    collectedFrames++;
+}
+
+std::string GpuProfiler::format(const ScopeResult& result) {
+    char buffer[160];
+    std::snprintf(buffer, sizeof(buffer), "%*s%s  %.2f ms (avg %.2f)", static_cast<int>(result.depth * 2), "", result.name.c_str(), result.gpuMs, result.averageGpuMs);
+    std::string line = buffer;
+    if (result.hasStatistics) {
+        line += "  prims " + formatCount(result.statistics[0]) + ", vs " + formatCount(result.statistics[1])
+            + ", fs " + formatCount(result.statistics[2]) + ", cs " + formatCount(result.statistics[3]);
+    }
+    return line;
+}
+
+bool GpuProfiler::writeCSV(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << "scope,depth,gpu_ms,average_gpu_ms";
+    for (uint32_t i = 0; i < kStatisticCount; i++) {
+        file << "," << statisticName(i);
+    }
+    file << "\n";
+    for (const ScopeResult& result : results) {
+        file << "\"" << result.name << "\"," << result.depth << "," << result.gpuMs << "," << result.averageGpuMs;
+        for (uint32_t i = 0; i < kStatisticCount; i++) {
+            file << ",";
+            if (result.hasStatistics) {
+                file << result.statistics[i];
+            }
+        }
+        file << "\n";
+    }
+    return file.good();
+}
+
+bool GpuProfiler::writeJSON(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const ScopeResult& result = results[i];
+        file << "  {\"scope\": \"" << escapeJSON(result.name) << "\", \"depth\": " << result.depth
+             << ", \"gpu_ms\": " << result.gpuMs << ", \"average_gpu_ms\": " << result.averageGpuMs;
+        if (result.hasStatistics) {
+            for (uint32_t s = 0; s < kStatisticCount; s++) {
+                file << ", \"" << statisticName(s) << "\": " << result.statistics[s];
+            }
+        }
+        file << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "]\n";
+    return file.good();
+}
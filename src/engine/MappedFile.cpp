@@ -0,0 +1,100 @@
+#include <MappedFile.h>
+#include <utility>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        bytes = std::exchange(other.bytes, nullptr);
+        length = std::exchange(other.length, 0);
+#if defined(_WIN32)
+        file = std::exchange(other.file, nullptr);
+        mapping = std::exchange(other.mapping, nullptr);
+#endif
+    }
+    return *this;
+}
+
+#if defined(_WIN32)
+bool MappedFile::open(const std::string& path) {
+    close();
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart <= 0) {
+        CloseHandle(handle);
+        return false;
+    }
+    HANDLE mappingHandle = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (mappingHandle) {
+            CloseHandle(mappingHandle);
+        }
+        CloseHandle(handle);
+        return false;
+    }
+    file = handle;
+    mapping = mappingHandle;
+    bytes = static_cast<const uint8_t*>(view);
+    length = static_cast<size_t>(fileSize.QuadPart);
+    return true;
+}
+
+void MappedFile::close() {
+    if (bytes) {
+        UnmapViewOfFile(bytes);
+        CloseHandle(mapping);
+        CloseHandle(file);
+    }
+    bytes = nullptr;
+    length = 0;
+    file = nullptr;
+    mapping = nullptr;
+}
+#else
+bool MappedFile::open(const std::string& path) {
+    close();
+    const int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size <= 0) {
+        ::close(descriptor);
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+    // The mapping keeps the file referenced on its own.
+    ::close(descriptor);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    bytes = static_cast<const uint8_t*>(view);
+    length = static_cast<size_t>(status.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if (bytes) {
+        munmap(const_cast<uint8_t*>(bytes), length);
+    }
+    bytes = nullptr;
+    length = 0;
+}
+#endif
@@ -1,5 +1,6 @@
 #include <Model.h>
 #include <Renderer.h>
+#include <CpuProfiler.h>
 #include <iostream>
 #include <filesystem>
 #include <fstream>
@@ -15,7 +16,8 @@ struct GeoSurface {
     uint32_t count;
 };
 
-void Model::loadFromFile(const std::string& path) {
+void Model::loadFromFile(const std::string& path, bool uploadToGPU) {
+    CPU_PROFILE_ZONE("Model::loadFromFile");
     const std::filesystem::path modelPath(path);
     auto dataResult = fastgltf::GltfDataBuffer::FromPath(modelPath);
     if (!dataResult) {
@@ -174,6 +176,9 @@ void Model::loadFromFile(const std::string& path) {
         std::cerr << "Model " << name << " contains no vertex/index data after loading " << path << std::endl;
         return;
     }
+    if (!uploadToGPU) {
+        return;
+    }
     renderer = Renderer::getInstance();
     renderer->createBuffer(
         vertices.size() * sizeof(float),
@@ -189,26 +194,8 @@ void Model::loadFromFile(const std::string& path) {
         indexBuffer,
         indexBufferMemory
     );
-    VkBuffer stagingVertexBuffer;
-    VkDeviceMemory stagingVertexBufferMemory;
-    VkDeviceSize vertexBufferSize = vertices.size() * sizeof(float);
-    renderer->createBuffer(vertexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingVertexBuffer, stagingVertexBufferMemory);
-    void* stagingData = nullptr;
-    vkMapMemory(renderer->getDevice(), stagingVertexBufferMemory, 0, vertexBufferSize, 0, &stagingData);
-    memcpy(stagingData, vertices.data(), vertexBufferSize);
-    vkUnmapMemory(renderer->getDevice(), stagingVertexBufferMemory);
-    renderer->copyBuffer(stagingVertexBuffer, vertexBuffer, vertexBufferSize);
-    VkBuffer stagingIndexBuffer;
-    VkDeviceMemory stagingIndexBufferMemory;
-    VkDeviceSize indexBufferSize = indices.size() * sizeof(uint32_t);
-    renderer->createBuffer(indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingIndexBuffer, stagingIndexBufferMemory);
-    stagingData = nullptr;
-    vkMapMemory(renderer->getDevice(), stagingIndexBufferMemory, 0, indexBufferSize, 0, &stagingData);
-    memcpy(stagingData, indices.data(), indexBufferSize);
-    vkUnmapMemory(renderer->getDevice(), stagingIndexBufferMemory);
-    renderer->copyBuffer(stagingIndexBuffer, indexBuffer, indexBufferSize);
-    vkDestroyBuffer(renderer->getDevice(), stagingIndexBuffer, nullptr);
-    vkFreeMemory(renderer->getDevice(), stagingIndexBufferMemory, nullptr);
-    vkDestroyBuffer(renderer->getDevice(), stagingVertexBuffer, nullptr);
-    vkFreeMemory(renderer->getDevice(), stagingVertexBufferMemory, nullptr);
+    // Staged right away; the copies run with the renderer's next flush instead of stalling the queue here.
+    UploadManager& uploads = renderer->getUploadManager();
+    uploads.uploadBuffer(vertexBuffer, vertices.data(), vertices.size() * sizeof(float));
+    uploads.uploadBuffer(indexBuffer, indices.data(), indices.size() * sizeof(uint32_t));
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <ModelManager.h>
 #include <Model.h>
+#include <CpuProfiler.h>
 #include <filesystem>
 #include <utils.h>
 
@@ -19,6 +20,7 @@ void ModelManager::shutdown() {
 }
 
 void ModelManager::loadModels(std::string path, std::string prevName) {
+    CPU_PROFILE_ZONE("ModelManager::loadModels");
     namespace fs = std::filesystem;
     fs::path searchPath = resolvePath(path);
     std::error_code ec;
@@ -0,0 +1,61 @@
+#include <QualityGovernor.h>
+#include <algorithm>
+
+namespace {
+    constexpr double kSmoothing = 0.1; // Weight of the newest frame in the moving averages
+}
+
+QualityGovernor::QualityGovernor(uint32_t levelCount, const Config& config)
+    : config(config), levelCount(std::max(levelCount, 1u)), upWindow(config.upFrames) {}
+
+bool QualityGovernor::update(double cpuMs, double gpuMs) {
+    if (!hasSamples) {
+        smoothedCpuMs = cpuMs;
+        smoothedGpuMs = gpuMs;
+        hasSamples = true;
+    } else {
+        smoothedCpuMs += (cpuMs - smoothedCpuMs) * kSmoothing;
+        smoothedGpuMs += (gpuMs - smoothedGpuMs) * kSmoothing;
+    }
+    ++framesSinceChange;
+    // A raise that has held for the longest window was a good call; stop penalizing the next one.
+    if (lastChangeRaised && framesSinceChange >= config.maxUpFrames) {
+        upWindow = config.upFrames;
+        lastChangeRaised = false;
+    }
+
+    const double overMs = config.targetMs * config.downThreshold;
+    const double headroomMs = config.targetMs * config.upThreshold;
+    if (smoothedGpuMs > overMs && smoothedGpuMs >= smoothedCpuMs) {
+        bottleneck = Bottleneck::GPU;
+    } else if (smoothedCpuMs > overMs) {
+        bottleneck = Bottleneck::CPU;
+    } else {
+        bottleneck = Bottleneck::None;
+    }
+    if (framesSinceChange <= config.settleFrames) {
+        overFrames = 0;
+        headroomFrames = 0;
+        return false;
+    }
+    overFrames = bottleneck == Bottleneck::GPU ? overFrames + 1 : 0;
+    // GPU headroom is worth spending even while the CPU holds the frame back.
+    headroomFrames = smoothedGpuMs < headroomMs ? headroomFrames + 1 : 0;
+
+    if (overFrames >= config.downFrames && level + 1 < levelCount) {
+        if (lastChangeRaised && framesSinceChange < upWindow + config.settleFrames) {
+            upWindow = std::min(upWindow * 2, config.maxUpFrames);
+        }
+        ++level;
+        lastChangeRaised = false;
+    } else if (headroomFrames >= upWindow && level > 0) {
+        --level;
+        lastChangeRaised = true;
+    } else {
+        return false;
+    }
+    framesSinceChange = 0;
+    overFrames = 0;
+    headroomFrames = 0;
+    return true;
+}
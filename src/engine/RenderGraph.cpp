@@ -0,0 +1,428 @@
+#include <RenderGraph.h>
+#include <GpuProfiler.h>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+    constexpr VkAccessFlags kWriteAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    bool lifetimesOverlap(int firstA, int lastA, int firstB, int lastB) {
+        return firstA <= lastB && firstB <= lastA;
+    }
+}
+
+RenderGraphAccess RenderGraphAccess::colorAttachment(VkImageLayout initialLayout, VkImageLayout finalLayout) {
+    const bool discard = initialLayout == VK_IMAGE_LAYOUT_UNDEFINED;
+    return {
+        .stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .layout = discard ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : initialLayout,
+        .finalLayout = finalLayout,
+        .discard = discard,
+    };
+}
+
+RenderGraphAccess RenderGraphAccess::depthAttachment(VkImageLayout initialLayout, VkImageLayout finalLayout) {
+    const bool discard = initialLayout == VK_IMAGE_LAYOUT_UNDEFINED;
+    return {
+        .stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        .access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .layout = discard ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : initialLayout,
+        .finalLayout = finalLayout,
+        .discard = discard,
+    };
+}
+
+RenderGraphAccess RenderGraphAccess::sampled(VkPipelineStageFlags stages, VkImageLayout layout) {
+    return {
+        .stages = stages,
+        .access = VK_ACCESS_SHADER_READ_BIT,
+        .layout = layout,
+    };
+}
+
+RenderGraphAccess RenderGraphAccess::storage(VkPipelineStageFlags stages, bool read, bool write, bool discard) {
+    return {
+        .stages = stages,
+        .access = (read ? VK_ACCESS_SHADER_READ_BIT : 0u) | (write ? VK_ACCESS_SHADER_WRITE_BIT : 0u),
+        .layout = VK_IMAGE_LAYOUT_GENERAL,
+        .discard = discard,
+    };
+}
+
+void RenderGraph::PassBuilder::read(Resource resource, const RenderGraphAccess& access) {
+    add(resource, access, true, false);
+}
+
+void RenderGraph::PassBuilder::write(Resource resource, const RenderGraphAccess& access) {
+    add(resource, access, (access.access & ~kWriteAccessMask) != 0, true);
+}
+
+void RenderGraph::PassBuilder::add(Resource resource, const RenderGraphAccess& access, bool read, bool write) {
+    if (resource == kInvalidResource) {
+        return;
+    }
+    // Several uses of one image inside a pass share its entry layout; the pass orders them itself.
+    for (Access& existing : accesses) {
+        if (existing.resource == resource) {
+            existing.access.stages |= access.stages;
+            existing.access.access |= access.access;
+            if (access.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED) {
+                existing.access.finalLayout = access.finalLayout;
+            }
+            existing.read = existing.read || read;
+            existing.write = existing.write || write;
+            return;
+        }
+    }
+    accesses.push_back({resource, access, read, write});
+}
+
+void RenderGraph::init(VkDevice vkDevice, VkPhysicalDevice vkPhysicalDevice) {
+    device = vkDevice;
+    physicalDevice = vkPhysicalDevice;
+}
+
+RenderGraph::Resource RenderGraph::createImage(const std::string& name, const ImageDesc& desc) {
+    VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = desc.format,
+        .extent = {desc.extent.width, desc.extent.height, 1},
+        .mipLevels = desc.mipLevels,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = desc.usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    ImageResource resource;
+    resource.name = name;
+    resource.aspect = desc.aspect;
+    resource.mipLevels = desc.mipLevels;
+    resource.lazilyAllocated = (desc.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+    if (vkCreateImage(device, &imageInfo, nullptr, &resource.image) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create render graph image " + name + "!");
+    }
+    vkGetImageMemoryRequirements(device, resource.image, &resource.requirements);
+    images.push_back(std::move(resource));
+    compiled = false;
+    return static_cast<Resource>(images.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importImage(const std::string& name, VkImage image, VkImageAspectFlags aspect, uint32_t mipLevels, VkImageLayout layout) {
+    ImageResource resource;
+    resource.name = name;
+    resource.image = image;
+    resource.aspect = aspect;
+    resource.mipLevels = mipLevels;
+    resource.imported = true;
+    resource.state.layout = layout;
+    images.push_back(std::move(resource));
+    return static_cast<Resource>(images.size() - 1);
+}
+
+VkImage RenderGraph::getImage(Resource resource) const {
+    return resource < images.size() ? images[resource].image : VK_NULL_HANDLE;
+}
+
+void RenderGraph::addPass(const std::string& name, const std::function<void(PassBuilder&)>& setup, std::function<void(VkCommandBuffer)> execute) {
+    Pass pass;
+    pass.name = name;
+    setup(pass.builder);
+    pass.execute = std::move(execute);
+    passes.push_back(std::move(pass));
+    compiled = false;
+}
+
+void RenderGraph::compile() {
+    // Walk backwards from the passes with effects outside the graph; anything that only feeds
+    // culled passes is culled too.
+    std::vector<bool> needed(images.size(), false);
+    uint32_t culledCount = 0;
+    for (size_t i = passes.size(); i-- > 0;) {
+        Pass& pass = passes[i];
+        bool live = pass.builder.sideEffect;
+        for (const PassBuilder::Access& access : pass.builder.accesses) {
+            if (access.write && (images[access.resource].imported || needed[access.resource])) {
+                live = true;
+            }
+        }
+        pass.culled = !live;
+        if (!live) {
+            culledCount++;
+            continue;
+        }
+        for (const PassBuilder::Access& access : pass.builder.accesses) {
+            if (access.read) {
+                needed[access.resource] = true;
+            }
+        }
+    }
+
+    for (ImageResource& image : images) {
+        image.firstPass = -1;
+        image.lastPass = -1;
+        image.aliasable = false;
+    }
+    for (size_t i = 0; i < passes.size(); i++) {
+        if (passes[i].culled) continue;
+        for (const PassBuilder::Access& access : passes[i].builder.accesses) {
+            ImageResource& image = images[access.resource];
+            if (image.firstPass < 0) {
+                image.firstPass = static_cast<int>(i);
+                // Only images whose first use this frame overwrites them may hand their memory to others.
+                image.aliasable = !image.imported && access.write && access.access.discard;
+            }
+            image.lastPass = static_cast<int>(i);
+        }
+    }
+    // Images can only be bound once; culling may change between compiles, placement may not.
+    if (memoryBlocks.empty()) {
+        allocateTransientMemory();
+    }
+    compiled = true;
+
+    std::cout << "Render graph: " << passes.size() - culledCount << " passes (" << culledCount << " culled), "
+              << transientMemorySize / (1024 * 1024) << " MB transient memory for "
+              << unaliasedMemorySize / (1024 * 1024) << " MB of images (" << lazyMemorySize / (1024 * 1024)
+              << " MB lazily allocated)" << std::endl;
+}
+
+uint32_t RenderGraph::findMemoryType(uint32_t typeBits, bool lazilyAllocated) const {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    // Attachments that never leave tile memory only get pages backed if the driver needs them.
+    if (lazilyAllocated) {
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+                return i;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+            return i;
+        }
+    }
+    throw std::runtime_error("Failed to find device local memory for the render graph!");
+}
+
+void RenderGraph::allocateTransientMemory() {
+    transientMemorySize = 0;
+    unaliasedMemorySize = 0;
+    lazyMemorySize = 0;
+
+    // Largest first, each at the lowest offset not used by an image whose lifetime overlaps its own.
+    std::vector<Resource> order;
+    for (Resource i = 0; i < images.size(); i++) {
+        if (!images[i].imported) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](Resource a, Resource b) {
+        return images[a].requirements.size > images[b].requirements.size;
+    });
+    const int passCount = static_cast<int>(passes.size());
+    auto lifetime = [&](const ImageResource& image) {
+        // Images that can't be aliased, or that no live pass uses, hold their range for the whole frame.
+        if (!image.aliasable || image.firstPass < 0) {
+            return std::pair<int, int>(0, passCount);
+        }
+        return std::pair<int, int>(image.firstPass, image.lastPass);
+    };
+    std::vector<Resource> placed;
+    for (Resource index : order) {
+        ImageResource& image = images[index];
+        unaliasedMemorySize += image.requirements.size;
+        const uint32_t memoryTypeIndex = findMemoryType(image.requirements.memoryTypeBits, image.lazilyAllocated);
+        uint32_t blockIndex = UINT32_MAX;
+        for (uint32_t b = 0; b < memoryBlocks.size(); b++) {
+            if (memoryBlocks[b].memoryTypeIndex == memoryTypeIndex) {
+                blockIndex = b;
+                break;
+            }
+        }
+        if (blockIndex == UINT32_MAX) {
+            memoryBlocks.push_back({VK_NULL_HANDLE, memoryTypeIndex, 0});
+            blockIndex = static_cast<uint32_t>(memoryBlocks.size() - 1);
+        }
+
+        const auto [first, last] = lifetime(image);
+        const VkDeviceSize alignment = std::max<VkDeviceSize>(image.requirements.alignment, 1);
+        std::vector<VkDeviceSize> candidates = {0};
+        for (Resource other : placed) {
+            const ImageResource& otherImage = images[other];
+            if (otherImage.memoryBlock == blockIndex) {
+                const VkDeviceSize end = otherImage.memoryOffset + otherImage.requirements.size;
+                candidates.push_back((end + alignment - 1) / alignment * alignment);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        VkDeviceSize offset = candidates.back();
+        for (VkDeviceSize candidate : candidates) {
+            bool fits = true;
+            for (Resource other : placed) {
+                const ImageResource& otherImage = images[other];
+                const auto [otherFirst, otherLast] = lifetime(otherImage);
+                if (otherImage.memoryBlock != blockIndex || !lifetimesOverlap(first, last, otherFirst, otherLast)) continue;
+                if (candidate < otherImage.memoryOffset + otherImage.requirements.size && otherImage.memoryOffset < candidate + image.requirements.size) {
+                    fits = false;
+                    break;
+                }
+            }
+            if (fits) {
+                offset = candidate;
+                break;
+            }
+        }
+        image.memoryBlock = blockIndex;
+        image.memoryOffset = offset;
+        memoryBlocks[blockIndex].size = std::max(memoryBlocks[blockIndex].size, offset + image.requirements.size);
+        placed.push_back(index);
+    }
+
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    for (MemoryBlock& block : memoryBlocks) {
+        if (block.size == 0) continue;
+        VkMemoryAllocateInfo allocInfo = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = block.size,
+            .memoryTypeIndex = block.memoryTypeIndex,
+        };
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate render graph memory!");
+        }
+        if (memoryProperties.memoryTypes[block.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+            lazyMemorySize += block.size;
+        } else {
+            transientMemorySize += block.size;
+        }
+    }
+    for (Resource index : placed) {
+        ImageResource& image = images[index];
+        vkBindImageMemory(device, image.image, memoryBlocks[image.memoryBlock].memory, image.memoryOffset);
+        for (Resource other : placed) {
+            const ImageResource& otherImage = images[other];
+            if (other != index && otherImage.memoryBlock == image.memoryBlock
+                && image.memoryOffset < otherImage.memoryOffset + otherImage.requirements.size
+                && otherImage.memoryOffset < image.memoryOffset + image.requirements.size) {
+                image.aliases.push_back(other);
+            }
+        }
+    }
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer) {
+    if (!compiled) {
+        compile();
+    }
+    // Aliased images lose their contents between frames; their first use starts from UNDEFINED.
+    for (ImageResource& image : images) {
+        image.firstUse = true;
+    }
+
+    for (Pass& pass : passes) {
+        if (pass.culled || (pass.builder.condition && !pass.builder.condition())) {
+            continue;
+        }
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+        pendingBarriers.clear();
+        for (const PassBuilder::Access& use : pass.builder.accesses) {
+            ImageResource& image = images[use.resource];
+            ImageState& state = image.state;
+            const RenderGraphAccess& access = use.access;
+            const bool startsFresh = image.aliasable && image.firstUse;
+            const bool discard = access.discard || startsFresh;
+            const bool layoutChange = discard || state.layout != access.layout;
+
+            VkPipelineStageFlags waitStages = 0;
+            VkAccessFlags waitAccess = 0;
+            if (layoutChange || use.write) {
+                // Transitions and writes wait for every earlier access (RAW, WAR and WAW).
+                waitStages = state.writeStages | state.readStages;
+                waitAccess = state.writeAccess;
+            } else if (state.writeAccess != 0 && (access.stages & ~state.visibleStages) != 0) {
+                waitStages = state.writeStages;
+                waitAccess = state.writeAccess;
+            }
+            if (startsFresh) {
+                // The previous occupants of this memory must be done with it.
+                for (Resource alias : image.aliases) {
+                    waitStages |= images[alias].state.writeStages | images[alias].state.readStages;
+                }
+            }
+            if (waitStages != 0 || layoutChange) {
+                pendingBarriers.push_back({
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                    .srcAccessMask = discard ? 0u : waitAccess,
+                    .dstAccessMask = access.access,
+                    .oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout,
+                    .newLayout = access.layout,
+                    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .image = image.image,
+                    .subresourceRange = {
+                        .aspectMask = image.aspect,
+                        .baseMipLevel = 0,
+                        .levelCount = image.mipLevels,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                    },
+                });
+                srcStages |= waitStages;
+                dstStages |= access.stages;
+            }
+
+            if (use.write) {
+                state.writeStages = access.stages;
+                state.writeAccess = access.access & kWriteAccessMask;
+                state.readStages = use.read ? access.stages : 0;
+                state.visibleStages = 0;
+            } else if (layoutChange || waitStages != 0) {
+                state.readStages = layoutChange ? access.stages : (state.readStages | access.stages);
+                state.visibleStages |= access.stages;
+            } else {
+                state.readStages |= access.stages;
+            }
+            state.layout = access.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED ? access.finalLayout : access.layout;
+            image.firstUse = false;
+        }
+        if (!pendingBarriers.empty()) {
+            vkCmdPipelineBarrier(commandBuffer,
+                srcStages != 0 ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStages,
+                0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(pendingBarriers.size()), pendingBarriers.data());
+        }
+        if (profiler) {
+            profiler->begin(commandBuffer, pass.name);
+        }
+        pass.execute(commandBuffer);
+        if (profiler) {
+            profiler->end(commandBuffer);
+        }
+    }
+}
+
+void RenderGraph::reset() {
+    for (ImageResource& image : images) {
+        if (!image.imported && image.image != VK_NULL_HANDLE) {
+            vkDestroyImage(device, image.image, nullptr);
+        }
+    }
+    for (MemoryBlock& block : memoryBlocks) {
+        if (block.memory != VK_NULL_HANDLE) {
+            vkFreeMemory(device, block.memory, nullptr);
+        }
+    }
+    images.clear();
+    passes.clear();
+    memoryBlocks.clear();
+    transientMemorySize = 0;
+    unaliasedMemorySize = 0;
+    compiled = false;
+}
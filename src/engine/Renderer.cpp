@@ -27,13 +27,16 @@
 #include <fstream>
 #include <variant>
 #include <queue>
+#include <chrono>
 #include <Renderer.h>
+#include <CpuProfiler.h>
 #include <UIManager.h>
 #include <ShaderManager.h>
 #include <FontManager.h>
 #include <SceneManager.h>
 #include <TextureManager.h>
 #include <EntityManager.h>
+#include <CharacterEntity.h>
 #include <ModelManager.h>
 #include <Model.h>
 #include <UIObject.h>
@@ -61,10 +64,73 @@ std::vector<const char*> deviceExtensions = {
     , "VK_KHR_portability_subset"
 #endif
 };
+#ifndef VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME
+#define VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME "VK_KHR_draw_indirect_count"
+#endif
 #ifndef VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME
 #define VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME "VK_EXT_shader_atomic_float"
 #endif
 
+// Sizes of the render target formats, for the bandwidth report.
+static uint32_t bytesPerPixel(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_R8G8_UNORM:
+            return 2;
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_R16G16_SNORM:
+        case VK_FORMAT_R16G16_SFLOAT:
+        case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+            return 4;
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+// Quality governor levels, cheapest last. Each caps a knob; a user setting that is already cheaper
+// than the cap is kept. The knobs that cost no reallocation go first, resolution last.
+struct QualityLevel {
+    const char* name;
+    std::optional<SSRPreset> ssrPreset;
+    std::optional<ShadowFilterMode> shadowFilter;
+    uint32_t shadowBudgetDivisor;
+    float renderScale;
+};
+static const QualityLevel kQualityLevels[] = {
+    {"full", std::nullopt, std::nullopt, 1, 1.0f},
+    {"low ssr", SSRPreset::Low, std::nullopt, 1, 1.0f},
+    {"pcf shadows", SSRPreset::Low, ShadowFilterMode::PCF, 1, 1.0f},
+    {"hard shadows", SSRPreset::Low, ShadowFilterMode::Hard, 1, 1.0f},
+    {"half shadow budget", SSRPreset::Low, ShadowFilterMode::Hard, 2, 1.0f},
+    {"85% resolution", SSRPreset::Low, ShadowFilterMode::Hard, 2, 0.85f},
+    {"75% resolution", SSRPreset::Low, ShadowFilterMode::Hard, 4, 0.75f},
+    {"67% resolution", SSRPreset::Low, ShadowFilterMode::Hard, 4, 0.67f},
+    {"50% resolution", SSRPreset::Low, ShadowFilterMode::Hard, 4, 0.5f},
+};
+static constexpr uint32_t kQualityLevelCount = sizeof(kQualityLevels) / sizeof(kQualityLevels[0]);
+
+// Relative GPU cost, for comparing a user setting against a quality level's cap.
+static uint32_t ssrPresetCost(SSRPreset preset) {
+    switch (preset) {
+        case SSRPreset::Low: return 0;
+        case SSRPreset::Medium: return 1;
+        case SSRPreset::High: return 2;
+        case SSRPreset::Reference: return 3;
+    }
+    return 3;
+}
+static uint32_t shadowFilterCost(ShadowFilterMode mode) {
+    switch (mode) {
+        case ShadowFilterMode::Hard: return 0;
+        case ShadowFilterMode::Moments: return 1;
+        case ShadowFilterMode::PCF: return 2;
+        case ShadowFilterMode::Reference: return 3;
+    }
+    return 3;
+}
+
 // Runtime toggle: use CAS fallback when float atomicAdd isn’t available via VK_EXT_shader_atomic_float
 static bool g_useCASAdvection = true;
 #ifdef NDEBUG
@@ -164,6 +230,86 @@ struct TextVertex{
         mainLoop();
         cleanup();
     }
+    int Renderer::runBenchmark(const BenchmarkOptions& options) {
+        constexpr float kStep = 1.0f / 60.0f;
+        CameraPath path;
+        if (!options.cameraPath.empty() && !path.load(resolvePath(options.cameraPath).string())) {
+            std::cerr << "Benchmark: failed to load camera path " << options.cameraPath << std::endl;
+            return 1;
+        }
+        headless = true;
+        headlessExtent = {std::max(options.width, 1u), std::max(options.height, 1u)};
+        textureMipmaps = options.textureMipmaps;
+        initVulkan();
+        const int sceneId = sceneManager->findScene(options.scene);
+        if (sceneId < 0) {
+            std::cerr << "Benchmark: unknown scene " << options.scene << std::endl;
+            cleanup();
+            return 1;
+        }
+        sceneManager->switchScene(sceneId);
+
+        // The path moves the root of the active camera's hierarchy, which is the player in game scenes.
+        Entity* rig = activeCamera;
+        while (rig && rig->getParent()) {
+            rig = rig->getParent();
+        }
+        const uint32_t totalFrames = options.warmupFrames + options.frames;
+        if (path.empty() && rig) {
+            // No path: turn once on the spot over the run.
+            const float duration = static_cast<float>(totalFrames) * kStep;
+            path.addKeyframe({.time = 0.0f, .position = rig->getPosition(), .rotation = rig->getRotation()});
+            path.addKeyframe({.time = duration, .position = rig->getPosition(), .rotation = rig->getRotation() + glm::vec3(0.0f, 360.0f, 0.0f)});
+        }
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        std::cout << "Benchmark: " << options.scene << " at " << headlessExtent.width << "x" << headlessExtent.height << " on " << properties.deviceName
+                  << ", " << options.warmupFrames << " warmup + " << options.frames << " measured frames" << std::endl;
+
+        BenchmarkReport report;
+        uint64_t collectedFrames = gpuProfiler.getCollectedFrames();
+        for (uint32_t frame = 0; frame < totalFrames; ++frame) {
+            if (rig) {
+                const CameraPath::Keyframe pose = path.sample(static_cast<float>(frame) * kStep);
+                rig->setPosition(pose.position);
+                rig->setRotation(pose.rotation);
+                // Keep gravity from building up between the poses the path dictates.
+                if (CharacterEntity* character = dynamic_cast<CharacterEntity*>(rig)) {
+                    character->resetVelocity();
+                }
+            }
+            drawFrame();
+            if (frame >= options.warmupFrames) {
+                report.addCpuFrame(frameCpuMs);
+            }
+            // drawFrame() read back the GPU time of the frame this slot recorded kMaxFramesInFlight frames ago.
+            if (frame >= options.warmupFrames + kMaxFramesInFlight && lastGpuFrameMs >= 0.0) {
+                report.addGpuFrame(lastGpuFrameMs);
+            }
+            // Per pass, so a change that targets one pass (texture mipmaps and the G-buffer) shows up on its own.
+            if (frame >= options.warmupFrames + kMaxFramesInFlight && gpuProfiler.getCollectedFrames() != collectedFrames) {
+                for (const GpuProfiler::ScopeResult& result : gpuProfiler.getResults()) {
+                    if (result.depth == 0) {
+                        report.addPassFrame(result.name, result.gpuMs);
+                    }
+                }
+            }
+            collectedFrames = gpuProfiler.getCollectedFrames();
+        }
+        vkDeviceWaitIdle(device);
+
+        bool passed = true;
+        const std::string json = report.toJSON(options, properties.deviceName, passed);
+        std::cout << json;
+        if (!options.outputPath.empty()) {
+            std::ofstream file(options.outputPath);
+            if (!(file << json)) {
+                std::cerr << "Benchmark: failed to write " << options.outputPath << std::endl;
+            }
+        }
+        cleanup();
+        return passed ? 0 : 2;
+    }
     VkCommandBuffer Renderer::beginSingleTimeCommands() {
         VkCommandBufferAllocateInfo allocInfo = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
@@ -188,6 +334,8 @@ struct TextVertex{
         if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
             throw std::runtime_error("failed to record command buffer!");
         }
+        // Whatever this reads may still be waiting in the upload batch.
+        uploadManager.flush();
         VkSubmitInfo submitInfo = {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
             .commandBufferCount = 1,
@@ -199,35 +347,14 @@ struct TextVertex{
         vkQueueWaitIdle(graphicsQueue);
         vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
     }
-    void Renderer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-        VkBufferCopy copyRegion = {
-            .srcOffset = 0,
-            .dstOffset = 0,
-            .size = size,
-        };
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-        endSingleTimeCommands(commandBuffer);
-    }
-    void Renderer::createTextureImage(int width, int height, unsigned char* imageBuffer, VkImage& textureImage, VkDeviceMemory& textureImageMemory, VkFormat format) {
+    void Renderer::createTextureImage(int width, int height, unsigned char* imageBuffer, VkImage& textureImage, DeviceAllocation& textureImageMemory, VkFormat format) {
         if(width == 0 || height == 0) {
             width = std::max(1, width);
             height = std::max(1, height);
         }
         VkDeviceSize imageSize = width * height;
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-        memcpy(data, imageBuffer, static_cast<size_t>(imageSize));
-        vkUnmapMemory(device, stagingBufferMemory);
         createImage(width, height, 1, VK_SAMPLE_COUNT_1_BIT, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-        transitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
-        transitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        uploadManager.uploadImage(textureImage, static_cast<uint32_t>(width), static_cast<uint32_t>(height), imageBuffer, imageSize);
     }
     VkShaderModule Renderer::createShaderModule(const std::vector<char>& code) {
         VkShaderModuleCreateInfo createInfo = {
@@ -272,7 +399,7 @@ struct TextVertex{
         }
         vkDestroyShaderModule(device, computeShader, nullptr);
     }
-    void Renderer::createGraphicsPipeline(const std::string& vertexShaderPath, const std::string& fragmentShaderPath, VkPipeline& pipeline, VkPipelineLayout& pipelineLayout, VkDescriptorSetLayout& descriptorSetLayout, VkPushConstantRange* pushConstantRange, bool enableDepth, bool useTextVertex, VkCullModeFlags cullMode, VkFrontFace frontFace, bool depthWrite, VkCompareOp depthCompare, VkRenderPass renderPassOverride, uint32_t colorAttachmentCount, VkSampleCountFlagBits sampleCount, bool noVertexInput) {
+    void Renderer::createGraphicsPipeline(const std::string& vertexShaderPath, const std::string& fragmentShaderPath, VkPipeline& pipeline, VkPipelineLayout& pipelineLayout, VkDescriptorSetLayout& descriptorSetLayout, VkPushConstantRange* pushConstantRange, bool enableDepth, bool useTextVertex, VkCullModeFlags cullMode, VkFrontFace frontFace, bool depthWrite, VkCompareOp depthCompare, VkRenderPass renderPassOverride, uint32_t colorAttachmentCount, VkSampleCountFlagBits sampleCount, bool noVertexInput, uint32_t subpass) {
         std::vector<char> vertShaderCode = readFile(vertexShaderPath);
         std::vector<char> fragShaderCode = readFile(fragmentShaderPath);
         VkShaderModule vertexShader = createShaderModule(vertShaderCode);
@@ -430,7 +557,7 @@ struct TextVertex{
             .pDynamicState = &dynamicState,
             .layout = pipelineLayout,
             .renderPass = renderPassOverride != VK_NULL_HANDLE ? renderPassOverride : compositeRenderPass,
-            .subpass = 0,
+            .subpass = subpass,
             .basePipelineHandle = VK_NULL_HANDLE,
             .basePipelineIndex = -1,
         };
@@ -440,7 +567,7 @@ struct TextVertex{
         vkDestroyShaderModule(device, fragmentShader, nullptr);
         vkDestroyShaderModule(device, vertexShader, nullptr);
     }
-    void Renderer::createDescriptorSetLayout(int vertexBitBindings, int fragmentBitBindings, VkDescriptorSetLayout& descriptorSetLayout, VkShaderStageFlags shaderStage, const std::vector<uint32_t>* fragmentDescriptorCounts) {
+    void Renderer::createDescriptorSetLayout(int vertexBitBindings, int fragmentBitBindings, VkDescriptorSetLayout& descriptorSetLayout, VkShaderStageFlags shaderStage, const std::vector<uint32_t>* fragmentDescriptorCounts, VkDescriptorType vertexDescriptorType, const std::vector<VkDescriptorType>* fragmentDescriptorTypes) {
         const int totalVertexBindings = std::max(vertexBitBindings, 0);
         const int totalFragmentBindings = std::max(fragmentBitBindings, 0);
         std::vector<VkDescriptorSetLayoutBinding> bindings;
@@ -450,11 +577,13 @@ struct TextVertex{
         
         VkShaderStageFlags uboStageFlags = isCompute ? VK_SHADER_STAGE_COMPUTE_BIT : 
                                                        (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+        const VkDescriptorType vertexType = vertexDescriptorType != VK_DESCRIPTOR_TYPE_MAX_ENUM ? vertexDescriptorType :
+                                            (isCompute ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
         
         for (int bindingIndex = 0; bindingIndex < totalVertexBindings; ++bindingIndex) {
             VkDescriptorSetLayoutBinding vertexLayoutBinding = {
                 .binding = static_cast<uint32_t>(bindingIndex),
-                .descriptorType = isCompute ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .descriptorType = vertexType,
                 .descriptorCount = 1,
                 .stageFlags = uboStageFlags,
                 .pImmutableSamplers = nullptr,
@@ -466,9 +595,13 @@ struct TextVertex{
             if (fragmentDescriptorCounts && static_cast<size_t>(offset) < fragmentDescriptorCounts->size()) {
                 descriptorCount = std::max((*fragmentDescriptorCounts)[static_cast<size_t>(offset)], 1u);
             }
+            VkDescriptorType descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            if (fragmentDescriptorTypes && static_cast<size_t>(offset) < fragmentDescriptorTypes->size()) {
+                descriptorType = (*fragmentDescriptorTypes)[static_cast<size_t>(offset)];
+            }
             VkDescriptorSetLayoutBinding fragmentLayoutBinding = {
                 .binding = static_cast<uint32_t>(totalVertexBindings + offset),
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .descriptorType = descriptorType,
                 .descriptorCount = descriptorCount,
                 .stageFlags = static_cast<VkShaderStageFlags>(isCompute ? VK_SHADER_STAGE_COMPUTE_BIT : VK_SHADER_STAGE_FRAGMENT_BIT),
                 .pImmutableSamplers = nullptr,
@@ -484,16 +617,29 @@ struct TextVertex{
             throw std::runtime_error("failed to create descriptor set layout!");
         }
     }
-    void Renderer::createDescriptorPool(int vertexBitBindings, int fragmentBitBindings, VkDescriptorPool &descriptorPool, int multiplier, bool isCompute, const std::vector<uint32_t>* fragmentDescriptorCounts) {
+    void Renderer::createDescriptorPool(int vertexBitBindings, int fragmentBitBindings, VkDescriptorPool &descriptorPool, int multiplier, bool isCompute, const std::vector<uint32_t>* fragmentDescriptorCounts, VkDescriptorType vertexDescriptorType, const std::vector<VkDescriptorType>* fragmentDescriptorTypes) {
         std::vector<VkDescriptorPoolSize> poolSizes;
         if (vertexBitBindings > 0) {
             VkDescriptorPoolSize vertexPoolSize = {
-                .type = isCompute ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .type = vertexDescriptorType != VK_DESCRIPTOR_TYPE_MAX_ENUM ? vertexDescriptorType :
+                        (isCompute ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
                 .descriptorCount = static_cast<uint32_t>(vertexBitBindings * MAX_FRAMES_IN_FLIGHT * multiplier),
             };
             poolSizes.push_back(vertexPoolSize);
         }
-        if (fragmentBitBindings > 0) {
+        if (fragmentBitBindings > 0 && fragmentDescriptorTypes && fragmentDescriptorTypes->size() == static_cast<size_t>(fragmentBitBindings)) {
+            // Mixed binding types: one pool size per binding; the pool sums sizes of the same type.
+            for (int offset = 0; offset < fragmentBitBindings; ++offset) {
+                uint32_t count = 1;
+                if (fragmentDescriptorCounts && static_cast<size_t>(offset) < fragmentDescriptorCounts->size()) {
+                    count = std::max((*fragmentDescriptorCounts)[static_cast<size_t>(offset)], 1u);
+                }
+                poolSizes.push_back({
+                    .type = (*fragmentDescriptorTypes)[static_cast<size_t>(offset)],
+                    .descriptorCount = count * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT * multiplier),
+                });
+            }
+        } else if (fragmentBitBindings > 0) {
             uint32_t totalFragmentDescriptors = static_cast<uint32_t>(fragmentBitBindings);
             if (fragmentDescriptorCounts && fragmentDescriptorCounts->size() == static_cast<size_t>(fragmentBitBindings)) {
                 totalFragmentDescriptors = 0;
@@ -517,7 +663,7 @@ struct TextVertex{
             throw std::runtime_error("failed to create descriptor pool!");
         }
     }
-    std::vector<VkDescriptorSet> Renderer::createDescriptorSets(VkDescriptorPool pool, VkDescriptorSetLayout& descriptorSetLayout, int vertexBindingCount, int fragmentBindingCount, std::vector<Image*>& textures, std::vector<VkBuffer>& uniformBuffers) {
+    std::vector<VkDescriptorSet> Renderer::createDescriptorSets(VkDescriptorPool pool, VkDescriptorSetLayout& descriptorSetLayout, int vertexBindingCount, int fragmentBindingCount, std::vector<Image*>& textures, std::vector<VkBuffer>& uniformBuffers, VkDescriptorType bufferDescriptorType, VkDeviceSize bufferRange) {
         std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
         VkDescriptorSetAllocateInfo allocInfo = {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
@@ -557,7 +703,7 @@ struct TextVertex{
                 bufferInfos.push_back({
                     .buffer = bufferHandle,
                     .offset = 0,
-                    .range = VK_WHOLE_SIZE,
+                    .range = bufferRange,
                 });
                 VkWriteDescriptorSet write = {
                     .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
@@ -565,7 +711,7 @@ struct TextVertex{
                     .dstBinding = u,
                     .dstArrayElement = 0,
                     .descriptorCount = 1,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                    .descriptorType = bufferDescriptorType,
                     .pBufferInfo = &bufferInfos.back(),
                 };
                 descriptorWrites.push_back(write);
@@ -627,8 +773,8 @@ struct TextVertex{
             }
         }
     }
-    void Renderer::createTextureImageView(VkFormat textureFormat, VkImage textureImage, VkImageView &textureImageView) {
-        textureImageView = createImageView(textureImage, textureFormat, 1);
+    void Renderer::createTextureImageView(VkFormat textureFormat, VkImage textureImage, VkImageView &textureImageView, uint32_t mipLevels) {
+        textureImageView = createImageView(textureImage, textureFormat, mipLevels);
     }
     VkImageView Renderer::createImageView(VkImage image, VkFormat format, uint32_t mipLevels, VkImageAspectFlags aspectFlags, VkImageViewType viewType, uint32_t layerCount){
         VkImageAspectFlags resolvedAspect = aspectFlags;
@@ -662,7 +808,7 @@ struct TextVertex{
         }
         return imageView;
     }
-    void Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+    void Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& bufferMemory) {
         VkBufferCreateInfo bufferInfo = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
             .size = size,
@@ -674,48 +820,11 @@ struct TextVertex{
         }
         VkMemoryRequirements memRequirements;
         vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
-        VkMemoryAllocateInfo allocInfo = {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .allocationSize = memRequirements.size,
-            .memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties),
-        };
-        if(vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate buffer memory!");
-        }
-        vkBindBufferMemory(device, buffer, bufferMemory, 0);
-    }
-    void Renderer::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount, VkDeviceSize layerSize) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-        if (layerCount == 0) {
-            layerCount = 1;
-        }
-        const VkDeviceSize inferredLayerSize = layerSize != 0 ? layerSize : static_cast<VkDeviceSize>(width) * static_cast<VkDeviceSize>(height) * 4;
-        std::vector<VkBufferImageCopy> regions(layerCount);
-        for (uint32_t layer = 0; layer < layerCount; ++layer) {
-            VkBufferImageCopy region = {
-                .bufferOffset = inferredLayerSize * layer,
-                .bufferRowLength = 0,
-                .bufferImageHeight = 0,
-                .imageSubresource = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .mipLevel = 0,
-                    .baseArrayLayer = layer,
-                    .layerCount = 1,
-                },
-                .imageOffset = {0, 0, 0},
-                .imageExtent = {
-                    .width = width,
-                    .height = height,
-                    .depth = 1,
-                },
-            };
-            regions[layer] = region;
-        }
-        vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
-        endSingleTimeCommands(commandBuffer);
+        bufferMemory = memoryAllocator.allocate(memRequirements, properties, true);
+        vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
     }
+    // Recorded into the upload batch, which is flushed before the next frame or one-time submission.
     void Renderer::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels, uint32_t layerCount) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
         VkImageMemoryBarrier barrier = {
             .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
             .oldLayout = oldLayout,
@@ -764,10 +873,11 @@ struct TextVertex{
         } else {
             barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         }
-        vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-        endSingleTimeCommands(commandBuffer);
+        uploadManager.recordGraphics([&](VkCommandBuffer commandBuffer) {
+            vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        });
     }
-    void Renderer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t arrayLayers, VkImageCreateFlags flags) {
+    void Renderer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, DeviceAllocation& imageMemory, uint32_t arrayLayers, VkImageCreateFlags flags) {
         VkImageCreateInfo imageInfo = {
             .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
             .flags = flags,
@@ -789,17 +899,22 @@ struct TextVertex{
         if(vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
             throw std::runtime_error("failed to create image!");
         }
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, image, &memRequirements);
-        VkMemoryAllocateInfo allocInfo = {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .allocationSize = memRequirements.size,
-            .memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties),
+        // Render targets on some drivers run faster in memory of their own, which they report here.
+        VkMemoryDedicatedRequirements dedicatedRequirements = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
         };
-        if(vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-        vkBindImageMemory(device, image, imageMemory, 0);
+        VkMemoryRequirements2 memRequirements = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+            .pNext = &dedicatedRequirements,
+        };
+        VkImageMemoryRequirementsInfo2 requirementsInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+            .image = image,
+        };
+        vkGetImageMemoryRequirements2(device, &requirementsInfo, &memRequirements);
+        const bool dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+        imageMemory = memoryAllocator.allocate(memRequirements.memoryRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR, dedicated, image);
+        vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
     }
     void Renderer::initWindow() {
         glfwInit();
@@ -828,6 +943,10 @@ struct TextVertex{
         #endif
     }
     void Renderer::cleanup() {
+        if (device != VK_NULL_HANDLE) {
+            // Pending uploads may target anything the managers below destroy.
+            uploadManager.wait(uploadManager.flush());
+        }
         if (uiManager) {
             uiManager->clear();
             uiManager = nullptr;
@@ -861,14 +980,31 @@ struct TextVertex{
         }
         vkDeviceWaitIdle(device);
         cleanupSwapChain();
+        retireIndirectDrawResources();
+        releaseRetiredIndirectDrawResources(true);
+        for (size_t i = 0; i < uniformRingBuffers.size(); i++) {
+            if (uniformRingBuffers[i]) {
+                vkDestroyBuffer(device, uniformRingBuffers[i], nullptr);
+                memoryAllocator.free(uniformRingMemory[i]);
+                uniformRingBuffers[i] = VK_NULL_HANDLE;
+            }
+        }
         if (gBufferRenderPass) {
             vkDestroyRenderPass(device, gBufferRenderPass, nullptr);
             gBufferRenderPass = VK_NULL_HANDLE;
         }
+        if (gBufferRenderPassLoad) {
+            vkDestroyRenderPass(device, gBufferRenderPassLoad, nullptr);
+            gBufferRenderPassLoad = VK_NULL_HANDLE;
+        }
         if (lightingRenderPass) {
             vkDestroyRenderPass(device, lightingRenderPass, nullptr);
             lightingRenderPass = VK_NULL_HANDLE;
         }
+        if (deferredRenderPass) {
+            vkDestroyRenderPass(device, deferredRenderPass, nullptr);
+            deferredRenderPass = VK_NULL_HANDLE;
+        }
         if (shadowRenderPass) {
             vkDestroyRenderPass(device, shadowRenderPass, nullptr);
             shadowRenderPass = VK_NULL_HANDLE;
@@ -877,6 +1013,19 @@ struct TextVertex{
             vkDestroyRenderPass(device, shadowRenderPassLoad, nullptr);
             shadowRenderPassLoad = VK_NULL_HANDLE;
         }
+        if (shadowRenderPassMultiview) {
+            vkDestroyRenderPass(device, shadowRenderPassMultiview, nullptr);
+            shadowRenderPassMultiview = VK_NULL_HANDLE;
+        }
+        if (shadowRenderPassMultiviewLoad) {
+            vkDestroyRenderPass(device, shadowRenderPassMultiviewLoad, nullptr);
+            shadowRenderPassMultiviewLoad = VK_NULL_HANDLE;
+        }
+        if (shadowTimestampPool) {
+            vkDestroyQueryPool(device, shadowTimestampPool, nullptr);
+            shadowTimestampPool = VK_NULL_HANDLE;
+        }
+        gpuProfiler.destroy();
         if (compositeRenderPass) {
             vkDestroyRenderPass(device, compositeRenderPass, nullptr);
             compositeRenderPass = VK_NULL_HANDLE;
@@ -885,6 +1034,22 @@ struct TextVertex{
             vkDestroySampler(device, gBufferSampler, nullptr);
             gBufferSampler = VK_NULL_HANDLE;
         }
+        if (upscaleSampler) {
+            vkDestroySampler(device, upscaleSampler, nullptr);
+            upscaleSampler = VK_NULL_HANDLE;
+        }
+        if (shadowCompareSampler) {
+            vkDestroySampler(device, shadowCompareSampler, nullptr);
+            shadowCompareSampler = VK_NULL_HANDLE;
+        }
+        if (hiZSampler) {
+            vkDestroySampler(device, hiZSampler, nullptr);
+            hiZSampler = VK_NULL_HANDLE;
+        }
+        if (ssrHistorySampler) {
+            vkDestroySampler(device, ssrHistorySampler, nullptr);
+            ssrHistorySampler = VK_NULL_HANDLE;
+        }
         if (textureSampler) {
             vkDestroySampler(device, textureSampler, nullptr);
             textureSampler = VK_NULL_HANDLE;
@@ -915,23 +1080,19 @@ struct TextVertex{
             vkDestroyBuffer(device, quadVertexBuffer, nullptr);
             quadVertexBuffer = VK_NULL_HANDLE;
         }
-        if (quadVertexBufferMemory) {
-            vkFreeMemory(device, quadVertexBufferMemory, nullptr);
-            quadVertexBufferMemory = VK_NULL_HANDLE;
-        }
+        memoryAllocator.free(quadVertexBufferMemory);
         if (quadIndexBuffer) {
             vkDestroyBuffer(device, quadIndexBuffer, nullptr);
             quadIndexBuffer = VK_NULL_HANDLE;
         }
-        if (quadIndexBufferMemory) {
-            vkFreeMemory(device, quadIndexBufferMemory, nullptr);
-            quadIndexBufferMemory = VK_NULL_HANDLE;
-        }
+        memoryAllocator.free(quadIndexBufferMemory);
         if (commandPool) {
             vkDestroyCommandPool(device, commandPool, nullptr);
             commandPool = VK_NULL_HANDLE;
         }
         if (device != VK_NULL_HANDLE) {
+            uploadManager.destroy();
+            memoryAllocator.destroy();
             vkDestroyDevice(device, nullptr);
             device = VK_NULL_HANDLE;
         }
@@ -961,20 +1122,32 @@ struct TextVertex{
         createLogicalDevice();
         createSwapChain();
         createImageViews();
-        createGBufferResources();
         createGBufferRenderPass();
-        createGBufferFramebuffers();
-        createLightingResources();
         createLightingRenderPass();
+        createDeferredRenderPass();
         createShadowRenderPass();
         createShadowRenderPassLoad();
-        createLightingFramebuffers();
+        createShadowRenderPassMultiview();
         createCompositeRenderPass();
         createCompositeFramebuffers();
         createCommandPool();
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        uniformRingAlignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
+        for (uint32_t i = 0; i < kMaxFramesInFlight; i++) {
+            createUniformRingBuffer(i, kUniformRingFrameSize);
+        }
+        createShadowTimestampPool();
+        createGBufferResources();
+        createLightingResources();
         createSSRResources();
+        createHiZResources();
+        createFrameGraph();
+        createGBufferFramebuffers();
+        createLightingFramebuffers();
         createTextureSampler();
         createGBufferSampler();
+        createShadowCompareSampler();
         shaderManager = ShaderManager::getInstance();
         setupUI();
         sceneManager = SceneManager::getInstance();
@@ -990,6 +1163,7 @@ struct TextVertex{
         createQuadBuffers();
         createCommandBuffers();
         createSyncObjects();
+        std::cout << "Device memory: " << DeviceAllocator::format(memoryAllocator.getStats()) << std::endl;
     }
     void Renderer::mainLoop() {
         while(!glfwWindowShouldClose(window)) {
@@ -1000,11 +1174,30 @@ struct TextVertex{
         vkDeviceWaitIdle(device);
     }
     void Renderer::drawFrame() {
-        deltaTime = static_cast<float>(glfwGetTime()) - currentTime;
-        currentTime = static_cast<float>(glfwGetTime());
+        CPU_PROFILE_ZONE("drawFrame");
+        if (headless) {
+            // Fixed steps keep benchmark runs comparable whatever the frame rate.
+            deltaTime = 1.0f / 60.0f;
+            currentTime += deltaTime;
+        } else {
+            deltaTime = static_cast<float>(glfwGetTime()) - currentTime;
+            currentTime = static_cast<float>(glfwGetTime());
+        }
         vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
-        uint32_t imageIndex;
-        VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        uploadManager.poll();
+        releaseRetiredIndirectDrawResources(false);
+        // CPU time excludes the waits on the fence and the swapchain, which only reflect the GPU and vsync.
+        const std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+        collectShadowTimings();
+        gpuProfiler.collect(currentFrame);
+        updateGpuProfilerOverlay();
+        updateQualityGovernor();
+        updateShadowBudget();
+        // Headless, each frame slot owns one offscreen image, free once the slot's fence has signalled.
+        uint32_t imageIndex = currentFrame;
+        const std::chrono::steady_clock::time_point acquireStart = std::chrono::steady_clock::now();
+        VkResult result = headless ? VK_SUCCESS : vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        const std::chrono::steady_clock::time_point acquireEnd = std::chrono::steady_clock::now();
         if (result == VK_ERROR_OUT_OF_DATE_KHR) {
             recreateSwapChain();
             return;
@@ -1017,17 +1210,24 @@ struct TextVertex{
         VkPipelineStageFlags waitStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
         VkSubmitInfo submitInfo = {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .waitSemaphoreCount = 1,
+            .waitSemaphoreCount = headless ? 0u : 1u,
             .pWaitSemaphores = &imageAvailableSemaphores[currentFrame],
             .pWaitDstStageMask = &waitStages,
             .commandBufferCount = 1,
             .pCommandBuffers = &commandBuffers[currentFrame],
-            .signalSemaphoreCount = 1,
+            .signalSemaphoreCount = headless ? 0u : 1u,
             .pSignalSemaphores = &renderFinishedSemaphores[currentFrame],
         };
+        // Uploads recorded while loading this frame's content are ordered ahead of it.
+        uploadManager.flush();
         if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
             throw std::runtime_error("failed to submit draw command buffer!");
         }
+        frameCpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart - (acquireEnd - acquireStart)).count();
+        if (headless) {
+            currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+            return;
+        }
         VkPresentInfoKHR presentInfo = {
             .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
             .waitSemaphoreCount = 1,
@@ -1046,7 +1246,7 @@ struct TextVertex{
         currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 void Renderer::createInstance() {
-    if(!glfwVulkanSupported()) {
+    if(!headless && !glfwVulkanSupported()) {
         throw std::runtime_error(
             "GLFW reports that Vulkan is unavailable. Ensure the Vulkan SDK/MoltenVK is installed and "
             "relaunch the application with VK_ICD_FILENAMES pointing at MoltenVK_icd.json."
@@ -1096,6 +1296,9 @@ void Renderer::createInstance() {
         }
     }
     void Renderer::createSurface() {
+        if(headless) {
+            return;
+        }
         if(!window) {
             throw std::runtime_error("GLFW window was not created before attempting to create a Vulkan surface.");
         }
@@ -1134,6 +1337,9 @@ void Renderer::createInstance() {
             indices.graphicsFamily.value(),
             indices.presentFamily.value()
         };
+        if (indices.transferFamily) {
+            uniqueQueueFamilies.insert(indices.transferFamily.value());
+        }
         float queuePriority = 1.0f;
         for(uint32_t queueFamily : uniqueQueueFamilies) {
             VkDeviceQueueCreateInfo queueCreateInfo = {
@@ -1150,8 +1356,12 @@ void Renderer::createInstance() {
         };
         bool enableAtomicFloatExt = false;
         bool canUseBufferFloat32AtomicAdd = false;
+        VkPhysicalDeviceMultiviewFeatures multiviewFeatures = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES,
+        };
         VkPhysicalDeviceShaderAtomicFloatFeaturesEXT atomicFloatFeatures = {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_ATOMIC_FLOAT_FEATURES_EXT,
+            .pNext = &multiviewFeatures,
         };
         VkPhysicalDeviceFeatures2 features2 = {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
@@ -1163,6 +1373,29 @@ void Renderer::createInstance() {
             canUseBufferFloat32AtomicAdd = atomicFloatFeatures.shaderBufferFloat32AtomicAdd == VK_TRUE;
         }
         g_useCASAdvection = !(enableAtomicFloatExt && canUseBufferFloat32AtomicAdd);
+        if(features2.features.drawIndirectFirstInstance == VK_TRUE) {
+            deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+            gpuDrivenGeometry = true;
+        }
+        supportsMultiview = multiviewFeatures.multiview == VK_TRUE;
+        layeredShadows = supportsMultiview;
+        if(features2.features.shaderStorageImageExtendedFormats == VK_TRUE) {
+            deviceFeatures.shaderStorageImageExtendedFormats = VK_TRUE;
+            supportsHiZ = true;
+        }
+        if(features2.features.multiDrawIndirect == VK_TRUE) {
+            deviceFeatures.multiDrawIndirect = VK_TRUE;
+            supportsMultiDrawIndirect = true;
+        }
+        if(features2.features.pipelineStatisticsQuery == VK_TRUE) {
+            deviceFeatures.pipelineStatisticsQuery = VK_TRUE;
+            supportsPipelineStatistics = true;
+        }
+        if(features2.features.textureCompressionBC == VK_TRUE) {
+            deviceFeatures.textureCompressionBC = VK_TRUE;
+            supportsBlockCompression = true;
+        }
+        const bool enableDrawIndirectCountExt = gpuDrivenGeometry && hasDeviceExtension(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
         VkDeviceCreateInfo createInfo = {
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
             .queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
@@ -1178,12 +1411,25 @@ void Renderer::createInstance() {
             enabledAtomicFloat.shaderBufferFloat32AtomicAdd = VK_TRUE;
             enabledFeatures2.pNext = &enabledAtomicFloat;
         }
+        VkPhysicalDeviceMultiviewFeatures enabledMultiview{};
+        if(supportsMultiview) {
+            enabledMultiview.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
+            enabledMultiview.multiview = VK_TRUE;
+            enabledMultiview.pNext = enabledFeatures2.pNext;
+            enabledFeatures2.pNext = &enabledMultiview;
+        }
         createInfo.pNext = &enabledFeatures2;
         createInfo.pEnabledFeatures = nullptr;
         std::vector<const char*> enabledExts = deviceExtensions;
+        if(headless) {
+            std::erase_if(enabledExts, [](const char* ext) { return std::strcmp(ext, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0; });
+        }
         if(!g_useCASAdvection && enableAtomicFloatExt) {
             enabledExts.push_back(VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME);
         }
+        if(enableDrawIndirectCountExt) {
+            enabledExts.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        }
         createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExts.size());
         createInfo.ppEnabledExtensionNames = enabledExts.data();
         if(enableValidationLayers) {
@@ -1197,8 +1443,32 @@ void Renderer::createInstance() {
         }
         vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+        const uint32_t transferFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+        vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
+        if(enableDrawIndirectCountExt) {
+            cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR"));
+        }
+        softwareOcclusionEnabled = cmdDrawIndexedIndirectCount == nullptr;
+        memoryAllocator.init(device, physicalDevice);
+        uploadManager.init(device, physicalDevice, memoryAllocator, indices.graphicsFamily.value(), graphicsQueue, transferFamily, transferQueue);
+        frameGraph.init(device, physicalDevice);
+        gpuProfiler.init(device, physicalDevice, indices.graphicsFamily.value(), kMaxFramesInFlight, supportsPipelineStatistics);
+        frameGraph.setProfiler(&gpuProfiler);
+        chooseRenderTargetFormats();
     }
     void Renderer::createSwapChain() {
+        if (headless) {
+            swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+            swapChainExtent = headlessExtent;
+            swapChainImages.resize(kMaxFramesInFlight);
+            swapChainImageMemory.resize(kMaxFramesInFlight);
+            for (uint32_t i = 0; i < kMaxFramesInFlight; i++) {
+                createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+                    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i], swapChainImageMemory[i]);
+            }
+            updateRenderExtent();
+            return;
+        }
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
         VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
         VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
@@ -1242,10 +1512,13 @@ void Renderer::createInstance() {
         vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
         swapChainImageFormat = surfaceFormat.format;
         swapChainExtent = extent;
+        updateRenderExtent();
     }
     void Renderer::recreateSwapChain() {
-        int width = 0, height = 0;
-        glfwGetFramebufferSize(window, &width, &height);
+        int width = 1, height = 1;
+        if (!headless) {
+            glfwGetFramebufferSize(window, &width, &height);
+        }
         while(width == 0 || height == 0) {
             glfwGetFramebufferSize(window, &width, &height);
             glfwWaitEvents();
@@ -1255,12 +1528,16 @@ void Renderer::createInstance() {
         createSwapChain();
         createImageViews();
         createGBufferResources();
-        createGBufferFramebuffers();
         createLightingResources();
-        createLightingFramebuffers();
         createSSRResources();
+        createHiZResources();
+        createFrameGraph();
+        createGBufferFramebuffers();
+        createLightingFramebuffers();
         createCompositeFramebuffers();
         recreateDeferredDescriptorSets();
+        // Targets at the old size are gone and their replacements allocated, so spare blocks go back.
+        memoryAllocator.trim();
     }
     void Renderer::cleanupSwapChain() {
         if (device == VK_NULL_HANDLE) {
@@ -1269,203 +1546,246 @@ void Renderer::createInstance() {
             swapChain = VK_NULL_HANDLE;
             depthImageView = VK_NULL_HANDLE;
             depthImage = VK_NULL_HANDLE;
-            depthImageMemory = VK_NULL_HANDLE;
+            depthImageMemory = {};
             colorImageView = VK_NULL_HANDLE;
             colorImage = VK_NULL_HANDLE;
-            colorImageMemory = VK_NULL_HANDLE;
+            colorImageMemory = {};
             return;
         }
-        for (auto framebuffer : gBufferFramebuffers) {
-            vkDestroyFramebuffer(device, framebuffer, nullptr);
-        }
-        gBufferFramebuffers.clear();
-        for (auto framebuffer : lightingFramebuffers) {
-            vkDestroyFramebuffer(device, framebuffer, nullptr);
-        }
-        lightingFramebuffers.clear();
         for (auto framebuffer : compositeFramebuffers) {
             vkDestroyFramebuffer(device, framebuffer, nullptr);
         }
         compositeFramebuffers.clear();
-        if (gBufferAlbedoView) vkDestroyImageView(device, gBufferAlbedoView, nullptr);
-        if (gBufferAlbedoImage) vkDestroyImage(device, gBufferAlbedoImage, nullptr);
-        if (gBufferAlbedoMemory) vkFreeMemory(device, gBufferAlbedoMemory, nullptr);
-        if (gBufferNormalView) vkDestroyImageView(device, gBufferNormalView, nullptr);
-        if (gBufferNormalImage) vkDestroyImage(device, gBufferNormalImage, nullptr);
-        if (gBufferNormalMemory) vkFreeMemory(device, gBufferNormalMemory, nullptr);
-        if (gBufferMaterialView) vkDestroyImageView(device, gBufferMaterialView, nullptr);
-        if (gBufferMaterialImage) vkDestroyImage(device, gBufferMaterialImage, nullptr);
-        if (gBufferMaterialMemory) vkFreeMemory(device, gBufferMaterialMemory, nullptr);
-        if (gBufferDepthView) vkDestroyImageView(device, gBufferDepthView, nullptr);
-        if (gBufferDepthImage) vkDestroyImage(device, gBufferDepthImage, nullptr);
-        if (gBufferDepthMemory) vkFreeMemory(device, gBufferDepthMemory, nullptr);
-        if (lightingView) vkDestroyImageView(device, lightingView, nullptr);
-        if (lightingImage) vkDestroyImage(device, lightingImage, nullptr);
-        if (lightingMemory) vkFreeMemory(device, lightingMemory, nullptr);
-        if (ssrView) vkDestroyImageView(device, ssrView, nullptr);
-        if (ssrImage) vkDestroyImage(device, ssrImage, nullptr);
-        if (ssrMemory) vkFreeMemory(device, ssrMemory, nullptr);
-        for (size_t i = 0; i < lightsUniformBuffers.size(); i++) {
-            if (lightsUniformBuffers[i]) {
-                vkDestroyBuffer(device, lightsUniformBuffers[i], nullptr);
-            }
-            if (lightsUniformBuffersMemory[i]) {
-                vkFreeMemory(device, lightsUniformBuffersMemory[i], nullptr);
-            }
-        }
-        lightsUniformBuffers.clear();
-        lightsUniformBuffersMemory.clear();
+        cleanupRenderTargets();
         for (auto framebuffer : swapChainFramebuffers) {
             vkDestroyFramebuffer(device, framebuffer, nullptr);
         }
         swapChainFramebuffers.clear();
         if (depthImageView) vkDestroyImageView(device, depthImageView, nullptr);
         if (depthImage) vkDestroyImage(device, depthImage, nullptr);
-        if (depthImageMemory) vkFreeMemory(device, depthImageMemory, nullptr);
+        memoryAllocator.free(depthImageMemory);
         if (colorImageView) vkDestroyImageView(device, colorImageView, nullptr);
         if (colorImage) vkDestroyImage(device, colorImage, nullptr);
-        if (colorImageMemory) vkFreeMemory(device, colorImageMemory, nullptr);
+        memoryAllocator.free(colorImageMemory);
         for (auto imageView : swapChainImageViews) {
             vkDestroyImageView(device, imageView, nullptr);
         }
         swapChainImageViews.clear();
+        for (size_t i = 0; i < swapChainImageMemory.size(); i++) {
+            vkDestroyImage(device, swapChainImages[i], nullptr);
+            memoryAllocator.free(swapChainImageMemory[i]);
+        }
+        swapChainImageMemory.clear();
         if (swapChain) vkDestroySwapchainKHR(device, swapChain, nullptr);
     }
+    // Everything sized by renderExtent, plus the per-frame buffers createDeferredDescriptorSets() recreates.
+    void Renderer::cleanupRenderTargets() {
+        // Transitions of the targets about to go may not have been submitted yet.
+        uploadManager.wait(uploadManager.flush());
+        for (auto framebuffer : gBufferFramebuffers) {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        gBufferFramebuffers.clear();
+        for (auto framebuffer : lightingFramebuffers) {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        lightingFramebuffers.clear();
+        // The graph owns the images and memory behind these views.
+        for (VkImageView* view : {&gBufferAlbedoView, &gBufferNormalView, &gBufferMaterialView, &gBufferDepthView, &lightingView, &ssrView, &ssrTraceView}) {
+            if (*view) vkDestroyImageView(device, *view, nullptr);
+            *view = VK_NULL_HANDLE;
+        }
+        frameGraph.reset();
+        gBufferAlbedoImage = VK_NULL_HANDLE;
+        gBufferNormalImage = VK_NULL_HANDLE;
+        gBufferMaterialImage = VK_NULL_HANDLE;
+        gBufferDepthImage = VK_NULL_HANDLE;
+        lightingImage = VK_NULL_HANDLE;
+        ssrImage = VK_NULL_HANDLE;
+        ssrTraceImage = VK_NULL_HANDLE;
+        for (size_t i = 0; i < ssrHistoryImages.size(); i++) {
+            if (ssrHistoryViews[i]) vkDestroyImageView(device, ssrHistoryViews[i], nullptr);
+            if (ssrHistoryImages[i]) vkDestroyImage(device, ssrHistoryImages[i], nullptr);
+            memoryAllocator.free(ssrHistoryMemory[i]);
+            ssrHistoryViews[i] = VK_NULL_HANDLE;
+            ssrHistoryImages[i] = VK_NULL_HANDLE;
+        }
+        for (VkImageView mipView : hiZMipViews) {
+            vkDestroyImageView(device, mipView, nullptr);
+        }
+        hiZMipViews.clear();
+        if (hiZView) vkDestroyImageView(device, hiZView, nullptr);
+        if (hiZImage) vkDestroyImage(device, hiZImage, nullptr);
+        memoryAllocator.free(hiZMemory);
+        hiZView = VK_NULL_HANDLE;
+        hiZImage = VK_NULL_HANDLE;
+        for (size_t i = 0; i < lightsBuffers.size(); i++) {
+            if (lightsBuffers[i]) {
+                vkDestroyBuffer(device, lightsBuffers[i], nullptr);
+            }
+            memoryAllocator.free(lightsBuffersMemory[i]);
+        }
+        lightsBuffers.clear();
+        lightsBuffersMemory.clear();
+        lightsBuffersMapped.clear();
+        for (size_t i = 0; i < clusterBuffers.size(); i++) {
+            if (clusterBuffers[i]) vkDestroyBuffer(device, clusterBuffers[i], nullptr);
+            memoryAllocator.free(clusterBuffersMemory[i]);
+            if (clusterLightIndexBuffers[i]) vkDestroyBuffer(device, clusterLightIndexBuffers[i], nullptr);
+            memoryAllocator.free(clusterLightIndexBuffersMemory[i]);
+            if (lightCullStatsBuffers[i]) vkDestroyBuffer(device, lightCullStatsBuffers[i], nullptr);
+            memoryAllocator.free(lightCullStatsBuffersMemory[i]);
+        }
+        clusterBuffers.clear();
+        clusterBuffersMemory.clear();
+        clusterLightIndexBuffers.clear();
+        clusterLightIndexBuffersMemory.clear();
+        lightCullStatsBuffers.clear();
+        lightCullStatsBuffersMemory.clear();
+    }
+    // Rebuilds the internal targets at a new renderExtent without touching the swapchain.
+    void Renderer::recreateRenderTargets() {
+        vkDeviceWaitIdle(device);
+        cleanupRenderTargets();
+        createGBufferResources();
+        createLightingResources();
+        createSSRResources();
+        createHiZResources();
+        createFrameGraph();
+        createGBufferFramebuffers();
+        createLightingFramebuffers();
+        recreateDeferredDescriptorSets();
+        memoryAllocator.trim();
+    }
+    void Renderer::updateRenderExtent() {
+        renderExtent = {
+            .width = std::max(static_cast<uint32_t>(static_cast<float>(swapChainExtent.width) * renderScale + 0.5f), 1u),
+            .height = std::max(static_cast<uint32_t>(static_cast<float>(swapChainExtent.height) * renderScale + 0.5f), 1u),
+        };
+    }
     void Renderer::createImageViews() {
         swapChainImageViews.resize(swapChainImages.size());
         for(size_t i=0; i<swapChainImages.size(); i++) {
             swapChainImageViews[i] = createImageView(swapChainImages[i], swapChainImageFormat, 1);
         }
     }
+    // G-buffer, lighting and SSR targets are declared to the frame graph here; createFrameGraph()
+    // binds their (aliased) memory and creates the views once every pass is known.
     void Renderer::createGBufferResources() {
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT,
-            VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, gBufferAlbedoImage, gBufferAlbedoMemory);
-        gBufferAlbedoView = createImageView(gBufferAlbedoImage, VK_FORMAT_R16G16B16A16_SFLOAT, 1);
-
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT,
-            VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, gBufferNormalImage, gBufferNormalMemory);
-        gBufferNormalView = createImageView(gBufferNormalImage, VK_FORMAT_R16G16B16A16_SFLOAT, 1);
-
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT,
-            VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, gBufferMaterialImage, gBufferMaterialMemory);
-        gBufferMaterialView = createImageView(gBufferMaterialImage, VK_FORMAT_R8G8B8A8_UNORM, 1);
-
-        VkFormat depthFormat = findDepthFormat();
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT,
-            depthFormat, VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, gBufferDepthImage, gBufferDepthMemory);
-        gBufferDepthView = createImageView(gBufferDepthImage, depthFormat, 1, VK_IMAGE_ASPECT_DEPTH_BIT);
+        // In the single render pass path the lighting subpass reads every target as an input attachment.
+        // Albedo has no reader after it, so it never needs to leave tile memory; SSR and the Hi-Z build
+        // still sample normal, material and depth afterwards.
+        const VkImageUsageFlags inputUsage = singlePassDeferred ? VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT : 0u;
+        const VkImageUsageFlags colorUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | inputUsage;
+        const VkImageUsageFlags albedoUsage = singlePassDeferred
+            ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT
+            : colorUsage;
+        gBufferAlbedoResource = frameGraph.createImage("gbuffer albedo", {renderExtent, kGBufferAlbedoFormat, albedoUsage});
+        gBufferNormalResource = frameGraph.createImage("gbuffer normal", {renderExtent, gBufferNormalFormat, colorUsage});
+        gBufferMaterialResource = frameGraph.createImage("gbuffer material", {renderExtent, kGBufferMaterialFormat, colorUsage});
+        gBufferDepthResource = frameGraph.createImage("gbuffer depth", {renderExtent, findDepthFormat(),
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | inputUsage, VK_IMAGE_ASPECT_DEPTH_BIT});
+        gBufferAlbedoImage = frameGraph.getImage(gBufferAlbedoResource);
+        gBufferNormalImage = frameGraph.getImage(gBufferNormalResource);
+        gBufferMaterialImage = frameGraph.getImage(gBufferMaterialResource);
+        gBufferDepthImage = frameGraph.getImage(gBufferDepthResource);
     }
     void Renderer::createGBufferRenderPass() {
-        VkAttachmentDescription albedoAttachment = {
-            .format = VK_FORMAT_R16G16B16A16_SFLOAT,
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        };
-        
-        VkAttachmentDescription normalAttachment = {
-            .format = VK_FORMAT_R16G16B16A16_SFLOAT,
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        };
-        
-        VkAttachmentDescription materialAttachment = {
-            .format = VK_FORMAT_R8G8B8A8_UNORM,
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        };
-        
-        VkAttachmentDescription depthAttachment = {
-            .format = findDepthFormat(),
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
-        };
-        
-        VkAttachmentReference colorRefs[3] = {
-            {.attachment = 0, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},  // Albedo
-            {.attachment = 1, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},  // Normal
-            {.attachment = 2, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},  // Material
-        };
-        
-        VkAttachmentReference depthRef = {
-            .attachment = 3,
-            .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-        };
-        
-        VkSubpassDescription subpass = {
-            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-            .colorAttachmentCount = 3,
-            .pColorAttachments = colorRefs,
-            .pDepthStencilAttachment = &depthRef,
-        };
-        
-        VkSubpassDependency dependency = {
-            .srcSubpass = VK_SUBPASS_EXTERNAL,
-            .dstSubpass = 0,
-            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-            .srcAccessMask = 0,
-            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-        };
-        
-        std::array<VkAttachmentDescription, 4> attachments = {
-            albedoAttachment,
-            normalAttachment,
-            materialAttachment,
-            depthAttachment
-        };
-        
-        VkRenderPassCreateInfo renderPassInfo = {
-            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-            .attachmentCount = 4,
-            .pAttachments = attachments.data(),
-            .subpassCount = 1,
-            .pSubpasses = &subpass,
-            .dependencyCount = 1,
-            .pDependencies = &dependency,
-        };
-        
-        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &gBufferRenderPass) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create G-Buffer render pass!");
+        // The load variant continues a G-buffer that a previous pass already filled and left readable;
+        // the second occlusion culling phase draws into it after building the Hi-Z pyramid from its depth.
+        for (bool load : {false, true}) {
+            VkRenderPass& renderPass = load ? gBufferRenderPassLoad : gBufferRenderPass;
+            VkAttachmentDescription albedoAttachment = {
+                .format = kGBufferAlbedoFormat,
+                .samples = VK_SAMPLE_COUNT_1_BIT,
+                .loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .initialLayout = load ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+                .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            };
+            
+            VkAttachmentDescription normalAttachment = albedoAttachment;
+            normalAttachment.format = gBufferNormalFormat;
+            
+            VkAttachmentDescription materialAttachment = albedoAttachment;
+            materialAttachment.format = kGBufferMaterialFormat;
+            
+            VkAttachmentDescription depthAttachment = {
+                .format = findDepthFormat(),
+                .samples = VK_SAMPLE_COUNT_1_BIT,
+                .loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .initialLayout = load ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+                .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+            };
+            
+            VkAttachmentReference colorRefs[3] = {
+                {.attachment = 0, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},  // Albedo
+                {.attachment = 1, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},  // Normal
+                {.attachment = 2, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},  // Material
+            };
+            
+            VkAttachmentReference depthRef = {
+                .attachment = 3,
+                .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            };
+            
+            VkSubpassDescription subpass = {
+                .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+                .colorAttachmentCount = 3,
+                .pColorAttachments = colorRefs,
+                .pDepthStencilAttachment = &depthRef,
+            };
+            
+            // Loading follows the earlier pass's attachment writes and waits for the Hi-Z build that sampled
+            // the depth before it is written again.
+            VkSubpassDependency dependency = {
+                .srcSubpass = VK_SUBPASS_EXTERNAL,
+                .dstSubpass = 0,
+                .srcStageMask = load
+                    ? (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+                    : (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT),
+                .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                .srcAccessMask = load ? (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT) : 0u,
+                .dstAccessMask = load
+                    ? (VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT)
+                    : (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT),
+            };
+            
+            std::array<VkAttachmentDescription, 4> attachments = {
+                albedoAttachment,
+                normalAttachment,
+                materialAttachment,
+                depthAttachment
+            };
+            
+            VkRenderPassCreateInfo renderPassInfo = {
+                .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+                .attachmentCount = 4,
+                .pAttachments = attachments.data(),
+                .subpassCount = 1,
+                .pSubpasses = &subpass,
+                .dependencyCount = 1,
+                .pDependencies = &dependency,
+            };
+            
+            if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create G-Buffer render pass!");
+            }
         }
     }
     void Renderer::createLightingResources() {
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT,
-            VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lightingImage, lightingMemory);
-        lightingView = createImageView(lightingImage, VK_FORMAT_R16G16B16A16_SFLOAT, 1);
+        lightingResource = frameGraph.createImage("lighting", {renderExtent, lightingFormat,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT});
+        lightingImage = frameGraph.getImage(lightingResource);
     }
     void Renderer::createLightingRenderPass() {
         VkAttachmentDescription lightingAttachment = {
-            .format = VK_FORMAT_R16G16B16A16_SFLOAT,
+            .format = lightingFormat,
             .samples = VK_SAMPLE_COUNT_1_BIT,
             .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
             .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
@@ -1504,29 +1824,132 @@ void Renderer::createInstance() {
             throw std::runtime_error("Failed to create lighting render pass!");
         }
     }
-    void Renderer::createShadowRenderPass() {
-        if (shadowRenderPass != VK_NULL_HANDLE) {
-            vkDestroyRenderPass(device, shadowRenderPass, nullptr);
-            shadowRenderPass = VK_NULL_HANDLE;
+    // Geometry and lighting as two subpasses of one render pass. The lighting subpass reads the
+    // G-buffer as input attachments at its own pixel, so tilers resolve it from tile memory; only
+    // the targets read after the pass (normal, material, depth for SSR and Hi-Z) are stored.
+    void Renderer::createDeferredRenderPass() {
+        if (!singlePassDeferred) {
+            return;
         }
-        VkAttachmentDescription depthAttachment = {
-            .format = findDepthFormat(),
+        VkAttachmentDescription albedoAttachment = {
+            .format = kGBufferAlbedoFormat,
             .samples = VK_SAMPLE_COUNT_1_BIT,
             .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
             .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
             .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-            .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         };
-        VkAttachmentReference depthRef = {
-            .attachment = 0,
-            .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        VkAttachmentDescription normalAttachment = albedoAttachment;
+        normalAttachment.format = gBufferNormalFormat;
+        normalAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        VkAttachmentDescription materialAttachment = normalAttachment;
+        materialAttachment.format = kGBufferMaterialFormat;
+        VkAttachmentDescription depthAttachment = normalAttachment;
+        depthAttachment.format = findDepthFormat();
+        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        VkAttachmentDescription lightingAttachment = normalAttachment;
+        lightingAttachment.format = lightingFormat;
+        std::array<VkAttachmentDescription, 5> attachments = {
+            albedoAttachment,
+            normalAttachment,
+            materialAttachment,
+            depthAttachment,
+            lightingAttachment
         };
-        VkSubpassDescription subpass = {
-            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-            .colorAttachmentCount = 0,
-            .pColorAttachments = nullptr,
+
+        VkAttachmentReference gBufferRefs[3] = {
+            {.attachment = 0, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},  // Albedo
+            {.attachment = 1, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},  // Normal
+            {.attachment = 2, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},  // Material
+        };
+        VkAttachmentReference depthRef = {
+            .attachment = 3,
+            .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        };
+        // Same order as the lighting shader's bindings 3-6.
+        VkAttachmentReference inputRefs[4] = {
+            {.attachment = 0, .layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            {.attachment = 1, .layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            {.attachment = 2, .layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            {.attachment = 3, .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL},
+        };
+        VkAttachmentReference lightingRef = {
+            .attachment = 4,
+            .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        };
+        std::array<VkSubpassDescription, 2> subpasses = {{
+            {
+                .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+                .colorAttachmentCount = 3,
+                .pColorAttachments = gBufferRefs,
+                .pDepthStencilAttachment = &depthRef,
+            },
+            {
+                .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+                .inputAttachmentCount = 4,
+                .pInputAttachments = inputRefs,
+                .colorAttachmentCount = 1,
+                .pColorAttachments = &lightingRef,
+            },
+        }};
+        std::array<VkSubpassDependency, 2> dependencies = {{
+            {
+                .srcSubpass = VK_SUBPASS_EXTERNAL,
+                .dstSubpass = 0,
+                .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                .srcAccessMask = 0,
+                .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            },
+            {
+                // Per pixel: the lighting subpass only reads the G-buffer texel it shades.
+                .srcSubpass = 0,
+                .dstSubpass = 1,
+                .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+                .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+            },
+        }};
+        VkRenderPassCreateInfo renderPassInfo = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+            .attachmentCount = static_cast<uint32_t>(attachments.size()),
+            .pAttachments = attachments.data(),
+            .subpassCount = static_cast<uint32_t>(subpasses.size()),
+            .pSubpasses = subpasses.data(),
+            .dependencyCount = static_cast<uint32_t>(dependencies.size()),
+            .pDependencies = dependencies.data(),
+        };
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &deferredRenderPass) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create single pass deferred render pass!");
+        }
+    }
+    void Renderer::createShadowRenderPass() {
+        if (shadowRenderPass != VK_NULL_HANDLE) {
+            vkDestroyRenderPass(device, shadowRenderPass, nullptr);
+            shadowRenderPass = VK_NULL_HANDLE;
+        }
+        VkAttachmentDescription depthAttachment = {
+            .format = findDepthFormat(),
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        };
+        VkAttachmentReference depthRef = {
+            .attachment = 0,
+            .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        };
+        VkSubpassDescription subpass = {
+            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+            .colorAttachmentCount = 0,
+            .pColorAttachments = nullptr,
             .pDepthStencilAttachment = &depthRef,
         };
         VkSubpassDependency dependency = {
@@ -1597,22 +2020,130 @@ void Renderer::createInstance() {
             throw std::runtime_error("Failed to create shadow render pass load!");
         }
     }
+    void Renderer::createShadowRenderPassMultiview() {
+        if (!supportsMultiview) {
+            return;
+        }
+        const uint32_t viewMask = 0x3F;
+        const uint32_t correlationMask = 0x3F;
+        for (bool load : {false, true}) {
+            VkRenderPass& renderPass = load ? shadowRenderPassMultiviewLoad : shadowRenderPassMultiview;
+            if (renderPass != VK_NULL_HANDLE) {
+                vkDestroyRenderPass(device, renderPass, nullptr);
+                renderPass = VK_NULL_HANDLE;
+            }
+            VkAttachmentDescription depthAttachment = {
+                .format = findDepthFormat(),
+                .samples = VK_SAMPLE_COUNT_1_BIT,
+                .loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            };
+            VkAttachmentReference depthRef = {
+                .attachment = 0,
+                .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            };
+            VkSubpassDescription subpass = {
+                .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+                .colorAttachmentCount = 0,
+                .pColorAttachments = nullptr,
+                .pDepthStencilAttachment = &depthRef,
+            };
+            VkSubpassDependency dependency = {
+                .srcSubpass = VK_SUBPASS_EXTERNAL,
+                .dstSubpass = 0,
+                .srcStageMask = load ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                .srcAccessMask = load ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT,
+                .dstAccessMask = load ? (VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT) : VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            };
+            VkRenderPassMultiviewCreateInfo multiviewInfo = {
+                .sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO,
+                .subpassCount = 1,
+                .pViewMasks = &viewMask,
+                .correlationMaskCount = 1,
+                .pCorrelationMasks = &correlationMask,
+            };
+            VkRenderPassCreateInfo renderPassInfo = {
+                .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+                .pNext = &multiviewInfo,
+                .attachmentCount = 1,
+                .pAttachments = &depthAttachment,
+                .subpassCount = 1,
+                .pSubpasses = &subpass,
+                .dependencyCount = 1,
+                .pDependencies = &dependency,
+            };
+            if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create multiview shadow render pass!");
+            }
+        }
+    }
+    void Renderer::createShadowTimestampPool() {
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        if (queueFamilies[indices.graphicsFamily.value()].timestampValidBits == 0 || properties.limits.timestampPeriod <= 0.0f) {
+            return;
+        }
+        timestampPeriod = properties.limits.timestampPeriod;
+        VkQueryPoolCreateInfo queryPoolInfo = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = kShadowTimestampsPerFrame * kMaxFramesInFlight,
+        };
+        if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &shadowTimestampPool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create shadow timestamp query pool!");
+        }
+    }
+    void Renderer::collectShadowTimings() {
+        std::vector<ShadowTimingSample>& samples = shadowTimingSamples[currentFrame];
+        for (const ShadowTimingSample& sample : samples) {
+            ShadowTimingStats& stats = shadowTimingStats[sample.label];
+            stats.cpuMs += sample.cpuMs;
+            stats.samples++;
+            uint64_t timestamps[2] = {};
+            if (sample.firstQuery != UINT32_MAX && vkGetQueryPoolResults(device, shadowTimestampPool, sample.firstQuery, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+                stats.gpuMs += static_cast<double>(timestamps[1] - timestamps[0]) * timestampPeriod / 1.0e6;
+            }
+        }
+        samples.clear();
+        if (++shadowTimingFrames < 300 || shadowTimingStats.empty()) {
+            return;
+        }
+        if (isProfilingOutputEnabled()) {
+            std::cout << "Shadow timings (averaged over " << shadowTimingFrames << " frames):" << std::endl;
+            for (const auto& [label, stats] : shadowTimingStats) {
+                std::cout << "  " << label << ": cpu " << stats.cpuMs / stats.samples << " ms, gpu " << stats.gpuMs / stats.samples << " ms (" << stats.samples << " updates)" << std::endl;
+            }
+        }
+        shadowTimingStats.clear();
+        shadowTimingFrames = 0;
+    }
     void Renderer::createGBufferFramebuffers() {
         gBufferFramebuffers.resize(swapChainImageViews.size());
         for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-            std::array<VkImageView, 4> attachments = {
+            std::array<VkImageView, 5> attachments = {
                 gBufferAlbedoView,
                 gBufferNormalView,
                 gBufferMaterialView,
-                gBufferDepthView
+                gBufferDepthView,
+                lightingView
             };
             VkFramebufferCreateInfo framebufferInfo = {
                 .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-                .renderPass = gBufferRenderPass,
-                .attachmentCount = static_cast<uint32_t>(attachments.size()),
+                .renderPass = getGBufferRenderPass(),
+                .attachmentCount = singlePassDeferred ? 5u : 4u,
                 .pAttachments = attachments.data(),
-                .width = swapChainExtent.width,
-                .height = swapChainExtent.height,
+                .width = renderExtent.width,
+                .height = renderExtent.height,
                 .layers = 1,
             };
             
@@ -1643,8 +2174,43 @@ void Renderer::createInstance() {
         if (vkCreateSampler(device, &samplerInfo, nullptr, &gBufferSampler) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create G-Buffer sampler!");
         }
+        // Composite reads lighting and SSR through this one, so a reduced renderExtent is upscaled bilinearly.
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &upscaleSampler) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create upscale sampler!");
+        }
+    }
+    void Renderer::createShadowCompareSampler() {
+        // Shadow cubemaps store linear distance / far; a LESS_OR_EQUAL compare against the receiver's
+        // distance returns the bilinearly filtered lit fraction in one fetch.
+        VkSamplerCreateInfo samplerInfo = {
+            .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            .magFilter = VK_FILTER_LINEAR,
+            .minFilter = VK_FILTER_LINEAR,
+            .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+            .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .mipLodBias = 0.0f,
+            .anisotropyEnable = VK_FALSE,
+            .maxAnisotropy = 1.0f,
+            .compareEnable = VK_TRUE,
+            .compareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
+            .minLod = 0.0f,
+            .maxLod = 0.0f,
+            .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+            .unnormalizedCoordinates = VK_FALSE,
+        };
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &shadowCompareSampler) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create shadow compare sampler!");
+        }
     }
     void Renderer::createLightingFramebuffers() {
+        // The merged render pass writes lighting through the G-buffer framebuffers.
+        if (singlePassDeferred) {
+            return;
+        }
         lightingFramebuffers.resize(swapChainImageViews.size());
         for (size_t i = 0; i < swapChainImageViews.size(); i++) {
             VkImageView attachments[] = {
@@ -1655,8 +2221,8 @@ void Renderer::createInstance() {
                 .renderPass = lightingRenderPass,
                 .attachmentCount = 1,
                 .pAttachments = attachments,
-                .width = swapChainExtent.width,
-                .height = swapChainExtent.height,
+                .width = renderExtent.width,
+                .height = renderExtent.height,
                 .layers = 1,
             };
             if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &lightingFramebuffers[i]) != VK_SUCCESS) {
@@ -1665,13 +2231,243 @@ void Renderer::createInstance() {
         }
     }
     void Renderer::createSSRResources() {
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT,
-            VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ssrImage, ssrMemory);
-        ssrView = createImageView(ssrImage, VK_FORMAT_R16G16B16A16_SFLOAT, 1);
-        transitionImageLayout(ssrImage, VK_FORMAT_R16G16B16A16_SFLOAT, 
-            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        const VkImageUsageFlags storageUsage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        ssrResource = frameGraph.createImage("ssr", {renderExtent, VK_FORMAT_R16G16B16A16_SFLOAT, storageUsage});
+        ssrImage = frameGraph.getImage(ssrResource);
+
+        // Half-resolution trace and its temporal history; sized like mip 1 of the Hi-Z pyramid.
+        // The history survives across frames, so it stays out of the graph's aliased memory.
+        ssrTraceExtent = {
+            .width = std::max(renderExtent.width / 2, 1u),
+            .height = std::max(renderExtent.height / 2, 1u),
+        };
+        ssrTraceResource = frameGraph.createImage("ssr trace", {ssrTraceExtent, VK_FORMAT_R16G16B16A16_SFLOAT, storageUsage});
+        ssrTraceImage = frameGraph.getImage(ssrTraceResource);
+        for (size_t i = 0; i < ssrHistoryImages.size(); i++) {
+            createImage(ssrTraceExtent.width, ssrTraceExtent.height, 1, VK_SAMPLE_COUNT_1_BIT,
+                VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ssrHistoryImages[i], ssrHistoryMemory[i]);
+            ssrHistoryViews[i] = createImageView(ssrHistoryImages[i], VK_FORMAT_R16G16B16A16_SFLOAT, 1);
+            transitionImageLayout(ssrHistoryImages[i], VK_FORMAT_R16G16B16A16_SFLOAT,
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        }
+        ssrHistoryValid = false;
+
+        if (!ssrHistorySampler) {
+            VkSamplerCreateInfo samplerInfo = {
+                .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+                .magFilter = VK_FILTER_LINEAR,
+                .minFilter = VK_FILTER_LINEAR,
+                .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+                .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                .mipLodBias = 0.0f,
+                .anisotropyEnable = VK_FALSE,
+                .maxAnisotropy = 1.0f,
+                .compareEnable = VK_FALSE,
+                .compareOp = VK_COMPARE_OP_ALWAYS,
+                .minLod = 0.0f,
+                .maxLod = 0.0f,
+                .borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,
+                .unnormalizedCoordinates = VK_FALSE,
+            };
+            if (vkCreateSampler(device, &samplerInfo, nullptr, &ssrHistorySampler) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create SSR history sampler!");
+            }
+        }
+    }
+    void Renderer::dispatchSSR(VkCommandBuffer commandBuffer) {
+        SSRPresetSettings settings = ssrPresetSettings(ssrPreset);
+        bool hierarchical = settings.hierarchical && supportsHiZ && hiZMipCount > 1
+            && ssrTraceDescriptorSets.size() == MAX_FRAMES_IN_FLIGHT
+            && ssrResolveDescriptorSets.size() == ssrHistoryImages.size()
+            && ssrUpsampleDescriptorSets.size() == ssrHistoryImages.size();
+        if (!hierarchical) {
+            settings = ssrPresetSettings(SSRPreset::Reference);
+        }
+
+        glm::mat4 view(1.0f);
+        glm::mat4 proj(1.0f);
+        glm::mat4 cameraWorld(1.0f);
+        if (activeCamera) {
+            cameraWorld = activeCamera->getWorldTransform();
+            view = glm::inverse(cameraWorld);
+            proj = glm::perspective(glm::radians(activeCamera->getFOV()), 
+                static_cast<float>(swapChainExtent.width) / std::max(static_cast<float>(swapChainExtent.height), 1.0f), 
+                0.1f, 200.0f);
+            proj[1][1] *= -1;
+        }
+        glm::mat4 invProj = glm::inverse(proj);
+
+        VkMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .pNext = nullptr,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        };
+        const size_t timing = beginShadowTiming(commandBuffer, std::string("ssr [") + settings.name + "]");
+        if (!hierarchical) {
+            ComputeShader* ssrShader = shaderManager->getComputeShader("ssr");
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ssrShader->pipeline);
+
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ssrShader->pipelineLayout, 0, 1, &ssrDescriptorSets[currentFrame], 0, nullptr);
+
+            SSRPushConstants ssrPushConstants{
+                .view = view,
+                .proj = proj,
+                .invView = cameraWorld,
+                .invProj = invProj,
+            };
+            vkCmdPushConstants(commandBuffer, ssrShader->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SSRPushConstants), &ssrPushConstants);
+
+            uint32_t groupX = (renderExtent.width + 7) / 8;
+            uint32_t groupY = (renderExtent.height + 7) / 8;
+            vkCmdDispatch(commandBuffer, groupX, groupY, 1);
+            ssrHistoryValid = false;
+        } else {
+            uint32_t halfGroupX = (ssrTraceExtent.width + 7) / 8;
+            uint32_t halfGroupY = (ssrTraceExtent.height + 7) / 8;
+
+            ComputeShader* traceShader = shaderManager->getComputeShader("ssr_trace");
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, traceShader->pipeline);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, traceShader->pipelineLayout, 0, 1, &ssrTraceDescriptorSets[currentFrame], 0, nullptr);
+            SSRTracePushConstants tracePushConstants{
+                .view = view,
+                .proj = proj,
+                .invProj = invProj,
+                .params = glm::uvec4(settings.maxIterations, hiZMipCount, ssrFrameIndex++, 0),
+                .thresholds = glm::vec4(settings.roughnessCutoff, settings.metallicCutoff, settings.thickness, settings.maxDistance),
+            };
+            vkCmdPushConstants(commandBuffer, traceShader->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SSRTracePushConstants), &tracePushConstants);
+            vkCmdDispatch(commandBuffer, halfGroupX, halfGroupY, 1);
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+            // Camera-only reprojection: the previous frame's clip position of each pixel comes from its depth.
+            glm::mat4 viewProj = proj * view;
+            ComputeShader* resolveShader = shaderManager->getComputeShader("ssr_resolve");
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, resolveShader->pipeline);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, resolveShader->pipelineLayout, 0, 1, &ssrResolveDescriptorSets[ssrHistoryIndex], 0, nullptr);
+            SSRResolvePushConstants resolvePushConstants{
+                .reprojection = ssrPrevViewProj * glm::inverse(viewProj),
+                .params = glm::vec4(settings.historyWeight, ssrHistoryValid ? 1.0f : 0.0f, 0.0f, 0.0f),
+            };
+            vkCmdPushConstants(commandBuffer, resolveShader->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SSRResolvePushConstants), &resolvePushConstants);
+            vkCmdDispatch(commandBuffer, halfGroupX, halfGroupY, 1);
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+            ComputeShader* upsampleShader = shaderManager->getComputeShader("ssr_upsample");
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, upsampleShader->pipeline);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, upsampleShader->pipelineLayout, 0, 1, &ssrUpsampleDescriptorSets[ssrHistoryIndex], 0, nullptr);
+            vkCmdDispatch(commandBuffer, (renderExtent.width + 7) / 8, (renderExtent.height + 7) / 8, 1);
+
+            ssrPrevViewProj = viewProj;
+            ssrHistoryIndex = 1 - ssrHistoryIndex;
+            ssrHistoryValid = true;
+        }
+        endShadowTiming(commandBuffer, timing);
+    }
+    void Renderer::createHiZResources() {
+        const VkFormat hiZFormat = VK_FORMAT_R32G32_SFLOAT;
+        uint32_t largestDimension = std::max(renderExtent.width, renderExtent.height);
+        hiZMipCount = std::min(static_cast<uint32_t>(std::floor(std::log2(static_cast<float>(std::max(largestDimension, 1u))))) + 1, kMaxHiZMips);
+        createImage(renderExtent.width, renderExtent.height, hiZMipCount, VK_SAMPLE_COUNT_1_BIT,
+            hiZFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, hiZImage, hiZMemory);
+        hiZView = createImageView(hiZImage, hiZFormat, hiZMipCount);
+        hiZMipViews.resize(hiZMipCount);
+        for (uint32_t mip = 0; mip < hiZMipCount; ++mip) {
+            VkImageViewCreateInfo viewInfo = {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                .image = hiZImage,
+                .viewType = VK_IMAGE_VIEW_TYPE_2D,
+                .format = hiZFormat,
+                .subresourceRange = {
+                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .baseMipLevel = mip,
+                    .levelCount = 1,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+            };
+            if (vkCreateImageView(device, &viewInfo, nullptr, &hiZMipViews[mip]) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create Hi-Z mip image view!");
+            }
+        }
+        transitionImageLayout(hiZImage, hiZFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, hiZMipCount);
+
+        // Without storage support for RG32F the pyramid is never built; a [0, 1] range everywhere
+        // keeps every consumer's test conservative.
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        VkClearColorValue clearColor = {{0.0f, 1.0f, 0.0f, 0.0f}};
+        VkImageSubresourceRange range = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = hiZMipCount,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        };
+        vkCmdClearColorImage(commandBuffer, hiZImage, VK_IMAGE_LAYOUT_GENERAL, &clearColor, 1, &range);
+        endSingleTimeCommands(commandBuffer);
+
+        if (!hiZSampler) {
+            VkSamplerCreateInfo samplerInfo = {
+                .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+                .magFilter = VK_FILTER_NEAREST,
+                .minFilter = VK_FILTER_NEAREST,
+                .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+                .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                .mipLodBias = 0.0f,
+                .anisotropyEnable = VK_FALSE,
+                .maxAnisotropy = 1.0f,
+                .compareEnable = VK_FALSE,
+                .compareOp = VK_COMPARE_OP_ALWAYS,
+                .minLod = 0.0f,
+                .maxLod = VK_LOD_CLAMP_NONE,
+                .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK,
+                .unnormalizedCoordinates = VK_FALSE,
+            };
+            if (vkCreateSampler(device, &samplerInfo, nullptr, &hiZSampler) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create Hi-Z sampler!");
+            }
+        }
+    }
+    void Renderer::buildHiZPyramid(VkCommandBuffer commandBuffer) {
+        ComputeShader* hiZShader = shaderManager->getComputeShader("hiz_build");
+        if (!supportsHiZ || !hiZShader || hiZDescriptorSets.size() != hiZMipCount) {
+            return;
+        }
+        const size_t timing = beginShadowTiming(commandBuffer, "hi-z pyramid");
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZShader->pipeline);
+        VkMemoryBarrier mipBarrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        };
+        uint32_t srcWidth = renderExtent.width;
+        uint32_t srcHeight = renderExtent.height;
+        for (uint32_t mip = 0; mip < hiZMipCount; ++mip) {
+            uint32_t dstWidth = mip == 0 ? srcWidth : std::max(srcWidth / 2, 1u);
+            uint32_t dstHeight = mip == 0 ? srcHeight : std::max(srcHeight / 2, 1u);
+            HiZBuildPushConstants pushConstants = {
+                .sizes = glm::uvec4(srcWidth, srcHeight, dstWidth, dstHeight),
+                .mode = glm::uvec4(mip == 0 ? 1u : 0u, 0u, 0u, 0u),
+            };
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZShader->pipelineLayout, 0, 1, &hiZDescriptorSets[mip], 0, nullptr);
+            vkCmdPushConstants(commandBuffer, hiZShader->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(HiZBuildPushConstants), &pushConstants);
+            vkCmdDispatch(commandBuffer, (dstWidth + 7) / 8, (dstHeight + 7) / 8, 1);
+            // Readers of the finished pyramid are synchronized by the frame graph.
+            if (mip + 1 < hiZMipCount) {
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &mipBarrier, 0, nullptr, 0, nullptr);
+            }
+            srcWidth = dstWidth;
+            srcHeight = dstHeight;
+        }
+        endShadowTiming(commandBuffer, timing);
     }
     void Renderer::createCompositeRenderPass() {
         VkAttachmentDescription colorAttachment = {
@@ -1682,7 +2478,7 @@ void Renderer::createInstance() {
             .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
             .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
             .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            .finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
         };
         VkAttachmentReference colorRef = {
             .attachment = 0,
@@ -1742,25 +2538,46 @@ void Renderer::createInstance() {
             throw std::runtime_error("Failed to get lighting or composite shader for descriptor set creation!");
         }
         
+        ComputeShader* lightCullShader = shaderManager->getComputeShader("light_cull");
+        if (!lightCullShader) {
+            throw std::runtime_error("Failed to get light culling shader for descriptor set creation!");
+        }
+
         VkDeviceSize bufferSize = sizeof(LightsBuffer);
-        lightsUniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-        lightsUniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        VkDeviceSize clusterBufferSize = sizeof(glm::uvec2) * kClusterCount;
+        VkDeviceSize lightIndexBufferSize = sizeof(uint32_t) * (kMaxClusterLightIndices + 1);
+        lightsBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        lightsBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        lightsBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+        clusterBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        clusterBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        clusterLightIndexBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        clusterLightIndexBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        lightCullStatsBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        lightCullStatsBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        lightCullStatsPending.fill(false);
         
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                lightsUniformBuffers[i], lightsUniformBuffersMemory[i]);
+                lightsBuffers[i], lightsBuffersMemory[i]);
+            lightsBuffersMapped[i] = lightsBuffersMemory[i].mapped;
+            createBuffer(clusterBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, clusterBuffers[i], clusterBuffersMemory[i]);
+            createBuffer(lightIndexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, clusterLightIndexBuffers[i], clusterLightIndexBuffersMemory[i]);
+            createBuffer(sizeof(LightCullStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, lightCullStatsBuffers[i], lightCullStatsBuffersMemory[i]);
         }
 
-        LightsBuffer lightBufferData{};
-        {
-            std::array<PointLight, kMaxPointLights> collectedLights{};
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            LightsBuffer* lightBufferData = static_cast<LightsBuffer*>(lightsBuffersMapped[i]);
             uint32_t lightCount = 0;
             std::function<void(Entity*)> traverse = [&](Entity* entity) -> void {
                 if (entity->isActive()) {
                     if (auto* light = dynamic_cast<Light*>(entity)) {
                         if (lightCount < kMaxPointLights) {
-                            collectedLights[lightCount++] = light->getPointLightData();
+                            lightBufferData->lights[lightCount++] = light->getPointLightData();
                         }
                     }
                 }
@@ -1773,17 +2590,20 @@ void Renderer::createInstance() {
                     traverse(entity);
                 }
             }
-            if (lightCount > 0) {
-                std::memcpy(lightBufferData.lights, collectedLights.data(), sizeof(PointLight) * lightCount);
-            }
-            lightBufferData.counts = glm::uvec4(lightCount, 0u, 0u, 0u);
+            lightBufferData->counts = glm::uvec4(lightCount, 0u, 0u, 0u);
+            activeLightCount = lightCount;
         }
+
+        std::vector<VkBuffer> lightCullBuffers;
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            void* data;
-            vkMapMemory(device, lightsUniformBuffersMemory[i], 0, bufferSize, 0, &data);
-            memcpy(data, &lightBufferData, bufferSize);
-            vkUnmapMemory(device, lightsUniformBuffersMemory[i]);
-        }
+            lightCullBuffers.push_back(lightsBuffers[i]);
+            lightCullBuffers.push_back(clusterBuffers[i]);
+            lightCullBuffers.push_back(clusterLightIndexBuffers[i]);
+            lightCullBuffers.push_back(lightCullStatsBuffers[i]);
+        }
+        std::vector<Image*> noTextures;
+        lightCullDescriptorSets = createDescriptorSets(lightCullShader->descriptorPool, lightCullShader->descriptorSetLayout,
+            lightCullShader->storageImageCount, 0, noTextures, lightCullBuffers, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
         
         std::vector<VkDescriptorSetLayout> lightingLayouts(MAX_FRAMES_IN_FLIGHT, lightingShader->descriptorSetLayout);
         VkDescriptorSetAllocateInfo allocInfo = {
@@ -1797,19 +2617,35 @@ void Renderer::createInstance() {
             throw std::runtime_error("Failed to allocate lighting descriptor sets!");
         }
         
-        for (auto& info : shadowCubeDescriptorInfos) {
-            info.sampler = VK_NULL_HANDLE;
-            info.imageView = VK_NULL_HANDLE;
-            info.imageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        for (auto* infos : {&shadowCubeDescriptorInfos, &shadowCompareDescriptorInfos, &shadowMomentDescriptorInfos}) {
+            for (auto& info : *infos) {
+                info.sampler = VK_NULL_HANDLE;
+                info.imageView = VK_NULL_HANDLE;
+                info.imageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            }
         }
         shadowCubeDescriptorCount = 0;
 
+        // Input attachments ignore the sampler; the layouts are the lighting subpass's.
+        const VkDescriptorType gBufferDescriptorType = singlePassDeferred ? VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            VkDescriptorBufferInfo bufferInfo = {
-                .buffer = lightsUniformBuffers[i],
-                .offset = 0,
-                .range = bufferSize,
-            };
+            std::array<VkDescriptorBufferInfo, 3> bufferInfos = {{
+                {
+                    .buffer = lightsBuffers[i],
+                    .offset = 0,
+                    .range = bufferSize,
+                },
+                {
+                    .buffer = clusterBuffers[i],
+                    .offset = 0,
+                    .range = clusterBufferSize,
+                },
+                {
+                    .buffer = clusterLightIndexBuffers[i],
+                    .offset = 0,
+                    .range = lightIndexBufferSize,
+                }
+            }};
 
             std::array<VkDescriptorImageInfo, 4> imageInfos = {{
                 {
@@ -1835,27 +2671,29 @@ void Renderer::createInstance() {
             }};
 
             std::vector<VkWriteDescriptorSet> descriptorWrites;
-            descriptorWrites.reserve(6);
-            descriptorWrites.push_back({
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .pNext = nullptr,
-                .dstSet = lightingDescriptorSets[i],
-                .dstBinding = 0,
-                .dstArrayElement = 0,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .pImageInfo = nullptr,
-                .pBufferInfo = &bufferInfo,
-                .pTexelBufferView = nullptr,
-            });
+            descriptorWrites.reserve(8);
+            for (uint32_t binding = 0; binding < bufferInfos.size(); ++binding) {
+                descriptorWrites.push_back({
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .pNext = nullptr,
+                    .dstSet = lightingDescriptorSets[i],
+                    .dstBinding = binding,
+                    .dstArrayElement = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pImageInfo = nullptr,
+                    .pBufferInfo = &bufferInfos[binding],
+                    .pTexelBufferView = nullptr,
+                });
+            }
             descriptorWrites.push_back({
                 .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                 .pNext = nullptr,
                 .dstSet = lightingDescriptorSets[i],
-                .dstBinding = 1,
+                .dstBinding = 3,
                 .dstArrayElement = 0,
                 .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .descriptorType = gBufferDescriptorType,
                 .pImageInfo = &imageInfos[0],
                 .pBufferInfo = nullptr,
                 .pTexelBufferView = nullptr,
@@ -1864,10 +2702,10 @@ void Renderer::createInstance() {
                 .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                 .pNext = nullptr,
                 .dstSet = lightingDescriptorSets[i],
-                .dstBinding = 2,
+                .dstBinding = 4,
                 .dstArrayElement = 0,
                 .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .descriptorType = gBufferDescriptorType,
                 .pImageInfo = &imageInfos[1],
                 .pBufferInfo = nullptr,
                 .pTexelBufferView = nullptr,
@@ -1876,10 +2714,10 @@ void Renderer::createInstance() {
                 .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                 .pNext = nullptr,
                 .dstSet = lightingDescriptorSets[i],
-                .dstBinding = 3,
+                .dstBinding = 5,
                 .dstArrayElement = 0,
                 .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .descriptorType = gBufferDescriptorType,
                 .pImageInfo = &imageInfos[2],
                 .pBufferInfo = nullptr,
                 .pTexelBufferView = nullptr,
@@ -1888,28 +2726,31 @@ void Renderer::createInstance() {
                 .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                 .pNext = nullptr,
                 .dstSet = lightingDescriptorSets[i],
-                .dstBinding = 4,
+                .dstBinding = 6,
                 .dstArrayElement = 0,
                 .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .descriptorType = gBufferDescriptorType,
                 .pImageInfo = &imageInfos[3],
                 .pBufferInfo = nullptr,
                 .pTexelBufferView = nullptr,
             });
 
             if (shadowCubeDescriptorCount > 0) {
-                descriptorWrites.push_back({
-                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                    .pNext = nullptr,
-                    .dstSet = lightingDescriptorSets[i],
-                    .dstBinding = 5,
-                    .dstArrayElement = 0,
-                    .descriptorCount = shadowCubeDescriptorCount,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    .pImageInfo = shadowCubeDescriptorInfos.data(),
-                    .pBufferInfo = nullptr,
-                    .pTexelBufferView = nullptr,
-                });
+                const VkDescriptorImageInfo* shadowInfos[3] = { shadowCubeDescriptorInfos.data(), shadowCompareDescriptorInfos.data(), shadowMomentDescriptorInfos.data() };
+                for (uint32_t binding = 0; binding < 3; ++binding) {
+                    descriptorWrites.push_back({
+                        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                        .pNext = nullptr,
+                        .dstSet = lightingDescriptorSets[i],
+                        .dstBinding = 7 + binding,
+                        .dstArrayElement = 0,
+                        .descriptorCount = shadowCubeDescriptorCount,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                        .pImageInfo = shadowInfos[binding],
+                        .pBufferInfo = nullptr,
+                        .pTexelBufferView = nullptr,
+                    });
+                }
             }
 
             vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
@@ -1928,20 +2769,25 @@ void Renderer::createInstance() {
         }
         
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            std::array<VkDescriptorImageInfo, 2> imageInfos = {{
+            std::array<VkDescriptorImageInfo, 3> imageInfos = {{
                 {
-                    .sampler = gBufferSampler,
+                    .sampler = upscaleSampler,
                     .imageView = lightingView,
                     .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
                 },
                 {
-                    .sampler = gBufferSampler,
+                    .sampler = upscaleSampler,
                     .imageView = ssrView,
                     .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
                 },
+                {
+                    .sampler = hiZSampler,
+                    .imageView = hiZView,
+                    .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                },
             }};
             
-            std::array<VkWriteDescriptorSet, 2> descriptorWrites = {{
+            std::array<VkWriteDescriptorSet, 3> descriptorWrites = {{
                 {
                     .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                     .dstSet = compositeDescriptorSets[i],
@@ -1960,9 +2806,18 @@ void Renderer::createInstance() {
                     .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                     .pImageInfo = &imageInfos[1],
                 },
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = compositeDescriptorSets[i],
+                    .dstBinding = 2,
+                    .dstArrayElement = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                    .pImageInfo = &imageInfos[2],
+                },
             }};
             
-            vkUpdateDescriptorSets(device, 2, descriptorWrites.data(), 0, nullptr);
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
         }
         ComputeShader* ssrShader = shaderManager->getComputeShader("ssr");
         if (!ssrShader) {
@@ -1987,7 +2842,7 @@ void Renderer::createInstance() {
                 .imageView = ssrView,
                 .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
             };
-            std::array<VkDescriptorImageInfo, 3> samplerInfos = {{
+            std::array<VkDescriptorImageInfo, 4> samplerInfos = {{
                 {
                     .sampler = gBufferSampler,
                     .imageView = lightingView,
@@ -2003,8 +2858,13 @@ void Renderer::createInstance() {
                     .imageView = gBufferNormalView,
                     .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
                 },
+                {
+                    .sampler = hiZSampler,
+                    .imageView = hiZView,
+                    .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                },
             }};
-            std::array<VkWriteDescriptorSet, 4> descriptorWrites = {{
+            std::array<VkWriteDescriptorSet, 5> descriptorWrites = {{
                 {
                     .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                     .dstSet = ssrDescriptorSets[i],
@@ -2041,32 +2901,184 @@ void Renderer::createInstance() {
                     .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                     .pImageInfo = &samplerInfos[2],
                 },
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = ssrDescriptorSets[i],
+                    .dstBinding = 4,
+                    .dstArrayElement = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                    .pImageInfo = &samplerInfos[3],
+                },
             }};
-            vkUpdateDescriptorSets(device, 4, descriptorWrites.data(), 0, nullptr);
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
         }
-    }
-    void Renderer::updateLightsUniformBuffer() {
-        std::vector<Light*> lights = entityManager->getAllLights();
-        constexpr uint32_t kInvalidShadowIndex = std::numeric_limits<uint32_t>::max();
 
-        std::array<PointLight, kMaxPointLights> pointLights{};
-        std::array<VkDescriptorImageInfo, kMaxShadowCubeSlots> newShadowInfos{};
-        for (auto& info : newShadowInfos) {
-            info.sampler = VK_NULL_HANDLE;
-            info.imageView = VK_NULL_HANDLE;
-            info.imageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        // One set per pyramid level: the level as a storage image and the level above it (or the depth buffer) as its source.
+        ComputeShader* hiZShader = shaderManager->getComputeShader("hiz_build");
+        if (hiZShader && hiZMipCount > 0) {
+            std::vector<VkDescriptorSetLayout> hiZLayouts(hiZMipCount, hiZShader->descriptorSetLayout);
+            VkDescriptorSetAllocateInfo hiZAllocInfo = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .descriptorPool = hiZShader->descriptorPool,
+                .descriptorSetCount = hiZMipCount,
+                .pSetLayouts = hiZLayouts.data(),
+            };
+            hiZDescriptorSets.resize(hiZMipCount);
+            if (vkAllocateDescriptorSets(device, &hiZAllocInfo, hiZDescriptorSets.data()) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to allocate Hi-Z descriptor sets!");
+            }
+            for (uint32_t mip = 0; mip < hiZMipCount; ++mip) {
+                VkDescriptorImageInfo storageImageInfo = {
+                    .sampler = VK_NULL_HANDLE,
+                    .imageView = hiZMipViews[mip],
+                    .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                };
+                VkDescriptorImageInfo sourceInfo = mip == 0 ? VkDescriptorImageInfo{
+                    .sampler = gBufferSampler,
+                    .imageView = gBufferDepthView,
+                    .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+                } : VkDescriptorImageInfo{
+                    .sampler = hiZSampler,
+                    .imageView = hiZMipViews[mip - 1],
+                    .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                };
+                std::array<VkWriteDescriptorSet, 2> descriptorWrites = {{
+                    {
+                        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                        .dstSet = hiZDescriptorSets[mip],
+                        .dstBinding = 0,
+                        .dstArrayElement = 0,
+                        .descriptorCount = 1,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                        .pImageInfo = &storageImageInfo,
+                    },
+                    {
+                        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                        .dstSet = hiZDescriptorSets[mip],
+                        .dstBinding = 1,
+                        .dstArrayElement = 0,
+                        .descriptorCount = 1,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                        .pImageInfo = &sourceInfo,
+                    },
+                }};
+                vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+            }
         }
 
-        uint32_t lightCount = 0;
-        uint32_t shadowSlot = 0;
-        std::function<void(Light*)> processLight = [&](Light* light) {
-            if (!light || !light->isActive()) {
-                return;
-            }
+        writeCullHiZDescriptors();
 
-            uint32_t assignedShadowIndex = kInvalidShadowIndex;
-            if (light->getCastsShadows() && shadowSlot < kMaxShadowCubeSlots) {
-                Image* shadowImage = light->getDynamicShadowMap();
+        // Hierarchical SSR: binding 0 is the pass's storage output, the rest are sampled inputs in order.
+        auto allocateSSRSets = [&](const std::string& shaderName, std::vector<VkDescriptorSet>& sets) -> bool {
+            ComputeShader* shader = shaderManager->getComputeShader(shaderName);
+            if (!shader) {
+                return false;
+            }
+            std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, shader->descriptorSetLayout);
+            VkDescriptorSetAllocateInfo allocInfo = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .descriptorPool = shader->descriptorPool,
+                .descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
+                .pSetLayouts = layouts.data(),
+            };
+            sets.resize(MAX_FRAMES_IN_FLIGHT);
+            if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to allocate " + shaderName + " descriptor sets!");
+            }
+            return true;
+        };
+        auto writeSSRSet = [&](VkDescriptorSet set, VkImageView storageView, const std::vector<VkDescriptorImageInfo>& samplerInfos) {
+            VkDescriptorImageInfo storageImageInfo = {
+                .sampler = VK_NULL_HANDLE,
+                .imageView = storageView,
+                .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+            };
+            std::vector<VkWriteDescriptorSet> descriptorWrites;
+            descriptorWrites.push_back({
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = set,
+                .dstBinding = 0,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                .pImageInfo = &storageImageInfo,
+            });
+            for (size_t binding = 0; binding < samplerInfos.size(); binding++) {
+                descriptorWrites.push_back({
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = set,
+                    .dstBinding = static_cast<uint32_t>(binding + 1),
+                    .dstArrayElement = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                    .pImageInfo = &samplerInfos[binding],
+                });
+            }
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        };
+        const VkDescriptorImageInfo hiZInfo = {
+            .sampler = hiZSampler,
+            .imageView = hiZView,
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        };
+        if (hiZView && allocateSSRSets("ssr_trace", ssrTraceDescriptorSets)) {
+            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                writeSSRSet(ssrTraceDescriptorSets[i], ssrTraceView, {
+                    {.sampler = gBufferSampler, .imageView = lightingView, .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                    {.sampler = gBufferSampler, .imageView = gBufferNormalView, .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                    {.sampler = gBufferSampler, .imageView = gBufferMaterialView, .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                    hiZInfo,
+                });
+            }
+        }
+        // Set i resolves into history i from history 1 - i; the upsample then reads history i.
+        if (hiZView && allocateSSRSets("ssr_resolve", ssrResolveDescriptorSets)) {
+            for (size_t i = 0; i < ssrHistoryImages.size(); i++) {
+                writeSSRSet(ssrResolveDescriptorSets[i], ssrHistoryViews[i], {
+                    {.sampler = gBufferSampler, .imageView = ssrTraceView, .imageLayout = VK_IMAGE_LAYOUT_GENERAL},
+                    {.sampler = ssrHistorySampler, .imageView = ssrHistoryViews[1 - i], .imageLayout = VK_IMAGE_LAYOUT_GENERAL},
+                    hiZInfo,
+                });
+            }
+        }
+        if (hiZView && allocateSSRSets("ssr_upsample", ssrUpsampleDescriptorSets)) {
+            for (size_t i = 0; i < ssrHistoryImages.size(); i++) {
+                writeSSRSet(ssrUpsampleDescriptorSets[i], ssrView, {
+                    {.sampler = gBufferSampler, .imageView = ssrHistoryViews[i], .imageLayout = VK_IMAGE_LAYOUT_GENERAL},
+                    hiZInfo,
+                });
+            }
+        }
+    }
+    void Renderer::updateLightsBuffer() {
+        CPU_PROFILE_ZONE("updateLightsBuffer");
+        std::vector<Light*> lights = entityManager->getAllLights();
+        constexpr uint32_t kInvalidShadowIndex = std::numeric_limits<uint32_t>::max();
+
+        LightsBuffer* lightBufferData = static_cast<LightsBuffer*>(lightsBuffersMapped[currentFrame]);
+        std::array<VkDescriptorImageInfo, kMaxShadowCubeSlots> newShadowInfos{};
+        std::array<VkDescriptorImageInfo, kMaxShadowCubeSlots> newCompareInfos{};
+        std::array<VkDescriptorImageInfo, kMaxShadowCubeSlots> newMomentInfos{};
+        for (auto* infos : {&newShadowInfos, &newCompareInfos, &newMomentInfos}) {
+            for (auto& info : *infos) {
+                info.sampler = VK_NULL_HANDLE;
+                info.imageView = VK_NULL_HANDLE;
+                info.imageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            }
+        }
+
+        uint32_t lightCount = 0;
+        uint32_t shadowSlot = 0;
+        std::function<void(Light*)> processLight = [&](Light* light) {
+            if (!light || !light->isActive()) {
+                return;
+            }
+
+            uint32_t assignedShadowIndex = kInvalidShadowIndex;
+            ShadowFilterMode filterMode = getEffectiveShadowFilter(light);
+            if (light->getCastsShadows() && shadowSlot < kMaxShadowCubeSlots) {
+                Image* shadowImage = light->getDynamicShadowMap();
                 if (shadowImage && shadowImage->imageView != VK_NULL_HANDLE && shadowImage->imageSampler != VK_NULL_HANDLE) {
                     assignedShadowIndex = shadowSlot;
                     newShadowInfos[shadowSlot] = {
@@ -2074,6 +3086,24 @@ void Renderer::createInstance() {
                         .imageView = shadowImage->imageView,
                         .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
                     };
+                    newCompareInfos[shadowSlot] = {
+                        .sampler = shadowCompareSampler,
+                        .imageView = shadowImage->imageView,
+                        .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+                    };
+                    // Every slot needs a valid descriptor; lights that don't use moments never sample this one,
+                    // and a moment map that hasn't been prefiltered yet falls back to PCF for the frame.
+                    newMomentInfos[shadowSlot] = newShadowInfos[shadowSlot];
+                    Image* momentImage = filterMode == ShadowFilterMode::Moments ? light->getShadowMomentMap() : nullptr;
+                    if (momentImage && !light->getShadowMomentsDirty()) {
+                        newMomentInfos[shadowSlot] = {
+                            .sampler = momentImage->imageSampler,
+                            .imageView = momentImage->imageView,
+                            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                        };
+                    } else if (filterMode == ShadowFilterMode::Moments) {
+                        filterMode = ShadowFilterMode::PCF;
+                    }
                     ++shadowSlot;
                 }
             }
@@ -2081,7 +3111,9 @@ void Renderer::createInstance() {
             light->setShadowMapIndex(assignedShadowIndex);
 
             if (lightCount < kMaxPointLights) {
-                pointLights[lightCount++] = light->getPointLightData();
+                PointLight pointLight = light->getPointLightData();
+                pointLight.shadowData.z = static_cast<uint32_t>(filterMode);
+                lightBufferData->lights[lightCount++] = pointLight;
             }
         };
 
@@ -2102,42 +3134,93 @@ void Renderer::createInstance() {
             }
         }
 
-        LightsBuffer lightBufferData{};
-        if (lightCount > 0) {
-            std::memcpy(lightBufferData.lights, pointLights.data(), sizeof(PointLight) * lightCount);
-        }
-        lightBufferData.counts = glm::uvec4(lightCount, 0u, 0u, 0u);
-
-        VkDeviceSize bufferSize = sizeof(LightsBuffer);
-        void* data;
-        vkMapMemory(device, lightsUniformBuffersMemory[currentFrame], 0, bufferSize, 0, &data);
-        memcpy(data, &lightBufferData, bufferSize);
-        vkUnmapMemory(device, lightsUniformBuffersMemory[currentFrame]);
+        lightBufferData->counts = glm::uvec4(lightCount, 0u, 0u, 0u);
+        activeLightCount = lightCount;
 
         shadowCubeDescriptorInfos = newShadowInfos;
+        shadowCompareDescriptorInfos = newCompareInfos;
+        shadowMomentDescriptorInfos = newMomentInfos;
         shadowCubeDescriptorCount = shadowSlot;
 
         if (!lightingDescriptorSets.empty() && shadowCubeDescriptorCount > 0) {
-            VkWriteDescriptorSet shadowWrite = {
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .pNext = nullptr,
-                .dstBinding = 5,
-                .dstArrayElement = 0,
-                .descriptorCount = shadowCubeDescriptorCount,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                .pImageInfo = shadowCubeDescriptorInfos.data(),
-                .pBufferInfo = nullptr,
-                .pTexelBufferView = nullptr,
-            };
+            const VkDescriptorImageInfo* shadowInfos[3] = { shadowCubeDescriptorInfos.data(), shadowCompareDescriptorInfos.data(), shadowMomentDescriptorInfos.data() };
+            std::array<VkWriteDescriptorSet, 3> shadowWrites{};
+            for (uint32_t binding = 0; binding < 3; ++binding) {
+                shadowWrites[binding] = {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .pNext = nullptr,
+                    .dstBinding = 7 + binding,
+                    .dstArrayElement = 0,
+                    .descriptorCount = shadowCubeDescriptorCount,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                    .pImageInfo = shadowInfos[binding],
+                    .pBufferInfo = nullptr,
+                    .pTexelBufferView = nullptr,
+                };
+            }
             for (VkDescriptorSet descriptorSet : lightingDescriptorSets) {
                 if (descriptorSet == VK_NULL_HANDLE) {
                     continue;
                 }
-                shadowWrite.dstSet = descriptorSet;
-                vkUpdateDescriptorSets(device, 1, &shadowWrite, 0, nullptr);
+                for (VkWriteDescriptorSet& shadowWrite : shadowWrites) {
+                    shadowWrite.dstSet = descriptorSet;
+                }
+                vkUpdateDescriptorSets(device, static_cast<uint32_t>(shadowWrites.size()), shadowWrites.data(), 0, nullptr);
             }
         }
     }
+    void Renderer::dispatchLightCulling(VkCommandBuffer commandBuffer) {
+        ComputeShader* lightCullShader = shaderManager->getComputeShader("light_cull");
+        if (!lightCullShader || lightCullDescriptorSets.empty()) {
+            return;
+        }
+        // This frame slot's fence has signalled, so the counters it wrote last time are complete.
+        if (lightCullStatsPending[currentFrame]) {
+            const LightCullStats& stats = *static_cast<const LightCullStats*>(lightCullStatsBuffersMemory[currentFrame].mapped);
+            if (lightCullWarningCooldown > 0) {
+                lightCullWarningCooldown--;
+            } else if (stats.overflowedClusters > 0 || stats.droppedIndices > 0) {
+                std::cerr << "Light culling dropped lights: " << stats.overflowedClusters << " clusters over the "
+                          << kMaxLightsPerCluster << "-light cap (up to " << stats.maxClusterLights << " lights in one), "
+                          << stats.droppedIndices << " cut by the full index buffer" << std::endl;
+                lightCullWarningCooldown = 300;
+            }
+        }
+        lightCullStatsPending[currentFrame] = true;
+        vkCmdFillBuffer(commandBuffer, clusterLightIndexBuffers[currentFrame], 0, sizeof(uint32_t), 0);
+        vkCmdFillBuffer(commandBuffer, lightCullStatsBuffers[currentFrame], 0, VK_WHOLE_SIZE, 0);
+        VkMemoryBarrier clearBarrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+        float cameraFOV = 90.0f;
+        glm::mat4 view = glm::mat4(1.0f);
+        if (activeCamera) {
+            cameraFOV = activeCamera->getFOV();
+            view = glm::inverse(activeCamera->getWorldTransform());
+        }
+        float aspectRatio = static_cast<float>(swapChainExtent.width) / std::max(static_cast<float>(swapChainExtent.height), 1.0f);
+        float tanHalfFovY = std::tan(glm::radians(cameraFOV) * 0.5f);
+        LightCullPushConstants pushConstants = {
+            .view = view,
+            .projParams = glm::vec4(tanHalfFovY * aspectRatio, tanHalfFovY, 0.1f, 200.0f),
+            .counts = glm::uvec4(activeLightCount, kMaxClusterLightIndices, 0u, 0u),
+        };
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullShader->pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullShader->pipelineLayout, 0, 1, &lightCullDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, lightCullShader->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LightCullPushConstants), &pushConstants);
+        vkCmdDispatch(commandBuffer, (kClusterCount + 63) / 64, 1, 1);
+
+        VkMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
     void Renderer::recreateDeferredDescriptorSets() {
         Shader* lightingShader = shaderManager->getShader("lighting");
         Shader* compositeShader = shaderManager->getShader("composite");
@@ -2152,8 +3235,27 @@ void Renderer::createInstance() {
         if (ssrShader && ssrShader->descriptorPool != VK_NULL_HANDLE) {
             vkResetDescriptorPool(device, ssrShader->descriptorPool, 0);
         }
+        ComputeShader* lightCullShader = shaderManager->getComputeShader("light_cull");
+        if (lightCullShader && lightCullShader->descriptorPool != VK_NULL_HANDLE) {
+            vkResetDescriptorPool(device, lightCullShader->descriptorPool, 0);
+        }
+        ComputeShader* hiZShader = shaderManager->getComputeShader("hiz_build");
+        if (hiZShader && hiZShader->descriptorPool != VK_NULL_HANDLE) {
+            vkResetDescriptorPool(device, hiZShader->descriptorPool, 0);
+        }
+        hiZDescriptorSets.clear();
+        for (const char* name : {"ssr_trace", "ssr_resolve", "ssr_upsample"}) {
+            ComputeShader* shader = shaderManager->getComputeShader(name);
+            if (shader && shader->descriptorPool != VK_NULL_HANDLE) {
+                vkResetDescriptorPool(device, shader->descriptorPool, 0);
+            }
+        }
+        ssrTraceDescriptorSets.clear();
+        ssrResolveDescriptorSets.clear();
+        ssrUpsampleDescriptorSets.clear();
         
         lightingDescriptorSets.clear();
+        lightCullDescriptorSets.clear();
         compositeDescriptorSets.clear();
         ssrDescriptorSets.clear();
         createDeferredDescriptorSets();
@@ -2166,6 +3268,27 @@ void Renderer::createInstance() {
         }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
         );
     }
+    // Every pipeline blends, so each target needs blendable color attachment support. SNORM keeps
+    // the octahedral normal's precision uniform; R11G11B10F is plenty for the unsigned HDR lighting.
+    void Renderer::chooseRenderTargetFormats() {
+        const VkFormatFeatureFlags renderable = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BLEND_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+        gBufferNormalFormat = findSupportedFormat({VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16_SFLOAT}, VK_IMAGE_TILING_OPTIMAL, renderable);
+        lightingFormat = findSupportedFormat({VK_FORMAT_B10G11R11_UFLOAT_PACK32, VK_FORMAT_R16G16B16A16_SFLOAT}, VK_IMAGE_TILING_OPTIMAL, renderable);
+
+        // Each target is written once and read back once at full resolution per frame.
+        const uint32_t gBufferBytes = bytesPerPixel(kGBufferAlbedoFormat) + bytesPerPixel(gBufferNormalFormat) + bytesPerPixel(kGBufferMaterialFormat);
+        const uint32_t previousGBufferBytes = bytesPerPixel(VK_FORMAT_R16G16B16A16_SFLOAT) * 2 + bytesPerPixel(VK_FORMAT_R8G8B8A8_UNORM);
+        const uint32_t lightingBytes = bytesPerPixel(lightingFormat);
+        const uint32_t previousLightingBytes = bytesPerPixel(VK_FORMAT_R16G16B16A16_SFLOAT);
+        std::cout << "G-buffer " << gBufferBytes << " B/px (was " << previousGBufferBytes << "), lighting "
+                  << lightingBytes << " B/px (was " << previousLightingBytes << ")";
+        for (VkExtent2D extent : {VkExtent2D{1920, 1080}, VkExtent2D{3840, 2160}}) {
+            uint64_t pixels = static_cast<uint64_t>(extent.width) * extent.height;
+            uint64_t savedBytes = pixels * 2 * ((previousGBufferBytes - gBufferBytes) + (previousLightingBytes - lightingBytes));
+            std::cout << ", " << extent.width << "x" << extent.height << " saves " << savedBytes / (1024 * 1024) << " MB/frame";
+        }
+        std::cout << std::endl;
+    }
     VkFormat Renderer::findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
         for(VkFormat format : candidates) {
             VkFormatProperties props;
@@ -2189,6 +3312,48 @@ void Renderer::createInstance() {
             throw std::runtime_error("failed to create command pool!");
         }
     }
+    // Each frame slot has its own ring, so a slot can be replaced as soon as its fence has signalled.
+    void Renderer::createUniformRingBuffer(uint32_t frame, VkDeviceSize size) {
+        createBuffer(size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            uniformRingBuffers[frame], uniformRingMemory[frame]);
+        uniformRingSizes[frame] = size;
+    }
+    // Called before the current slot records, once its fence has signalled: regrows the slot's ring to the
+    // largest demand seen so far and points every entity's descriptor set for this slot at the new buffer.
+    void Renderer::growUniformRingBuffer() {
+        if (uniformRingPeakDemand <= uniformRingSizes[currentFrame]) {
+            return;
+        }
+        VkDeviceSize size = uniformRingSizes[currentFrame];
+        while (size < uniformRingPeakDemand) {
+            size *= 2;
+        }
+        vkDestroyBuffer(device, uniformRingBuffers[currentFrame], nullptr);
+        memoryAllocator.free(uniformRingMemory[currentFrame]);
+        createUniformRingBuffer(currentFrame, size);
+        for (auto& [name, entity] : entityManager->getAllEntities()) {
+            entity->bindUniformRingBuffer(currentFrame, uniformRingBuffers[currentFrame]);
+        }
+        std::cout << "Uniform ring for frame slot " << currentFrame << " grown to " << size / 1024 << " KB" << std::endl;
+    }
+    uint32_t Renderer::allocateUniformData(const void* data, VkDeviceSize size) {
+        const VkDeviceSize alignedSize = (size + uniformRingAlignment - 1) & ~(uniformRingAlignment - 1);
+        uniformRingDemand += alignedSize;
+        if (uniformRingOffset + alignedSize > uniformRingSizes[currentFrame]) {
+            // The draw is dropped for this frame only; the ring grows before this slot records again.
+            if (uniformRingDemand - alignedSize == uniformRingOffset) {
+                std::cerr << "Uniform ring full (" << uniformRingSizes[currentFrame] / 1024 << " KB), skipping draws this frame" << std::endl;
+            }
+            uniformRingPeakDemand = std::max(uniformRingPeakDemand, uniformRingDemand);
+            return kUniformAllocationFailed;
+        }
+        uniformRingPeakDemand = std::max(uniformRingPeakDemand, uniformRingDemand);
+        const VkDeviceSize offset = uniformRingOffset;
+        std::memcpy(static_cast<char*>(uniformRingMemory[currentFrame].mapped) + offset, data, static_cast<size_t>(size));
+        uniformRingOffset += alignedSize;
+        return static_cast<uint32_t>(offset);
+    }
     void Renderer::createQuadBuffers() {
         std::vector<TextVertex> vertices = {
             {{-1.0f, -1.0f}, {0.0f, 0.0f}},
@@ -2201,27 +3366,10 @@ void Renderer::createInstance() {
         };
         VkDeviceSize vertexBufferSize = sizeof(vertices[0]) * vertices.size();
         VkDeviceSize indexBufferSize = sizeof(indices[0]) * indices.size();
-        VkBuffer stagingVertexBuffer;
-        VkDeviceMemory stagingVertexBufferMemory;
-        createBuffer(vertexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingVertexBuffer, stagingVertexBufferMemory);
-        void* data;
-        vkMapMemory(device, stagingVertexBufferMemory, 0, vertexBufferSize, 0, &data);
-        memcpy(data, vertices.data(), (size_t) vertexBufferSize);
-        vkUnmapMemory(device, stagingVertexBufferMemory);
         createBuffer(vertexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, quadVertexBuffer, quadVertexBufferMemory);
-        copyBuffer(stagingVertexBuffer, quadVertexBuffer, vertexBufferSize);
-        vkDestroyBuffer(device, stagingVertexBuffer, nullptr);
-        vkFreeMemory(device, stagingVertexBufferMemory, nullptr);
-        VkBuffer stagingIndexBuffer;
-        VkDeviceMemory stagingIndexBufferMemory;
-        createBuffer(indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingIndexBuffer, stagingIndexBufferMemory);
-        vkMapMemory(device, stagingIndexBufferMemory, 0, indexBufferSize, 0, &data);
-        memcpy(data, indices.data(), (size_t) indexBufferSize);
-        vkUnmapMemory(device, stagingIndexBufferMemory);
+        uploadManager.uploadBuffer(quadVertexBuffer, vertices.data(), vertexBufferSize);
         createBuffer(indexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, quadIndexBuffer, quadIndexBufferMemory);
-        copyBuffer(stagingIndexBuffer, quadIndexBuffer, indexBufferSize);
-        vkDestroyBuffer(device, stagingIndexBuffer, nullptr);
-        vkFreeMemory(device, stagingIndexBufferMemory, nullptr);
+        uploadManager.uploadBuffer(quadIndexBuffer, indices.data(), indexBufferSize);
     }
     void Renderer::setupUI() {
         uiManager = UIManager::getInstance();
@@ -2229,6 +3377,7 @@ void Renderer::createInstance() {
         fontManager->loadFont("src/assets/fonts/Lato.ttf", "Lato", 48);
     }
     void Renderer::updateEntities() {
+        CPU_PROFILE_ZONE("updateEntities");
         auto& entities = entityManager->getAllEntities();
         std::function<void(Entity*)> traverse = [&](Entity* entity) -> void {
             entity->updateWorldTransform();
@@ -2243,30 +3392,232 @@ void Renderer::createInstance() {
             }
         }
     }
-    void Renderer::renderEntitiesShadowDepth(VkCommandBuffer commandBuffer, const std::vector<Light*>& lights) {
-        if (lights.empty()) return;
-        Shader* shadowShader = shaderManager->getShader("shadowmap");
-        if (!shadowShader) {
-            return;
+    void Renderer::updateShadowBudget() {
+        static constexpr uint32_t kShadowTiers[] = { kShadowMapSize, kShadowMapSize / 2, kShadowMapSize / 4, kShadowMapSize / 8 };
+        static constexpr float kShadowTierCoverage[] = { 0.5f, 0.25f, 0.1f, 0.02f };
+        static constexpr uint32_t kShadowTierCount = 4;
+        // Static and dynamic cubemap, six D32 faces each, plus the half-resolution RGBA32F moment cubemap (the size of one more depth cube).
+        std::function<VkDeviceSize(Light*, uint32_t)> shadowMapMemory = [this](Light* light, uint32_t size) -> VkDeviceSize {
+            VkDeviceSize cubes = getEffectiveShadowFilter(light) == ShadowFilterMode::Moments ? 3ull : 2ull;
+            return cubes * 6ull * size * size * sizeof(float);
+        };
+        ++shadowBudgetFrame;
+
+        glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 5.0f);
+        float cameraFOV = 45.0f;
+        Frustum cameraFrustum;
+        if (activeCamera) {
+            glm::mat4 cameraWorld = activeCamera->getWorldTransform();
+            cameraPos = glm::vec3(cameraWorld * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+            cameraFOV = activeCamera->getFOV();
+            float aspectRatio = static_cast<float>(swapChainExtent.width) / std::max(static_cast<float>(swapChainExtent.height), 1.0f);
+            cameraFrustum = activeCamera->getFrustrum(aspectRatio, 0.1f, 200.0f, cameraWorld);
         }
+        const float tanHalfFov = std::tan(glm::radians(cameraFOV) * 0.5f);
 
-        auto& rootEntities = entityManager->getRootEntities();
-        if (rootEntities.empty()) {
+        struct ShadowRequest {
+            Light* light;
+            float priority;
+            uint32_t size;
+        };
+        std::vector<ShadowRequest> requests;
+        for (Light* light : entityManager->getAllLights()) {
+            if (!light) {
+                continue;
+            }
+            float priority = 0.0f;
+            if (light->isActive() && light->getCastsShadows()) {
+                glm::vec3 pos = light->getWorldPosition();
+                float radius = light->getRadius();
+                float distance = glm::length(pos - cameraPos);
+                bool visible = !activeCamera || cameraFrustum.intersectsAABB(pos - glm::vec3(radius), pos + glm::vec3(radius));
+                // Fraction of the screen height covered by the light's sphere of influence.
+                float coverage = distance > radius ? radius / (distance * tanHalfFov) : 1.0f;
+                priority = visible ? std::min(coverage, 1.0f) * light->getShadowImportance() : 0.0f;
+            }
+            requests.push_back(ShadowRequest{ light, priority, 0 });
+        }
+        std::sort(requests.begin(), requests.end(), [](const ShadowRequest& a, const ShadowRequest& b) {
+            return a.priority > b.priority;
+        });
+
+        // Grant each wanted light the tier its coverage asks for, dropping tiers until it fits the budget.
+        VkDeviceSize used = 0;
+        for (ShadowRequest& request : requests) {
+            uint32_t tier = 0;
+            while (tier < kShadowTierCount && request.priority < kShadowTierCoverage[tier]) {
+                ++tier;
+            }
+            for (; tier < kShadowTierCount; ++tier) {
+                VkDeviceSize cost = shadowMapMemory(request.light, kShadowTiers[tier]);
+                if (used + cost <= shadowMemoryBudget) {
+                    request.size = kShadowTiers[tier];
+                    request.light->setShadowLastUsedFrame(shadowBudgetFrame);
+                    used += cost;
+                    break;
+                }
+            }
+        }
+
+        // Lights no longer wanted keep their maps while the budget allows; the least recently used go first.
+        std::vector<ShadowRequest*> cached;
+        for (ShadowRequest& request : requests) {
+            if (request.size == 0 && request.light->getShadowMapSize() > 0 && request.light->getCastsShadows()) {
+                cached.push_back(&request);
+            }
+        }
+        std::sort(cached.begin(), cached.end(), [](const ShadowRequest* a, const ShadowRequest* b) {
+            return a->light->getShadowLastUsedFrame() > b->light->getShadowLastUsedFrame();
+        });
+        for (ShadowRequest* request : cached) {
+            VkDeviceSize cost = shadowMapMemory(request->light, request->light->getShadowMapSize());
+            if (used + cost <= shadowMemoryBudget) {
+                request->size = request->light->getShadowMapSize();
+                used += cost;
+            }
+        }
+
+        // Reallocating stalls the GPU, so apart from lights that have no maps yet, tier changes are applied at most every kShadowBudgetInterval frames.
+        bool anyChange = false;
+        bool urgentChange = false;
+        for (const ShadowRequest& request : requests) {
+            if (request.size != request.light->getShadowMapSize()) {
+                anyChange = true;
+                urgentChange = urgentChange || request.light->getShadowMapSize() == 0;
+            }
+        }
+        if (!anyChange || (!urgentChange && !shadowBudgetDirty && shadowBudgetFrame - lastShadowBudgetChange < kShadowBudgetInterval)) {
             return;
         }
+        vkDeviceWaitIdle(device);
+        for (const ShadowRequest& request : requests) {
+            if (request.size == request.light->getShadowMapSize()) {
+                continue;
+            }
+            request.light->setShadowMapSize(request.size);
+            if (request.size > 0) {
+                entityManager->markLightDirty(request.light);
+            }
+        }
+        shadowMemoryUsed = used;
+        lastShadowBudgetChange = shadowBudgetFrame;
+        shadowBudgetDirty = false;
 
-        std::function<bool(Entity*, const glm::mat4&, const glm::vec4&, VkExtent2D)> renderEntity = [&](Entity* entity, const glm::mat4& lightViewProj, const glm::vec4& lightPosFar, VkExtent2D extent) -> bool {
-            if (!entity->isActive() || entity->isMovable()) {
-                return false;
+        std::cout << "Shadow budget: " << shadowMemoryUsed / (1024 * 1024) << " / " << shadowMemoryBudget / (1024 * 1024) << " MB";
+        for (const ShadowRequest& request : requests) {
+            std::cout << ", " << request.light->getName() << "=";
+            if (request.size > 0) {
+                std::cout << request.size;
+            } else {
+                std::cout << "none";
             }
-            std::string shaderName = entity->getShader();
-            if (shaderName != "gbuffer") {
-                return true;
+        }
+        std::cout << std::endl;
+    }
+    // Returns the sample's index for endShadowTiming, so scopes can nest.
+    size_t Renderer::beginShadowTiming(VkCommandBuffer commandBuffer, const std::string& label) {
+        std::vector<ShadowTimingSample>& samples = shadowTimingSamples[currentFrame];
+        uint32_t firstQuery = currentFrame * kShadowTimestampsPerFrame + static_cast<uint32_t>(samples.size()) * 2;
+        if (shadowTimestampPool == VK_NULL_HANDLE || firstQuery + 2 > currentFrame * kShadowTimestampsPerFrame + kFrameTimestampQuery) {
+            firstQuery = UINT32_MAX;
+        } else {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, shadowTimestampPool, firstQuery);
+        }
+        samples.push_back(ShadowTimingSample{
+            .label = label,
+            .firstQuery = firstQuery,
+            .cpuStart = std::chrono::steady_clock::now(),
+        });
+        return samples.size() - 1;
+    }
+    void Renderer::endShadowTiming(VkCommandBuffer commandBuffer, size_t sampleIndex) {
+        ShadowTimingSample& sample = shadowTimingSamples[currentFrame][sampleIndex];
+        if (sample.firstQuery != UINT32_MAX) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadowTimestampPool, sample.firstQuery + 1);
+        }
+        sample.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sample.cpuStart).count();
+    }
+    void Renderer::computeShadowFaces(Light* light, Frustum faceFrustums[6]) {
+        glm::vec3 pos = light->getWorldPosition();
+        glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), 1.0f, light->getShadowNearPlane(), light->getShadowFarPlane());
+        glm::mat4 views[6] = {
+            glm::lookAt(pos, pos + glm::vec3(1, 0, 0),  glm::vec3(0,-1, 0)),
+            glm::lookAt(pos, pos + glm::vec3(-1,0, 0),  glm::vec3(0,-1, 0)),
+            glm::lookAt(pos, pos + glm::vec3(0, 1, 0),  glm::vec3(0, 0, 1)),
+            glm::lookAt(pos, pos + glm::vec3(0,-1, 0),  glm::vec3(0, 0,-1)),
+            glm::lookAt(pos, pos + glm::vec3(0, 0, 1),  glm::vec3(0,-1, 0)),
+            glm::lookAt(pos, pos + glm::vec3(0, 0,-1),  glm::vec3(0,-1, 0)),
+        };
+        for (int face = 0; face < 6; ++face) {
+            glm::mat4 lightViewProj = shadowProj * views[face];
+            light->setShadowViewProjection(face, lightViewProj);
+            faceFrustums[face].extractFromMatrix(lightViewProj);
+        }
+    }
+    void Renderer::drawShadowCasters(VkCommandBuffer commandBuffer, Light* light, const std::vector<Entity*>& roots, bool staticCasters, bool dynamicImage, uint32_t faceMask, std::array<uint32_t, 6>& casterCounts) {
+        Image* shadowMap = dynamicImage ? light->getDynamicShadowMap() : light->getShadowMap();
+        VkExtent2D extent = { static_cast<uint32_t>(shadowMap->width), static_cast<uint32_t>(shadowMap->height) };
+        Shader* layeredShader = layeredShadows ? shaderManager->getShader("shadowmap_multiview") : nullptr;
+        VkFramebuffer layeredFramebuffer = layeredShader ? light->getLayeredShadowFrameBuffer(dynamicImage) : VK_NULL_HANDLE;
+        Shader* shadowShader = layeredFramebuffer != VK_NULL_HANDLE ? layeredShader : shaderManager->getShader("shadowmap");
+        if (!shadowShader) {
+            return;
+        }
+
+        Frustum faceFrustums[6];
+        computeShadowFaces(light, faceFrustums);
+        const glm::vec3 lightPos = light->getWorldPosition();
+        const float lightRadius = light->getRadius();
+        const glm::vec4 lightPosFar = glm::vec4(lightPos, light->getShadowFarPlane());
+        const glm::vec4 clipParams = glm::vec4(light->getShadowNearPlane(), light->getShadowFarPlane(), 0.0f, 0.0f);
+        int currentFace = 0;
+
+        std::function<void(Entity*)> traverse = [&](Entity* entity) -> void {
+            if (!entity->isActive() || (staticCasters && entity->isMovable())) {
+                return;
             }
-            glm::mat4 modelMatrix = entity->getWorldTransform();
             Model* model = entity->getModel();
-            if (!model) return true;
-
+            if (entity->getShader() == "gbuffer" && model && model->getIndexCount() > 0) {
+                glm::mat4 modelMatrix = entity->getWorldTransform();
+                AABB bounds = entity->getWorldBounds(modelMatrix);
+                uint32_t casterFaces = intersectsSphere(bounds, lightPos, lightRadius) ? cubeFaceMask(bounds, faceFrustums) & faceMask : 0u;
+                if (!layeredFramebuffer) {
+                    casterFaces &= 1u << currentFace;
+                }
+                VkBuffer vertexBuffer = model->getVertexBuffer();
+                VkBuffer indexBuffer = model->getIndexBuffer();
+                if (casterFaces != 0 && vertexBuffer != VK_NULL_HANDLE && indexBuffer != VK_NULL_HANDLE) {
+                    for (int face = 0; face < 6; ++face) {
+                        casterCounts[face] += (casterFaces >> face) & 1u;
+                    }
+                    if (layeredFramebuffer) {
+                        ShadowMultiviewPushConstants pushConstants = {
+                            .model = modelMatrix,
+                            .lightPosFar = lightPosFar,
+                            .clipParams = clipParams,
+                            .faceMask = glm::uvec4(casterFaces, 0u, 0u, 0u),
+                        };
+                        vkCmdPushConstants(commandBuffer, shadowShader->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+                    } else {
+                        ShadowMapPushConstants pushConstants = {
+                            .model = modelMatrix,
+                            .lightViewProj = light->getShadowViewProjections()[currentFace],
+                            .lightPosFar = lightPosFar,
+                        };
+                        vkCmdPushConstants(commandBuffer, shadowShader->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+                    }
+                    VkDeviceSize offsets[] = {0};
+                    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
+                    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+                    vkCmdDrawIndexed(commandBuffer, model->getIndexCount(), 1, 0, 0, 0);
+                }
+            }
+            for (Entity* child : entity->getChildren()) {
+                traverse(child);
+            }
+        };
+        std::function<void(const VkRenderPassBeginInfo&)> recordPass = [&](const VkRenderPassBeginInfo& renderPassInfo) {
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
             vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowShader->pipeline);
             VkViewport viewport = {
                 .x = 0.0f,
@@ -2282,123 +3633,459 @@ void Renderer::createInstance() {
                 .extent = extent,
             };
             vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-            ShadowMapPushConstants pushConstants = {
-                .model = modelMatrix,
-                .lightViewProj = lightViewProj,
-                .lightPosFar = lightPosFar,
-            };
-            vkCmdPushConstants(commandBuffer, shadowShader->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
-            const uint32_t indexCount = model->getIndexCount();
-            if (indexCount > 0) {
-                VkBuffer vertexBuffer = model->getVertexBuffer();
-                VkBuffer indexBuffer = model->getIndexBuffer();
-                if (vertexBuffer != VK_NULL_HANDLE && indexBuffer != VK_NULL_HANDLE) {
-                    VkDeviceSize offsets[] = {0};
-                    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
-                    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-                    vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
-                }
+            for (Entity* root : roots) {
+                traverse(root);
             }
-            return true;
+            vkCmdEndRenderPass(commandBuffer);
         };
-        std::function<void(Entity*, const glm::mat4&, const glm::vec4&, VkExtent2D)> traverse = [&](Entity* entity, const glm::mat4& lightViewProj, const glm::vec4& lightPosFar, VkExtent2D extent) -> void {
-            if (!renderEntity(entity, lightViewProj, lightPosFar, extent)) {
+
+        const size_t timing = beginShadowTiming(commandBuffer, light->getName() + (dynamicImage ? " dynamic" : " static") + (layeredFramebuffer ? " [layered]" : " [per-face]"));
+        if (layeredFramebuffer) {
+            recordPass(light->getLayeredShadowRenderPassBeginInfo(layeredFramebuffer, extent, dynamicImage));
+        } else {
+            for (currentFace = 0; currentFace < 6; ++currentFace) {
+                if (((faceMask >> currentFace) & 1u) == 0) {
+                    continue;
+                }
+                VkFramebuffer framebuffer = dynamicImage ? light->getDynamicShadowFrameBuffer(currentFace) : light->getShadowFrameBuffer(currentFace);
+                if (framebuffer == VK_NULL_HANDLE) {
+                    continue;
+                }
+                recordPass(dynamicImage ? light->getShadowRenderPassBeginInfoLoad(framebuffer, extent, currentFace) : light->getShadowRenderPassBeginInfo(framebuffer, extent, currentFace));
+            }
+        }
+        endShadowTiming(commandBuffer, timing);
+    }
+    void Renderer::renderEntitiesShadowDepth(VkCommandBuffer commandBuffer, const std::vector<Light*>& lights) {
+        CPU_PROFILE_ZONE("renderEntitiesShadowDepth");
+        if (lights.empty()) return;
+        auto& rootEntities = entityManager->getRootEntities();
+        if (rootEntities.empty()) {
+            return;
+        }
+        for (Light* light : lights) {
+            if (!light || !light->isActive() || !light->getCastsShadows()) {
+                continue;
+            }
+            Image* shadowMap = light->getShadowMap();
+            if (!shadowMap) {
+                continue;
+            }
+
+            std::array<uint32_t, 6> casterCounts{};
+            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, shadowMap);
+            drawShadowCasters(commandBuffer, light, rootEntities, true, false, 0x3F, casterCounts);
+            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, shadowMap);
+            light->setDynamicShadowStaleFaces(0x3F);
+            if (casterCounts != light->getShadowCasterCounts()) {
+                light->setShadowCasterCounts(casterCounts);
+                if (isProfilingOutputEnabled()) {
+                    std::cout << "Shadow casters for " << light->getName() << " (+X -X +Y -Y +Z -Z):";
+                    for (uint32_t count : casterCounts) {
+                        std::cout << " " << count;
+                    }
+                    std::cout << std::endl;
+                }
+            }
+        }
+    }
+    void Renderer::renderEntitiesMovableShadowDepth(VkCommandBuffer commandBuffer) {
+        CPU_PROFILE_ZONE("renderEntitiesMovableShadowDepth");
+        std::vector<Light*> lights;
+        lights = entityManager->getAllLights();
+        if (lights.empty()) return;
+
+        std::vector<Entity*> movableEntities = entityManager->getMovableEntities();
+        DynamicShadowStats stats{};
+
+        Frustum faceFrustums[6];
+        glm::vec3 lightPos(0.0f);
+        float lightRadius = 0.0f;
+        uint32_t casterFaces = 0;
+        std::function<void(Entity*)> collectFaces = [&](Entity* entity) -> void {
+            if (!entity->isActive()) {
                 return;
             }
+            if (entity->getShader() == "gbuffer" && entity->getModel()) {
+                AABB bounds = entity->getWorldBounds(entity->getWorldTransform());
+                if (intersectsSphere(bounds, lightPos, lightRadius)) {
+                    casterFaces |= cubeFaceMask(bounds, faceFrustums);
+                }
+            }
             for (Entity* child : entity->getChildren()) {
-                traverse(child, lightViewProj, lightPosFar, extent);
+                collectFaces(child);
             }
         };
         for (Light* light : lights) {
             if (!light || !light->isActive() || !light->getCastsShadows()) {
                 continue;
             }
-            glm::vec3 pos = light->getWorldPosition();
-            float nearPlane = light->getShadowNearPlane();
-            float farPlane = light->getShadowFarPlane();
-            glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane);
-            glm::mat4 views[6] = {
-                glm::lookAt(pos, pos + glm::vec3(1, 0, 0),  glm::vec3(0,-1, 0)),
-                glm::lookAt(pos, pos + glm::vec3(-1,0, 0),  glm::vec3(0,-1, 0)),
-                glm::lookAt(pos, pos + glm::vec3(0, 1, 0),  glm::vec3(0, 0, 1)),
-                glm::lookAt(pos, pos + glm::vec3(0,-1, 0),  glm::vec3(0, 0,-1)),
-                glm::lookAt(pos, pos + glm::vec3(0, 0, 1),  glm::vec3(0,-1, 0)),
-                glm::lookAt(pos, pos + glm::vec3(0, 0,-1),  glm::vec3(0,-1, 0)),
-            };
-
             Image* shadowMap = light->getShadowMap();
-            if (!shadowMap) {
+            Image* dynamicShadowMap = light->getDynamicShadowMap();
+            if (!shadowMap || !dynamicShadowMap) {
                 continue;
             }
-            VkExtent2D extent = { static_cast<uint32_t>(shadowMap->width), static_cast<uint32_t>(shadowMap->height) };
+            const VkDeviceSize faceBytes = static_cast<VkDeviceSize>(shadowMap->width) * shadowMap->height * sizeof(float);
+
+            computeShadowFaces(light, faceFrustums);
+            lightPos = light->getWorldPosition();
+            lightRadius = light->getRadius();
+            casterFaces = 0;
+            for (Entity* entity : movableEntities) {
+                collectFaces(entity);
+            }
+
+            // Faces touched by movers last frame still hold their shadows and must be restored from the static map.
+            const uint32_t copyFaces = casterFaces | light->getDynamicShadowStaleFaces();
+            light->setDynamicShadowStaleFaces(casterFaces);
+            if (copyFaces == 0) {
+                stats.lightsSkipped++;
+                stats.bytesSaved += faceBytes * 6;
+                continue;
+            }
+            stats.lightsUpdated++;
+            light->setShadowMomentsDirty(true);
+
+            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, shadowMap);
+            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, dynamicShadowMap, true);
 
-            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, shadowMap);
             for (int face = 0; face < 6; ++face) {
-                VkFramebuffer framebuffer = light->getShadowFrameBuffer(face);
-                if (framebuffer == VK_NULL_HANDLE) {
+                if (((copyFaces >> face) & 1u) == 0) {
+                    stats.bytesSaved += faceBytes;
                     continue;
                 }
+                VkImageCopy copyRegion = light->getShadowImageCopyRegion(face);
+                vkCmdCopyImage(commandBuffer,
+                    shadowMap->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    dynamicShadowMap->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    1, &copyRegion
+                );
+                stats.facesCopied++;
+            }
 
-                VkRenderPassBeginInfo renderPassInfo = light->getShadowRenderPassBeginInfo(framebuffer, extent, face);
-                vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-                glm::mat4 lightView = views[face];
-                glm::mat4 lightViewProj = shadowProj * lightView;
-                light->setShadowViewProjection(face, lightViewProj);
-                glm::vec4 lightPosFar = glm::vec4(pos, farPlane);
-                for (Entity* root : rootEntities) {
-                    traverse(root, lightViewProj, lightPosFar, extent);
+            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, shadowMap);
+            if (casterFaces != 0) {
+                light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, dynamicShadowMap, true);
+                std::array<uint32_t, 6> casterCounts{};
+                drawShadowCasters(commandBuffer, light, movableEntities, false, true, casterFaces, casterCounts);
+                for (int face = 0; face < 6; ++face) {
+                    stats.facesRedrawn += (casterFaces >> face) & 1u;
                 }
+            }
+            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, dynamicShadowMap, true);
+        }
 
-                vkCmdEndRenderPass(commandBuffer);
+        if (stats != dynamicShadowStats) {
+            dynamicShadowStats = stats;
+            if (isProfilingOutputEnabled()) {
+                std::cout << "Dynamic shadows: " << stats.lightsUpdated << " lights updated, " << stats.lightsSkipped << " skipped, "
+                          << stats.facesCopied << " faces copied, " << stats.facesRedrawn << " faces redrawn, "
+                          << stats.bytesSaved / (1024 * 1024) << " MB of copies saved per frame" << std::endl;
             }
-            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, shadowMap);
         }
     }
-    void Renderer::renderEntitiesMovableShadowDepth(VkCommandBuffer commandBuffer) {
-        std::vector<Light*> lights;
-        lights = entityManager->getAllLights();
-        if (lights.empty()) return;
-        Shader* shadowShader = shaderManager->getShader("shadowmap");
-        if (!shadowShader) {
+    void Renderer::dumpGpuProfile(const std::string& basePath) {
+        const bool written = gpuProfiler.writeCSV(basePath + ".csv") && gpuProfiler.writeJSON(basePath + ".json");
+        std::cout << "GPU profile: " << (written ? "wrote " : "failed to write ") << basePath << ".csv and " << basePath << ".json" << std::endl;
+    }
+    bool Renderer::isProfilingOutputEnabled() const {
+        return CpuProfiler::isEnabled() || gpuProfilerOverlayMode != 0;
+    }
+    // One TextObject per profiler scope in the top-left corner. Looked up by name every frame since
+    // switching scenes clears the UI.
+    void Renderer::updateGpuProfilerOverlay() {
+        static const std::string kOverlayName = "gpuProfilerOverlay";
+        UIObject* overlay = uiManager->getUIObject(kOverlayName);
+        if (gpuProfilerOverlayMode == 0) {
+            if (overlay) {
+                uiManager->removeUIObject(overlay);
+            }
+            return;
+        }
+        if (!overlay) {
+            overlay = new UIObject({0.0f, 0.0f}, {1.0f, 1.0f}, {0, 0}, kOverlayName, "");
+            uiManager->addUIObject(overlay);
+        }
+        const std::vector<GpuProfiler::ScopeResult>& results = gpuProfiler.getResults();
+        const size_t lineCount = std::max(results.size(), overlay->children.size());
+        for (size_t i = 0; i < lineCount; i++) {
+            const std::string lineName = "gpuProfilerLine" + std::to_string(i);
+            auto it = overlay->children.find(lineName);
+            TextObject* line = it != overlay->children.end() ? static_cast<TextObject*>(it->second) : nullptr;
+            if (i >= results.size()) {
+                if (line) {
+                    line->text.clear();
+                }
+                continue;
+            }
+            if (!line) {
+                line = new TextObject("", "Lato", {8.0f, 8.0f + 14.0f * static_cast<float>(i)}, {400.0f, 12.0f}, {0, 2}, lineName, {1.0f, 1.0f, 0.6f});
+                overlay->addChild(line);
+            }
+            line->text = GpuProfiler::format(results[i]);
+        }
+    }
+    ShadowFilterMode Renderer::getEffectiveShadowFilter(const Light* light) const {
+        return shadowFilterOverride.value_or(light->getShadowFilterMode());
+    }
+    void Renderer::setQualityGovernorEnabled(bool enabled, float targetMs) {
+        if (qualityGovernorEnabled) {
+            applyQualityLevel(0);
+        }
+        qualityGovernorEnabled = enabled;
+        if (!enabled) {
+            std::cout << "Quality governor: off" << std::endl;
+            return;
+        }
+        qualityBaseSSRPreset = ssrPreset;
+        qualityBaseShadowFilter = shadowFilterOverride;
+        qualityBaseShadowBudget = shadowMemoryBudget;
+        QualityGovernor::Config config{};
+        config.targetMs = targetMs;
+        qualityGovernor = QualityGovernor(kQualityLevelCount, config);
+        std::cout << "Quality governor: on, target " << targetMs << " ms" << std::endl;
+    }
+    void Renderer::updateQualityGovernor() {
+        // This frame slot's fence has signalled, so the frame timestamps it wrote last time are available.
+        const bool timingPending = frameTimingPending[currentFrame];
+        frameTimingPending[currentFrame] = false;
+        lastGpuFrameMs = -1.0;
+        uint64_t timestamps[2] = {};
+        if (timingPending && vkGetQueryPoolResults(device, shadowTimestampPool, currentFrame * kShadowTimestampsPerFrame + kFrameTimestampQuery, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            lastGpuFrameMs = static_cast<double>(timestamps[1] - timestamps[0]) * timestampPeriod / 1.0e6;
+        }
+        if (!qualityGovernorEnabled) {
             return;
         }
+        // Without timestamps the wall-clock frame time is the best stand-in for the GPU's share.
+        const double gpuMs = lastGpuFrameMs >= 0.0 ? lastGpuFrameMs : static_cast<double>(deltaTime) * 1000.0;
+        const QualityGovernor::Bottleneck previousBottleneck = qualityGovernor.getBottleneck();
+        const bool changed = qualityGovernor.update(frameCpuMs, gpuMs);
+        if (qualityGovernor.getBottleneck() == QualityGovernor::Bottleneck::CPU && previousBottleneck != QualityGovernor::Bottleneck::CPU) {
+            std::cout << "Quality governor: CPU-bound (cpu " << qualityGovernor.getCpuMs() << " ms, gpu " << qualityGovernor.getGpuMs() << " ms), holding GPU quality" << std::endl;
+        }
+        if (!changed) {
+            return;
+        }
+        const uint32_t level = qualityGovernor.getLevel();
+        applyQualityLevel(level);
+        std::cout << "Quality governor: gpu " << qualityGovernor.getGpuMs() << " ms, cpu " << qualityGovernor.getCpuMs() << " ms, target "
+                  << qualityGovernor.getConfig().targetMs << " ms -> level " << level << " (" << kQualityLevels[level].name << "): ssr "
+                  << ssrPresetSettings(ssrPreset).name << ", shadows " << (shadowFilterOverride ? shadowFilterModeName(*shadowFilterOverride) : "per-light")
+                  << ", shadow budget " << shadowMemoryBudget / (1024 * 1024) << " MB, render " << renderExtent.width << "x" << renderExtent.height
+                  << " of " << swapChainExtent.width << "x" << swapChainExtent.height << std::endl;
+    }
+    void Renderer::applyQualityLevel(uint32_t level) {
+        const QualityLevel& quality = kQualityLevels[std::min(level, kQualityLevelCount - 1)];
+        SSRPreset preset = qualityBaseSSRPreset;
+        if (quality.ssrPreset && ssrPresetCost(*quality.ssrPreset) < ssrPresetCost(preset)) {
+            preset = *quality.ssrPreset;
+        }
+        if (preset != ssrPreset) {
+            setSSRPreset(preset);
+        }
+        std::optional<ShadowFilterMode> filter = qualityBaseShadowFilter;
+        if (quality.shadowFilter && (!filter || shadowFilterCost(*quality.shadowFilter) < shadowFilterCost(*filter))) {
+            filter = quality.shadowFilter;
+        }
+        if (filter != shadowFilterOverride) {
+            shadowFilterOverride = filter;
+            for (Light* light : entityManager->getAllLights()) {
+                light->setShadowMomentsDirty(true);
+            }
+            shadowBudgetDirty = true;
+        }
+        const VkDeviceSize budget = qualityBaseShadowBudget / quality.shadowBudgetDivisor;
+        if (budget != shadowMemoryBudget) {
+            shadowMemoryBudget = budget;
+            shadowBudgetDirty = true;
+        }
+        if (quality.renderScale != renderScale) {
+            renderScale = quality.renderScale;
+            if (swapChain != VK_NULL_HANDLE) {
+                updateRenderExtent();
+                recreateRenderTargets();
+            }
+        }
+    }
+    void Renderer::prefilterShadowMoments(VkCommandBuffer commandBuffer) {
+        ComputeShader* momentsShader = shaderManager->getComputeShader("shadow_moments");
+        if (!momentsShader) {
+            return;
+        }
+        if (shadowMomentDescriptorSets.empty()) {
+            std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT * kMaxShadowCubeSlots, momentsShader->descriptorSetLayout);
+            VkDescriptorSetAllocateInfo allocInfo = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .descriptorPool = momentsShader->descriptorPool,
+                .descriptorSetCount = static_cast<uint32_t>(layouts.size()),
+                .pSetLayouts = layouts.data(),
+            };
+            shadowMomentDescriptorSets.resize(layouts.size());
+            if (vkAllocateDescriptorSets(device, &allocInfo, shadowMomentDescriptorSets.data()) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to allocate shadow moment descriptor sets!");
+            }
+        }
 
-        std::vector<Entity*> movableEntities = entityManager->getMovableEntities();
+        uint32_t slot = 0;
+        for (Light* light : entityManager->getAllLights()) {
+            if (slot >= kMaxShadowCubeSlots) {
+                break;
+            }
+            if (!light || !light->isActive() || !light->getCastsShadows() || !light->getShadowMomentsDirty() || getEffectiveShadowFilter(light) != ShadowFilterMode::Moments) {
+                continue;
+            }
+            Image* dynamicShadowMap = light->getDynamicShadowMap();
+            Image* momentMap = light->getShadowMomentMap();
+            VkImageView depthArrayView = light->getLayeredShadowView(true);
+            VkImageView momentStorageView = light->getShadowMomentStorageView();
+            if (!dynamicShadowMap || !momentMap || depthArrayView == VK_NULL_HANDLE || momentStorageView == VK_NULL_HANDLE) {
+                continue;
+            }
+            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, dynamicShadowMap, true);
 
-        std::function<bool(Entity*, const glm::mat4&, const glm::vec4&, VkExtent2D)> renderEntity = [&](Entity* entity, const glm::mat4& lightViewProj, const glm::vec4& lightPosFar, VkExtent2D extent) -> bool {
+            // Sets for this frame slot were last used by the frame whose fence we already waited on.
+            VkDescriptorSet descriptorSet = shadowMomentDescriptorSets[currentFrame * kMaxShadowCubeSlots + slot];
+            VkDescriptorImageInfo storageInfo = {
+                .sampler = VK_NULL_HANDLE,
+                .imageView = momentStorageView,
+                .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+            };
+            VkDescriptorImageInfo depthInfo = {
+                .sampler = dynamicShadowMap->imageSampler,
+                .imageView = depthArrayView,
+                .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+            };
+            std::array<VkWriteDescriptorSet, 2> descriptorWrites = {{
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = descriptorSet,
+                    .dstBinding = 0,
+                    .dstArrayElement = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                    .pImageInfo = &storageInfo,
+                },
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = descriptorSet,
+                    .dstBinding = 1,
+                    .dstArrayElement = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                    .pImageInfo = &depthInfo,
+                },
+            }};
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+            if (slot == 0) {
+                // Make this frame's shadow depth writes visible to compute, and keep the previous
+                // frame's lighting reads of the moment maps ahead of the writes below.
+                VkMemoryBarrier depthBarrier = {
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                };
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &depthBarrier, 0, nullptr, 0, nullptr);
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, momentsShader->pipeline);
+            }
+            ++slot;
+
+            const uint32_t momentSize = static_cast<uint32_t>(momentMap->width);
+            ShadowMomentsPushConstants pushConstants = {
+                .size = glm::uvec4(momentSize, static_cast<uint32_t>(dynamicShadowMap->width), 0u, 0u),
+                .exponents = glm::vec4(kShadowMomentPositiveExponent, kShadowMomentNegativeExponent, 0.0f, 0.0f),
+            };
+            const size_t timing = beginShadowTiming(commandBuffer, light->getName() + " moments prefilter");
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, momentsShader->pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+            vkCmdPushConstants(commandBuffer, momentsShader->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ShadowMomentsPushConstants), &pushConstants);
+            vkCmdDispatch(commandBuffer, (momentSize + 7) / 8, (momentSize + 7) / 8, 6);
+            endShadowTiming(commandBuffer, timing);
+            light->setShadowMomentsDirty(false);
+        }
+        if (slot > 0) {
+            VkMemoryBarrier barrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            };
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        }
+    }
+    void Renderer::renderEntitiesGeometry(VkCommandBuffer commandBuffer) {
+        CPU_PROFILE_ZONE("renderEntitiesGeometry");
+        auto& rootEntities = entityManager->getRootEntities();
+        glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 5.0f);
+        float cameraFOV = 45.0f;
+        glm::mat4 view = glm::mat4(1.0f);
+
+        int culledEntities = 0;
+        Frustum frustrum;
+        if (activeCamera) {
+            glm::mat4 cameraWorld = activeCamera->getWorldTransform();
+            glm::vec4 worldPos = cameraWorld * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            cameraPos = glm::vec3(worldPos);
+            cameraFOV = activeCamera->getFOV();
+            float aspectRatio = static_cast<float>(swapChainExtent.width) / std::max(static_cast<float>(swapChainExtent.height), 1.0f);
+            frustrum = activeCamera->getFrustrum(aspectRatio, 0.1f, 200.0f, cameraWorld);
+            view = glm::inverse(cameraWorld);
+        }
+        glm::mat4 proj = glm::perspective(glm::radians(cameraFOV), static_cast<float>(swapChainExtent.width) / std::max(static_cast<float>(swapChainExtent.height), 1.0f), 0.1f, 200.0f);
+        proj[1][1] *= -1;
+        const bool softwareOcclusionActive = softwareOcclusionEnabled && activeCamera && !rootEntities.empty();
+        uint32_t softwareOccluded = 0;
+        if (softwareOcclusionActive) {
+            prepareSoftwareOcclusion(proj * view);
+        }
+        std::function<bool(Entity*)> renderEntity = [&](Entity* entity) -> bool {
             if (!entity->isActive()) {
                 return false;
             }
             std::string shaderName = entity->getShader();
-            if (shaderName != "gbuffer") {
+            if (shaderName != "gbuffer" && shaderName != "skybox") {
                 return true;
             }
             glm::mat4 modelMatrix = entity->getWorldTransform();
+            if (activeCamera && entity->getModel() && entity->getName() != "skybox") {
+                AABB bounds = entity->getWorldBounds(modelMatrix);
+                if (!frustrum.intersectsAABB(bounds.min, bounds.max)) {
+                    culledEntities++;
+                    return true;  // Culled: skip rendering
+                }
+                if (softwareOcclusionActive && !entity->isOccluder() && !softwareOcclusion.isVisible(bounds)) {
+                    softwareOccluded++;
+                    return true;
+                }
+            }
             Model* model = entity->getModel();
-            if (!model) return true;
-
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowShader->pipeline);
+            Shader* shader = shaderManager->getShader(shaderName);
+            if (!model || !shader) return true;
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->pipeline);
+            
             VkViewport viewport = {
                 .x = 0.0f,
                 .y = 0.0f,
-                .width = static_cast<float>(extent.width),
-                .height = static_cast<float>(extent.height),
+                .width = static_cast<float>(renderExtent.width),
+                .height = static_cast<float>(renderExtent.height),
                 .minDepth = 0.0f,
                 .maxDepth = 1.0f,
             };
             vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
             VkRect2D scissor = {
                 .offset = {0, 0},
-                .extent = extent,
+                .extent = renderExtent,
             };
             vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-            ShadowMapPushConstants pushConstants = {
-                .model = modelMatrix,
-                .lightViewProj = lightViewProj,
-                .lightPosFar = lightPosFar,
-            };
-            vkCmdPushConstants(commandBuffer, shadowShader->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+            
+            UniformBufferObject ubo{};
+            ubo.model = modelMatrix;
+            ubo.view = view;
+            ubo.proj = proj;
+            ubo.cameraPos = cameraPos;
+            const uint32_t dynamicOffset = entity->updateUniformBuffer(ubo);
+            if (dynamicOffset == kUniformAllocationFailed) {
+                return true;
+            }
             const uint32_t indexCount = model->getIndexCount();
             if (indexCount > 0) {
                 VkBuffer vertexBuffer = model->getVertexBuffer();
@@ -2407,217 +4094,457 @@ void Renderer::createInstance() {
                     VkDeviceSize offsets[] = {0};
                     vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
                     vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-                    vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+                    const auto& descriptorSets = entity->getDescriptorSets();
+                    if (descriptorSets.size() == MAX_FRAMES_IN_FLIGHT && descriptorSets[currentFrame] != VK_NULL_HANDLE) {
+                        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->pipelineLayout, 0, 1, &descriptorSets[currentFrame], 1, &dynamicOffset);
+                        vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+                    }
                 }
             }
             return true;
         };
-        std::function<void(Entity*, const glm::mat4&, const glm::vec4&, VkExtent2D)> traverse = [&](Entity* entity, const glm::mat4& lightViewProj, const glm::vec4& lightPosFar, VkExtent2D extent) -> void {
-            if (!renderEntity(entity, lightViewProj, lightPosFar, extent)) {
+        
+        if (rootEntities.empty()) return;
+
+        if (!indirectDrawBatches.empty()) {
+            renderIndirectDrawBatches(commandBuffer, view, proj, cameraPos);
+            for (Entity* entity : cpuGeometryEntities) {
+                renderEntity(entity);
+            }
+        } else {
+            std::function<void(Entity*)> traverse = [&](Entity* entity) -> void {
+                if (!renderEntity(entity)) {
+                    return;
+                }
+                for (Entity* child : entity->getChildren()) {
+                    traverse(child);
+                }
+            };
+
+            for (Entity* entity : rootEntities) {
+                traverse(entity);
+            }
+        }
+
+        if (softwareOcclusionActive) {
+            softwareOccludedTotal += softwareOccluded;
+            if (++softwareOcclusionFrames >= 300) {
+                if (isProfilingOutputEnabled()) {
+                    std::cout << "Software occlusion (averaged over " << softwareOcclusionFrames << " frames): "
+                              << softwareOcclusion.getTriangleCount() << " occluder triangles, "
+                              << softwareOcclusionMs / softwareOcclusionFrames << " ms rasterizing, "
+                              << static_cast<double>(softwareOccludedTotal) / softwareOcclusionFrames << " entities occluded" << std::endl;
+                }
+                softwareOccludedTotal = 0;
+                softwareOcclusionMs = 0.0;
+                softwareOcclusionFrames = 0;
+            }
+        }
+    }
+    // Rasterizes every active occluder entity into the CPU depth buffer for this frame's camera.
+    void Renderer::prepareSoftwareOcclusion(const glm::mat4& viewProjection) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        softwareOcclusion.beginFrame(viewProjection);
+        std::function<void(Entity*)> collect = [&](Entity* entity) -> void {
+            if (!entity->isActive()) {
                 return;
             }
+            if (entity->isOccluder() && entity->getModel()) {
+                softwareOcclusion.addOccluder(*entity->getModel(), entity->getWorldTransform());
+            }
             for (Entity* child : entity->getChildren()) {
-                traverse(child, lightViewProj, lightPosFar, extent);
+                collect(child);
             }
         };
-        for (Light* light : lights) {
-            if (!light || !light->isActive() || !light->getCastsShadows()) {
+        for (Entity* entity : entityManager->getRootEntities()) {
+            collect(entity);
+        }
+        softwareOcclusion.rasterize();
+        softwareOcclusionMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+    // Hands the current indirect draw resources to the retire list. The frame being recorded has
+    // already waited on its own fence, so only the other frame slots can still be reading them.
+    void Renderer::retireIndirectDrawResources() {
+        RetiredIndirectDrawResources retired;
+        auto retireBuffer = [&retired](VkBuffer& buffer, DeviceAllocation& memory) {
+            if (buffer) {
+                retired.buffers.emplace_back(buffer, memory);
+            }
+            buffer = VK_NULL_HANDLE;
+            memory = {};
+        };
+        retireBuffer(cullObjectBuffer, cullObjectBufferMemory);
+        retireBuffer(cullVisibilityBuffer, cullVisibilityBufferMemory);
+        for (size_t i = 0; i < cullCommandBuffers.size(); i++) {
+            retireBuffer(cullCommandBuffers[i], cullCommandBuffersMemory[i]);
+            retireBuffer(cullCountBuffers[i], cullCountBuffersMemory[i]);
+            retireBuffer(cullStatsBuffers[i], cullStatsBuffersMemory[i]);
+        }
+        for (VkDescriptorPool* pool : {&cullDescriptorPool, &indirectDescriptorPool}) {
+            if (*pool) {
+                retired.descriptorPools.push_back(*pool);
+            }
+            *pool = VK_NULL_HANDLE;
+        }
+        cullCommandBuffers.clear();
+        cullCommandBuffersMemory.clear();
+        cullCountBuffers.clear();
+        cullCountBuffersMemory.clear();
+        cullStatsBuffers.clear();
+        cullStatsBuffersMemory.clear();
+        cullStatsBuffersMapped.clear();
+        cullStatsPending.fill(false);
+        indirectDrawBatches.clear();
+        cullDescriptorSets.clear();
+        indirectObjectCount = 0;
+        if (retired.buffers.empty() && retired.descriptorPools.empty()) {
+            return;
+        }
+        retired.pendingFrameMask = ((1u << MAX_FRAMES_IN_FLIGHT) - 1) & ~(1u << currentFrame);
+        retiredIndirectDrawResources.push_back(std::move(retired));
+    }
+    // Called once the current frame slot's fence has signalled; all releases everything, for shutdown.
+    void Renderer::releaseRetiredIndirectDrawResources(bool all) {
+        for (RetiredIndirectDrawResources& retired : retiredIndirectDrawResources) {
+            retired.pendingFrameMask &= ~(1u << currentFrame);
+            if (retired.pendingFrameMask != 0 && !all) {
                 continue;
             }
-            glm::vec3 pos = light->getWorldPosition();
-            float nearPlane = light->getShadowNearPlane();
-            float farPlane = light->getShadowFarPlane();
-            glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane);
-            glm::mat4 views[6] = {
-                glm::lookAt(pos, pos + glm::vec3(1, 0, 0),  glm::vec3(0,-1, 0)),
-                glm::lookAt(pos, pos + glm::vec3(-1,0, 0),  glm::vec3(0,-1, 0)),
-                glm::lookAt(pos, pos + glm::vec3(0, 1, 0),  glm::vec3(0, 0, 1)),
-                glm::lookAt(pos, pos + glm::vec3(0,-1, 0),  glm::vec3(0, 0,-1)),
-                glm::lookAt(pos, pos + glm::vec3(0, 0, 1),  glm::vec3(0,-1, 0)),
-                glm::lookAt(pos, pos + glm::vec3(0, 0,-1),  glm::vec3(0,-1, 0)),
-            };
+            for (auto& [buffer, memory] : retired.buffers) {
+                vkDestroyBuffer(device, buffer, nullptr);
+                memoryAllocator.free(memory);
+            }
+            for (VkDescriptorPool pool : retired.descriptorPools) {
+                vkDestroyDescriptorPool(device, pool, nullptr);
+            }
+            retired.buffers.clear();
+            retired.descriptorPools.clear();
+            retired.pendingFrameMask = 0;
+        }
+        std::erase_if(retiredIndirectDrawResources, [](const RetiredIndirectDrawResources& retired) {
+            return retired.pendingFrameMask == 0;
+        });
+    }
+    // Runs before the frame's command buffer begins. Any scene change re-sorts entities between the
+    // indirect batches and the CPU draw list; only a change to the static geometry rebuilds the GPU
+    // side, and the resources it replaces are retired through the frame fences instead of idling the device.
+    void Renderer::updateIndirectDrawBatches() {
+        if (entityManager->getSceneVersion() == indirectSceneVersion) {
+            return;
+        }
+        indirectSceneVersion = entityManager->getSceneVersion();
+        cpuGeometryEntities.clear();
+        Shader* indirectShader = shaderManager->getShader("gbuffer_indirect");
+        ComputeShader* cullShader = shaderManager->getComputeShader("cull");
+        if (!gpuDrivenGeometry || !indirectShader || !cullShader) {
+            return;
+        }
 
-            Image* shadowMap = light->getShadowMap();
-            Image* dynamicShadowMap = light->getDynamicShadowMap();
-            if (!shadowMap || !dynamicShadowMap) {
-                continue;
+        std::map<std::pair<Model*, std::vector<Image*>>, std::vector<Entity*>> batchedEntities;
+        std::function<void(Entity*, bool)> collect = [&](Entity* entity, bool movableParent) -> void {
+            if (!entity->isActive()) {
+                return;
+            }
+            const std::string shaderName = entity->getShader();
+            Model* model = entity->getModel();
+            const bool movable = movableParent || entity->isMovable();
+            if (shaderName == "gbuffer" && model && !movable && model->getIndexCount() > 0
+                && entity->getBoundTextures().size() >= static_cast<size_t>(indirectShader->fragmentBitBindings)
+                && (batchedEntities.size() < kMaxIndirectBatches || batchedEntities.count({model, entity->getBoundTextures()}))) {
+                batchedEntities[{model, entity->getBoundTextures()}].push_back(entity);
+            } else if (shaderName == "gbuffer" || shaderName == "skybox") {
+                cpuGeometryEntities.push_back(entity);
+            }
+            for (Entity* child : entity->getChildren()) {
+                collect(child, movable);
             }
-            VkExtent2D extent = { static_cast<uint32_t>(shadowMap->width), static_cast<uint32_t>(shadowMap->height) };
+        };
+        for (Entity* entity : entityManager->getRootEntities()) {
+            collect(entity, false);
+        }
+        if (entityManager->getStaticGeometryVersion() == indirectStaticGeometryVersion) {
+            return;
+        }
+        indirectStaticGeometryVersion = entityManager->getStaticGeometryVersion();
+        retireIndirectDrawResources();
+        if (batchedEntities.empty()) {
+            return;
+        }
 
-            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, shadowMap);
-            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, dynamicShadowMap, true);
+        std::vector<GPUObjectData> objects;
+        for (auto& [key, entities] : batchedEntities) {
+            IndirectDrawBatch batch;
+            batch.model = key.first;
+            batch.textures = key.second;
+            batch.firstCommand = static_cast<uint32_t>(objects.size());
+            batch.commandCount = static_cast<uint32_t>(entities.size());
+            const uint32_t batchIndex = static_cast<uint32_t>(indirectDrawBatches.size());
+            for (Entity* entity : entities) {
+                GPUObjectData object{};
+                object.model = entity->getWorldTransform();
+                object.boundsMin = glm::vec4(batch.model->getBoundsMin(), 0.0f);
+                object.boundsMax = glm::vec4(batch.model->getBoundsMax(), 0.0f);
+                object.drawInfo = glm::uvec4(batchIndex, batch.firstCommand, batch.model->getIndexCount(), 0u);
+                objects.push_back(object);
+            }
+            indirectDrawBatches.push_back(std::move(batch));
+        }
+        indirectObjectCount = static_cast<uint32_t>(objects.size());
 
-            for (int face = 0; face < 6; ++face) {
-                VkImageCopy copyRegion = light->getShadowImageCopyRegion(face);
-                vkCmdCopyImage(commandBuffer,
-                    shadowMap->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                    dynamicShadowMap->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    1, &copyRegion
-                );
+        VkDeviceSize objectBufferSize = sizeof(GPUObjectData) * objects.size();
+        createBuffer(objectBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            cullObjectBuffer, cullObjectBufferMemory);
+        memcpy(cullObjectBufferMemory.mapped, objects.data(), objectBufferSize);
+
+        // Commands and counts have one half per occlusion culling phase.
+        VkDeviceSize commandBufferSize = sizeof(VkDrawIndexedIndirectCommand) * objects.size() * 2;
+        VkDeviceSize countBufferSize = sizeof(uint32_t) * indirectDrawBatches.size() * 2;
+        cullCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        cullCommandBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        cullCountBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        cullCountBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        cullStatsBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        cullStatsBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        cullStatsBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+        // Visibility carries over between frames, so both frames in flight share it; it starts cleared
+        // and the first frame's second phase draws everything that survives the (empty) pyramid.
+        createBuffer(sizeof(uint32_t) * objects.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cullVisibilityBuffer, cullVisibilityBufferMemory);
+        cullVisibilityCleared = false;
+        std::vector<VkBuffer> objectBuffers(MAX_FRAMES_IN_FLIGHT, cullObjectBuffer);
+        std::vector<VkBuffer> cullBuffers;
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            createBuffer(commandBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cullCommandBuffers[i], cullCommandBuffersMemory[i]);
+            createBuffer(countBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cullCountBuffers[i], cullCountBuffersMemory[i]);
+            createBuffer(sizeof(GeometryCullStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cullStatsBuffers[i], cullStatsBuffersMemory[i]);
+            cullStatsBuffersMapped[i] = cullStatsBuffersMemory[i].mapped;
+            cullBuffers.push_back(cullObjectBuffer);
+            cullBuffers.push_back(cullCommandBuffers[i]);
+            cullBuffers.push_back(cullCountBuffers[i]);
+            cullBuffers.push_back(cullVisibilityBuffer);
+            cullBuffers.push_back(cullStatsBuffers[i]);
+        }
+        // Each build owns its descriptor pools, so they retire together with the buffers their sets point at.
+        createDescriptorPool(cullShader->storageImageCount, cullShader->computeBitBindings - cullShader->storageImageCount,
+            cullDescriptorPool, 1, true, nullptr, cullShader->storageDescriptorType);
+        createDescriptorPool(indirectShader->vertexBitBindings, indirectShader->fragmentBitBindings, indirectDescriptorPool,
+            static_cast<int>(indirectDrawBatches.size()), false, nullptr, indirectShader->vertexDescriptorType);
+        std::vector<Image*> noTextures;
+        cullDescriptorSets = createDescriptorSets(cullDescriptorPool, cullShader->descriptorSetLayout,
+            cullShader->storageImageCount, 0, noTextures, cullBuffers, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writeCullHiZDescriptors();
+        for (auto& batch : indirectDrawBatches) {
+            batch.descriptorSets = createDescriptorSets(indirectDescriptorPool, indirectShader->descriptorSetLayout,
+                indirectShader->vertexBitBindings, indirectShader->fragmentBitBindings, batch.textures, objectBuffers, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        }
+        std::cout << "GPU culling: " << indirectObjectCount << " static objects in " << indirectDrawBatches.size() << " indirect batches ("
+                  << (cmdDrawIndexedIndirectCount ? "draw indirect count" : "draw indirect fallback") << ")" << std::endl;
+    }
+    // Phase 0 culls against the frustum only, 1 draws last frame's visible set, 2 is the occlusion test.
+    CullPushConstants Renderer::makeCullPushConstants(uint32_t phase) const {
+        CullPushConstants cullPushConstants{};
+        for (auto& plane : cullPushConstants.frustumPlanes) {
+            plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        }
+        cullPushConstants.viewProj = glm::mat4(1.0f);
+        if (activeCamera) {
+            float aspectRatio = static_cast<float>(swapChainExtent.width) / std::max(static_cast<float>(swapChainExtent.height), 1.0f);
+            Frustum frustum = activeCamera->getFrustrum(aspectRatio, 0.1f, 200.0f, activeCamera->getWorldTransform());
+            for (int i = 0; i < 6; i++) {
+                cullPushConstants.frustumPlanes[i] = glm::vec4(frustum.planes[i].normal, frustum.planes[i].distance);
+            }
+            glm::mat4 proj = glm::perspective(glm::radians(activeCamera->getFOV()), aspectRatio, 0.1f, 200.0f);
+            proj[1][1] *= -1;
+            cullPushConstants.viewProj = proj * glm::inverse(activeCamera->getWorldTransform());
+        }
+        cullPushConstants.hiZSize = glm::vec4(renderExtent.width, renderExtent.height, hiZMipCount, 0.0f);
+        cullPushConstants.counts = glm::uvec4(indirectObjectCount, cmdDrawIndexedIndirectCount ? 1u : 0u,
+            phase, static_cast<uint32_t>(indirectDrawBatches.size()));
+        return cullPushConstants;
+    }
+    void Renderer::dispatchGeometryCulling(VkCommandBuffer commandBuffer) {
+        occlusionPhaseActive = false;
+        if (indirectDrawBatches.empty()) {
+            return;
+        }
+        ComputeShader* cullShader = shaderManager->getComputeShader("cull");
+        if (!cullShader) {
+            return;
+        }
+        // This frame slot's fence has signalled, so the counters it wrote last time are complete.
+        if (cullStatsPending[currentFrame]) {
+            geometryCullStats = *static_cast<const GeometryCullStats*>(cullStatsBuffersMapped[currentFrame]);
+            occludedObjectsTotal += geometryCullStats.occlusionCulled;
+            if (++occlusionStatsFrames >= 300) {
+                if (isProfilingOutputEnabled()) {
+                    std::cout << "Occlusion culling (averaged over " << occlusionStatsFrames << " frames): " << indirectObjectCount << " objects, "
+                              << static_cast<double>(occludedObjectsTotal) / occlusionStatsFrames << " occluded; last frame "
+                              << geometryCullStats.frustumCulled << " outside the frustum, " << geometryCullStats.occlusionCulled << " occluded, "
+                              << geometryCullStats.firstPhaseDraws << " + " << geometryCullStats.secondPhaseDraws << " drawn" << std::endl;
+                }
+                occludedObjectsTotal = 0;
+                occlusionStatsFrames = 0;
             }
+        }
+        cullStatsPending[currentFrame] = true;
+        // The single render pass path has no point between geometry and lighting to build the pyramid.
+        occlusionPhaseActive = occlusionCulling && supportsHiZ && hiZMipCount > 0 && !singlePassDeferred;
 
-            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, shadowMap);
-            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, dynamicShadowMap, true);
-
-            for (int face = 0; face < 6; ++face) {
-                VkFramebuffer framebuffer = light->getDynamicShadowFrameBuffer(face);
-                if (framebuffer == VK_NULL_HANDLE) {
-                    continue;
-                }
+        vkCmdFillBuffer(commandBuffer, cullCountBuffers[currentFrame], 0, VK_WHOLE_SIZE, 0);
+        vkCmdFillBuffer(commandBuffer, cullStatsBuffers[currentFrame], 0, VK_WHOLE_SIZE, 0);
+        if (!cullVisibilityCleared) {
+            vkCmdFillBuffer(commandBuffer, cullVisibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+            cullVisibilityCleared = true;
+        }
+        VkMemoryBarrier clearBarrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        };
+        // Also orders this read of the visibility flags after the previous frame's second phase wrote them.
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
 
-                VkRenderPassBeginInfo renderPassInfo = light->getShadowRenderPassBeginInfoLoad(framebuffer, extent, face);
-                vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        CullPushConstants cullPushConstants = makeCullPushConstants(occlusionPhaseActive ? 1u : 0u);
 
-                glm::mat4 lightView = views[face];
-                glm::mat4 lightViewProj = shadowProj * lightView;
-                light->setShadowViewProjection(face, lightViewProj);
-                glm::vec4 lightPosFar = glm::vec4(pos, farPlane);
-                for (Entity* entity : movableEntities) {
-                    traverse(entity, lightViewProj, lightPosFar, extent);
-                }
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullShader->pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullShader->pipelineLayout, 0, 1, &cullDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, cullShader->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &cullPushConstants);
+        vkCmdDispatch(commandBuffer, (indirectObjectCount + 63) / 64, 1, 1);
 
-                vkCmdEndRenderPass(commandBuffer);
-            }
-            light->transitionShadowMapLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, dynamicShadowMap, true);
+        VkMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+    void Renderer::writeCullHiZDescriptors() {
+        if (cullDescriptorSets.empty() || !hiZView || !hiZSampler) {
+            return;
+        }
+        VkDescriptorImageInfo hiZInfo = {
+            .sampler = hiZSampler,
+            .imageView = hiZView,
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        };
+        for (VkDescriptorSet set : cullDescriptorSets) {
+            VkWriteDescriptorSet write = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = set,
+                .dstBinding = 5,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .pImageInfo = &hiZInfo,
+            };
+            vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
         }
     }
-    void Renderer::renderEntitiesGeometry(VkCommandBuffer commandBuffer) {
-        auto& rootEntities = entityManager->getRootEntities();
+    void Renderer::renderOcclusionCulledGeometry(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        ComputeShader* cullShader = shaderManager->getComputeShader("cull");
+        if (!occlusionPhaseActive || !cullShader) {
+            return;
+        }
+        const size_t timing = beginShadowTiming(commandBuffer, "occlusion culling second phase");
+        // The frame graph made the first phase's depth visible to the pyramid build.
+        buildHiZPyramid(commandBuffer);
+        VkMemoryBarrier pyramidBarrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &pyramidBarrier, 0, nullptr, 0, nullptr);
+
+        // Same objects and camera as the first phase, now tested against the pyramid of its depth.
+        CullPushConstants cullPushConstants = makeCullPushConstants(2u);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullShader->pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullShader->pipelineLayout, 0, 1, &cullDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, cullShader->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &cullPushConstants);
+        vkCmdDispatch(commandBuffer, (indirectObjectCount + 63) / 64, 1, 1);
+        VkMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
         glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 5.0f);
         float cameraFOV = 45.0f;
         glm::mat4 view = glm::mat4(1.0f);
-
-        int culledEntities = 0;
-        Frustum frustrum;
         if (activeCamera) {
             glm::mat4 cameraWorld = activeCamera->getWorldTransform();
-            glm::vec4 worldPos = cameraWorld * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-            cameraPos = glm::vec3(worldPos);
+            cameraPos = glm::vec3(cameraWorld * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
             cameraFOV = activeCamera->getFOV();
-            float aspectRatio = static_cast<float>(swapChainExtent.width) / std::max(static_cast<float>(swapChainExtent.height), 1.0f);
-            frustrum = activeCamera->getFrustrum(aspectRatio, 0.1f, 200.0f, cameraWorld);
             view = glm::inverse(cameraWorld);
         }
-        std::function<bool(Entity*)> renderEntity = [&](Entity* entity) -> bool {
-            if (!entity->isActive()) {
-                return false;
-            }
-            std::string shaderName = entity->getShader();
-            if (shaderName != "gbuffer" && shaderName != "skybox") {
-                return true;
-            }
-            glm::mat4 modelMatrix = entity->getWorldTransform();
-            if (activeCamera && entity->getModel() && entity->getName() != "skybox") {
-                AABB bounds = entity->getWorldBounds(modelMatrix);
-                if (!frustrum.intersectsAABB(bounds.min, bounds.max)) {
-                    culledEntities++;
-                    return true;  // Culled: skip rendering
-                }
-            }
-            Model* model = entity->getModel();
-            Shader* shader = shaderManager->getShader(shaderName);
-            if (!model || !shader) return true;
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->pipeline);
-            
-            VkViewport viewport = {
-                .x = 0.0f,
-                .y = 0.0f,
-                .width = static_cast<float>(swapChainExtent.width),
-                .height = static_cast<float>(swapChainExtent.height),
-                .minDepth = 0.0f,
-                .maxDepth = 1.0f,
-            };
-            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-            VkRect2D scissor = {
-                .offset = {0, 0},
-                .extent = swapChainExtent,
-            };
-            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-            
-            UniformBufferObject ubo{};
-            ubo.model = modelMatrix;
-            ubo.view = view;
-            ubo.proj = glm::perspective(glm::radians(cameraFOV), static_cast<float>(swapChainExtent.width) / std::max(static_cast<float>(swapChainExtent.height), 1.0f), 0.1f, 200.0f);
-            ubo.proj[1][1] *= -1;
-            ubo.cameraPos = cameraPos;
-            entity->updateUniformBuffer(currentFrame, ubo);
-            const uint32_t indexCount = model->getIndexCount();
-            if (indexCount > 0) {
-                VkBuffer vertexBuffer = model->getVertexBuffer();
-                VkBuffer indexBuffer = model->getIndexBuffer();
-                if (vertexBuffer != VK_NULL_HANDLE && indexBuffer != VK_NULL_HANDLE) {
-                    VkDeviceSize offsets[] = {0};
-                    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
-                    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-                    auto descriptorSets = entity->getDescriptorSets();
-                    if (descriptorSets.size() == MAX_FRAMES_IN_FLIGHT && descriptorSets[currentFrame] != VK_NULL_HANDLE) {
-                        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
-                        vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
-                    }
-                }
-            }
-            return true;
+        glm::mat4 proj = glm::perspective(glm::radians(cameraFOV), static_cast<float>(swapChainExtent.width) / std::max(static_cast<float>(swapChainExtent.height), 1.0f), 0.1f, 200.0f);
+        proj[1][1] *= -1;
+        VkRenderPassBeginInfo renderPassInfo = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = gBufferRenderPassLoad,
+            .framebuffer = gBufferFramebuffers[imageIndex],
+            .renderArea = {.offset = {0, 0}, .extent = renderExtent},
+            .clearValueCount = 0,
+            .pClearValues = nullptr,
         };
-        
-        if (rootEntities.empty()) return;
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        renderIndirectDrawBatches(commandBuffer, view, proj, cameraPos, true);
+        vkCmdEndRenderPass(commandBuffer);
+        endShadowTiming(commandBuffer, timing);
+    }
+    void Renderer::renderIndirectDrawBatches(VkCommandBuffer commandBuffer, const glm::mat4& view, const glm::mat4& proj, const glm::vec3& cameraPos, bool secondPhase) {
+        Shader* shader = shaderManager->getShader("gbuffer_indirect");
+        if (!shader || indirectDrawBatches.empty()) {
+            return;
+        }
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->pipeline);
+        VkViewport viewport = {
+            .x = 0.0f,
+            .y = 0.0f,
+            .width = static_cast<float>(renderExtent.width),
+            .height = static_cast<float>(renderExtent.height),
+            .minDepth = 0.0f,
+            .maxDepth = 1.0f,
+        };
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        VkRect2D scissor = {
+            .offset = {0, 0},
+            .extent = renderExtent,
+        };
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-        std::function<void(Entity*)> traverse = [&](Entity* entity) -> void {
-            if (!renderEntity(entity)) {
-                return;
-            }
-            for (Entity* child : entity->getChildren()) {
-                traverse(child);
+        IndirectGeometryPushConstants pushConstants{};
+        pushConstants.view = view;
+        pushConstants.proj = proj;
+        pushConstants.cameraPos = glm::vec4(cameraPos, 1.0f);
+        vkCmdPushConstants(commandBuffer, shader->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(IndirectGeometryPushConstants), &pushConstants);
+
+        const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+        VkBuffer commandBufferHandle = cullCommandBuffers[currentFrame];
+        const VkDeviceSize phaseCommandOffset = secondPhase ? static_cast<VkDeviceSize>(indirectObjectCount) * stride : 0;
+        const VkDeviceSize phaseCountOffset = secondPhase ? indirectDrawBatches.size() * sizeof(uint32_t) : 0;
+        for (size_t batchIndex = 0; batchIndex < indirectDrawBatches.size(); ++batchIndex) {
+            const IndirectDrawBatch& batch = indirectDrawBatches[batchIndex];
+            VkBuffer vertexBuffer = batch.model->getVertexBuffer();
+            VkDeviceSize offsets[] = {0};
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
+            vkCmdBindIndexBuffer(commandBuffer, batch.model->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->pipelineLayout, 0, 1, &batch.descriptorSets[currentFrame], 0, nullptr);
+            VkDeviceSize commandOffset = phaseCommandOffset + static_cast<VkDeviceSize>(batch.firstCommand) * stride;
+            if (cmdDrawIndexedIndirectCount) {
+                cmdDrawIndexedIndirectCount(commandBuffer, commandBufferHandle, commandOffset, cullCountBuffers[currentFrame], phaseCountOffset + batchIndex * sizeof(uint32_t), batch.commandCount, stride);
+            } else if (supportsMultiDrawIndirect) {
+                vkCmdDrawIndexedIndirect(commandBuffer, commandBufferHandle, commandOffset, batch.commandCount, stride);
+            } else {
+                for (uint32_t i = 0; i < batch.commandCount; ++i) {
+                    vkCmdDrawIndexedIndirect(commandBuffer, commandBufferHandle, commandOffset + static_cast<VkDeviceSize>(i) * stride, 1, stride);
+                }
             }
-        };
-        
-        for (Entity* entity : rootEntities) {
-            traverse(entity);
-        }
-    }
-    void Renderer::transitionGBufferForReading(VkCommandBuffer commandBuffer) {
-        VkImageMemoryBarrier barriers[4] = {};
-
-        // Albedo
-        barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barriers[0].pNext = nullptr;
-        barriers[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        barriers[0].oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-        barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barriers[0].image = gBufferAlbedoImage;
-        barriers[0].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        barriers[0].subresourceRange.baseMipLevel = 0;
-        barriers[0].subresourceRange.levelCount = 1;
-        barriers[0].subresourceRange.baseArrayLayer = 0;
-        barriers[0].subresourceRange.layerCount = 1;
-        // Normal
-        barriers[1] = barriers[0];
-        barriers[1].image = gBufferNormalImage;
-        // Material
-        barriers[2] = barriers[0];
-        barriers[2].image = gBufferMaterialImage;
-        // Depth
-        barriers[3].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barriers[3].pNext = nullptr;
-        barriers[3].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-        barriers[3].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        barriers[3].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    barriers[3].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
-        barriers[3].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barriers[3].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barriers[3].image = gBufferDepthImage;
-        barriers[3].subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-        barriers[3].subresourceRange.baseMipLevel = 0;
-        barriers[3].subresourceRange.levelCount = 1;
-        barriers[3].subresourceRange.baseArrayLayer = 0;
-        barriers[3].subresourceRange.layerCount = 1;
-        
-        vkCmdPipelineBarrier(commandBuffer,
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 4, barriers
-        );
+        }
     }
     void Renderer::renderDeferredLighting(VkCommandBuffer commandBuffer) {
         Shader* lightingShader = shaderManager->getShader("lighting");
@@ -2628,15 +4555,15 @@ void Renderer::createInstance() {
         VkViewport viewport = {
             .x = 0.0f,
             .y = 0.0f,
-            .width = static_cast<float>(swapChainExtent.width),
-            .height = static_cast<float>(swapChainExtent.height),
+            .width = static_cast<float>(renderExtent.width),
+            .height = static_cast<float>(renderExtent.height),
             .minDepth = 0.0f,
             .maxDepth = 1.0f,
         };
         vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
         VkRect2D scissor = {
             .offset = {0, 0},
-            .extent = swapChainExtent,
+            .extent = renderExtent,
         };
         vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
         
@@ -2695,9 +4622,14 @@ void Renderer::createInstance() {
             vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, 
                 compositeShader->pipelineLayout, 0, 1, &compositeDescriptorSets[currentFrame], 0, nullptr);
         }
+        CompositePushConstants pushConstants = {
+            .debug = glm::uvec4(hiZDebugMip >= 0 ? 1u : 0u, static_cast<uint32_t>(std::max(hiZDebugMip, 0)), 0u, 0u),
+        };
+        vkCmdPushConstants(commandBuffer, compositeShader->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(CompositePushConstants), &pushConstants);
         vkCmdDraw(commandBuffer, 3, 1, 0, 0);
     }
     void Renderer::renderUI(VkCommandBuffer commandBuffer){
+        CPU_PROFILE_ZONE("renderUI");
         Shader* uiShader = ShaderManager::getInstance()->getShader("ui");
         struct UIPushConstants {
             glm::vec3 color = glm::vec3(1.0f);
@@ -2860,109 +4792,229 @@ void Renderer::createInstance() {
             }
         }
     }
-    void Renderer::recordDeferredCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
-        updateEntities();
-        VkCommandBufferBeginInfo beginInfo = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-            .flags = 0,
-            .pInheritanceInfo = nullptr,
-        };
-        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
-        }
-        std::vector<Light*> lights = entityManager->getDirtyLights();
-        renderEntitiesShadowDepth(commandBuffer, lights);
-        renderEntitiesMovableShadowDepth(commandBuffer);
-        {
-            VkClearValue clearValues[4];
+    // Declares the frame's passes and the images each one touches. The graph derives every barrier
+    // between them, culls passes whose results nothing consumes and packs transient targets with
+    // disjoint lifetimes into shared memory. Buffers are synchronized by the passes themselves.
+    void Renderer::createFrameGraph() {
+        const VkImageLayout readOnly = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        const VkImageLayout depthReadOnly = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        const VkPipelineStageFlags computeStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        const VkPipelineStageFlags fragmentStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        const RenderGraph::Resource hiZ = frameGraph.importImage("hi-z", hiZImage, VK_IMAGE_ASPECT_COLOR_BIT, hiZMipCount, VK_IMAGE_LAYOUT_GENERAL);
+        std::array<RenderGraph::Resource, 2> ssrHistory{};
+        for (size_t i = 0; i < ssrHistoryImages.size(); i++) {
+            ssrHistory[i] = frameGraph.importImage("ssr history " + std::to_string(i), ssrHistoryImages[i], VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_LAYOUT_GENERAL);
+        }
+        const std::array<RenderGraph::Resource, 3> gBufferColor = {gBufferAlbedoResource, gBufferNormalResource, gBufferMaterialResource};
+
+        frameGraph.addPass("shadows", [](RenderGraph::PassBuilder& pass) {
+            pass.setSideEffect();
+        }, [this](VkCommandBuffer commandBuffer) {
+            std::vector<Light*> lights = entityManager->getDirtyLights();
+            gpuProfiler.begin(commandBuffer, "static shadows");
+            renderEntitiesShadowDepth(commandBuffer, lights);
+            gpuProfiler.end(commandBuffer);
+            gpuProfiler.begin(commandBuffer, "movable shadows");
+            renderEntitiesMovableShadowDepth(commandBuffer);
+            gpuProfiler.end(commandBuffer);
+            gpuProfiler.begin(commandBuffer, "shadow moments");
+            prefilterShadowMoments(commandBuffer);
+            gpuProfiler.end(commandBuffer);
+        });
+        frameGraph.addPass("geometry culling", [](RenderGraph::PassBuilder& pass) {
+            pass.setSideEffect();
+        }, [this](VkCommandBuffer commandBuffer) {
+            dispatchGeometryCulling(commandBuffer);
+        });
+        auto beginGBufferPass = [this](VkCommandBuffer commandBuffer) {
+            VkClearValue clearValues[5];
             clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};  // Albedo
-            clearValues[1].color = {{0.5f, 0.5f, 1.0f, 1.0f}};  // Normal (0,0,1 encoded)
+            clearValues[1].color = {{0.0f, 0.0f, 0.0f, 1.0f}};  // Normal (+Z, octahedral)
             clearValues[2].color = {{0.0f, 0.5f, 0.0f, 1.0f}};  // Material
             clearValues[3].depthStencil = {1.0f, 0};
-            
+            clearValues[4].color = {{0.0f, 0.0f, 0.0f, 1.0f}};  // Lighting, single render pass path only
+
             VkRenderPassBeginInfo renderPassInfo = {
                 .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-                .renderPass = gBufferRenderPass,
-                .framebuffer = gBufferFramebuffers[imageIndex],
-                .renderArea = {.offset = {0, 0}, .extent = swapChainExtent},
-                .clearValueCount = 4,
+                .renderPass = getGBufferRenderPass(),
+                .framebuffer = gBufferFramebuffers[frameGraphImageIndex],
+                .renderArea = {.offset = {0, 0}, .extent = renderExtent},
+                .clearValueCount = singlePassDeferred ? 5u : 4u,
                 .pClearValues = clearValues,
             };
-            
-            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-            renderEntitiesGeometry(commandBuffer);
-            vkCmdEndRenderPass(commandBuffer);
 
-            transitionGBufferForReading(commandBuffer);
-        }
-        {
-            VkClearValue clearValue;
-            clearValue.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
-            
-            VkRenderPassBeginInfo renderPassInfo = {
-                .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-                .renderPass = lightingRenderPass,
-                .framebuffer = lightingFramebuffers[imageIndex],
-                .renderArea = {.offset = {0, 0}, .extent = swapChainExtent},
-                .clearValueCount = 1,
-                .pClearValues = &clearValue,
-            };
-            
             vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-            updateLightsUniformBuffer();
+            const size_t timing = beginShadowTiming(commandBuffer, "gbuffer pass");
+            renderEntitiesGeometry(commandBuffer);
+            endShadowTiming(commandBuffer, timing);
+        };
+        auto recordLighting = [this](VkCommandBuffer commandBuffer) {
+            const size_t timing = beginShadowTiming(commandBuffer, std::string("lighting pass [") + (shadowFilterOverride ? shadowFilterModeName(*shadowFilterOverride) : "per-light") + " filtering]");
             renderDeferredLighting(commandBuffer);
-            vkCmdEndRenderPass(commandBuffer);
-        }
-        {
-            ComputeShader* ssrShader = shaderManager->getComputeShader("ssr");
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ssrShader->pipeline);
+            endShadowTiming(commandBuffer, timing);
+        };
+        auto addLightCullingPass = [this]() {
+            frameGraph.addPass("light culling", [](RenderGraph::PassBuilder& pass) {
+                pass.setSideEffect();
+            }, [this](VkCommandBuffer commandBuffer) {
+                updateLightsBuffer();
+                dispatchLightCulling(commandBuffer);
+            });
+        };
+        auto addHiZPass = [&]() {
+            frameGraph.addPass("hi-z pyramid", [&](RenderGraph::PassBuilder& pass) {
+                pass.read(gBufferDepthResource, RenderGraphAccess::sampled(computeStage, depthReadOnly));
+                pass.write(hiZ, RenderGraphAccess::storage(computeStage, true, true));
+            }, [this](VkCommandBuffer commandBuffer) {
+                buildHiZPyramid(commandBuffer);
+            });
+        };
 
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ssrShader->pipelineLayout, 0, 1, &ssrDescriptorSets[currentFrame], 0, nullptr);
+        if (singlePassDeferred) {
+            // Light culling only needs the lights, so it moves ahead of the merged pass; the G-buffer
+            // reads between the subpasses are ordered by the render pass itself.
+            addLightCullingPass();
+            frameGraph.addPass("gbuffer + lighting", [&](RenderGraph::PassBuilder& pass) {
+                for (RenderGraph::Resource target : gBufferColor) {
+                    pass.write(target, RenderGraphAccess::colorAttachment(VK_IMAGE_LAYOUT_UNDEFINED, readOnly));
+                }
+                pass.write(gBufferDepthResource, RenderGraphAccess::depthAttachment(VK_IMAGE_LAYOUT_UNDEFINED, depthReadOnly));
+                pass.write(lightingResource, RenderGraphAccess::colorAttachment(VK_IMAGE_LAYOUT_UNDEFINED, readOnly));
+            }, [beginGBufferPass, recordLighting](VkCommandBuffer commandBuffer) {
+                beginGBufferPass(commandBuffer);
+                vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+                recordLighting(commandBuffer);
+                vkCmdEndRenderPass(commandBuffer);
+            });
+            addHiZPass();
+        } else {
+            frameGraph.addPass("gbuffer", [&](RenderGraph::PassBuilder& pass) {
+                for (RenderGraph::Resource target : gBufferColor) {
+                    pass.write(target, RenderGraphAccess::colorAttachment(VK_IMAGE_LAYOUT_UNDEFINED, readOnly));
+                }
+                pass.write(gBufferDepthResource, RenderGraphAccess::depthAttachment(VK_IMAGE_LAYOUT_UNDEFINED, depthReadOnly));
+            }, [beginGBufferPass](VkCommandBuffer commandBuffer) {
+                beginGBufferPass(commandBuffer);
+                vkCmdEndRenderPass(commandBuffer);
+            });
+            frameGraph.addPass("occlusion culling second phase", [&](RenderGraph::PassBuilder& pass) {
+                pass.setCondition([this]() { return occlusionPhaseActive; });
+                pass.read(gBufferDepthResource, RenderGraphAccess::sampled(computeStage, depthReadOnly));
+                pass.write(hiZ, RenderGraphAccess::storage(computeStage, true, true));
+                for (RenderGraph::Resource target : gBufferColor) {
+                    pass.write(target, RenderGraphAccess::colorAttachment(readOnly, readOnly));
+                }
+                pass.write(gBufferDepthResource, RenderGraphAccess::depthAttachment(depthReadOnly, depthReadOnly));
+            }, [this](VkCommandBuffer commandBuffer) {
+                renderOcclusionCulledGeometry(commandBuffer, frameGraphImageIndex);
+            });
+            addHiZPass();
+            addLightCullingPass();
+            frameGraph.addPass("lighting", [&](RenderGraph::PassBuilder& pass) {
+                for (RenderGraph::Resource target : gBufferColor) {
+                    pass.read(target, RenderGraphAccess::sampled(fragmentStage, readOnly));
+                }
+                pass.read(gBufferDepthResource, RenderGraphAccess::sampled(fragmentStage, depthReadOnly));
+                pass.write(lightingResource, RenderGraphAccess::colorAttachment(VK_IMAGE_LAYOUT_UNDEFINED, readOnly));
+            }, [this, recordLighting](VkCommandBuffer commandBuffer) {
+                VkClearValue clearValue;
+                clearValue.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
 
-            SSRPushConstants ssrPushConstants{};
-            if (activeCamera) {
-                glm::mat4 cameraWorld = activeCamera->getWorldTransform();
-                ssrPushConstants.view = glm::inverse(cameraWorld);
-                ssrPushConstants.proj = glm::perspective(glm::radians(activeCamera->getFOV()), 
-                    static_cast<float>(swapChainExtent.width) / std::max(static_cast<float>(swapChainExtent.height), 1.0f), 
-                    0.1f, 200.0f);
-                ssrPushConstants.proj[1][1] *= -1;
-                ssrPushConstants.invView = cameraWorld;
-                ssrPushConstants.invProj = glm::inverse(ssrPushConstants.proj);
-            }
-            vkCmdPushConstants(commandBuffer, ssrShader->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SSRPushConstants), &ssrPushConstants);
+                VkRenderPassBeginInfo renderPassInfo = {
+                    .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+                    .renderPass = lightingRenderPass,
+                    .framebuffer = lightingFramebuffers[frameGraphImageIndex],
+                    .renderArea = {.offset = {0, 0}, .extent = renderExtent},
+                    .clearValueCount = 1,
+                    .pClearValues = &clearValue,
+                };
 
-            uint32_t groupX = (swapChainExtent.width + 7) / 8;
-            uint32_t groupY = (swapChainExtent.height + 7) / 8;
-            vkCmdDispatch(commandBuffer, groupX, groupY, 1);
-            
-            VkMemoryBarrier barrier = {
-                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-                .pNext = nullptr,
-                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
-                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-            };
-            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+                vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+                recordLighting(commandBuffer);
+                vkCmdEndRenderPass(commandBuffer);
+            });
         }
-        {
+        frameGraph.addPass("ssr", [&](RenderGraph::PassBuilder& pass) {
+            pass.read(lightingResource, RenderGraphAccess::sampled(computeStage, readOnly));
+            pass.read(gBufferNormalResource, RenderGraphAccess::sampled(computeStage, readOnly));
+            pass.read(gBufferMaterialResource, RenderGraphAccess::sampled(computeStage, readOnly));
+            pass.read(gBufferDepthResource, RenderGraphAccess::sampled(computeStage, depthReadOnly));
+            pass.read(hiZ, RenderGraphAccess::sampled(computeStage, VK_IMAGE_LAYOUT_GENERAL));
+            pass.write(ssrTraceResource, RenderGraphAccess::storage(computeStage, true, true, true));
+            for (RenderGraph::Resource history : ssrHistory) {
+                pass.write(history, RenderGraphAccess::storage(computeStage, true, true));
+            }
+            pass.write(ssrResource, RenderGraphAccess::storage(computeStage, false, true, true));
+        }, [this](VkCommandBuffer commandBuffer) {
+            dispatchSSR(commandBuffer);
+        });
+        frameGraph.addPass("composite", [&](RenderGraph::PassBuilder& pass) {
+            // Presentation is ordered by the composite render pass and the swapchain semaphores.
+            pass.setSideEffect();
+            pass.read(lightingResource, RenderGraphAccess::sampled(fragmentStage, readOnly));
+            pass.read(ssrResource, RenderGraphAccess::sampled(fragmentStage, readOnly));
+            pass.read(hiZ, RenderGraphAccess::sampled(fragmentStage, VK_IMAGE_LAYOUT_GENERAL));
+        }, [this](VkCommandBuffer commandBuffer) {
+            // Composite waits on the swapchain image, which would fold vsync into the frame's GPU time.
+            // Offscreen there is nothing to wait for, so headless frames include it.
+            if (frameTimingPending[currentFrame] && !headless) {
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadowTimestampPool, currentFrame * kShadowTimestampsPerFrame + kFrameTimestampQuery + 1);
+            }
             VkClearValue clearValue;
             clearValue.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
-            
+
             VkRenderPassBeginInfo renderPassInfo = {
                 .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
                 .renderPass = compositeRenderPass,
-                .framebuffer = compositeFramebuffers[imageIndex],
+                .framebuffer = compositeFramebuffers[frameGraphImageIndex],
                 .renderArea = {.offset = {0, 0}, .extent = swapChainExtent},
                 .clearValueCount = 1,
                 .pClearValues = &clearValue,
             };
-            
+
             vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
             renderComposite(commandBuffer);
+            gpuProfiler.begin(commandBuffer, "ui");
             renderUI(commandBuffer);
+            gpuProfiler.end(commandBuffer);
             vkCmdEndRenderPass(commandBuffer);
+            if (frameTimingPending[currentFrame] && headless) {
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadowTimestampPool, currentFrame * kShadowTimestampsPerFrame + kFrameTimestampQuery + 1);
+            }
+        });
+        frameGraph.compile();
+
+        gBufferAlbedoView = createImageView(gBufferAlbedoImage, kGBufferAlbedoFormat, 1);
+        gBufferNormalView = createImageView(gBufferNormalImage, gBufferNormalFormat, 1);
+        gBufferMaterialView = createImageView(gBufferMaterialImage, kGBufferMaterialFormat, 1);
+        gBufferDepthView = createImageView(gBufferDepthImage, findDepthFormat(), 1, VK_IMAGE_ASPECT_DEPTH_BIT);
+        lightingView = createImageView(lightingImage, lightingFormat, 1);
+        ssrView = createImageView(ssrImage, VK_FORMAT_R16G16B16A16_SFLOAT, 1);
+        ssrTraceView = createImageView(ssrTraceImage, VK_FORMAT_R16G16B16A16_SFLOAT, 1);
+    }
+    void Renderer::recordDeferredCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        CPU_PROFILE_ZONE("recordDeferredCommandBuffer");
+        growUniformRingBuffer();
+        uniformRingOffset = 0;
+        uniformRingDemand = 0;
+        updateEntities();
+        updateIndirectDrawBatches();
+        VkCommandBufferBeginInfo beginInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = 0,
+            .pInheritanceInfo = nullptr,
+        };
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
         }
-        
+        if (shadowTimestampPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(commandBuffer, shadowTimestampPool, currentFrame * kShadowTimestampsPerFrame, kShadowTimestampsPerFrame);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, shadowTimestampPool, currentFrame * kShadowTimestampsPerFrame + kFrameTimestampQuery);
+            frameTimingPending[currentFrame] = true;
+        }
+        gpuProfiler.beginFrame(commandBuffer, currentFrame);
+        frameGraphImageIndex = imageIndex;
+        frameGraph.execute(commandBuffer);
         vkEndCommandBuffer(commandBuffer);
     }
     void Renderer::createColorResources() {
@@ -2976,6 +5028,8 @@ void Renderer::createInstance() {
         depthImageView = createImageView(depthImage, depthFormat, 1);
     }
     void Renderer::createTextureSampler() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
         VkSamplerCreateInfo samplerInfo = {
             .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
             .magFilter = VK_FILTER_LINEAR,
@@ -2986,11 +5040,12 @@ void Renderer::createInstance() {
             .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
             .mipLodBias = 0.0f,
             .anisotropyEnable = VK_TRUE,
-            .maxAnisotropy = 16,
+            .maxAnisotropy = std::min(properties.limits.maxSamplerAnisotropy, 16.0f),
             .compareEnable = VK_FALSE,
             .compareOp = VK_COMPARE_OP_ALWAYS,
             .minLod = 0.0f,
-            .maxLod = 0.0f,
+            // Shared by every material texture, whatever the length of its mip chain.
+            .maxLod = VK_LOD_CLAMP_NONE,
             .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
             .unnormalizedCoordinates = VK_FALSE,
         };
@@ -2999,6 +5054,8 @@ void Renderer::createInstance() {
         }
     }
     void Renderer::createTextureSampler(VkSampler &sampler, uint32_t mipLevels){
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
         VkSamplerCreateInfo samplerInfo = {
             .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
             .magFilter = VK_FILTER_LINEAR,
@@ -3009,7 +5066,7 @@ void Renderer::createInstance() {
             .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
             .mipLodBias = 0.0f,
             .anisotropyEnable = VK_TRUE,
-            .maxAnisotropy = 16,
+            .maxAnisotropy = std::min(properties.limits.maxSamplerAnisotropy, 16.0f),
             .compareEnable = VK_FALSE,
             .compareOp = VK_COMPARE_OP_ALWAYS,
             .minLod = 0.0f,
@@ -3024,11 +5081,15 @@ void Renderer::createInstance() {
         uiMode = enabled;
         hoveredObject = nullptr;
         if (uiMode) {
-            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+            if (window) {
+                glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+            }
             cursorLocked = false;
             activeCamera = nullptr;
         } else {
-            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+            if (window) {
+                glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+            }
             cursorLocked = true;
         }
         firstMouse = true;
@@ -3083,8 +5144,10 @@ void Renderer::createInstance() {
     }
     std::vector<const char*> Renderer::getRequiredExtensions() {
         uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        const char** glfwExtensions = nullptr;
+        if(!headless) {
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        }
         std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
         if(enableValidationLayers) extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
         #ifdef __APPLE__
@@ -3093,16 +5156,6 @@ void Renderer::createInstance() {
         #endif
         return extensions;
     }
-    uint32_t Renderer::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties){
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-        for(uint32_t i=0; i<memProperties.memoryTypeCount; i++) {
-            if(typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-                return i;
-            }
-        }
-        throw std::runtime_error("Failed to find suitable memory type!");
-    }
     void Renderer::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo) {
         createInfo = {};
         createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
@@ -3122,10 +5175,21 @@ void Renderer::createInstance() {
         vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
         std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
         vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+        for(uint32_t i=0; i<queueFamilyCount; i++) {
+            if((queueFamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamilies[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+                indices.transferFamily = i;
+                break;
+            }
+        }
         for(uint32_t i=0; i<queueFamilyCount; i++) {
             if(queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) indices.graphicsFamily = i;
             VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            if(headless) {
+                // Nothing is presented; the graphics queue stands in so the rest of setup is unchanged.
+                presentSupport = indices.graphicsFamily == i;
+            } else {
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            }
             if(presentSupport) indices.presentFamily = i;
             if(indices.isComplete()) break;
         }
@@ -3217,6 +5281,124 @@ void Renderer::createInstance() {
         }
         escapeWasPressed = escapePressed;
 
+        static bool layeredToggleWasPressed = false;
+        bool layeredTogglePressed = glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS;
+        if (layeredTogglePressed && !layeredToggleWasPressed && app->supportsMultiview) {
+            app->layeredShadows = !app->layeredShadows;
+            for (Light* light : app->entityManager->getAllLights()) {
+                app->entityManager->markLightDirty(light);
+            }
+            std::cout << "Shadow rendering: " << (app->layeredShadows ? "layered (multiview)" : "per-face") << std::endl;
+        }
+        layeredToggleWasPressed = layeredTogglePressed;
+
+        // F3 cycles a global shadow filter override (per-light, hard, pcf, moments, reference) for comparing lighting pass timings.
+        static bool filterToggleWasPressed = false;
+        bool filterTogglePressed = glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS;
+        if (filterTogglePressed && !filterToggleWasPressed) {
+            if (!app->shadowFilterOverride) {
+                app->shadowFilterOverride = ShadowFilterMode::Hard;
+            } else if (*app->shadowFilterOverride == ShadowFilterMode::Reference) {
+                app->shadowFilterOverride.reset();
+            } else {
+                app->shadowFilterOverride = static_cast<ShadowFilterMode>(static_cast<uint32_t>(*app->shadowFilterOverride) + 1);
+            }
+            for (Light* light : app->entityManager->getAllLights()) {
+                light->setShadowMomentsDirty(true);
+            }
+            app->shadowBudgetDirty = true;
+            std::cout << "Shadow filtering: " << (app->shadowFilterOverride ? shadowFilterModeName(*app->shadowFilterOverride) : "per-light") << std::endl;
+        }
+        filterToggleWasPressed = filterTogglePressed;
+
+        // F4 steps the Hi-Z debug view through each pyramid level, then back to the normal image.
+        static bool hiZDebugWasPressed = false;
+        bool hiZDebugPressed = glfwGetKey(window, GLFW_KEY_F4) == GLFW_PRESS;
+        if (hiZDebugPressed && !hiZDebugWasPressed && app->hiZMipCount > 0) {
+            app->hiZDebugMip = app->hiZDebugMip + 1 < static_cast<int>(app->hiZMipCount) ? app->hiZDebugMip + 1 : -1;
+            if (app->hiZDebugMip >= 0) {
+                std::cout << "Hi-Z debug: mip " << app->hiZDebugMip << " (" << std::max(app->renderExtent.width >> app->hiZDebugMip, 1u) << "x" << std::max(app->renderExtent.height >> app->hiZDebugMip, 1u) << ")" << std::endl;
+            } else {
+                std::cout << "Hi-Z debug: off" << std::endl;
+            }
+        }
+        hiZDebugWasPressed = hiZDebugPressed;
+
+        // F5 cycles the SSR quality preset; compare the "ssr [...]" timings printed by collectShadowTimings.
+        static bool ssrPresetWasPressed = false;
+        bool ssrPresetPressed = glfwGetKey(window, GLFW_KEY_F5) == GLFW_PRESS;
+        if (ssrPresetPressed && !ssrPresetWasPressed) {
+            app->setSSRPreset(static_cast<SSRPreset>((static_cast<uint32_t>(app->ssrPreset) + 1) % 4));
+            SSRPresetSettings settings = ssrPresetSettings(app->ssrPreset);
+            std::cout << "SSR preset: " << settings.name;
+            if (settings.hierarchical && !app->supportsHiZ) {
+                std::cout << " (no Hi-Z support, using reference)";
+            }
+            std::cout << std::endl;
+        }
+        ssrPresetWasPressed = ssrPresetPressed;
+
+        // F6 toggles two-phase occlusion culling; the periodic report shows how many objects it rejects.
+        static bool occlusionToggleWasPressed = false;
+        bool occlusionTogglePressed = glfwGetKey(window, GLFW_KEY_F6) == GLFW_PRESS;
+        if (occlusionTogglePressed && !occlusionToggleWasPressed) {
+            app->setOcclusionCullingEnabled(!app->occlusionCulling);
+            std::cout << "Occlusion culling: " << (app->occlusionCulling ? "on" : "off") << std::endl;
+        }
+        occlusionToggleWasPressed = occlusionTogglePressed;
+
+        // F7 toggles CPU occlusion culling of the entities that aren't drawn indirectly.
+        static bool softwareOcclusionWasPressed = false;
+        bool softwareOcclusionPressed = glfwGetKey(window, GLFW_KEY_F7) == GLFW_PRESS;
+        if (softwareOcclusionPressed && !softwareOcclusionWasPressed) {
+            app->setSoftwareOcclusionEnabled(!app->softwareOcclusionEnabled);
+            std::cout << "Software occlusion culling: " << (app->softwareOcclusionEnabled ? "on" : "off") << std::endl;
+        }
+        softwareOcclusionWasPressed = softwareOcclusionPressed;
+
+        // F8 toggles the adaptive quality governor; each level change is logged with the frame times behind it.
+        static bool qualityGovernorWasPressed = false;
+        bool qualityGovernorPressed = glfwGetKey(window, GLFW_KEY_F8) == GLFW_PRESS;
+        if (qualityGovernorPressed && !qualityGovernorWasPressed) {
+            app->setQualityGovernorEnabled(!app->qualityGovernorEnabled, app->qualityGovernor.getConfig().targetMs);
+        }
+        qualityGovernorWasPressed = qualityGovernorPressed;
+
+        // F9 cycles the GPU profiler overlay: off, per-pass timings, timings with pipeline statistics.
+        static bool gpuProfilerWasPressed = false;
+        bool gpuProfilerPressed = glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS;
+        if (gpuProfilerPressed && !gpuProfilerWasPressed) {
+            const uint32_t modeCount = app->gpuProfiler.hasPipelineStatistics() ? 3u : 2u;
+            app->gpuProfilerOverlayMode = (app->gpuProfilerOverlayMode + 1) % modeCount;
+            app->gpuProfiler.setPipelineStatisticsEnabled(app->gpuProfilerOverlayMode == 2);
+            static constexpr const char* kModeNames[] = {"off", "timings", "timings and pipeline statistics"};
+            std::cout << "GPU profiler overlay: " << kModeNames[app->gpuProfilerOverlayMode] << std::endl;
+        }
+        gpuProfilerWasPressed = gpuProfilerPressed;
+
+        // F10 dumps the latest per-pass results to gpu_profile.csv and gpu_profile.json.
+        static bool gpuProfileDumpWasPressed = false;
+        bool gpuProfileDumpPressed = glfwGetKey(window, GLFW_KEY_F10) == GLFW_PRESS;
+        if (gpuProfileDumpPressed && !gpuProfileDumpWasPressed) {
+            app->dumpGpuProfile("gpu_profile");
+        }
+        gpuProfileDumpWasPressed = gpuProfileDumpPressed;
+
+        // F11 starts CPU zone capture, or writes what has been captured so far to cpu_trace.json once it runs.
+        static bool cpuProfilerWasPressed = false;
+        bool cpuProfilerPressed = glfwGetKey(window, GLFW_KEY_F11) == GLFW_PRESS;
+        if (cpuProfilerPressed && !cpuProfilerWasPressed) {
+            if (!CpuProfiler::isEnabled()) {
+                CpuProfiler::setEnabled(true);
+                std::cout << "CPU profiler: capturing" << std::endl;
+            } else if (CpuProfiler::writeChromeTrace("cpu_trace.json")) {
+                std::cout << "CPU profiler: wrote cpu_trace.json" << std::endl;
+            } else {
+                std::cerr << "Failed to write cpu_trace.json" << std::endl;
+            }
+        }
+        cpuProfilerWasPressed = cpuProfilerPressed;
+
         bool isPressed = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
         double currentTime = glfwGetTime();
 
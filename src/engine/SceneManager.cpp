@@ -2,11 +2,13 @@
 #include <UIManager.h>
 #include "../game/Scenes.h"
 #include <utility>
+#include <cstdlib>
 
 SceneManager::SceneManager() {
     for (const auto& [id, sceneFunc] : Scenes().sceneList) {
         addScene(id, sceneFunc);
     }
+    sceneIds = Scenes::sceneNames;
 }
 SceneManager::~SceneManager() {
     shutdown();
@@ -15,6 +17,7 @@ SceneManager::~SceneManager() {
 void SceneManager::shutdown() {
     currentScene = 0;
     scenes.clear();
+    sceneIds.clear();
 }
 
 void SceneManager::addScene(int id, std::function<void()> func) {
@@ -31,6 +34,19 @@ void SceneManager::switchScene(int id) {
     }
 }
 
+int SceneManager::findScene(const std::string& name) const {
+    auto it = sceneIds.find(name);
+    if (it != sceneIds.end()) {
+        return it->second;
+    }
+    char* end = nullptr;
+    const long id = std::strtol(name.c_str(), &end, 10);
+    if (!name.empty() && *end == '\0' && scenes.count(static_cast<int>(id))) {
+        return static_cast<int>(id);
+    }
+    return -1;
+}
+
 SceneManager* SceneManager::getInstance() {
     static SceneManager instance;
     return &instance;
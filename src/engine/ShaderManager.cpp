@@ -24,36 +24,45 @@ ShaderManager::ShaderManager() {
             .renderPassToUse = Renderer::getInstance()->getGBufferRenderPass(),
             .colorAttachmentCount = 3,
             .noVertexInput = false,
+            .vertexDescriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
         },
         new Shader{
             .name = "lighting",
             .vertexPath = "src/assets/shaders/compiled/lighting.vert.spv",
-            .fragmentPath = "src/assets/shaders/compiled/lighting.frag.spv",
+            .fragmentPath = renderer->isSinglePassDeferred()
+                ? "src/assets/shaders/compiled/lighting_subpass.frag.spv"
+                : "src/assets/shaders/compiled/lighting.frag.spv",
             .pushConstantRange = {
                 .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
                 .offset = 0,
                 .size = sizeof(LightingPushConstants),
             },
             .poolMultiplier = 4,
-            .vertexBitBindings = 1,
-            .fragmentBitBindings = 5,
+            .vertexBitBindings = 3,
+            .fragmentBitBindings = 7,
             .enableDepth = false,
             .useTextVertex = true,
             .cullMode = VK_CULL_MODE_BACK_BIT,
             .depthWrite = false,
             .depthCompare = VK_COMPARE_OP_LESS,
             .renderPassToUse = Renderer::getInstance()->getLightingRenderPass(),
+            .subpass = Renderer::getInstance()->getLightingSubpass(),
             .colorAttachmentCount = 1,
             .noVertexInput = true,
+            .vertexDescriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
         },
         new Shader{
             .name = "composite",
             .vertexPath = "src/assets/shaders/compiled/composite.vert.spv",
             .fragmentPath = "src/assets/shaders/compiled/composite.frag.spv",
-            .pushConstantRange = {},
+            .pushConstantRange = {
+                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                .offset = 0,
+                .size = sizeof(CompositePushConstants),
+            },
             .poolMultiplier = 4,
             .vertexBitBindings = 0,
-            .fragmentBitBindings = 2,
+            .fragmentBitBindings = 3,
             .enableDepth = false,
             .useTextVertex = true,
             .cullMode = VK_CULL_MODE_BACK_BIT,
@@ -104,6 +113,7 @@ ShaderManager::ShaderManager() {
             .renderPassToUse = Renderer::getInstance()->getGBufferRenderPass(),
             .colorAttachmentCount = 3,
             .noVertexInput = false,
+            .vertexDescriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
         },
         new ComputeShader{
             .name = "ssr",
@@ -114,9 +124,113 @@ ShaderManager::ShaderManager() {
                 .size = sizeof(SSRPushConstants),
             },
             .poolMultiplier = 4,
+            .computeBitBindings = 5,
+            .storageImageCount = 1,
+        },
+        new ComputeShader{
+            .name = "ssr_trace",
+            .computePath = "src/assets/shaders/compiled/ssr_trace.comp.spv",
+            .pushConstantRange = {
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(SSRTracePushConstants),
+            },
+            .poolMultiplier = 1,
+            .computeBitBindings = 5,
+            .storageImageCount = 1,
+        },
+        new ComputeShader{
+            .name = "ssr_resolve",
+            .computePath = "src/assets/shaders/compiled/ssr_resolve.comp.spv",
+            .pushConstantRange = {
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(SSRResolvePushConstants),
+            },
+            .poolMultiplier = 1,
             .computeBitBindings = 4,
             .storageImageCount = 1,
         },
+        new ComputeShader{
+            .name = "ssr_upsample",
+            .computePath = "src/assets/shaders/compiled/ssr_upsample.comp.spv",
+            .poolMultiplier = 1,
+            .computeBitBindings = 3,
+            .storageImageCount = 1,
+        },
+        new ComputeShader{
+            .name = "hiz_build",
+            .computePath = "src/assets/shaders/compiled/hiz_build.comp.spv",
+            .pushConstantRange = {
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(HiZBuildPushConstants),
+            },
+            .poolMultiplier = static_cast<int>(Renderer::kMaxHiZMips),
+            .computeBitBindings = 2,
+            .storageImageCount = 1,
+        },
+        new ComputeShader{
+            .name = "cull",
+            .computePath = "src/assets/shaders/compiled/cull.comp.spv",
+            .pushConstantRange = {
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(CullPushConstants),
+            },
+            .poolMultiplier = 1,
+            .computeBitBindings = 6,
+            .storageImageCount = 5,
+            .storageDescriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        },
+        new ComputeShader{
+            .name = "light_cull",
+            .computePath = "src/assets/shaders/compiled/light_cull.comp.spv",
+            .pushConstantRange = {
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(LightCullPushConstants),
+            },
+            .poolMultiplier = 1,
+            .computeBitBindings = 4,
+            .storageImageCount = 4,
+            .storageDescriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        },
+        new ComputeShader{
+            .name = "shadow_moments",
+            .computePath = "src/assets/shaders/compiled/shadow_moments.comp.spv",
+            .pushConstantRange = {
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(ShadowMomentsPushConstants),
+            },
+            .poolMultiplier = static_cast<int>(Renderer::kMaxShadowCubeSlots),
+            .computeBitBindings = 2,
+            .storageImageCount = 1,
+        },
+        new Shader{
+            .name = "gbuffer_indirect",
+            .vertexPath = "src/assets/shaders/compiled/gbuffer_indirect.vert.spv",
+            .fragmentPath = "src/assets/shaders/compiled/gbuffer.frag.spv",
+            .pushConstantRange = {
+                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+                .offset = 0,
+                .size = sizeof(IndirectGeometryPushConstants),
+            },
+            // Batch descriptor sets come from a pool the renderer creates with each batch build.
+            .poolMultiplier = 1,
+            .vertexBitBindings = 1,
+            .fragmentBitBindings = 4,
+            .enableDepth = true,
+            .useTextVertex = false,
+            .cullMode = VK_CULL_MODE_BACK_BIT,
+            .depthWrite = true,
+            .depthCompare = VK_COMPARE_OP_LESS,
+            .renderPassToUse = Renderer::getInstance()->getGBufferRenderPass(),
+            .colorAttachmentCount = 3,
+            .noVertexInput = false,
+            .vertexDescriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        },
         new Shader{
             .name = "shadowmap",
             .vertexPath = "src/assets/shaders/compiled/shadowmap.vert.spv",
@@ -139,6 +253,29 @@ ShaderManager::ShaderManager() {
             .noVertexInput = false,
         },
     };
+    if (renderer->supportsLayeredShadows()) {
+        defaultShaders.push_back(new Shader{
+            .name = "shadowmap_multiview",
+            .vertexPath = "src/assets/shaders/compiled/shadowmap_multiview.vert.spv",
+            .fragmentPath = "src/assets/shaders/compiled/shadowmap_multiview.frag.spv",
+            .pushConstantRange = {
+                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                .offset = 0,
+                .size = sizeof(ShadowMultiviewPushConstants),
+            },
+            .poolMultiplier = 64,
+            .vertexBitBindings = 0,
+            .fragmentBitBindings = 0,
+            .enableDepth = true,
+            .useTextVertex = false,
+            .cullMode = VK_CULL_MODE_NONE,
+            .depthWrite = true,
+            .depthCompare = VK_COMPARE_OP_LESS,
+            .renderPassToUse = renderer->getShadowMapRenderPassMultiview(),
+            .colorAttachmentCount = 0,
+            .noVertexInput = false,
+        });
+    }
     for (auto& shader : defaultShaders) {
         if (std::holds_alternative<Shader*>(shader)) {
             Shader* s = std::get<Shader*>(shader);
@@ -215,27 +352,37 @@ void ShaderManager::shutdown() {
 void ShaderManager::loadShader(Shader* shader) {
     std::vector<uint32_t> fragmentDescriptorCounts;
     const std::vector<uint32_t>* fragmentDescriptorCountsPtr = nullptr;
+    std::vector<VkDescriptorType> fragmentDescriptorTypes;
+    const std::vector<VkDescriptorType>* fragmentDescriptorTypesPtr = nullptr;
     if (shader->name == "lighting") {
-        fragmentDescriptorCounts = {1u, 1u, 1u, 1u, kMaxPointLights};
+        fragmentDescriptorCounts = {1u, 1u, 1u, 1u, Renderer::kMaxShadowCubeSlots, Renderer::kMaxShadowCubeSlots, Renderer::kMaxShadowCubeSlots};
         fragmentDescriptorCountsPtr = &fragmentDescriptorCounts;
+        if (renderer->isSinglePassDeferred()) {
+            // The G-buffer bindings become input attachments of the lighting subpass.
+            fragmentDescriptorTypes = {
+                VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            };
+            fragmentDescriptorTypesPtr = &fragmentDescriptorTypes;
+        }
     }
-    renderer->createDescriptorSetLayout(shader->vertexBitBindings, shader->fragmentBitBindings, shader->descriptorSetLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, fragmentDescriptorCountsPtr);
+    renderer->createDescriptorSetLayout(shader->vertexBitBindings, shader->fragmentBitBindings, shader->descriptorSetLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, fragmentDescriptorCountsPtr, shader->vertexDescriptorType, fragmentDescriptorTypesPtr);
     VkPushConstantRange* pPCR = (shader->pushConstantRange.size > 0) ? &shader->pushConstantRange : nullptr;
     
     const VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
     VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT;
 
-    renderer->createGraphicsPipeline(shader->vertexPath, shader->fragmentPath, shader->pipeline, shader->pipelineLayout, shader->descriptorSetLayout, pPCR, shader->enableDepth, shader->useTextVertex, shader->cullMode, frontFace, shader->depthWrite, shader->depthCompare, shader->renderPassToUse, shader->colorAttachmentCount, sampleCount, shader->noVertexInput);
-    renderer->createDescriptorPool(shader->vertexBitBindings, shader->fragmentBitBindings, shader->descriptorPool, shader->poolMultiplier, false, fragmentDescriptorCountsPtr);
+    renderer->createGraphicsPipeline(shader->vertexPath, shader->fragmentPath, shader->pipeline, shader->pipelineLayout, shader->descriptorSetLayout, pPCR, shader->enableDepth, shader->useTextVertex, shader->cullMode, frontFace, shader->depthWrite, shader->depthCompare, shader->renderPassToUse, shader->colorAttachmentCount, sampleCount, shader->noVertexInput, shader->subpass);
+    renderer->createDescriptorPool(shader->vertexBitBindings, shader->fragmentBitBindings, shader->descriptorPool, shader->poolMultiplier, false, fragmentDescriptorCountsPtr, shader->vertexDescriptorType, fragmentDescriptorTypesPtr);
     shaders[shader->name] = *shader;
 }
 void ShaderManager::loadShader(ComputeShader* shader) {
     int samplerCount = shader->computeBitBindings - shader->storageImageCount;
 
-    renderer->createDescriptorSetLayout(shader->storageImageCount, samplerCount, shader->descriptorSetLayout, VK_SHADER_STAGE_COMPUTE_BIT);
+    renderer->createDescriptorSetLayout(shader->storageImageCount, samplerCount, shader->descriptorSetLayout, VK_SHADER_STAGE_COMPUTE_BIT, nullptr, shader->storageDescriptorType);
     VkPushConstantRange* pPCR = (shader->pushConstantRange.size > 0) ? &shader->pushConstantRange : nullptr;
     renderer->createComputePipeline(shader->computePath, shader->pipeline, shader->pipelineLayout, shader->descriptorSetLayout, pPCR);
-    renderer->createDescriptorPool(shader->storageImageCount, samplerCount, shader->descriptorPool, shader->poolMultiplier, true);
+    renderer->createDescriptorPool(shader->storageImageCount, samplerCount, shader->descriptorPool, shader->poolMultiplier, true, nullptr, shader->storageDescriptorType);
     shaders[shader->name] = *shader;
 }
 ShaderManager* ShaderManager::getInstance() {
@@ -139,18 +139,7 @@ bool Skybox::createCubemapTexture() {
         stbi_image_free(ldrPixels);
     }
 
-    VkBuffer stagingBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
     const VkDeviceSize totalSize = faceStrideBytes * 6;
-    renderer->createBuffer(totalSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
-    void* mapped = nullptr;
-    if (vkMapMemory(renderer->device, stagingMemory, 0, totalSize, 0, &mapped) != VK_SUCCESS || !mapped) {
-        vkDestroyBuffer(renderer->device, stagingBuffer, nullptr);
-        vkFreeMemory(renderer->device, stagingMemory, nullptr);
-        return false;
-    }
-    std::memcpy(mapped, cubemapData.data(), static_cast<size_t>(totalSize));
-    vkUnmapMemory(renderer->device, stagingMemory);
 
     Image cubemap;
     cubemap.width = static_cast<int>(faceSize);
@@ -159,12 +148,7 @@ bool Skybox::createCubemapTexture() {
     cubemap.path = source->path;
 
     renderer->createImage(faceSize, faceSize, 1, VK_SAMPLE_COUNT_1_BIT, cubemap.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cubemap.image, cubemap.imageMemory, 6, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
-    renderer->transitionImageLayout(cubemap.image, cubemap.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, 6);
-    renderer->copyBufferToImage(stagingBuffer, cubemap.image, faceSize, faceSize, 6, faceStrideBytes);
-    renderer->transitionImageLayout(cubemap.image, cubemap.format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, 6);
-
-    vkDestroyBuffer(renderer->device, stagingBuffer, nullptr);
-    vkFreeMemory(renderer->device, stagingMemory, nullptr);
+    const UploadManager::Ticket upload = renderer->getUploadManager().uploadImage(cubemap.image, faceSize, faceSize, cubemapData.data(), totalSize, 6);
 
     cubemap.imageView = renderer->createImageView(cubemap.image, cubemap.format, 1, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_CUBE, 6);
 
@@ -187,9 +171,10 @@ bool Skybox::createCubemapTexture() {
         .unnormalizedCoordinates = VK_FALSE,
     };
     if (vkCreateSampler(renderer->device, &samplerInfo, nullptr, &cubemap.imageSampler) != VK_SUCCESS) {
+        renderer->getUploadManager().wait(upload);
         vkDestroyImageView(renderer->device, cubemap.imageView, nullptr);
         vkDestroyImage(renderer->device, cubemap.image, nullptr);
-        vkFreeMemory(renderer->device, cubemap.imageMemory, nullptr);
+        renderer->freeDeviceMemory(cubemap.imageMemory);
         return false;
     }
 
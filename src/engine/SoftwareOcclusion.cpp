@@ -0,0 +1,308 @@
+#include <SoftwareOcclusion.h>
+#include <Model.h>
+#include <CpuProfiler.h>
+#include <utils.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SOFTWARE_OCCLUSION_SSE 1
+#endif
+#if defined(USE_OPENMP)
+#include <omp.h>
+#endif
+
+namespace {
+    constexpr std::size_t kFloatsPerVertex = 11; // Matches Model's interleaved layout
+    constexpr float kNearPlane = 0.1f;
+}
+
+SoftwareOcclusionBuffer::SoftwareOcclusionBuffer() : depth(kWidth * kHeight, 1.0f) {}
+
+void SoftwareOcclusionBuffer::beginFrame(const glm::mat4& viewProj) {
+    viewProjection = viewProj;
+    triangles.clear();
+    std::fill(depth.begin(), depth.end(), 1.0f);
+}
+
+void SoftwareOcclusionBuffer::addOccluder(const Model& model, const glm::mat4& worldTransform) {
+    const std::vector<float>& vertices = model.getVertices();
+    const std::vector<uint32_t>& indices = model.getIndices();
+    const std::size_t vertexCount = vertices.size() / kFloatsPerVertex;
+    const glm::mat4 worldViewProjection = viewProjection * worldTransform;
+    clipVertices.resize(vertexCount);
+    for (std::size_t i = 0; i < vertexCount; ++i) {
+        const float* position = &vertices[i * kFloatsPerVertex];
+        clipVertices[i] = worldViewProjection * glm::vec4(position[0], position[1], position[2], 1.0f);
+    }
+
+    for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+        if (indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount) continue;
+        const glm::vec4 clip[3] = {clipVertices[indices[i]], clipVertices[indices[i + 1]], clipVertices[indices[i + 2]]};
+        // Triangles crossing the near plane are dropped instead of clipped; an occluder that
+        // covers less than it could only costs culling efficiency, never correctness.
+        if (clip[0].w < kNearPlane || clip[1].w < kNearPlane || clip[2].w < kNearPlane) continue;
+        if (clip[0].z > clip[0].w && clip[1].z > clip[1].w && clip[2].z > clip[2].w) continue;
+
+        float x[3], y[3], z[3];
+        for (int v = 0; v < 3; ++v) {
+            const float invW = 1.0f / clip[v].w;
+            x[v] = (clip[v].x * invW * 0.5f + 0.5f) * static_cast<float>(kWidth);
+            y[v] = (clip[v].y * invW * 0.5f + 0.5f) * static_cast<float>(kHeight);
+            z[v] = std::max(clip[v].z * invW, 0.0f);
+        }
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (std::abs(area) < 1e-6f) continue;
+        // Occluders are rasterized double-sided, so flip clockwise triangles instead of culling them.
+        if (area < 0.0f) {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(z[1], z[2]);
+            area = -area;
+        }
+
+        Triangle triangle;
+        triangle.minX = std::max(0, static_cast<int>(std::floor(std::min({x[0], x[1], x[2]}))));
+        triangle.maxX = std::min(static_cast<int>(kWidth) - 1, static_cast<int>(std::floor(std::max({x[0], x[1], x[2]}))));
+        triangle.minY = std::max(0, static_cast<int>(std::floor(std::min({y[0], y[1], y[2]}))));
+        triangle.maxY = std::min(static_cast<int>(kHeight) - 1, static_cast<int>(std::floor(std::max({y[0], y[1], y[2]}))));
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) continue;
+        for (int edge = 0; edge < 3; ++edge) {
+            const int next = (edge + 1) % 3;
+            triangle.edgeA[edge] = y[edge] - y[next];
+            triangle.edgeB[edge] = x[next] - x[edge];
+            triangle.edgeC[edge] = -(triangle.edgeA[edge] * x[edge] + triangle.edgeB[edge] * y[edge]);
+        }
+        const float invArea = 1.0f / area;
+        triangle.zA = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) * invArea;
+        triangle.zB = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) * invArea;
+        triangle.zC = z[0] - triangle.zA * x[0] - triangle.zB * y[0];
+        triangle.zMax = std::max({z[0], z[1], z[2]});
+        triangles.push_back(triangle);
+    }
+}
+
+void SoftwareOcclusionBuffer::rasterize() {
+    const int bandCount = static_cast<int>(kHeight / kBandHeight);
+    // Bands own disjoint rows, so workers never write the same depth texel.
+    #if defined(USE_OPENMP)
+    #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int band = 0; band < bandCount; ++band) {
+        rasterizeBand(static_cast<uint32_t>(band));
+    }
+}
+
+void SoftwareOcclusionBuffer::rasterizeBand(uint32_t band) {
+    CPU_PROFILE_ZONE("SoftwareOcclusion::rasterizeBand");
+    const int bandMinY = static_cast<int>(band * kBandHeight);
+    const int bandMaxY = bandMinY + static_cast<int>(kBandHeight) - 1;
+    for (const Triangle& triangle : triangles) {
+        if (triangle.maxY < bandMinY || triangle.minY > bandMaxY) continue;
+        const int startY = std::max(triangle.minY, bandMinY);
+        const int endY = std::min(triangle.maxY, bandMaxY);
+        // Spans start on a 4-pixel boundary; kWidth is a multiple of 4, so they never overrun a row.
+        const int startX = triangle.minX & ~3;
+        for (int y = startY; y <= endY; ++y) {
+            const float py = static_cast<float>(y) + 0.5f;
+            float* row = &depth[static_cast<std::size_t>(y) * kWidth];
+#if defined(SOFTWARE_OCCLUSION_SSE)
+            const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(startX) + 0.5f), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+            __m128 edge[3];
+            __m128 edgeStep[3];
+            for (int e = 0; e < 3; ++e) {
+                edge[e] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA[e]), px), _mm_set1_ps(triangle.edgeB[e] * py + triangle.edgeC[e]));
+                edgeStep[e] = _mm_set1_ps(triangle.edgeA[e] * 4.0f);
+            }
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.zA), px), _mm_set1_ps(triangle.zB * py + triangle.zC));
+            const __m128 zStep = _mm_set1_ps(triangle.zA * 4.0f);
+            const __m128 zMax = _mm_set1_ps(triangle.zMax);
+            const __m128 zero = _mm_setzero_ps();
+            for (int x = startX; x <= triangle.maxX; x += 4) {
+                const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge[0], zero), _mm_cmpge_ps(edge[1], zero)), _mm_cmpge_ps(edge[2], zero));
+                if (_mm_movemask_ps(inside) != 0) {
+                    const __m128 stored = _mm_loadu_ps(row + x);
+                    const __m128 nearest = _mm_min_ps(stored, _mm_min_ps(z, zMax));
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, stored)));
+                }
+                for (int e = 0; e < 3; ++e) {
+                    edge[e] = _mm_add_ps(edge[e], edgeStep[e]);
+                }
+                z = _mm_add_ps(z, zStep);
+            }
+#else
+            for (int x = startX; x <= triangle.maxX; ++x) {
+                const float px = static_cast<float>(x) + 0.5f;
+                bool inside = true;
+                for (int e = 0; e < 3; ++e) {
+                    inside = inside && triangle.edgeA[e] * px + triangle.edgeB[e] * py + triangle.edgeC[e] >= 0.0f;
+                }
+                if (inside) {
+                    const float z = std::min(triangle.zA * px + triangle.zB * py + triangle.zC, triangle.zMax);
+                    row[x] = std::min(row[x], z);
+                }
+            }
+#endif
+        }
+    }
+}
+
+bool SoftwareOcclusionBuffer::isVisible(const AABB& worldBounds) const {
+    float minX = static_cast<float>(kWidth);
+    float maxX = 0.0f;
+    float minY = static_cast<float>(kHeight);
+    float maxY = 0.0f;
+    float nearestDepth = 1.0f;
+    for (int i = 0; i < 8; ++i) {
+        const glm::vec3 corner((i & 1) ? worldBounds.max.x : worldBounds.min.x,
+                               (i & 2) ? worldBounds.max.y : worldBounds.min.y,
+                               (i & 4) ? worldBounds.max.z : worldBounds.min.z);
+        const glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+        if (clip.w < kNearPlane) {
+            return true; // Reaches the camera plane
+        }
+        const float invW = 1.0f / clip.w;
+        const float x = (clip.x * invW * 0.5f + 0.5f) * static_cast<float>(kWidth);
+        const float y = (clip.y * invW * 0.5f + 0.5f) * static_cast<float>(kHeight);
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearestDepth = std::min(nearestDepth, clip.z * invW);
+    }
+    const int startX = std::max(0, static_cast<int>(std::floor(minX)));
+    const int endX = std::min(static_cast<int>(kWidth) - 1, static_cast<int>(std::floor(maxX)));
+    const int startY = std::max(0, static_cast<int>(std::floor(minY)));
+    const int endY = std::min(static_cast<int>(kHeight) - 1, static_cast<int>(std::floor(maxY)));
+    if (startX > endX || startY > endY) {
+        return true; // Off screen; the frustum test owns that decision
+    }
+
+    // Visible as soon as one covered texel holds an occluder depth behind the box's nearest point.
+    for (int y = startY; y <= endY; ++y) {
+        const float* row = &depth[static_cast<std::size_t>(y) * kWidth];
+#if defined(SOFTWARE_OCCLUSION_SSE)
+        const __m128 nearest = _mm_set1_ps(nearestDepth);
+        const __m128 first = _mm_set1_ps(static_cast<float>(startX));
+        const __m128 last = _mm_set1_ps(static_cast<float>(endX));
+        __m128 lane = _mm_add_ps(_mm_set1_ps(static_cast<float>(startX & ~3)), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+        const __m128 laneStep = _mm_set1_ps(4.0f);
+        for (int x = startX & ~3; x <= endX; x += 4) {
+            const __m128 covered = _mm_and_ps(_mm_cmpge_ps(lane, first), _mm_cmple_ps(lane, last));
+            const __m128 behind = _mm_cmpge_ps(_mm_loadu_ps(row + x), nearest);
+            if (_mm_movemask_ps(_mm_and_ps(covered, behind)) != 0) {
+                return true;
+            }
+            lane = _mm_add_ps(lane, laneStep);
+        }
+#else
+        for (int x = startX; x <= endX; ++x) {
+            if (row[x] >= nearestDepth) {
+                return true;
+            }
+        }
+#endif
+    }
+    return false;
+}
+
+int SoftwareOcclusionBuffer::runBenchmark() {
+    Model walls("walls");
+    walls.loadFromFile(resolvePath("src/assets/models/walls.glb").string(), false);
+    Model cube("cube");
+    cube.loadFromFile(resolvePath("src/assets/models/cube.glb").string(), false);
+    if (walls.getIndices().empty() || cube.getIndices().empty()) {
+        std::cerr << "Occlusion benchmark: failed to load walls.glb / cube.glb" << std::endl;
+        return 1;
+    }
+
+    // Same placement as the walls entity in Scenes.cpp.
+    const glm::mat4 wallsTransform = glm::scale(glm::mat4(1.0f), glm::vec3(1.2f));
+    const glm::vec3 levelMin = walls.getBoundsMin() * 1.2f;
+    const glm::vec3 levelMax = walls.getBoundsMax() * 1.2f;
+    const glm::vec3 levelCenter = 0.5f * (levelMin + levelMax);
+    const glm::vec3 levelExtent = 0.5f * (levelMax - levelMin);
+    const float eyeHeight = std::min(levelMin.y + 1.7f, levelMax.y);
+
+    // Crates on a regular grid over the floor of the level.
+    constexpr int kGridSize = 32;
+    std::vector<AABB> candidates;
+    candidates.reserve(kGridSize * kGridSize);
+    for (int gz = 0; gz < kGridSize; ++gz) {
+        for (int gx = 0; gx < kGridSize; ++gx) {
+            const glm::vec3 position(levelMin.x + (gx + 0.5f) * (levelMax.x - levelMin.x) / kGridSize,
+                                     levelMin.y - cube.getBoundsMin().y,
+                                     levelMin.z + (gz + 0.5f) * (levelMax.z - levelMin.z) / kGridSize);
+            candidates.push_back({cube.getBoundsMin() + position, cube.getBoundsMax() + position});
+        }
+    }
+
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+    proj[1][1] *= -1;
+
+    constexpr int kViewCount = 8;
+    constexpr int kIterations = 200;
+    SoftwareOcclusionBuffer buffer;
+    double totalRasterMs = 0.0;
+    double totalTestMs = 0.0;
+    uint64_t totalOccluded = 0;
+#if defined(USE_OPENMP)
+    const int threadCount = omp_get_max_threads();
+#else
+    const int threadCount = 1;
+#endif
+#if defined(SOFTWARE_OCCLUSION_SSE)
+    const char* spanWidth = "SSE 4-wide";
+#else
+    const char* spanWidth = "scalar";
+#endif
+    std::cout << "Software occlusion benchmark: " << kWidth << "x" << kHeight << " depth, " << spanWidth << " spans, "
+              << threadCount << " thread(s), " << candidates.size() << " candidate boxes, " << kIterations << " iterations per view" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+
+    for (int viewIndex = 0; viewIndex < kViewCount; ++viewIndex) {
+        // Eyes on a ring inside the level; even views look inward, odd ones toward the nearest wall.
+        const float angle = glm::two_pi<float>() * static_cast<float>(viewIndex) / kViewCount;
+        const glm::vec3 ringOffset(std::cos(angle) * levelExtent.x * 0.5f, 0.0f, std::sin(angle) * levelExtent.z * 0.5f);
+        const glm::vec3 eye(levelCenter.x + ringOffset.x, eyeHeight, levelCenter.z + ringOffset.z);
+        const glm::vec3 direction = (viewIndex % 2 == 0) ? -ringOffset : ringOffset;
+        const glm::vec3 forward = glm::normalize(glm::vec3(direction.x, -0.05f * glm::length(direction), direction.z));
+        const glm::mat4 view = glm::lookAt(eye, eye + forward, glm::vec3(0.0f, 1.0f, 0.0f));
+        const glm::mat4 viewProj = proj * view;
+
+        double rasterMs = 0.0;
+        double testMs = 0.0;
+        uint32_t occluded = 0;
+        for (int iteration = 0; iteration < kIterations; ++iteration) {
+            const auto rasterStart = std::chrono::high_resolution_clock::now();
+            buffer.beginFrame(viewProj);
+            buffer.addOccluder(walls, wallsTransform);
+            buffer.rasterize();
+            const auto testStart = std::chrono::high_resolution_clock::now();
+            occluded = 0;
+            for (const AABB& box : candidates) {
+                if (!buffer.isVisible(box)) {
+                    occluded++;
+                }
+            }
+            const auto testEnd = std::chrono::high_resolution_clock::now();
+            rasterMs += std::chrono::duration<double, std::milli>(testStart - rasterStart).count();
+            testMs += std::chrono::duration<double, std::milli>(testEnd - testStart).count();
+        }
+        rasterMs /= kIterations;
+        testMs /= kIterations;
+        totalRasterMs += rasterMs;
+        totalTestMs += testMs;
+        totalOccluded += occluded;
+        std::cout << "  view " << viewIndex << ": " << buffer.getTriangleCount() << " occluder triangles, rasterize " << rasterMs << " ms, test "
+                  << testMs << " ms (" << testMs * 1000.0 / candidates.size() << " us/box), " << occluded << "/" << candidates.size() << " occluded" << std::endl;
+    }
+    std::cout << "  average: rasterize " << totalRasterMs / kViewCount << " ms, test " << totalTestMs / kViewCount << " ms, "
+              << static_cast<double>(totalOccluded) / kViewCount << " occluded per view" << std::endl;
+    return 0;
+}
@@ -0,0 +1,537 @@
+#include <TextureCooker.h>
+#include <CpuProfiler.h>
+#include <stb/stb_image.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+    constexpr char kIdentifier[8] = {'P', 'F', 'T', 'E', 'X', '\r', '\n', '\x1A'};
+    constexpr uint64_t kDataAlignment = 16;
+
+    // Little-endian, like every platform we ship on; the level index follows the header and the
+    // levels follow the index at the next kDataAlignment boundary, back to back.
+    struct FileHeader {
+        char identifier[8];
+        uint32_t version;
+        uint32_t vkFormat;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+        uint32_t reserved;
+        uint64_t sourceHash;
+    };
+    struct LevelIndex {
+        uint64_t byteOffset;
+        uint64_t byteLength;
+    };
+    static_assert(sizeof(FileHeader) == 40 && sizeof(LevelIndex) == 16);
+
+    uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint64_t alignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    uint16_t floatToHalf(float value) {
+        union { float f; uint32_t i; } v;
+        v.f = value;
+        uint32_t i = v.i;
+
+        uint32_t sign = (i >> 16) & 0x8000;
+        int32_t exponent = ((i >> 23) & 0xff) - 127 + 15;
+        uint32_t mantissa = i & 0x7fffff;
+
+        if (exponent <= 0) {
+            if (exponent < -10) return static_cast<uint16_t>(sign);
+            mantissa = (mantissa | 0x800000) >> (1 - exponent);
+            return static_cast<uint16_t>(sign | (mantissa >> 13));
+        } else if (exponent >= 0x1f) {
+            return static_cast<uint16_t>(sign | 0x7c00);
+        }
+
+        return static_cast<uint16_t>(sign | (exponent << 10) | (mantissa >> 13));
+    }
+
+    const std::array<float, 256>& srgbToLinearTable() {
+        static const std::array<float, 256> table = [] {
+            std::array<float, 256> values{};
+            for (int i = 0; i < 256; ++i) {
+                const float c = static_cast<float>(i) / 255.0f;
+                values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return values;
+        }();
+        return table;
+    }
+
+    uint8_t linearToSrgb(float value) {
+        value = std::clamp(value, 0.0f, 1.0f);
+        const float c = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+        return static_cast<uint8_t>(std::lround(c * 255.0f));
+    }
+
+    // 2x2 box filter with the last row or column repeated on odd sizes. sRGB colour is averaged in
+    // linear space, as the GPU does when it blits an sRGB image; alpha and UNORM data are linear already.
+    std::vector<uint8_t> downsampleRGBA8(const std::vector<uint8_t>& source, uint32_t width, uint32_t height, bool srgb) {
+        const std::array<float, 256>& toLinear = srgbToLinearTable();
+        const uint32_t levelWidth = std::max(width / 2, 1u);
+        const uint32_t levelHeight = std::max(height / 2, 1u);
+        std::vector<uint8_t> level(static_cast<size_t>(levelWidth) * levelHeight * 4);
+        for (uint32_t y = 0; y < levelHeight; ++y) {
+            const uint32_t rows[2] = {std::min(y * 2, height - 1), std::min(y * 2 + 1, height - 1)};
+            for (uint32_t x = 0; x < levelWidth; ++x) {
+                const uint32_t columns[2] = {std::min(x * 2, width - 1), std::min(x * 2 + 1, width - 1)};
+                float color[3] = {};
+                uint32_t alpha = 0;
+                for (uint32_t row : rows) {
+                    for (uint32_t column : columns) {
+                        const uint8_t* texel = &source[(static_cast<size_t>(row) * width + column) * 4];
+                        for (int c = 0; c < 3; ++c) {
+                            color[c] += srgb ? toLinear[texel[c]] : texel[c] / 255.0f;
+                        }
+                        alpha += texel[3];
+                    }
+                }
+                uint8_t* out = &level[(static_cast<size_t>(y) * levelWidth + x) * 4];
+                for (int c = 0; c < 3; ++c) {
+                    out[c] = srgb ? linearToSrgb(color[c] * 0.25f) : static_cast<uint8_t>(std::lround(std::clamp(color[c] * 0.25f, 0.0f, 1.0f) * 255.0f));
+                }
+                out[3] = static_cast<uint8_t>((alpha + 2) / 4);
+            }
+        }
+        return level;
+    }
+
+    std::vector<float> downsampleFloat(const std::vector<float>& source, uint32_t width, uint32_t height) {
+        const uint32_t levelWidth = std::max(width / 2, 1u);
+        const uint32_t levelHeight = std::max(height / 2, 1u);
+        std::vector<float> level(static_cast<size_t>(levelWidth) * levelHeight * 4);
+        for (uint32_t y = 0; y < levelHeight; ++y) {
+            const uint32_t rows[2] = {std::min(y * 2, height - 1), std::min(y * 2 + 1, height - 1)};
+            for (uint32_t x = 0; x < levelWidth; ++x) {
+                const uint32_t columns[2] = {std::min(x * 2, width - 1), std::min(x * 2 + 1, width - 1)};
+                float* out = &level[(static_cast<size_t>(y) * levelWidth + x) * 4];
+                for (uint32_t row : rows) {
+                    for (uint32_t column : columns) {
+                        const float* texel = &source[(static_cast<size_t>(row) * width + column) * 4];
+                        for (int c = 0; c < 4; ++c) {
+                            out[c] += texel[c] * 0.25f;
+                        }
+                    }
+                }
+            }
+        }
+        return level;
+    }
+
+    uint16_t packRGB565(const float color[3]) {
+        const auto quantize = [](float value, int maximum) {
+            return static_cast<uint16_t>(std::clamp(static_cast<int>(std::lround(value / 255.0f * maximum)), 0, maximum));
+        };
+        return static_cast<uint16_t>((quantize(color[0], 31) << 11) | (quantize(color[1], 63) << 5) | quantize(color[2], 31));
+    }
+
+    void unpackRGB565(uint16_t packed, int color[3]) {
+        const int r = (packed >> 11) & 31;
+        const int g = (packed >> 5) & 63;
+        const int b = packed & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // BC1 colour block in four-colour mode (also the colour half of BC3). The endpoints are the
+    // extremes of the block along its principal axis, which keeps gradients that a bounding box
+    // corner-to-corner line would miss.
+    void encodeColorBlock(const uint8_t texels[16][4], uint8_t* out) {
+        float mean[3] = {};
+        for (int i = 0; i < 16; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                mean[c] += texels[i][c] / 16.0f;
+            }
+        }
+        float covariance[6] = {};
+        for (int i = 0; i < 16; ++i) {
+            const float d[3] = {texels[i][0] - mean[0], texels[i][1] - mean[1], texels[i][2] - mean[2]};
+            covariance[0] += d[0] * d[0];
+            covariance[1] += d[0] * d[1];
+            covariance[2] += d[0] * d[2];
+            covariance[3] += d[1] * d[1];
+            covariance[4] += d[1] * d[2];
+            covariance[5] += d[2] * d[2];
+        }
+        float axis[3] = {1.0f, 1.0f, 1.0f};
+        for (int iteration = 0; iteration < 8; ++iteration) {
+            const float next[3] = {
+                covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+                covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+                covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2],
+            };
+            const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+            if (length < 1e-6f) {
+                break;
+            }
+            for (int c = 0; c < 3; ++c) {
+                axis[c] = next[c] / length;
+            }
+        }
+        float minProjection = 0.0f;
+        float maxProjection = 0.0f;
+        for (int i = 0; i < 16; ++i) {
+            const float projection = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] + (texels[i][2] - mean[2]) * axis[2];
+            minProjection = std::min(minProjection, projection);
+            maxProjection = std::max(maxProjection, projection);
+        }
+        float high[3];
+        float low[3];
+        for (int c = 0; c < 3; ++c) {
+            high[c] = mean[c] + axis[c] * maxProjection;
+            low[c] = mean[c] + axis[c] * minProjection;
+        }
+        uint16_t color0 = packRGB565(high);
+        uint16_t color1 = packRGB565(low);
+        // color0 > color1 selects four-colour mode in BC1.
+        if (color0 < color1) {
+            std::swap(color0, color1);
+        }
+        std::memcpy(out, &color0, 2);
+        std::memcpy(out + 2, &color1, 2);
+        uint32_t indices = 0;
+        if (color0 != color1) {
+            int palette[4][3];
+            unpackRGB565(color0, palette[0]);
+            unpackRGB565(color1, palette[1]);
+            for (int c = 0; c < 3; ++c) {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            for (int i = 0; i < 16; ++i) {
+                int best = 0;
+                int bestDistance = INT32_MAX;
+                for (int entry = 0; entry < 4; ++entry) {
+                    int distance = 0;
+                    for (int c = 0; c < 3; ++c) {
+                        const int d = texels[i][c] - palette[entry][c];
+                        distance += d * d;
+                    }
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        best = entry;
+                    }
+                }
+                indices |= static_cast<uint32_t>(best) << (i * 2);
+            }
+        }
+        std::memcpy(out + 4, &indices, 4);
+    }
+
+    // One channel as a BC4 block in eight-value mode, between the block's extremes: the alpha half
+    // of BC3, the whole of BC4 and each half of BC5.
+    void encodeChannelBlock(const uint8_t texels[16][4], int channel, uint8_t* out) {
+        uint8_t alpha0 = 0;
+        uint8_t alpha1 = 255;
+        for (int i = 0; i < 16; ++i) {
+            alpha0 = std::max(alpha0, texels[i][channel]);
+            alpha1 = std::min(alpha1, texels[i][channel]);
+        }
+        out[0] = alpha0;
+        out[1] = alpha1;
+        uint64_t indices = 0;
+        if (alpha0 != alpha1) {
+            int palette[8] = {alpha0, alpha1};
+            for (int entry = 2; entry < 8; ++entry) {
+                palette[entry] = ((8 - entry) * alpha0 + (entry - 1) * alpha1) / 7;
+            }
+            for (int i = 0; i < 16; ++i) {
+                int best = 0;
+                for (int entry = 1; entry < 8; ++entry) {
+                    if (std::abs(texels[i][channel] - palette[entry]) < std::abs(texels[i][channel] - palette[best])) {
+                        best = entry;
+                    }
+                }
+                indices |= static_cast<uint64_t>(best) << (i * 3);
+            }
+        }
+        for (int byte = 0; byte < 6; ++byte) {
+            out[2 + byte] = static_cast<uint8_t>(indices >> (byte * 8));
+        }
+    }
+
+    bool isColorFormat(VkFormat format) {
+        return format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC3_SRGB_BLOCK || format == VK_FORMAT_R8G8B8A8_SRGB;
+    }
+
+    // Appends one level in format: BC1 or BC4 (8 bytes per 4x4 block), BC3 or BC5 (16). Blocks that
+    // hang over the edge repeat the last row and column.
+    void compressLevel(const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height, VkFormat format, std::vector<uint8_t>& out) {
+        const uint32_t blocksX = (width + 3) / 4;
+        const uint32_t blocksY = (height + 3) / 4;
+        const bool bc1 = format == VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+        const bool bc4 = format == VK_FORMAT_BC4_UNORM_BLOCK;
+        const bool bc5 = format == VK_FORMAT_BC5_UNORM_BLOCK;
+        const size_t blockBytes = bc1 || bc4 ? 8 : 16;
+        const size_t start = out.size();
+        out.resize(start + static_cast<size_t>(blocksX) * blocksY * blockBytes);
+        uint8_t texels[16][4];
+        for (uint32_t blockY = 0; blockY < blocksY; ++blockY) {
+            for (uint32_t blockX = 0; blockX < blocksX; ++blockX) {
+                for (uint32_t i = 0; i < 16; ++i) {
+                    const uint32_t x = std::min(blockX * 4 + i % 4, width - 1);
+                    const uint32_t y = std::min(blockY * 4 + i / 4, height - 1);
+                    std::memcpy(texels[i], &pixels[(static_cast<size_t>(y) * width + x) * 4], 4);
+                }
+                uint8_t* block = &out[start + (static_cast<size_t>(blockY) * blocksX + blockX) * blockBytes];
+                if (bc4 || bc5) {
+                    encodeChannelBlock(texels, 0, block);
+                    if (bc5) {
+                        encodeChannelBlock(texels, 1, block + 8);
+                    }
+                    continue;
+                }
+                if (!bc1) {
+                    encodeChannelBlock(texels, 3, block);
+                    block += 8;
+                }
+                encodeColorBlock(texels, block);
+            }
+        }
+    }
+}
+
+VkDeviceSize CookedTexture::size(uint32_t levelCount) const {
+    VkDeviceSize total = 0;
+    for (uint32_t level = 0; level < levelCount && level < levelSizes.size(); ++level) {
+        total += levelSizes[level];
+    }
+    return total;
+}
+
+TextureCooker::TextureCooker(std::filesystem::path cacheDirectory, bool blockCompression)
+    : cacheDirectory(std::move(cacheDirectory)), blockCompression(blockCompression) {}
+
+bool TextureCooker::load(const std::string& name, const std::string& sourcePath, CookedTexture& texture) const {
+    uint64_t hash = 0;
+    {
+        // Hashing the contents rather than the timestamp keeps checkouts and copies from forcing a recook.
+        MappedFile source;
+        if (!source.open(sourcePath)) {
+            return false;
+        }
+        hash = hashBytes(source.data(), source.size());
+    }
+    // Together with the source, these decide the target format.
+    const Usage usage = usageOf(sourcePath);
+    const uint32_t settings[3] = {kVersion, blockCompression ? 1u : 0u, static_cast<uint32_t>(usage)};
+    hash = hashBytes(settings, sizeof(settings), hash);
+
+    const std::filesystem::path path = cacheDirectory / (name + ".ptex");
+    if (loadCached(path, hash, texture)) {
+        return true;
+    }
+    if (!cook(sourcePath, usage, texture)) {
+        return false;
+    }
+    if (!write(path, hash, texture) && !reportedWriteFailure.exchange(true)) {
+        std::cerr << "Texture cooker: can't write to " << cacheDirectory.string()
+                  << ", textures will be cooked again on the next launch" << std::endl;
+    }
+    return true;
+}
+
+bool TextureCooker::loadCached(const std::filesystem::path& path, uint64_t sourceHash, CookedTexture& texture) const {
+    MappedFile file;
+    if (!file.open(path.string()) || file.size() < sizeof(FileHeader)) {
+        return false;
+    }
+    FileHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.identifier, kIdentifier, sizeof(kIdentifier)) != 0 || header.version != kVersion
+        || header.sourceHash != sourceHash || header.levelCount == 0 || header.levelCount > 32
+        || sizeof(FileHeader) + header.levelCount * sizeof(LevelIndex) > file.size()) {
+        return false;
+    }
+    std::vector<LevelIndex> levels(header.levelCount);
+    std::memcpy(levels.data(), file.data() + sizeof(FileHeader), levels.size() * sizeof(LevelIndex));
+    // The levels have to be contiguous for the upload to take them as one range.
+    uint64_t end = levels[0].byteOffset;
+    for (const LevelIndex& level : levels) {
+        if (level.byteOffset != end || level.byteLength == 0) {
+            return false;
+        }
+        end += level.byteLength;
+    }
+    if (levels[0].byteOffset % kDataAlignment != 0 || end > file.size()) {
+        return false;
+    }
+
+    texture.format = static_cast<VkFormat>(header.vkFormat);
+    texture.width = header.width;
+    texture.height = header.height;
+    texture.levelSizes.clear();
+    for (const LevelIndex& level : levels) {
+        texture.levelSizes.push_back(level.byteLength);
+    }
+    texture.data = file.data() + levels[0].byteOffset;
+    texture.fromCache = true;
+    texture.storage.clear();
+    texture.file = std::move(file);
+    return true;
+}
+
+TextureCooker::Usage TextureCooker::usageOf(const std::string& sourcePath) {
+    const std::string stem = std::filesystem::path(sourcePath).stem().string();
+    if (stem == "normal") {
+        return Usage::Normal;
+    }
+    if (stem == "roughness" || stem == "metallic") {
+        return Usage::Scalar;
+    }
+    return Usage::Color;
+}
+
+VkFormat TextureCooker::targetFormat(Usage usage, bool opaque) const {
+    if (!blockCompression) {
+        return usage == Usage::Color ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    }
+    switch (usage) {
+        case Usage::Normal:
+            return VK_FORMAT_BC5_UNORM_BLOCK;
+        case Usage::Scalar:
+            // The metallic map's alpha is the cutout mask, which BC4 would drop.
+            return opaque ? VK_FORMAT_BC4_UNORM_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+        default:
+            return opaque ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC3_SRGB_BLOCK;
+    }
+}
+
+bool TextureCooker::cook(const std::string& sourcePath, Usage usage, CookedTexture& texture) const {
+    CPU_PROFILE_ZONE("cook texture");
+    // Cooks run on the load workers; the global flag is the skybox's to set on the main thread.
+    stbi_set_flip_vertically_on_load_thread(false);
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    texture.levelSizes.clear();
+    texture.storage.clear();
+    if (sourcePath.ends_with(".hdr")) {
+        float* pixels = stbi_loadf(sourcePath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+        if (!pixels || width <= 0 || height <= 0) {
+            stbi_image_free(pixels);
+            return false;
+        }
+        std::vector<float> level(pixels, pixels + static_cast<size_t>(width) * height * 4);
+        stbi_image_free(pixels);
+        uint32_t levelWidth = static_cast<uint32_t>(width);
+        uint32_t levelHeight = static_cast<uint32_t>(height);
+        const uint32_t levelCount = static_cast<uint32_t>(std::bit_width(std::max(levelWidth, levelHeight)));
+        for (uint32_t i = 0; i < levelCount; ++i) {
+            const size_t start = texture.storage.size();
+            texture.storage.resize(start + level.size() * sizeof(uint16_t));
+            for (size_t c = 0; c < level.size(); ++c) {
+                const uint16_t half = floatToHalf(level[c]);
+                std::memcpy(&texture.storage[start + c * sizeof(uint16_t)], &half, sizeof(half));
+            }
+            texture.levelSizes.push_back(level.size() * sizeof(uint16_t));
+            if (i + 1 < levelCount) {
+                level = downsampleFloat(level, levelWidth, levelHeight);
+                levelWidth = std::max(levelWidth / 2, 1u);
+                levelHeight = std::max(levelHeight / 2, 1u);
+            }
+        }
+        texture.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    } else {
+        stbi_uc* pixels = stbi_load(sourcePath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+        if (!pixels || width <= 0 || height <= 0) {
+            stbi_image_free(pixels);
+            return false;
+        }
+        std::vector<uint8_t> level(pixels, pixels + static_cast<size_t>(width) * height * 4);
+        stbi_image_free(pixels);
+        bool opaque = true;
+        for (size_t i = 3; i < level.size() && opaque; i += 4) {
+            opaque = level[i] == 255;
+        }
+        texture.format = targetFormat(usage, opaque);
+        const bool srgb = isColorFormat(texture.format);
+        uint32_t levelWidth = static_cast<uint32_t>(width);
+        uint32_t levelHeight = static_cast<uint32_t>(height);
+        const uint32_t levelCount = static_cast<uint32_t>(std::bit_width(std::max(levelWidth, levelHeight)));
+        for (uint32_t i = 0; i < levelCount; ++i) {
+            const size_t start = texture.storage.size();
+            if (blockCompression) {
+                compressLevel(level, levelWidth, levelHeight, texture.format, texture.storage);
+            } else {
+                texture.storage.insert(texture.storage.end(), level.begin(), level.end());
+            }
+            texture.levelSizes.push_back(texture.storage.size() - start);
+            if (i + 1 < levelCount) {
+                level = downsampleRGBA8(level, levelWidth, levelHeight, srgb);
+                levelWidth = std::max(levelWidth / 2, 1u);
+                levelHeight = std::max(levelHeight / 2, 1u);
+            }
+        }
+    }
+    texture.width = static_cast<uint32_t>(width);
+    texture.height = static_cast<uint32_t>(height);
+    texture.data = texture.storage.data();
+    texture.fromCache = false;
+    texture.file.close();
+    return true;
+}
+
+bool TextureCooker::write(const std::filesystem::path& path, uint64_t sourceHash, const CookedTexture& texture) const {
+    std::error_code ec;
+    std::filesystem::create_directories(cacheDirectory, ec);
+    FileHeader header = {
+        .version = kVersion,
+        .vkFormat = static_cast<uint32_t>(texture.format),
+        .width = texture.width,
+        .height = texture.height,
+        .levelCount = static_cast<uint32_t>(texture.levelSizes.size()),
+        .reserved = 0,
+        .sourceHash = sourceHash,
+    };
+    std::memcpy(header.identifier, kIdentifier, sizeof(kIdentifier));
+    const uint64_t dataOffset = alignUp(sizeof(FileHeader) + texture.levelSizes.size() * sizeof(LevelIndex), kDataAlignment);
+    std::vector<LevelIndex> levels;
+    uint64_t offset = dataOffset;
+    for (VkDeviceSize levelSize : texture.levelSizes) {
+        levels.push_back({offset, levelSize});
+        offset += levelSize;
+    }
+
+    // Written next to the target and renamed over it, so a reader never maps a half-written file.
+    std::filesystem::path temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        const char padding[kDataAlignment] = {};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(levels.data()), static_cast<std::streamsize>(levels.size() * sizeof(LevelIndex)));
+        file.write(padding, static_cast<std::streamsize>(dataOffset - sizeof(FileHeader) - levels.size() * sizeof(LevelIndex)));
+        file.write(reinterpret_cast<const char*>(texture.data), static_cast<std::streamsize>(offset - dataOffset));
+        if (!file) {
+            file.close();
+            std::filesystem::remove(temporary, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, path, ec);
+    if (ec) {
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#include <TextureLoadPipeline.h>
+#include <CpuProfiler.h>
+#include <algorithm>
+
+TextureLoadPipeline::TextureLoadPipeline(const TextureCooker& cooker, std::vector<Job> jobs, VkDeviceSize memoryBudget, uint32_t workerCount)
+    : cooker(cooker), jobs(std::move(jobs)), memoryBudget(memoryBudget), start(std::chrono::steady_clock::now()) {
+    if (workerCount == 0) {
+        // Leave a hardware thread to the consumer, which stages results while the workers load.
+        const uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+    workerCount = std::min<uint32_t>(workerCount, static_cast<uint32_t>(this->jobs.size()));
+    workers.reserve(workerCount);
+    for (uint32_t i = 0; i < workerCount; ++i) {
+        workers.emplace_back([this, i]() {
+            CpuProfiler::setThreadName("texture loader " + std::to_string(i));
+            work();
+        });
+    }
+}
+
+TextureLoadPipeline::~TextureLoadPipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    roomAvailable.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void TextureLoadPipeline::work() {
+    while (true) {
+        size_t index = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            roomAvailable.wait(lock, [this]() { return stopping || finishedBytes < memoryBudget; });
+            if (stopping || nextJob == jobs.size()) {
+                return;
+            }
+            index = nextJob++;
+        }
+
+        Result result;
+        {
+            CPU_PROFILE_ZONE("load texture");
+            const std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+            result.name = jobs[index].name;
+            result.loaded = cooker.load(jobs[index].name, jobs[index].path, result.texture);
+            const std::chrono::steady_clock::time_point loadEnd = std::chrono::steady_clock::now();
+            result.loadMs = std::chrono::duration<double, std::milli>(loadEnd - loadStart).count();
+            result.readyMs = std::chrono::duration<double, std::milli>(loadEnd - start).count();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finishedBytes += result.texture.size(static_cast<uint32_t>(result.texture.levelSizes.size()));
+            finished.push_back(std::move(result));
+        }
+        resultReady.notify_one();
+    }
+}
+
+bool TextureLoadPipeline::takeFinished(std::vector<Result>& results) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (takenCount == jobs.size()) {
+            return false;
+        }
+        resultReady.wait(lock, [this]() { return !finished.empty(); });
+        takenCount += finished.size();
+        for (Result& result : finished) {
+            results.push_back(std::move(result));
+        }
+        finished.clear();
+        finishedBytes = 0;
+    }
+    roomAvailable.notify_all();
+    return true;
+}
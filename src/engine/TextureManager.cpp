@@ -1,38 +1,17 @@
 #include <TextureManager.h>
+#include <CpuProfiler.h>
 #include <Renderer.h>
+#include <TextureCooker.h>
+#include <TextureLoadPipeline.h>
+#include <chrono>
+#include <cstdlib>
 #include <filesystem>
-#include <stb/stb_image.h>
+#include <iostream>
+#include <map>
 #include <utils.h>
 
-static uint16_t floatToHalf(float value) {
-    union { float f; uint32_t i; } v;
-    v.f = value;
-    uint32_t i = v.i;
-    
-    uint32_t sign = (i >> 16) & 0x8000;
-    int32_t exponent = ((i >> 23) & 0xff) - 127 + 15;
-    uint32_t mantissa = i & 0x7fffff;
-    
-    if (exponent <= 0) {
-        if (exponent < -10) return static_cast<uint16_t>(sign);
-        mantissa = (mantissa | 0x800000) >> (1 - exponent);
-        return static_cast<uint16_t>(sign | (mantissa >> 13));
-    } else if (exponent >= 0x1f) {
-        return static_cast<uint16_t>(sign | 0x7c00);
-    }
-    
-    return static_cast<uint16_t>(sign | (exponent << 10) | (mantissa >> 13));
-}
-
-TextureManager::TextureManager() {
-    renderer = Renderer::getInstance();
-    findAllTextures();
-    prepareTextureAtlas();
-}
-TextureManager::~TextureManager() {
-    shutdown();
-}
-void TextureManager::findAllTextures(std::string path, std::string prevName) {
+// Texture files under path by atlas name: directory names joined with underscores, then the stem.
+static void collectTextureFiles(const std::string& path, const std::string& prevName, std::map<std::string, std::string>& files) {
     namespace fs = std::filesystem;
     fs::path searchPath = resolvePath(path);
     std::error_code ec;
@@ -46,125 +25,169 @@ void TextureManager::findAllTextures(std::string path, std::string prevName) {
     for (const auto& entry : fs::directory_iterator(searchPath)) {
         std::string name = entry.path().stem().string();
         if (entry.path().extension() == ".png" || entry.path().extension() == ".hdr") {
-            textureAtlas[prevName + name] = Image{};
-            textureAtlas[prevName + name].path = entry.path().string();
+            files[prevName + name] = entry.path().string();
         } else if (entry.is_directory()) {
-            findAllTextures(entry.path().string(), prevName + name + "_");
+            collectTextureFiles(entry.path().string(), prevName + name + "_", files);
         }
     }
 }
-void TextureManager::prepareTextureAtlas() {
-    struct ImageLoadResult {
-        std::string name;
-        void* pixels;
-        int width;
-        int height;
-        bool isHDR;
+
+// The per-user cache directory, so a read-only or shared install still caches. PARTICLEFRONT_CACHE_DIR
+// overrides it.
+static std::filesystem::path textureCacheDirectory() {
+    const auto environment = [](const char* name) {
+        const char* value = std::getenv(name);
+        return value && *value ? std::filesystem::path(value) : std::filesystem::path();
     };
-    std::vector<ImageLoadResult> loadedImages;
-    
-#if defined(USE_OPENMP)
-    #pragma omp parallel for
-#endif
-    for (int i = 0; i < static_cast<int>(textureAtlas.size()); ++i) {
-        auto it = std::next(textureAtlas.begin(), i);
-        stbi_set_flip_vertically_on_load(false);
-        int texWidth, texHeight, texChannels;
-        void* pixels = nullptr;
-        bool isHDR = false;
-        
-        if (it->second.path.ends_with(".hdr")) {
-            pixels = stbi_loadf(it->second.path.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-            isHDR = true;
-        } else {
-            pixels = stbi_load(it->second.path.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-            isHDR = false;
+    std::filesystem::path root = environment("PARTICLEFRONT_CACHE_DIR");
+    if (root.empty()) {
+#if defined(_WIN32)
+        root = environment("LOCALAPPDATA");
+#elif defined(__APPLE__)
+        if (const std::filesystem::path home = environment("HOME"); !home.empty()) {
+            root = home / "Library" / "Caches";
+        }
+#else
+        root = environment("XDG_CACHE_HOME");
+        if (const std::filesystem::path home = environment("HOME"); root.empty() && !home.empty()) {
+            root = home / ".cache";
         }
-        
-#if defined(USE_OPENMP)
-        #pragma omp critical
 #endif
-        {
-            loadedImages.push_back({it->first, pixels, texWidth, texHeight, isHDR});
+        if (root.empty()) {
+            std::error_code ec;
+            root = std::filesystem::temp_directory_path(ec);
         }
+        root /= "particlefront";
     }
-    
-    for (auto& imageData : loadedImages) {
-        Image& texture = textureAtlas[imageData.name];
-        void* pixels = imageData.pixels;
-        if (!pixels || imageData.width <= 0 || imageData.height <= 0) continue;
-        
-        VkFormat imageFormat;
-        VkDeviceSize pixelSize;
-        if (imageData.isHDR) {
-            imageFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
-            float* floatPixels = static_cast<float*>(pixels);
-            size_t numPixels = static_cast<size_t>(imageData.width) * static_cast<size_t>(imageData.height);
-            std::vector<uint16_t> float16Pixels(numPixels * 4);
-            for (size_t i = 0; i < numPixels * 4; ++i) {
-                float16Pixels[i] = floatToHalf(floatPixels[i]);
+    return root / "textures";
+}
+
+TextureManager::TextureManager() {
+    renderer = Renderer::getInstance();
+    findAllTextures();
+    prepareTextureAtlas();
+}
+TextureManager::~TextureManager() {
+    shutdown();
+}
+void TextureManager::findAllTextures(std::string path, std::string prevName) {
+    std::map<std::string, std::string> files;
+    collectTextureFiles(path, prevName, files);
+    for (const auto& [name, file] : files) {
+        textureAtlas[name] = Image{};
+        textureAtlas[name].path = file;
+    }
+}
+void TextureManager::prepareTextureAtlas() {
+    CPU_PROFILE_ZONE("TextureManager::prepareTextureAtlas");
+    const std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+    const auto milliseconds = [](std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    };
+    // Cooked textures come straight out of the mapped cache; only new or changed sources are
+    // decoded, mipmapped and compressed, and those are cached for the next launch.
+    const TextureCooker cooker(textureCacheDirectory(), renderer->supportsBlockCompressedTextures());
+    std::vector<TextureLoadPipeline::Job> jobs;
+    jobs.reserve(textureAtlas.size());
+    for (const auto& [name, texture] : textureAtlas) {
+        jobs.push_back({name, texture.path});
+    }
+    TextureLoadPipeline pipeline(cooker, std::move(jobs));
+
+    // Textures are staged as they come off the workers, and each group that finished together is
+    // submitted right away, so the copies run while the remaining textures are still loading. A
+    // group shares one barrier call per side of its copies.
+    UploadManager& uploadManager = renderer->getUploadManager();
+    UploadManager::Ticket ticket = 0;
+    std::vector<TextureLoadPipeline::Result> results;
+    std::vector<UploadManager::ImageUpload> uploads;
+    size_t textureCount = 0;
+    size_t cookedCount = 0;
+    VkDeviceSize uploadBytes = 0;
+    double loadMs = 0.0;
+    double stagingMs = 0.0;
+    while (pipeline.takeFinished(results)) {
+        const std::chrono::steady_clock::time_point stagingStart = std::chrono::steady_clock::now();
+        uploads.clear();
+        for (const TextureLoadPipeline::Result& result : results) {
+            if (!result.loaded) {
+                std::cerr << "Failed to load texture " << textureAtlas[result.name].path << std::endl;
+                continue;
             }
-            pixelSize = numPixels * 4 * sizeof(uint16_t);
-            VkBuffer stagingBuffer;
-            VkDeviceMemory stagingBufferMemory;
-            renderer->createBuffer(pixelSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-                stagingBuffer, stagingBufferMemory);
-            void* data;
-            vkMapMemory(renderer->device, stagingBufferMemory, 0, pixelSize, 0, &data);
-            memcpy(data, float16Pixels.data(), static_cast<size_t>(pixelSize));
-            vkUnmapMemory(renderer->device, stagingBufferMemory);
-            VkImage textureImage;
-            VkDeviceMemory textureImageMemory;
-            renderer->createImage(imageData.width, imageData.height, 1, VK_SAMPLE_COUNT_1_BIT, 
-                imageFormat, VK_IMAGE_TILING_OPTIMAL, 
-                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-            renderer->transitionImageLayout(textureImage, imageFormat, 
-                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-            renderer->copyBufferToImage(stagingBuffer, textureImage, 
-                static_cast<uint32_t>(imageData.width), static_cast<uint32_t>(imageData.height));
-            renderer->transitionImageLayout(textureImage, imageFormat, 
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-            vkDestroyBuffer(renderer->device, stagingBuffer, nullptr);
-            vkFreeMemory(renderer->device, stagingBufferMemory, nullptr);
-            texture.image = textureImage;
-            texture.imageMemory = textureImageMemory;
-            renderer->createTextureImageView(imageFormat, textureImage, texture.imageView);
-        } else {
-            imageFormat = VK_FORMAT_R8G8B8A8_SRGB;
-            pixelSize = static_cast<VkDeviceSize>(imageData.width) * 
-                static_cast<VkDeviceSize>(imageData.height) * 4;
-            VkBuffer stagingBuffer;
-            VkDeviceMemory stagingBufferMemory;
-            renderer->createBuffer(pixelSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-                stagingBuffer, stagingBufferMemory);
-            void* data;
-            vkMapMemory(renderer->device, stagingBufferMemory, 0, pixelSize, 0, &data);
-            memcpy(data, pixels, static_cast<size_t>(pixelSize));
-            vkUnmapMemory(renderer->device, stagingBufferMemory);
+            const CookedTexture& cooked = result.texture;
+            Image& texture = textureAtlas[result.name];
+            const uint32_t mipLevels = renderer->areTextureMipmapsEnabled() ? static_cast<uint32_t>(cooked.levelSizes.size()) : 1u;
             VkImage textureImage;
-            VkDeviceMemory textureImageMemory;
-            renderer->createImage(imageData.width, imageData.height, 1, VK_SAMPLE_COUNT_1_BIT, 
-                imageFormat, VK_IMAGE_TILING_OPTIMAL, 
+            DeviceAllocation textureImageMemory;
+            renderer->createImage(cooked.width, cooked.height, mipLevels, VK_SAMPLE_COUNT_1_BIT, 
+                cooked.format, VK_IMAGE_TILING_OPTIMAL, 
                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-            renderer->transitionImageLayout(textureImage, imageFormat, 
-                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-            renderer->copyBufferToImage(stagingBuffer, textureImage, 
-                static_cast<uint32_t>(imageData.width), static_cast<uint32_t>(imageData.height));
-            renderer->transitionImageLayout(textureImage, imageFormat, 
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-            vkDestroyBuffer(renderer->device, stagingBuffer, nullptr);
-            vkFreeMemory(renderer->device, stagingBufferMemory, nullptr);
             texture.image = textureImage;
             texture.imageMemory = textureImageMemory;
-            renderer->createTextureImageView(imageFormat, textureImage, texture.imageView);
+            texture.format = cooked.format;
+            texture.width = static_cast<int>(cooked.width);
+            texture.height = static_cast<int>(cooked.height);
+            renderer->createTextureImageView(cooked.format, textureImage, texture.imageView, mipLevels);
+            uploads.push_back({
+                .image = textureImage,
+                .width = cooked.width,
+                .height = cooked.height,
+                .data = cooked.data,
+                .size = cooked.size(mipLevels),
+                .levelSizes = std::vector<VkDeviceSize>(cooked.levelSizes.begin(), cooked.levelSizes.begin() + mipLevels),
+            });
+            textureCount++;
+            uploadBytes += cooked.size(mipLevels);
+            cookedCount += cooked.fromCache ? 0 : 1;
+            loadMs += result.loadMs;
+            // Per-texture timings only when profiling (--cpu-profiler); the summary below covers the rest.
+            if (CpuProfiler::isEnabled()) {
+                std::cout << "  " << result.name << ": " << cooked.width << "x" << cooked.height << ", "
+                          << cooked.size(mipLevels) / 1024 << " KB, " << (cooked.fromCache ? "read" : "cooked") << " in "
+                          << result.loadMs << " ms, ready at " << result.readyMs << " ms" << std::endl;
+            }
+        }
+        if (!uploads.empty()) {
+            uploadManager.uploadImages(uploads);
+            ticket = uploadManager.flush();
+        }
+        // Staged, so the mappings and cook results can go.
+        results.clear();
+        stagingMs += milliseconds(std::chrono::steady_clock::now() - stagingStart);
+    }
+
+    std::cout << "Texture atlas: " << textureCount << " textures (" << cookedCount << " cooked), "
+              << uploadBytes / (1024 * 1024) << " MB in " << milliseconds(std::chrono::steady_clock::now() - loadStart)
+              << " ms (" << pipeline.getWorkerCount() << " workers loading for " << loadMs << " ms in total, staging "
+              << stagingMs << " ms)" << std::endl;
+    uploadManager.onComplete(ticket, [loadStart, milliseconds]() {
+        std::cout << "Texture atlas resident on the GPU " << milliseconds(std::chrono::steady_clock::now() - loadStart)
+                  << " ms after loading started" << std::endl;
+    });
+}
+int TextureManager::cookTextures() {
+    std::map<std::string, std::string> files;
+    collectTextureFiles("src/textures/ui/", "", files);
+    // Block compressed, as almost every desktop GPU samples it; a device without it recooks on launch.
+    const TextureCooker cooker(textureCacheDirectory(), true);
+    size_t cookedCount = 0;
+    size_t failedCount = 0;
+    VkDeviceSize bytes = 0;
+    for (const auto& [name, path] : files) {
+        CookedTexture cooked;
+        if (!cooker.load(name, path, cooked)) {
+            std::cerr << "Texture cooker: failed to cook " << path << std::endl;
+            failedCount++;
+            continue;
         }
-        
-        stbi_image_free(pixels);
+        cookedCount += cooked.fromCache ? 0 : 1;
+        bytes += cooked.size(static_cast<uint32_t>(cooked.levelSizes.size()));
     }
+    std::cout << "Texture cooker: " << files.size() - failedCount << " textures (" << cookedCount << " cooked, "
+              << files.size() - failedCount - cookedCount << " up to date), " << bytes / (1024 * 1024) << " MB in "
+              << textureCacheDirectory().string() << std::endl;
+    return failedCount == 0 ? 0 : 1;
 }
 Image* TextureManager::getTexture(const std::string& name) {
     auto it = textureAtlas.find(name);
@@ -190,13 +213,34 @@ void TextureManager::registerTexture(const std::string& name, const Image& textu
             if (it->second.image) {
                 vkDestroyImage(deviceHandle, it->second.image, nullptr);
             }
-            if (it->second.imageMemory) {
-                vkFreeMemory(deviceHandle, it->second.imageMemory, nullptr);
-            }
+            renderer->freeDeviceMemory(it->second.imageMemory);
         }
     }
     textureAtlas[name] = texture;
 }
+void TextureManager::unregisterTexture(const std::string& name) {
+    auto it = textureAtlas.find(name);
+    if (it == textureAtlas.end()) {
+        return;
+    }
+    if (!renderer) {
+        renderer = Renderer::getInstance();
+    }
+    VkDevice deviceHandle = renderer ? renderer->device : VK_NULL_HANDLE;
+    if (deviceHandle != VK_NULL_HANDLE) {
+        if (it->second.imageSampler) {
+            vkDestroySampler(deviceHandle, it->second.imageSampler, nullptr);
+        }
+        if (it->second.imageView) {
+            vkDestroyImageView(deviceHandle, it->second.imageView, nullptr);
+        }
+        if (it->second.image) {
+            vkDestroyImage(deviceHandle, it->second.image, nullptr);
+        }
+        renderer->freeDeviceMemory(it->second.imageMemory);
+    }
+    textureAtlas.erase(it);
+}
 void TextureManager::shutdown() {
     if (!renderer || renderer->device == VK_NULL_HANDLE) {
         textureAtlas.clear();
@@ -215,10 +259,7 @@ void TextureManager::shutdown() {
             vkDestroyImage(renderer->device, texture.image, nullptr);
             texture.image = VK_NULL_HANDLE;
         }
-        if (texture.imageMemory) {
-            vkFreeMemory(renderer->device, texture.imageMemory, nullptr);
-            texture.imageMemory = VK_NULL_HANDLE;
-        }
+        renderer->freeDeviceMemory(texture.imageMemory);
     }
     textureAtlas.clear();
 }
@@ -0,0 +1,493 @@
+#include <UploadManager.h>
+#include <CpuProfiler.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    constexpr VkPipelineStageFlags kBufferConsumerStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    constexpr VkAccessFlags kBufferConsumerAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                                    VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    constexpr VkPipelineStageFlags kImageConsumerStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    VkCommandPool createCommandPool(VkDevice device, uint32_t queueFamily) {
+        VkCommandPoolCreateInfo poolInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = queueFamily,
+        };
+        VkCommandPool pool = VK_NULL_HANDLE;
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create upload command pool!");
+        }
+        return pool;
+    }
+
+    VkCommandBuffer allocateCommandBuffer(VkDevice device, VkCommandPool pool) {
+        VkCommandBufferAllocateInfo allocInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate upload command buffer!");
+        }
+        return commandBuffer;
+    }
+
+    VkBuffer createStagingBuffer(VkDevice device, DeviceAllocator& allocator, VkDeviceSize size, DeviceAllocation& memory) {
+        VkBufferCreateInfo bufferInfo = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = size,
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        };
+        VkBuffer buffer = VK_NULL_HANDLE;
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create staging buffer!");
+        }
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, buffer, &requirements);
+        memory = allocator.allocate(requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true);
+        vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+        return buffer;
+    }
+}
+
+void UploadManager::init(VkDevice device, VkPhysicalDevice physicalDevice, DeviceAllocator& allocator,
+                         uint32_t graphicsFamily, VkQueue graphicsQueue, uint32_t transferFamily, VkQueue transferQueue) {
+    this->device = device;
+    this->allocator = &allocator;
+    this->graphicsFamily = graphicsFamily;
+    this->graphicsQueue = graphicsQueue;
+    this->transferFamily = transferFamily;
+    this->transferQueue = transferQueue;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    // 16 bytes covers the largest texel we upload (RGBA32F), which copies to images must align to.
+    copyAlignment = std::max<VkDeviceSize>(properties.limits.optimalBufferCopyOffsetAlignment, 16);
+
+    graphicsCommandPool = createCommandPool(device, graphicsFamily);
+    if (transferFamily != graphicsFamily) {
+        transferCommandPool = createCommandPool(device, transferFamily);
+    }
+    for (Batch& batch : batches) {
+        batch.graphicsCommands = allocateCommandBuffer(device, graphicsCommandPool);
+        if (transferCommandPool) {
+            batch.transferCommands = allocateCommandBuffer(device, transferCommandPool);
+            VkSemaphoreCreateInfo semaphoreInfo = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            };
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &batch.copiesDone) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create upload semaphore!");
+            }
+        }
+        VkFenceCreateInfo fenceInfo = {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        };
+        if (vkCreateFence(device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create upload fence!");
+        }
+    }
+    ringBuffer = createStagingBuffer(device, allocator, kStagingRingSize, ringMemory);
+}
+
+void UploadManager::destroy() {
+    if (device == VK_NULL_HANDLE) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (completedTicket < submittedTicket) {
+            waitLocked(submittedTicket);
+        }
+        for (Batch& batch : batches) {
+            // Uploads recorded but never flushed are dropped along with whatever they targeted.
+            if (batch.open) {
+                vkEndCommandBuffer(batch.graphicsCommands);
+                if (batch.transferCommands) {
+                    vkEndCommandBuffer(batch.transferCommands);
+                }
+                retireLocked(batch);
+            }
+            if (batch.copiesDone) {
+                vkDestroySemaphore(device, batch.copiesDone, nullptr);
+            }
+            vkDestroyFence(device, batch.fence, nullptr);
+            batch = {};
+        }
+        readyCallbacks.clear();
+        vkDestroyCommandPool(device, graphicsCommandPool, nullptr);
+        if (transferCommandPool) {
+            vkDestroyCommandPool(device, transferCommandPool, nullptr);
+        }
+        graphicsCommandPool = VK_NULL_HANDLE;
+        transferCommandPool = VK_NULL_HANDLE;
+        vkDestroyBuffer(device, ringBuffer, nullptr);
+        allocator->free(ringMemory);
+        ringBuffer = VK_NULL_HANDLE;
+        ringHead = 0;
+        ringUsed = 0;
+        submittedTicket = 0;
+        completedTicket = 0;
+    }
+    device = VK_NULL_HANDLE;
+}
+
+UploadManager::Batch& UploadManager::openBatch() {
+    const Ticket ticket = submittedTicket + 1;
+    Batch& batch = batches[ticket % kBatchCount];
+    if (batch.open) {
+        return batch;
+    }
+    if (batch.submitted) {
+        // Every slot is in flight; the oldest has to finish before its command buffers are reused.
+        waitLocked(batch.ticket);
+    }
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    if (vkBeginCommandBuffer(batch.graphicsCommands, &beginInfo) != VK_SUCCESS ||
+        (batch.transferCommands && vkBeginCommandBuffer(batch.transferCommands, &beginInfo) != VK_SUCCESS)) {
+        throw std::runtime_error("Failed to begin upload command buffer!");
+    }
+    batch.ticket = ticket;
+    batch.open = true;
+    return batch;
+}
+
+UploadManager::Staging UploadManager::reserveStaging(VkDeviceSize size) {
+    Staging staging;
+    if (size > kStagingRingSize / 2) {
+        // Rare and large (a whole HDR cubemap); a buffer of its own beats draining the ring for it.
+        staging.buffer = createStagingBuffer(device, *allocator, size, staging.overflow);
+        staging.mapped = staging.overflow.mapped;
+        return staging;
+    }
+    while (true) {
+        if (ringUsed == 0) {
+            ringHead = 0;
+        }
+        VkDeviceSize start = alignUp(ringHead, copyAlignment);
+        VkDeviceSize skipped = start - ringHead;
+        if (start + size > kStagingRingSize) {
+            skipped = kStagingRingSize - ringHead;
+            start = 0;
+        }
+        if (ringUsed + skipped + size <= kStagingRingSize) {
+            ringHead = start + size;
+            ringUsed += skipped + size;
+            staging.buffer = ringBuffer;
+            staging.offset = start;
+            staging.mapped = static_cast<char*>(ringMemory.mapped) + start;
+            staging.ringBytes = skipped + size;
+            return staging;
+        }
+        // Out of ring space: make sure what holds it is submitted, then wait for the oldest batch.
+        if (batches[(submittedTicket + 1) % kBatchCount].open) {
+            submitLocked();
+        }
+        waitLocked(completedTicket + 1);
+    }
+}
+
+void UploadManager::attachStaging(Batch& batch, Staging& staging) {
+    batch.ringBytes += staging.ringBytes;
+    if (staging.overflow) {
+        batch.overflowBuffers.emplace_back(staging.buffer, staging.overflow);
+    }
+    batch.copyCount++;
+}
+
+UploadManager::Ticket UploadManager::uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize offset) {
+    CPU_PROFILE_ZONE("upload buffer");
+    std::lock_guard<std::mutex> lock(mutex);
+    Staging staging = reserveStaging(size);
+    std::memcpy(staging.mapped, data, static_cast<size_t>(size));
+    Batch& batch = openBatch();
+    attachStaging(batch, staging);
+
+    VkBufferCopy region = {
+        .srcOffset = staging.offset,
+        .dstOffset = offset,
+        .size = size,
+    };
+    vkCmdCopyBuffer(copyCommands(batch), staging.buffer, buffer, 1, &region);
+    VkBufferMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = kBufferConsumerAccess,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = buffer,
+        .offset = offset,
+        .size = size,
+    };
+    if (batch.transferCommands) {
+        // Release on the transfer queue, acquire on the graphics queue after the semaphore wait.
+        barrier.srcQueueFamilyIndex = transferFamily;
+        barrier.dstQueueFamilyIndex = graphicsFamily;
+        barrier.dstAccessMask = 0;
+        vkCmdPipelineBarrier(batch.transferCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = kBufferConsumerAccess;
+    }
+    vkCmdPipelineBarrier(batch.graphicsCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, kBufferConsumerStages, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    return batch.ticket;
+}
+
+UploadManager::Ticket UploadManager::uploadImage(VkImage image, uint32_t width, uint32_t height, const void* data, VkDeviceSize size, uint32_t layerCount) {
+    return uploadImages({{
+        .image = image,
+        .width = width,
+        .height = height,
+        .data = data,
+        .size = size,
+        .layerCount = layerCount,
+    }});
+}
+
+UploadManager::Ticket UploadManager::uploadImages(const std::vector<ImageUpload>& uploads) {
+    CPU_PROFILE_ZONE("upload images");
+    std::lock_guard<std::mutex> lock(mutex);
+    if (uploads.empty()) {
+        return submittedTicket;
+    }
+    std::vector<VkDeviceSize> offsets(uploads.size());
+    VkDeviceSize totalSize = 0;
+    for (size_t i = 0; i < uploads.size(); ++i) {
+        offsets[i] = alignUp(totalSize, copyAlignment);
+        totalSize = offsets[i] + uploads[i].size;
+    }
+    Staging staging = reserveStaging(totalSize);
+    for (size_t i = 0; i < uploads.size(); ++i) {
+        std::memcpy(static_cast<char*>(staging.mapped) + offsets[i], uploads[i].data, static_cast<size_t>(uploads[i].size));
+    }
+    Batch& batch = openBatch();
+    attachStaging(batch, staging);
+    VkCommandBuffer commands = copyCommands(batch);
+
+    std::vector<VkImageMemoryBarrier> barriers(uploads.size());
+    for (size_t i = 0; i < uploads.size(); ++i) {
+        barriers[i] = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = uploads[i].image,
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = std::max(static_cast<uint32_t>(uploads[i].levelSizes.size()), 1u),
+                .baseArrayLayer = 0,
+                .layerCount = std::max(uploads[i].layerCount, 1u),
+            },
+        };
+    }
+    vkCmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+        static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    std::vector<VkBufferImageCopy> regions;
+    for (size_t i = 0; i < uploads.size(); ++i) {
+        const ImageUpload& upload = uploads[i];
+        const uint32_t layerCount = std::max(upload.layerCount, 1u);
+        regions.clear();
+        VkDeviceSize levelOffset = staging.offset + offsets[i];
+        const uint32_t levelCount = upload.levelSizes.empty() ? 1u : static_cast<uint32_t>(upload.levelSizes.size());
+        for (uint32_t level = 0; level < levelCount; ++level) {
+            const VkDeviceSize levelSize = upload.levelSizes.empty() ? upload.size : upload.levelSizes[level];
+            for (uint32_t layer = 0; layer < layerCount; ++layer) {
+                regions.push_back({
+                    .bufferOffset = levelOffset + levelSize / layerCount * layer,
+                    .bufferRowLength = 0,
+                    .bufferImageHeight = 0,
+                    .imageSubresource = {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .mipLevel = level,
+                        .baseArrayLayer = layer,
+                        .layerCount = 1,
+                    },
+                    .imageOffset = {0, 0, 0},
+                    .imageExtent = {std::max(upload.width >> level, 1u), std::max(upload.height >> level, 1u), 1},
+                });
+            }
+            levelOffset += levelSize;
+        }
+        vkCmdCopyBufferToImage(commands, staging.buffer, upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            static_cast<uint32_t>(regions.size()), regions.data());
+    }
+
+    for (VkImageMemoryBarrier& barrier : barriers) {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    if (batch.transferCommands) {
+        for (VkImageMemoryBarrier& barrier : barriers) {
+            barrier.srcQueueFamilyIndex = transferFamily;
+            barrier.dstQueueFamilyIndex = graphicsFamily;
+            barrier.dstAccessMask = 0;
+        }
+        vkCmdPipelineBarrier(batch.transferCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr,
+            static_cast<uint32_t>(barriers.size()), barriers.data());
+        for (VkImageMemoryBarrier& barrier : barriers) {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        }
+    }
+    vkCmdPipelineBarrier(batch.graphicsCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, kImageConsumerStages, 0, 0, nullptr, 0, nullptr,
+        static_cast<uint32_t>(barriers.size()), barriers.data());
+    return batch.ticket;
+}
+
+UploadManager::Ticket UploadManager::recordGraphics(const std::function<void(VkCommandBuffer)>& record) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Batch& batch = openBatch();
+    record(batch.graphicsCommands);
+    return batch.ticket;
+}
+
+void UploadManager::submitLocked() {
+    Batch& batch = batches[(submittedTicket + 1) % kBatchCount];
+    if (!batch.open) {
+        return;
+    }
+    if (vkEndCommandBuffer(batch.graphicsCommands) != VK_SUCCESS ||
+        (batch.transferCommands && vkEndCommandBuffer(batch.transferCommands) != VK_SUCCESS)) {
+        throw std::runtime_error("Failed to record upload command buffer!");
+    }
+    vkResetFences(device, 1, &batch.fence);
+    const bool crossQueue = batch.transferCommands && batch.copyCount > 0;
+    if (crossQueue) {
+        VkSubmitInfo transferSubmit = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &batch.transferCommands,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &batch.copiesDone,
+        };
+        if (vkQueueSubmit(transferQueue, 1, &transferSubmit, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to submit uploads to the transfer queue!");
+        }
+    }
+    // The acquires wait for the copies at the transfer stage and chain into every later submission.
+    const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkSubmitInfo graphicsSubmit = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = crossQueue ? 1u : 0u,
+        .pWaitSemaphores = &batch.copiesDone,
+        .pWaitDstStageMask = &waitStage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &batch.graphicsCommands,
+    };
+    if (vkQueueSubmit(graphicsQueue, 1, &graphicsSubmit, batch.fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit uploads to the graphics queue!");
+    }
+    batch.open = false;
+    batch.submitted = true;
+    submittedTicket = batch.ticket;
+}
+
+void UploadManager::retireLocked(Batch& batch) {
+    for (auto& [buffer, memory] : batch.overflowBuffers) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        allocator->free(memory);
+    }
+    batch.overflowBuffers.clear();
+    ringUsed -= batch.ringBytes;
+    batch.ringBytes = 0;
+    batch.copyCount = 0;
+    for (std::function<void()>& callback : batch.callbacks) {
+        readyCallbacks.push_back(std::move(callback));
+    }
+    batch.callbacks.clear();
+    batch.open = false;
+    batch.submitted = false;
+}
+
+void UploadManager::waitLocked(Ticket ticket) {
+    CPU_PROFILE_ZONE("upload wait");
+    // Batches retire in submission order so the ring's used range stays contiguous.
+    while (completedTicket < ticket && completedTicket < submittedTicket) {
+        Batch& batch = batches[(completedTicket + 1) % kBatchCount];
+        vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        retireLocked(batch);
+        completedTicket++;
+    }
+}
+
+UploadManager::Ticket UploadManager::flush() {
+    CPU_PROFILE_ZONE("upload flush");
+    std::lock_guard<std::mutex> lock(mutex);
+    submitLocked();
+    return submittedTicket;
+}
+
+void UploadManager::poll() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (completedTicket < submittedTicket) {
+            Batch& batch = batches[(completedTicket + 1) % kBatchCount];
+            if (vkGetFenceStatus(device, batch.fence) != VK_SUCCESS) {
+                break;
+            }
+            retireLocked(batch);
+            completedTicket++;
+        }
+    }
+    runCallbacks();
+}
+
+bool UploadManager::isComplete(Ticket ticket) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ticket <= completedTicket;
+}
+
+void UploadManager::wait(Ticket ticket) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ticket > submittedTicket) {
+            submitLocked();
+        }
+        waitLocked(ticket);
+    }
+    runCallbacks();
+}
+
+void UploadManager::onComplete(Ticket ticket, std::function<void()> callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ticket > completedTicket) {
+            Batch& batch = batches[ticket % kBatchCount];
+            if (batch.ticket == ticket && (batch.open || batch.submitted)) {
+                batch.callbacks.push_back(std::move(callback));
+                return;
+            }
+        }
+    }
+    callback();
+}
+
+void UploadManager::runCallbacks() {
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        callbacks.swap(readyCallbacks);
+    }
+    for (std::function<void()>& callback : callbacks) {
+        callback();
+    }
+}
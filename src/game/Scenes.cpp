@@ -76,6 +76,7 @@ void Scene1() {
 
     Entity* walls = new Entity("walls", "gbuffer", {0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, {1.2f, 1.2f, 1.2f}, {"materials_walls_albedo", "materials_walls_metallic", "materials_walls_roughness", "materials_walls_normal"});
     walls->setModel(ModelManager::getInstance()->getModel("walls"));
+    walls->setOccluder(true);
     entityMgr->addEntity("walls", walls);
 
     for (int i = 0; i < 3; ++i) {
@@ -96,4 +97,9 @@ void Scene1() {
 std::map<int, std::function<void()>> Scenes::sceneList = {
     {0, MainMenu},
     {1, Scene1},
+};
+
+std::map<std::string, int> Scenes::sceneNames = {
+    {"MainMenu", 0},
+    {"Scene1", 1},
 };
\ No newline at end of file
@@ -2,8 +2,10 @@
 #include <map>
 #include <functional>
 #include <iostream>
+#include <string>
 
 class Scenes {
 public:
     static std::map<int, std::function<void()>> sceneList;
+    static std::map<std::string, int> sceneNames;
 };
\ No newline at end of file
@@ -1,6 +1,83 @@
 #include <Renderer.h>
+#include <TextureManager.h>
+#include <SoftwareOcclusion.h>
+#include <CpuProfiler.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
 
-int main() {
+int main(int argc, char** argv) {
+    CpuProfiler::setThreadName("main");
+    // --benchmark [scene] renders headlessly and exits; the --benchmark-* options configure it.
+    bool benchmark = false;
+    BenchmarkOptions benchmarkOptions;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--benchmark") == 0) {
+            benchmark = true;
+            if (hasValue && argv[i + 1][0] != '-') {
+                benchmarkOptions.scene = argv[++i];
+            }
+        }
+        if (std::strcmp(argv[i], "--benchmark-resolution") == 0 && hasValue) {
+            unsigned width = 0, height = 0;
+            if (std::sscanf(argv[++i], "%ux%u", &width, &height) == 2 && width > 0 && height > 0) {
+                benchmarkOptions.width = width;
+                benchmarkOptions.height = height;
+            }
+        }
+        if (std::strcmp(argv[i], "--benchmark-frames") == 0 && hasValue) {
+            benchmarkOptions.frames = static_cast<uint32_t>(std::max(std::atoi(argv[++i]), 1));
+        }
+        if (std::strcmp(argv[i], "--benchmark-warmup") == 0 && hasValue) {
+            benchmarkOptions.warmupFrames = static_cast<uint32_t>(std::max(std::atoi(argv[++i]), 0));
+        }
+        if (std::strcmp(argv[i], "--benchmark-path") == 0 && hasValue) {
+            benchmarkOptions.cameraPath = argv[++i];
+        }
+        if (std::strcmp(argv[i], "--benchmark-output") == 0 && hasValue) {
+            benchmarkOptions.outputPath = argv[++i];
+        }
+        if (std::strcmp(argv[i], "--benchmark-baseline") == 0 && hasValue) {
+            benchmarkOptions.baselinePath = argv[++i];
+        }
+        if (std::strcmp(argv[i], "--benchmark-tolerance") == 0 && hasValue) {
+            // Fraction, e.g. 0.1 fails a percentile more than 10% slower than the baseline.
+            benchmarkOptions.tolerance = std::strtod(argv[++i], nullptr);
+        }
+        if (std::strcmp(argv[i], "--no-mipmaps") == 0) {
+            // Single-level material textures, to measure what the mip chains save; benchmark reports record it.
+            Renderer::getInstance()->setTextureMipmapsEnabled(false);
+            benchmarkOptions.textureMipmaps = false;
+        }
+        if (std::strcmp(argv[i], "--cook-textures") == 0) {
+            return TextureManager::cookTextures();
+        }
+        if (std::strcmp(argv[i], "--occlusion-benchmark") == 0) {
+            return SoftwareOcclusionBuffer::runBenchmark();
+        }
+        if (std::strcmp(argv[i], "--single-pass-deferred") == 0) {
+            Renderer::getInstance()->setSinglePassDeferred(true);
+        }
+        if (std::strcmp(argv[i], "--quality-governor") == 0) {
+            // Optional target frame time in milliseconds; 60 fps otherwise.
+            float targetMs = i + 1 < argc ? std::strtof(argv[i + 1], nullptr) : 0.0f;
+            if (targetMs > 0.0f) {
+                ++i;
+            } else {
+                targetMs = 1000.0f / 60.0f;
+            }
+            Renderer::getInstance()->setQualityGovernorEnabled(true, targetMs);
+        }
+        if (std::strcmp(argv[i], "--cpu-profiler") == 0) {
+            // Captures from startup so asset loading shows up; F11 writes the trace.
+            CpuProfiler::setEnabled(true);
+        }
+    }
+    if (benchmark) {
+        return Renderer::getInstance()->runBenchmark(benchmarkOptions);
+    }
     Renderer::getInstance()->run();
     return 0;
-}
\ No newline at end of file
+}